@@ -0,0 +1,75 @@
+#ifndef LUPS_ARENA_H
+#define LUPS_ARENA_H
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// ArenaList is a fixed size array allocated in an arena.
+template <typename T> class ArenaList {
+public:
+	ArenaList() : data_(nullptr), size_(0) {}
+	ArenaList(T *data, std::size_t size) : data_(data), size_(size) {}
+
+	T *begin() const { return data_; }
+	T *end() const { return data_ + size_; }
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	T &operator[](std::size_t index) const { return data_[index]; }
+
+private:
+	T *data_;
+	std::size_t size_;
+};
+
+// Arena owns the nodes of a parsed program. They are bump allocated from large
+// blocks that are all freed at once with the arena, the nodes' destructors
+// never run. Everything a node references has to be in the arena too, so nodes
+// hold ArenaLists and views of interned or source text instead of owning
+// containers.
+class Arena {
+public:
+	Arena() : names_(&resource_) {}
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	template <typename T, typename... Args> T *make(Args &&...args) {
+		return new (resource_.allocate(sizeof(T), alignof(T)))
+				T(std::forward<Args>(args)...);
+	}
+
+	// list copies the elements into the arena.
+	template <typename T> ArenaList<T> list(const std::vector<T> &elems) {
+		if (elems.empty())
+			return ArenaList<T>();
+
+		auto data =
+				(T *)resource_.allocate(sizeof(T) * elems.size(), alignof(T));
+		std::uninitialized_copy(elems.begin(), elems.end(), data);
+		return ArenaList<T>(data, elems.size());
+	}
+
+	// intern returns the arena's copy of a name, every identifier with the same
+	// name shares it.
+	std::string_view intern(std::string_view name) {
+		auto it = names_.find(name);
+		if (it != names_.end())
+			return *it;
+
+		auto copy = (char *)resource_.allocate(name.size(), 1);
+		std::memcpy(copy, name.data(), name.size());
+		return *names_.insert(std::string_view(copy, name.size())).first;
+	}
+
+private:
+	std::pmr::monotonic_buffer_resource resource_;
+	std::pmr::unordered_set<std::string_view> names_;
+};
+
+#endif
@@ -45,11 +45,12 @@ std::string ExpressionStatement::String() {
 }
 
 std::string PrefixExpression::String() {
-	return "(" + opr + right->String() + ")";
+	return "(" + std::string(opr) + right->String() + ")";
 }
 
 std::string InfixExpression::String() {
-	return "(" + left->String() + " " + opr + " " + right->String() + ")";
+	return "(" + left->String() + " " + std::string(opr) + " " +
+				 right->String() + ")";
 }
 
 std::string CallExpression::String() {
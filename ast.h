@@ -1,10 +1,13 @@
 #ifndef LUPS_AST_H
 #define LUPS_AST_H
 
+#include "arena.h"
 #include "token.h"
+#include <cstddef>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 enum class AstType {
@@ -27,6 +30,30 @@ enum class AstType {
 	FunctionLiteral,
 };
 
+// NodePtr points at a node in the arena of the program it belongs to. It is
+// used like a unique_ptr, but the arena owns the node, so moving or dropping a
+// NodePtr never frees anything.
+template <typename T> class NodePtr {
+public:
+	NodePtr() : ptr_(nullptr) {}
+	NodePtr(std::nullptr_t) : ptr_(nullptr) {}
+	NodePtr(T *ptr) : ptr_(ptr) {}
+	template <typename U,
+						typename = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+	NodePtr(const NodePtr<U> &other) : ptr_(other.get()) {}
+
+	T *get() const { return ptr_; }
+	T *operator->() const { return ptr_; }
+	T &operator*() const { return *ptr_; }
+	explicit operator bool() const { return ptr_ != nullptr; }
+
+	bool operator==(std::nullptr_t) const { return ptr_ == nullptr; }
+	bool operator!=(std::nullptr_t) const { return ptr_ != nullptr; }
+
+private:
+	T *ptr_;
+};
+
 class Node {
 public:
 	virtual std::string TokenLiteral() const = 0;
@@ -55,57 +82,62 @@ public:
 	std::string String();
 	AstType Type() const { return AstType::Program; }
 
-	std::vector<std::unique_ptr<Statement>> statements;
+	// the tokens in the tree point into the source and the nodes are allocated
+	// in the arena, the program keeps both alive.
+	std::shared_ptr<const std::string> source;
+	Arena arena;
+	std::vector<NodePtr<Statement>> statements;
 };
 
 class Identifier : public Expression {
 public:
-	std::string TokenLiteral() const { return token.literal; }
-	std::string String() { return value; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
+	std::string String() { return std::string(value); }
 	AstType Type() const { return AstType::Identifier; }
 
 	Token token;
-	std::string value;
+	// interned in the program's arena.
+	std::string_view value;
 };
 
 class LetStatement : public Statement {
 public:
 	void statementNode() {}
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	std::string String();
 	AstType Type() const { return AstType::LetStatement; }
 
 	Token token;
-	std::unique_ptr<Identifier> name;
-	std::unique_ptr<Expression> value;
+	NodePtr<Identifier> name;
+	NodePtr<Expression> value;
 };
 
 class ReturnStatement : public Statement {
 public:
 	void statementNode() {}
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	std::string String();
 	AstType Type() const { return AstType::ReturnStatement; }
 
 	Token token;
-	std::unique_ptr<Expression> return_value;
+	NodePtr<Expression> return_value;
 };
 
 class ExpressionStatement : public Statement {
 public:
 	void statementNode() {}
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	std::string String();
 	AstType Type() const { return AstType::ExpressionStatement; }
 
 	Token token;
-	std::unique_ptr<Expression> expression;
+	NodePtr<Expression> expression;
 };
 
 class IntegerLiteral : public Expression {
 public:
-	std::string TokenLiteral() const { return token.literal; }
-	std::string String() { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
+	std::string String() { return std::string(token.literal); }
 	AstType Type() const { return AstType::IntegerLiteral; }
 
 	Token token;
@@ -114,33 +146,33 @@ public:
 
 class PrefixExpression : public Expression {
 public:
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	std::string String();
 	AstType Type() const { return AstType::PrefixExpression; }
 
 	Token token;
 
 	// the operator
-	std::string opr;
-	std::unique_ptr<Expression> right;
+	std::string_view opr;
+	NodePtr<Expression> right;
 };
 
 class InfixExpression : public Expression {
 public:
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	std::string String();
 	AstType Type() const { return AstType::InfixExpression; }
 
 	Token token;
-	std::string opr;
-	std::unique_ptr<Expression> right;
-	std::unique_ptr<Expression> left;
+	std::string_view opr;
+	NodePtr<Expression> right;
+	NodePtr<Expression> left;
 };
 
 class BooleanExpression : public Expression {
 public:
-	std::string String() { return token.literal; }
-	std::string TokenLiteral() const { return token.literal; }
+	std::string String() { return std::string(token.literal); }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::BooleanExpression; }
 
 	Token token;
@@ -150,93 +182,136 @@ public:
 class BlockStatement : public Statement {
 public:
 	void statementNode() {}
-	std::string String() { return token.literal; }
-	std::string TokenLiteral() const { return token.literal; }
+	std::string String() { return std::string(token.literal); }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::BlockStatement; }
 
 	Token token;
-	std::vector<std::unique_ptr<Statement>> statements;
+	ArenaList<NodePtr<Statement>> statements;
 };
 
 class IfExpression : public Expression {
 public:
-	std::string String() { return token.literal; }
-	std::string TokenLiteral() const { return token.literal; }
+	std::string String() { return std::string(token.literal); }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::IfExpression; }
 
 	Token token;
-	std::unique_ptr<Expression> cond;
-	std::unique_ptr<BlockStatement> after;
-	std::unique_ptr<BlockStatement> other;
+	NodePtr<Expression> cond;
+	NodePtr<BlockStatement> after;
+	NodePtr<BlockStatement> other;
 };
 
 class FunctionLiteral : public Expression {
 public:
-	std::string String() { return token.literal; }
-	std::string TokenLiteral() const { return token.literal; }
+	std::string String() { return std::string(token.literal); }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::FunctionLiteral; }
 
 	Token token;
-	std::vector<std::unique_ptr<Identifier>> params;
-	std::unique_ptr<BlockStatement> body;
+	ArenaList<NodePtr<Identifier>> params;
+	NodePtr<BlockStatement> body;
 };
 
 class CallExpression : public Expression {
 public:
 	std::string String();
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::CallExpression; }
 
 	Token token;
-	std::vector<std::unique_ptr<Expression>> arguments;
-	std::unique_ptr<Expression> func;
+	ArenaList<NodePtr<Expression>> arguments;
+	NodePtr<Expression> func;
 };
 
 class StringLiteral : public Expression {
 public:
-	std::string String() { return value; }
-	std::string TokenLiteral() const { return token.literal; }
+	std::string String() { return std::string(value); }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::StringLiteral; }
 
 	Token token;
-	std::string value;
+	std::string_view value;
 };
 
 class ArrayLiteral : public Expression {
 public:
 	std::string String();
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::ArrayLiteral; }
 
-	std::vector<std::unique_ptr<Expression>> elements;
+	ArenaList<NodePtr<Expression>> elements;
 	Token token;
 };
 
 class IndexExpression : public Expression {
 public:
 	std::string String();
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::IndexExpression; }
 
 	Token token;
-	std::unique_ptr<Expression> left;
-	std::unique_ptr<Expression> index;
+	NodePtr<Expression> left;
+	NodePtr<Expression> index;
 };
 
 class HashLiteral : public Expression {
 public:
 	std::string String() { return "hashliteral string"; };
-	std::string TokenLiteral() const { return token.literal; }
+	std::string TokenLiteral() const { return std::string(token.literal); }
 	AstType Type() const { return AstType::HashLiteral; }
 
 	Token token;
 
 	// we can use maps put there i found some errors for iterating them when it
-	// consists only of unique pointers. That is why it is a vector and we don't
+	// consists only of unique pointers. That is why it is a list and we don't
 	// need to query anything from the ast node so it just works.
-	std::vector<
-			std::pair<std::unique_ptr<Expression>, std::unique_ptr<Expression>>>
-			pairs;
+	ArenaList<std::pair<NodePtr<Expression>, NodePtr<Expression>>> pairs;
 };
 
+// visit calls visitor with the node cast to its concrete type, which is picked
+// by the node's AstType. The overload to call is resolved at compile time, so
+// walking a tree this way needs no dynamic_cast.
+template <typename Visitor>
+decltype(auto) visit(const Node &node, Visitor &&visitor) {
+	switch (node.Type()) {
+	case AstType::Program:
+		return visitor(static_cast<const Program &>(node));
+	case AstType::Identifier:
+		return visitor(static_cast<const Identifier &>(node));
+	case AstType::LetStatement:
+		return visitor(static_cast<const LetStatement &>(node));
+	case AstType::ReturnStatement:
+		return visitor(static_cast<const ReturnStatement &>(node));
+	case AstType::ExpressionStatement:
+		return visitor(static_cast<const ExpressionStatement &>(node));
+	case AstType::HashLiteral:
+		return visitor(static_cast<const HashLiteral &>(node));
+	case AstType::ArrayLiteral:
+		return visitor(static_cast<const ArrayLiteral &>(node));
+	case AstType::CallExpression:
+		return visitor(static_cast<const CallExpression &>(node));
+	case AstType::StringLiteral:
+		return visitor(static_cast<const StringLiteral &>(node));
+	case AstType::IndexExpression:
+		return visitor(static_cast<const IndexExpression &>(node));
+	case AstType::PrefixExpression:
+		return visitor(static_cast<const PrefixExpression &>(node));
+	case AstType::InfixExpression:
+		return visitor(static_cast<const InfixExpression &>(node));
+	case AstType::BlockStatement:
+		return visitor(static_cast<const BlockStatement &>(node));
+	case AstType::IfExpression:
+		return visitor(static_cast<const IfExpression &>(node));
+	case AstType::IntegerLiteral:
+		return visitor(static_cast<const IntegerLiteral &>(node));
+	case AstType::BooleanExpression:
+		return visitor(static_cast<const BooleanExpression &>(node));
+	case AstType::FunctionLiteral:
+		break;
+	}
+	// the function literal is handled out here so every path returns.
+	return visitor(static_cast<const FunctionLiteral &>(node));
+}
+
 #endif
@@ -1,12 +1,24 @@
 #include "ast.h"
+#include "builtins.h"
 #include "compiler.h"
+#include "kernels.h"
 #include "lexer.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "regcompiler.h"
+#include "regvm.h"
+#include "tier.h"
+#include "verifier.h"
 #include "vm.h"
+#include <algorithm>
+#include <climits>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <sys/resource.h>
 #include <sys/time.h>
+#include <vector>
 
 typedef unsigned long long timestamp_t;
 
@@ -23,54 +35,655 @@ std::unique_ptr<Program> parse_compiler_program_helper(std::string input) {
 	return parser.parse_program();
 }
 
-static const std::string input = "let fib = func(n) {"
-																 "    if (n == 0) {"
-																 "        return 0;"
-																 "    } else {"
-																 "        if (n == 1) {"
-																 "            return 1;"
-																 "        } else {"
-																 "            return fib(n-1) + fib(n-2);"
-																 "        }"
-																 "    }"
-																 "};"
-																 "fib(25);";
-
-int main() {
-	std::string engine;
-	std::cout << "which engine (vm|eval): ";
-	std::cin >> engine;
+struct Workload {
+	std::string name;
+	std::string input;
+};
+
+static const std::vector<Workload> workloads{
+		{"fib", "let fib = func(n) {"
+						"    if (n == 0) {"
+						"        return 0;"
+						"    } else {"
+						"        if (n == 1) {"
+						"            return 1;"
+						"        } else {"
+						"            return fib(n-1) + fib(n-2);"
+						"        }"
+						"    }"
+						"};"
+						"fib(25);"},
+		// creates closures and passes functions around as values.
+		{"closure", "let newAdder = func(a) { func(b) { a + b } };"
+								"let inc = func(x) { x + 1 };"
+								"let apply = func(f, n) {"
+								"    if (n == 0) { 0 } else { f(apply(f, n - 1)) }"
+								"};"
+								"let run = func(n) {"
+								"    if (n < 2) {"
+								"        newAdder(n);"
+								"        apply(inc, 10)"
+								"    } else {"
+								"        run(n - 1) + run(n - 2)"
+								"    }"
+								"};"
+								"run(20);"},
+		// builds short lived arrays and strings, which keeps the gc busy.
+		{"alloc", "let make = func(n) {"
+							"    if (n == 0) { [] } else { push(make(n - 1), n) }"
+							"};"
+							"let run = func(n) {"
+							"    if (n < 2) {"
+							"        \"a\" + \"b\";"
+							"        make(8)[0]"
+							"    } else {"
+							"        run(n - 1) + run(n - 2)"
+							"    }"
+							"};"
+							"run(22);"},
+		// reads settings out of a hash with constant keys, like config scripts.
+		{"lookup", "let config = {\"width\": 640, \"height\": 480, \"scale\": 2};"
+							 "let sizes = [1, 2, 4, 8];"
+							 "let area = func(i) {"
+							 "    config[\"width\"] * config[\"height\"] * config[\"scale\"] "
+							 "+ sizes[i]"
+							 "};"
+							 "let run = func(n) {"
+							 "    if (n < 2) { area(n) } else { run(n - 1) + run(n - 2) }"
+							 "};"
+							 "run(22);"},
+};
+
+static int run_vm_workload(const Workload &workload, int opt_level) {
+	auto program = parse_compiler_program_helper(workload.input);
+
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	if (status.has_value()) {
+		std::cout << "compilation unsuccessful";
+		return -1;
+	}
+
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, opt_level);
+	auto invalid = verifier::verify(*bytecode);
+	if (invalid.has_value()) {
+		std::cout << "invalid bytecode: " << invalid.value();
+		return -1;
+	}
+
+	auto vm = new VM(bytecode);
+
+	timestamp_t t0 = get_timestamp();
+
+	auto vm_status = vm->run();
+	timestamp_t t1 = get_timestamp();
+	if (vm_status.has_value()) {
+		std::cout << "running unsuccessful: " << vm_status.value();
+		return -1;
+	}
+
+	auto stack_elem = vm->last_popped_stack_elem();
+	if (stack_elem == nullptr) {
+		std::cout << "running unsuccessful";
+		return -1;
+	}
+	double secs = (t1 - t0) / 1000000.0L;
+	std::cout << workload.name << ": the vm took: " << secs << '\n';
+	std::cout << workload.name << ": result is: " << stack_elem->Inspect()
+						<< '\n';
+
+	const auto &gc = vm->gc_stats();
+	std::cout << workload.name << ": gc collections: " << gc.collections
+						<< " freed: " << gc.objects_freed << " live: " << gc.live_objects
+						<< " max pause: " << gc.max_pause_ms
+						<< "ms total pause: " << gc.total_pause_ms << "ms\n";
+	std::cout << workload.name << ": gc minor collections: " << gc.minor_collections
+						<< " promotion rate: " << gc.promotion_rate()
+						<< " max minor pause: " << gc.max_minor_pause_ms
+						<< "ms total minor pause: " << gc.total_minor_pause_ms << "ms\n";
+
+	return 0;
+}
+
+// run_engines_workload runs a workload on the stack vm and on the register vm
+// and compares their times, both have to agree on the result.
+static int run_engines_workload(const Workload &workload, int opt_level) {
+	auto program = parse_compiler_program_helper(workload.input);
+
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	auto reg_comp = new RegisterCompiler();
+	if (!status.has_value())
+		status = reg_comp->compile(*program);
+	if (status.has_value()) {
+		std::cout << "compilation unsuccessful: " << status.value() << '\n';
+		return -1;
+	}
+
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, opt_level);
+	auto invalid = verifier::verify(*bytecode);
+	if (invalid.has_value()) {
+		std::cout << "invalid bytecode: " << invalid.value() << '\n';
+		return -1;
+	}
+
+	auto vm = new VM(bytecode);
+	timestamp_t t0 = get_timestamp();
+	auto vm_status = vm->run();
+	timestamp_t t1 = get_timestamp();
+
+	auto reg_vm = new RegisterVM(reg_comp->bytecode());
+	timestamp_t t2 = get_timestamp();
+	auto reg_status = reg_vm->run();
+	timestamp_t t3 = get_timestamp();
+
+	if (vm_status.has_value() || reg_status.has_value()) {
+		std::cout << "running unsuccessful: "
+							<< vm_status.value_or(reg_status.value_or("")) << '\n';
+		return -1;
+	}
+
+	const auto stack_result = vm->last_popped_stack_elem()->Inspect();
+	const auto reg_result = reg_vm->result()->Inspect();
+	if (stack_result != reg_result) {
+		std::cout << workload.name << ": the stack vm gives " << stack_result
+							<< " but the register vm gives " << reg_result << '\n';
+		return -1;
+	}
+
+	const double stack_secs = (t1 - t0) / 1000000.0L;
+	const double reg_secs = (t3 - t2) / 1000000.0L;
+	std::cout << workload.name << ": stack vm: " << stack_secs
+						<< " register vm: " << reg_secs
+						<< " speedup: " << stack_secs / reg_secs << "x\n";
+
+	return 0;
+}
+
+// run_tiers_workload runs a workload on the tree walker alone, on the tiered
+// runtime and on the stack vm. The times include compiling, since that is what
+// the tiered runtime saves on short scripts.
+static int run_tiers_workload(const Workload &workload, int opt_level) {
+	auto program = parse_compiler_program_helper(workload.input);
+
+	TierConfig eval_only;
+	eval_only.call_threshold = INT_MAX;
+	eval_only.back_edge_threshold = INT_MAX;
+	timestamp_t t0 = get_timestamp();
+	const auto eval_result = TieredRuntime(eval_only).run(program.get());
+	timestamp_t t1 = get_timestamp();
+	const auto tiered_result = TieredRuntime().run(program.get());
+	timestamp_t t2 = get_timestamp();
+
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	if (status.has_value()) {
+		std::cout << "compilation unsuccessful: " << status.value() << '\n';
+		return -1;
+	}
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, opt_level);
+	auto invalid = verifier::verify(*bytecode);
+	if (invalid.has_value()) {
+		std::cout << "invalid bytecode: " << invalid.value() << '\n';
+		return -1;
+	}
+	auto vm = new VM(bytecode);
+	auto vm_status = vm->run();
+	timestamp_t t3 = get_timestamp();
+	if (vm_status.has_value()) {
+		std::cout << "running unsuccessful: " << vm_status.value() << '\n';
+		return -1;
+	}
+
+	const auto vm_result = vm->last_popped_stack_elem()->Inspect();
+	if (eval_result->Inspect() != vm_result ||
+			tiered_result->Inspect() != vm_result) {
+		std::cout << workload.name << ": eval gives " << eval_result->Inspect()
+							<< ", tiered gives " << tiered_result->Inspect()
+							<< " but the vm gives " << vm_result << '\n';
+		return -1;
+	}
+
+	std::cout << workload.name << ": eval: " << (t1 - t0) / 1000000.0L
+						<< " tiered: " << (t2 - t1) / 1000000.0L
+						<< " vm: " << (t3 - t2) / 1000000.0L << '\n';
+
+	return 0;
+}
+
+// generate_program returns a program with the given amount of lines that only
+// uses a fixed set of globals and constants, so it stays within the operand
+// limits no matter the size.
+static std::string generate_program(int lines) {
+	constexpr int num_globals = 100;
+
+	// identifiers can't contain digits.
+	auto global = [](int i) {
+		return std::string("x") + (char)('a' + i / 26) + (char)('a' + i % 26);
+	};
+
+	std::string out;
+	for (int i = 0; i < num_globals && i < lines; ++i)
+		out += "let " + global(i) + " = " + std::to_string(i) + ";\n";
+
+	for (int i = num_globals; i < lines; ++i) {
+		const auto a = global(i % num_globals);
+		const auto b = global((i + 1) % num_globals);
+		const auto n = std::to_string(i % 1000);
+		if (i % 5 == 0)
+			out += "if (" + a + " > " + n + ") { " + a + " } else { " + b + " };\n";
+		else
+			out += a + " + " + n + " * (" + b + " - 1);\n";
+	}
+
+	return out;
+}
+
+static long max_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static int run_compile_workload(int lines, int opt_level) {
+	const auto input = generate_program(lines);
+
+	const auto rss_before = max_rss_kb();
+	timestamp_t t0 = get_timestamp();
+	auto program = parse_compiler_program_helper(input);
+	timestamp_t t1 = get_timestamp();
+	const auto parse_rss = max_rss_kb() - rss_before;
+
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	timestamp_t t2 = get_timestamp();
+	if (status.has_value()) {
+		std::cout << "compilation unsuccessful: " << status.value() << '\n';
+		return -1;
+	}
+
+	program.reset();
+	timestamp_t t3 = get_timestamp();
+
+	auto bytecode = comp->bytecode();
+	const double parse_secs = (t1 - t0) / 1000000.0L;
+	const double compile_secs = (t2 - t1) / 1000000.0L;
+	std::cout << lines << " lines: parsing took: " << parse_secs
+						<< " (peak memory grew by " << parse_rss / 1024 << "MB)"
+						<< " freeing the ast took: " << (t3 - t2) / 1000000.0L
+						<< " compiling took: " << compile_secs << " ("
+						<< (long long)(lines / compile_secs) << " lines/s) "
+						<< bytecode->instructions.size() << " bytes "
+						<< bytecode->constants.size() << " constants\n";
+
+	return 0;
+}
+
+// generate_source returns at least the given amount of bytes of source that
+// uses every kind of token: functions, calls, strings, arrays, hashes and
+// keywords.
+static std::string generate_source(std::size_t bytes) {
+	const std::vector<std::string> statements{
+			"let fib = func(n) { if (n < 2) { return n; } else { fib(n - 1) + "
+			"fib(n - 2) } };\n",
+			"let words = [\"alpha\", \"beta\", \"gamma\", \"delta\"];\n",
+			"let config = {\"width\": 640, \"height\": 480, \"deep\": true};\n",
+			"let area = config[\"width\"] * config[\"height\"] / 2;\n",
+			"if (area != 1234 == false) { push(words, \"epsilon\") } else { "
+			"tail(words) };\n",
+			"let apply = func(fn, value) { fn(value) - !false };\n",
+	};
+
+	std::string out;
+	for (std::size_t i = 0; out.size() < bytes; ++i)
+		out += statements[i % statements.size()];
+
+	return out;
+}
+
+// run_parse_workload reports the throughput of the lexer alone and of the
+// lexer together with the parser.
+static int run_parse_workload(int megabytes) {
+	const auto input = generate_source((std::size_t)megabytes << 20);
+
+	timestamp_t t0 = get_timestamp();
+	auto lexer = Lexer(input);
+	std::size_t tokens = 0;
+	while (lexer.next_token().type != tokentypes::EOFF)
+		++tokens;
+	timestamp_t t1 = get_timestamp();
 
 	auto program = parse_compiler_program_helper(input);
+	timestamp_t t2 = get_timestamp();
+	if (program->statements.empty()) {
+		std::cout << "parsing unsuccessful\n";
+		return -1;
+	}
+
+	const double mb = input.size() / (double)(1 << 20);
+	std::cout << megabytes << "MB (" << tokens << " tokens): lexing: "
+						<< mb / ((t1 - t0) / 1000000.0L) << " MB/s"
+						<< " lexing and parsing: " << mb / ((t2 - t1) / 1000000.0L)
+						<< " MB/s\n";
 
-	if (engine == "vm") {
-		auto comp = new Compiler();
-		auto status = comp->compile(*program);
-		if (status.has_value()) {
-			std::cout << "compilation unsuccessful";
+	return 0;
+}
+
+struct OpcodeWorkload {
+	std::string name;
+	// a statement that is dominated by the opcode, the local a and the global g
+	// are in scope.
+	std::string statement;
+};
+
+static const std::vector<OpcodeWorkload> opcode_workloads{
+		{"OpConstant", "1;"},
+		{"OpGetGlobal", "g;"},
+		{"OpGetLocal", "a;"},
+		{"OpArray", "[];"},
+		{"OpJump", "if (a) { a };"},
+		{"OpClosure", "func() { 1 };"},
+};
+
+// run_opcode_workload reports the average time of a statement when ran many
+// times in a straight line function body. Every statement also includes an
+// OpPop.
+static int run_opcode_workload(const OpcodeWorkload &workload, int opt_level) {
+	constexpr int statements = 1000;
+	constexpr int depth = 18;
+
+	std::string body;
+	for (int i = 0; i < statements; ++i)
+		body += workload.statement;
+
+	const auto input = "let g = [1];"
+										 "let body = func(a) { " +
+										 body +
+										 " 0 };"
+										 "let run = func(n) {"
+										 "    if (n < 2) { body(true) } else { run(n - 1) + run(n - 2) }"
+										 "};"
+										 "run(" +
+										 std::to_string(depth) + ");";
+
+	auto program = parse_compiler_program_helper(input);
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	if (status.has_value()) {
+		std::cout << "compilation unsuccessful: " << status.value() << '\n';
+		return -1;
+	}
+
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, opt_level);
+	auto vm = new VM(bytecode);
+
+	timestamp_t t0 = get_timestamp();
+	auto vm_status = vm->run();
+	timestamp_t t1 = get_timestamp();
+	if (vm_status.has_value()) {
+		std::cout << "running unsuccessful: " << vm_status.value() << '\n';
+		return -1;
+	}
+
+	// run(n) calls body once per leaf of the call tree.
+	long long calls[depth + 1];
+	calls[0] = calls[1] = 1;
+	for (int i = 2; i <= depth; ++i)
+		calls[i] = calls[i - 1] + calls[i - 2];
+
+	const double ns = (t1 - t0) * 1000.0L / (calls[depth] * statements);
+	std::cout << workload.name << ": " << ns << "ns per statement\n";
+
+	return 0;
+}
+
+// run_hash_workload fills a hash with integer keys and reads every key back.
+// The keys and values are shared, so the memory growth is the table itself.
+static int run_hash_workload(int entries) {
+	std::vector<Object *> keys(entries);
+	for (int i = 0; i < entries; ++i)
+		keys[i] = new Integer(i * 31);
+	auto value = new Integer(1);
+
+	const auto rss_before = max_rss_kb();
+	timestamp_t t0 = get_timestamp();
+
+	auto hash = new Hash();
+	for (auto key : keys)
+		hash->set(key, value);
+	timestamp_t t1 = get_timestamp();
+
+	for (auto key : keys)
+		if (hash->get(key) != value) {
+			std::cout << "lookup unsuccessful\n";
 			return -1;
 		}
+	timestamp_t t2 = get_timestamp();
 
-		auto vm = new VM(comp->bytecode());
+	const auto table_kb = max_rss_kb() - rss_before;
+	std::cout << entries << " entries: inserting took: "
+						<< (t1 - t0) / 1000000.0L
+						<< " looking up took: " << (t2 - t1) / 1000000.0L
+						<< " table size: " << table_kb / 1024 << "MB ("
+						<< table_kb * 1024.0 / entries << " bytes per entry)\n";
 
-		timestamp_t t0 = get_timestamp();
+	return 0;
+}
 
-		auto vm_status = vm->run();
-		timestamp_t t1 = get_timestamp();
-		if (vm_status.has_value()) {
-			std::cout << "running unsuccessful: " << vm_status.value();
-			return -1;
+// run_array_workload builds a list with the push builtin and consumes it with
+// first and tail, the way recursive lups code processes lists.
+static int run_array_workload(int elements) {
+	std::vector<Object *> ints(elements);
+	for (int i = 0; i < elements; ++i)
+		ints[i] = new Integer(i);
+
+	timestamp_t t0 = get_timestamp();
+
+	std::vector<Object *> empty;
+	Object *list = new Array(empty);
+	for (auto obj : ints) {
+		std::vector<Object *> args{list, obj};
+		auto pushed = builtin_functions::array_push(args);
+		delete list;
+		list = pushed;
+	}
+	timestamp_t t1 = get_timestamp();
+
+	long long sum = 0;
+	while (!((Array *)list)->elements.empty()) {
+		std::vector<Object *> args{list};
+		sum += ((Integer *)builtin_functions::array_first(args))->value;
+		auto tailed = builtin_functions::array_tail(args);
+		delete list;
+		list = tailed;
+	}
+	timestamp_t t2 = get_timestamp();
+	delete list;
+
+	if (sum != (long long)elements * (elements - 1) / 2) {
+		std::cout << "wrong sum " << sum << '\n';
+		return -1;
+	}
+
+	std::cout << elements << " elements: pushing took: "
+						<< (t1 - t0) / 1000000.0L
+						<< " taking the tail took: " << (t2 - t1) / 1000000.0L << '\n';
+
+	return 0;
+}
+
+// run_kernel_workload times the numeric builtins' kernels of every
+// implementation the cpu supports, repeated so that small arrays still take
+// measurable time.
+static int run_kernel_workload(int elements) {
+	std::vector<int> a(elements), b(elements), out(elements);
+	for (int i = 0; i < elements; ++i) {
+		a[i] = i % 1000 - 500;
+		b[i] = i % 7;
+	}
+	const auto repeat = std::max(1, 100000000 / elements);
+
+	for (auto impl : {&kernels::scalar(), kernels::sse41(), kernels::avx2()}) {
+		if (impl == nullptr)
+			continue;
+
+		int check = 0;
+		auto time = [&](const char *name, const std::function<void()> &fn) {
+			timestamp_t t0 = get_timestamp();
+			for (int i = 0; i < repeat; ++i)
+				fn();
+			timestamp_t t1 = get_timestamp();
+			std::cout << "  " << name << ": "
+								<< (t1 - t0) * 1000.0L / ((long double)repeat * elements)
+								<< " ns per element\n";
+		};
+
+		std::cout << elements << " elements with " << impl->name << ":\n";
+		time("sum", [&] { check += impl->sum(a.data(), a.size()); });
+		time("min", [&] { check += impl->min(a.data(), a.size()); });
+		time("max", [&] { check += impl->max(a.data(), a.size()); });
+		time("dot", [&] { check += impl->dot(a.data(), b.data(), a.size()); });
+		time("scale", [&] { impl->scale(a.data(), 3, out.data(), a.size()); });
+		time("add", [&] { impl->add(a.data(), b.data(), out.data(), a.size()); });
+
+		// keeps the results alive.
+		if (check == 42)
+			std::cout << '\n';
+	}
+
+	return 0;
+}
+
+// usage: bench [engine] [-O<level>] [workload...], when no workloads are given
+// all of them are ran. The compile engine takes line counts instead of
+// workloads and measures the compiler on generated programs, the opcodes engine
+// measures the cost of single opcodes, the hashes engine takes entry counts
+// and measures the hash table and the arrays engine takes element counts and
+// measures the list builtins, the kernels engine measures the numeric
+// builtins of integer arrays the same way. The parse engine takes source sizes
+// in megabytes and measures the lexer and parser. The engines engine runs the
+// vm workloads on both the stack vm and the register vm, the tiers engine on
+// the tree walker, the tiered runtime and the stack vm.
+int main(int argc, char *argv[]) {
+	std::string engine;
+	if (argc > 1) {
+		engine = argv[1];
+	} else {
+		std::cout << "which engine (vm|engines|tiers|compile|opcodes|hashes|arrays|kernels|parse): ";
+		std::cin >> engine;
+	}
+
+	int opt_level = optimizer::MaxLevel;
+	std::vector<std::string> selected;
+	for (int i = 2; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg.rfind("-O", 0) == 0 && arg.size() > 2)
+			opt_level = std::stoi(arg.substr(2));
+		else
+			selected.push_back(arg);
+	}
+
+	if (engine == "compile") {
+		if (selected.empty())
+			selected = {"10000", "100000", "1000000"};
+
+		for (const auto &lines : selected)
+			if (run_compile_workload(std::stoi(lines), opt_level) != 0)
+				return -1;
+
+		return 0;
+	}
+
+	if (engine == "parse") {
+		if (selected.empty())
+			selected = {"1", "4", "16"};
+
+		for (const auto &megabytes : selected)
+			if (run_parse_workload(std::stoi(megabytes)) != 0)
+				return -1;
+
+		return 0;
+	}
+
+	if (engine == "arrays") {
+		if (selected.empty())
+			selected = {"1000000"};
+
+		for (const auto &elements : selected)
+			if (run_array_workload(std::stoi(elements)) != 0)
+				return -1;
+
+		return 0;
+	}
+
+	if (engine == "kernels") {
+		if (selected.empty())
+			selected = {"1000", "1000000"};
+
+		for (const auto &elements : selected)
+			if (run_kernel_workload(std::stoi(elements)) != 0)
+				return -1;
+
+		return 0;
+	}
+
+	if (engine == "hashes") {
+		if (selected.empty())
+			selected = {"1000000"};
+
+		for (const auto &entries : selected)
+			if (run_hash_workload(std::stoi(entries)) != 0)
+				return -1;
+
+		return 0;
+	}
+
+	if (engine == "opcodes") {
+		for (const auto &workload : opcode_workloads) {
+			if (!selected.empty() && std::find(selected.begin(), selected.end(),
+																				 workload.name) == selected.end())
+				continue;
+
+			if (run_opcode_workload(workload, opt_level) != 0)
+				return -1;
 		}
 
-		auto stack_elem = vm->last_popped_stack_elem();
-		if (stack_elem == nullptr) {
-			std::cout << "running unsuccessful";
-			return -1;
+		return 0;
+	}
+
+	if (engine == "engines" || engine == "tiers") {
+		for (const auto &workload : workloads) {
+			if (!selected.empty() && std::find(selected.begin(), selected.end(),
+																				 workload.name) == selected.end())
+				continue;
+
+			const auto status = engine == "engines"
+															? run_engines_workload(workload, opt_level)
+															: run_tiers_workload(workload, opt_level);
+			if (status != 0)
+				return -1;
 		}
-		double secs = (t1 - t0) / 1000000.0L;
-		std::cout << "the vm took: " << secs << '\n';
-		std::cout << "result is: " << stack_elem->Inspect() << '\n';
 
 		return 0;
 	}
+
+	if (engine != "vm") {
+		std::cout << "unsupported engine: " << engine << '\n';
+		return -1;
+	}
+
+	for (const auto &workload : workloads) {
+		if (!selected.empty() && std::find(selected.begin(), selected.end(),
+																			 workload.name) == selected.end())
+			continue;
+
+		if (run_vm_workload(workload, opt_level) != 0)
+			return -1;
+	}
+
+	return 0;
 }
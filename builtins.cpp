@@ -1,8 +1,9 @@
 #include "builtins.h"
 #include "eval.h"
+#include "kernels.h"
 #include <iostream>
 
-const std::array<std::pair<std::string, Builtin *>, 6>
+const std::array<std::pair<std::string, Builtin *>, 12>
 		builtin_functions::functions = {
 				std::make_pair("len", new Builtin(*builtin_functions::len)),
 				std::make_pair("println", new Builtin(*builtin_functions::println)),
@@ -10,19 +11,31 @@ const std::array<std::pair<std::string, Builtin *>, 6>
 				std::make_pair("last", new Builtin(*builtin_functions::array_last)),
 				std::make_pair("tail", new Builtin(*builtin_functions::array_tail)),
 				std::make_pair("push", new Builtin(*builtin_functions::array_push)),
+				std::make_pair("sum", new Builtin(*builtin_functions::array_sum)),
+				std::make_pair("min", new Builtin(*builtin_functions::array_min)),
+				std::make_pair("max", new Builtin(*builtin_functions::array_max)),
+				std::make_pair("dot", new Builtin(*builtin_functions::array_dot)),
+				std::make_pair("scale", new Builtin(*builtin_functions::array_scale)),
+				std::make_pair("add", new Builtin(*builtin_functions::array_add)),
 };
 
+static bool is_array(Object *obj) {
+	return obj->Type() == ObjType::Array || obj->Type() == ObjType::IntArray;
+}
+
 Object *builtin_functions::len(std::vector<Object *> &objs) {
-	if (objs.size() != 2) {
-		return new Error("wrong number of arguments. want 2");
+	if (objs.size() != 1) {
+		return new Error("wrong number of arguments. want 1");
 	}
 
-	if (objs[0]->Type() != ObjType::Array && objs[0]->Type() != ObjType::String) {
+	if (!is_array(objs[0]) && objs[0]->Type() != ObjType::String) {
 		return new Error("the argument to 'len' must be of type array or string");
 	}
 
 	if (objs[0]->Type() == ObjType::Array) {
 		return new Integer(((Array *)objs[0])->elements.size());
+	} else if (objs[0]->Type() == ObjType::IntArray) {
+		return new Integer(((IntArray *)objs[0])->size());
 	} else if (objs[0]->Type() == ObjType::String) {
 		return new Integer(((String *)objs[0])->value.size());
 	}
@@ -45,13 +58,20 @@ Object *builtin_functions::array_first(std::vector<Object *> &objs) {
 		return new Error("wrong number of arguments. want 1");
 	}
 
-	if (objs[0]->Type() != ObjType::Array) {
+	if (!is_array(objs[0])) {
 		return new Error("the argument must be of type array");
 	}
 
-	auto elements = ((Array *)objs[0])->elements;
-	if (elements.size() > 0) {
-		return elements[0];
+	if (objs[0]->Type() == ObjType::IntArray) {
+		const auto array = (IntArray *)objs[0];
+		if (array->size() > 0)
+			return new Integer((*array)[0]);
+		return object_constant::null;
+	}
+
+	const auto &elements = ((Array *)objs[0])->elements;
+	if (!elements.empty()) {
+		return elements.front();
 	}
 
 	return object_constant::null;
@@ -62,14 +82,20 @@ Object *builtin_functions::array_last(std::vector<Object *> &objs) {
 		return new Error("wrong number of arguments. want 1");
 	}
 
-	if (objs[0]->Type() != ObjType::Array) {
+	if (!is_array(objs[0])) {
 		return new Error("the argument must be of type array");
 	}
 
-	auto elements = ((Array *)objs[0])->elements;
-	auto size = elements.size();
-	if (size > 0) {
-		return elements[size - 1];
+	if (objs[0]->Type() == ObjType::IntArray) {
+		const auto array = (IntArray *)objs[0];
+		if (array->size() > 0)
+			return new Integer((*array)[array->size() - 1]);
+		return object_constant::null;
+	}
+
+	const auto &elements = ((Array *)objs[0])->elements;
+	if (!elements.empty()) {
+		return elements.back();
 	}
 
 	return object_constant::null;
@@ -80,15 +106,21 @@ Object *builtin_functions::array_tail(std::vector<Object *> &objs) {
 		return new Error("wrong number of arguments. want 1");
 	}
 
-	if (objs[0]->Type() != ObjType::Array) {
+	if (!is_array(objs[0])) {
 		return new Error("the argument must be of type array");
 	}
 
+	if (objs[0]->Type() == ObjType::IntArray) {
+		const auto array = (IntArray *)objs[0];
+		if (array->size() > 0)
+			return array->tailed();
+		return object_constant::null;
+	}
+
 	auto elements = ((Array *)objs[0])->elements;
-	auto size = elements.size();
-	if (size > 0) {
-		std::vector<Object *> tailed_elements(elements.begin() + 1, elements.end());
-		return new Array(tailed_elements);
+	if (!elements.empty()) {
+		elements.drop_front();
+		return new Array(std::move(elements));
 	}
 
 	return object_constant::null;
@@ -99,14 +131,105 @@ Object *builtin_functions::array_push(std::vector<Object *> &objs) {
 		return new Error("wrong number of arguments. want 2");
 	}
 
-	if (objs[0]->Type() != ObjType::Array) {
+	if (!is_array(objs[0])) {
 		return new Error("the argument must be of type array");
 	}
 
-	auto array = (Array *)objs[0];
-	auto length = array->elements.size();
-	std::vector<Object *> new_elements = array->elements;
-	new_elements.push_back(objs[1]);
+	if (objs[0]->Type() == ObjType::IntArray) {
+		const auto array = (IntArray *)objs[0];
+		if (objs[1]->Type() == ObjType::Integer)
+			return array->pushed(((Integer *)objs[1])->value);
+
+		// the array stops being packed once it holds something else.
+		PersistentVector elements;
+		for (std::size_t i = 0; i < array->size(); ++i)
+			elements.push_back(new Integer((*array)[i]));
+		elements.push_back(objs[1]);
+		return new Array(std::move(elements));
+	}
+
+	auto elements = ((Array *)objs[0])->elements;
+	elements.push_back(objs[1]);
+
+	return new Array(std::move(elements));
+}
+
+// the numeric builtins only take packed integer arrays.
+static Error *check_int_arrays(std::vector<Object *> &objs, int arrays,
+															 int want) {
+	if ((int)objs.size() != want)
+		return new Error("wrong number of arguments. want " + std::to_string(want));
+
+	for (int i = 0; i < arrays; ++i)
+		if (objs[i]->Type() != ObjType::IntArray)
+			return new Error("the argument must be an array of integers");
+
+	return nullptr;
+}
+
+Object *builtin_functions::array_sum(std::vector<Object *> &objs) {
+	if (auto err = check_int_arrays(objs, 1, 1))
+		return err;
+
+	const auto array = (IntArray *)objs[0];
+	return new Integer(kernels::best().sum(array->data(), array->size()));
+}
+
+Object *builtin_functions::array_min(std::vector<Object *> &objs) {
+	if (auto err = check_int_arrays(objs, 1, 1))
+		return err;
+
+	const auto array = (IntArray *)objs[0];
+	if (array->size() == 0)
+		return object_constant::null;
+	return new Integer(kernels::best().min(array->data(), array->size()));
+}
+
+Object *builtin_functions::array_max(std::vector<Object *> &objs) {
+	if (auto err = check_int_arrays(objs, 1, 1))
+		return err;
+
+	const auto array = (IntArray *)objs[0];
+	if (array->size() == 0)
+		return object_constant::null;
+	return new Integer(kernels::best().max(array->data(), array->size()));
+}
+
+Object *builtin_functions::array_dot(std::vector<Object *> &objs) {
+	if (auto err = check_int_arrays(objs, 2, 2))
+		return err;
+
+	const auto a = (IntArray *)objs[0];
+	const auto b = (IntArray *)objs[1];
+	if (a->size() != b->size())
+		return new Error("the arrays must have the same length");
+	return new Integer(kernels::best().dot(a->data(), b->data(), a->size()));
+}
+
+Object *builtin_functions::array_scale(std::vector<Object *> &objs) {
+	if (auto err = check_int_arrays(objs, 1, 2))
+		return err;
+
+	if (objs[1]->Type() != ObjType::Integer)
+		return new Error("the factor must be of type integer");
+
+	const auto array = (IntArray *)objs[0];
+	std::vector<int> res(array->size());
+	kernels::best().scale(array->data(), ((Integer *)objs[1])->value, res.data(),
+												array->size());
+	return new IntArray(std::move(res));
+}
+
+Object *builtin_functions::array_add(std::vector<Object *> &objs) {
+	if (auto err = check_int_arrays(objs, 2, 2))
+		return err;
+
+	const auto a = (IntArray *)objs[0];
+	const auto b = (IntArray *)objs[1];
+	if (a->size() != b->size())
+		return new Error("the arrays must have the same length");
 
-	return new Array(new_elements);
+	std::vector<int> res(a->size());
+	kernels::best().add(a->data(), b->data(), res.data(), a->size());
+	return new IntArray(std::move(res));
 }
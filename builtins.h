@@ -13,8 +13,16 @@ Object *array_first(std::vector<Object *> &objs);
 Object *println(std::vector<Object *> &objs);
 Object *len(std::vector<Object *> &objs);
 
+// numeric builtins of integer arrays, see kernels.h.
+Object *array_sum(std::vector<Object *> &objs);
+Object *array_min(std::vector<Object *> &objs);
+Object *array_max(std::vector<Object *> &objs);
+Object *array_dot(std::vector<Object *> &objs);
+Object *array_scale(std::vector<Object *> &objs);
+Object *array_add(std::vector<Object *> &objs);
+
 // we store them in an array such that the function indices are predictable.
-extern const std::array<std::pair<std::string, Builtin *>, 6> functions;
+extern const std::array<std::pair<std::string, Builtin *>, 12> functions;
 } // namespace builtin_functions
 
 #endif
@@ -0,0 +1,147 @@
+#include "cache.h"
+#include "serializer.h"
+#include "verifier.h"
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/file.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+// the hits and misses are kept as text in this file in the cache directory,
+// every update locks it.
+static const char *StatsFile = "stats";
+
+std::uint64_t fnv1a(std::uint64_t hash, const char *data, std::size_t size) {
+	for (std::size_t i = 0; i < size; ++i) {
+		hash ^= (std::uint8_t)data[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+CacheStats read_stats(int fd) {
+	char buf[64] = {};
+	CacheStats stats{0, 0};
+	if (pread(fd, buf, sizeof(buf) - 1, 0) > 0)
+		std::sscanf(buf, "hits %" SCNu64 " misses %" SCNu64, &stats.hits,
+								&stats.misses);
+	return stats;
+}
+
+bool write_all(int fd, const char *data, std::size_t size) {
+	while (size > 0) {
+		auto written = write(fd, data, size);
+		if (written < 0)
+			return false;
+
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+} // namespace
+
+CompileCache::CompileCache(const std::string &dir) : dir_(dir) {
+	std::error_code err;
+	std::filesystem::create_directories(dir_, err);
+}
+
+std::string CompileCache::key(const std::string &source, int opt_level) const {
+	// everything that changes the bytecode for the same source is hashed in
+	// front of it.
+	const std::uint32_t versions[] = {CompilerVersion, serializer::Version,
+																		code::OpHalt + 1, (std::uint32_t)opt_level};
+	auto hash = fnv1a(0xcbf29ce484222325, (const char *)versions,
+										sizeof(versions));
+	hash = fnv1a(hash, source.data(), source.size());
+
+	char name[64];
+	std::snprintf(name, sizeof(name), "%016" PRIx64 "-%zx", hash, source.size());
+	return name;
+}
+
+std::string CompileCache::path(const std::string &key) const {
+	return dir_ + "/" + key + serializer::Extension;
+}
+
+bool CompileCache::load(const std::string &key, Bytecode &bytecode) {
+	// a missing, foreign or damaged entry is a miss alike, and so is one that
+	// reads fine but doesn't pass the verifier.
+	const bool hit = !serializer::load_file(path(key), bytecode).has_value() &&
+									 !verifier::verify(bytecode).has_value();
+	count(hit);
+	return hit;
+}
+
+std::optional<std::string> CompileCache::store(const std::string &key,
+																							 const Bytecode &bytecode) {
+	std::vector<char> data;
+	auto err = serializer::serialize(bytecode, data);
+	if (err.has_value())
+		return err;
+
+	// the entry is written under a name no other writer uses and then renamed
+	// over the entry, which replaces it atomically.
+	static std::atomic<int> writes{0};
+	const auto final_path = path(key);
+	const auto tmp_path = final_path + ".tmp." + std::to_string(getpid()) + "." +
+												std::to_string(writes++);
+
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return "could not create " + tmp_path;
+
+	const bool written = write_all(fd, data.data(), data.size());
+	if (close(fd) != 0 || !written) {
+		unlink(tmp_path.c_str());
+		return "could not write " + tmp_path;
+	}
+
+	if (rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+		unlink(tmp_path.c_str());
+		return "could not rename " + tmp_path + " to " + final_path;
+	}
+
+	return std::nullopt;
+}
+
+// count is best effort, a cache that can't keep stats still caches.
+void CompileCache::count(bool hit) {
+	const auto stats_path = dir_ + "/" + StatsFile;
+	int fd = open(stats_path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return;
+
+	if (flock(fd, LOCK_EX) == 0) {
+		auto stats = read_stats(fd);
+		if (hit)
+			++stats.hits;
+		else
+			++stats.misses;
+
+		char buf[64];
+		auto size = std::snprintf(buf, sizeof(buf),
+															"hits %" PRIu64 "\nmisses %" PRIu64 "\n",
+															stats.hits, stats.misses);
+		if (ftruncate(fd, 0) == 0)
+			pwrite(fd, buf, size, 0);
+	}
+
+	close(fd);
+}
+
+CacheStats CompileCache::stats() const {
+	const auto stats_path = dir_ + "/" + StatsFile;
+	int fd = open(stats_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return CacheStats{0, 0};
+
+	flock(fd, LOCK_SH);
+	auto stats = read_stats(fd);
+	close(fd);
+	return stats;
+}
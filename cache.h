@@ -0,0 +1,54 @@
+#ifndef LUPS_CACHE_H
+#define LUPS_CACHE_H
+
+#include "compiler.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// CacheStats counts the lookups of every process that used a cache directory.
+struct CacheStats {
+	std::uint64_t hits;
+	std::uint64_t misses;
+};
+
+// CompileCache keeps compiled bytecode in a directory as .lpsc files named
+// after a hash of the source, the optimization level and the versions of the
+// compiler and the file format. Running a script that is in the cache skips
+// lexing, parsing and compiling and costs a hash of the source and a map of
+// the file.
+//
+// Many processes can share a directory. An entry is written to a file of its
+// own and renamed into place, so readers see either no entry or a complete
+// one, and writers racing on the same source write the same bytes. Entries
+// that fail to load or to verify count as misses and are replaced.
+class CompileCache {
+public:
+	// bumped whenever the compiler or the optimizer change the code they emit
+	// for the same source, so old entries are not used anymore.
+	static constexpr std::uint32_t CompilerVersion = 1;
+
+	// the directory is created if it doesn't exist.
+	CompileCache(const std::string &dir);
+
+	// key returns the name of the entry for the source compiled at opt_level.
+	std::string key(const std::string &source, int opt_level) const;
+
+	// load fills bytecode with the verified entry for key, it returns false on
+	// a miss.
+	bool load(const std::string &key, Bytecode &bytecode);
+
+	std::optional<std::string> store(const std::string &key,
+																	 const Bytecode &bytecode);
+
+	// stats returns the hits and misses of every process so far.
+	CacheStats stats() const;
+
+private:
+	std::string path(const std::string &key) const;
+	void count(bool hit);
+
+	std::string dir_;
+};
+
+#endif
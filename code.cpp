@@ -42,9 +42,8 @@ std::string string_format(const std::string fmt, ...) {
 	return str;
 }
 
-std::uint16_t code::decode_uint16(Instructions inst) {
-	std::uint16_t num = (std::uint16_t)inst[1] | (int)inst[0] << 8;
-	return num;
+std::uint16_t code::decode_uint16(const Instructions &inst) {
+	return read_uint16(inst.data());
 }
 
 std::vector<char> code::make(Opcode op, std::vector<int> operands) {
@@ -85,8 +84,7 @@ std::string code::instructions_to_string(Instructions &instructions) {
 			continue;
 		}
 
-		auto read_res = code::read_operands(
-				def, Instructions(instructions.begin() + i + 1, instructions.end()));
+		auto read_res = code::read_operands(def, instructions.data() + i + 1);
 		res += string_format("%04d %s\n", i,
 												 code::fmt_instructions(def, read_res.first).c_str());
 		i += 1 + read_res.second;
@@ -95,18 +93,22 @@ std::string code::instructions_to_string(Instructions &instructions) {
 	return res;
 }
 
+std::pair<std::vector<int>, int>
+code::read_operands(Definition *def, const code::Instructions &inst) {
+	return read_operands(def, inst.data());
+}
+
 std::pair<std::vector<int>, int> code::read_operands(Definition *def,
-																										 code::Instructions inst) {
+																										 const char *ins) {
 	std::vector<int> operands(def->operand_widths.size(), 0);
 
 	int offset = 0;
 	for (int i = 0; i < (int)def->operand_widths.size(); ++i) {
 		auto width = def->operand_widths[i];
 		if (width == 2) {
-			operands[i] = (int)code::decode_uint16(
-					Instructions(inst.begin() + offset, inst.end()));
+			operands[i] = (int)read_uint16(ins + offset);
 		} else if (width == 1) {
-			operands[i] = (int)((std::uint8_t)inst[offset]);
+			operands[i] = (int)read_uint8(ins + offset);
 		}
 
 		offset += width;
@@ -128,6 +130,9 @@ std::string code::fmt_instructions(Definition *def, std::vector<int> operands) {
 	case 2:
 		return def->name + " " + std::to_string(operands[0]) + " " +
 					 std::to_string(operands[1]);
+	case 3:
+		return def->name + " " + std::to_string(operands[0]) + " " +
+					 std::to_string(operands[1]) + " " + std::to_string(operands[2]);
 	}
 
 	return "ERROR: unhandled operand count for " + def->name + '\n';
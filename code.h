@@ -40,6 +40,53 @@ enum Opcodes {
 	OpGetBuiltin,
 	OpClosure,
 	OpGetFree,
+
+	// OpTeeGlobal and OpTeeLocal store the top of the stack without popping it.
+	// They are only emitted by the optimizer in place of a set that is directly
+	// followed by a get of the same slot.
+	OpTeeGlobal,
+	OpTeeLocal,
+
+	// superinstructions the optimizer fuses common sequences into:
+	//   OpSubLocalConst l c          = OpGetLocal l; OpConstant c; OpSub
+	//   OpJumpNotEqualLocalConst l c t
+	//                                = OpGetLocal l; OpConstant c; OpEqual;
+	//                                  OpJumpNotTruthy t
+	//   OpCallGlobal g n             = OpGetGlobal g; <n arguments>; OpCall n
+	//   OpIndexConst c               = OpConstant c; OpIndex
+	// OpCallGlobal reads the callee after the arguments have been pushed and
+	// moves them up by one slot to make room for it. The engines compute
+	// OpSubLocalConst and OpJumpNotEqualLocalConst inline for integers and run
+	// the unfused OpSub or OpEqual for other types.
+	OpSubLocalConst,
+	OpJumpNotEqualLocalConst,
+	OpCallGlobal,
+	OpIndexConst,
+
+	// quickened opcodes are never emitted by the compiler. The vm rewrites an
+	// arithmetic or comparison instruction in place to the variant for the
+	// operand types it sees, the variant only checks a guard before doing the
+	// work. When the guard fails the instruction goes back to the generic
+	// version, or to a poly version that never quickens again for sites that
+	// see several types.
+	OpAddInt,
+	OpAddString,
+	OpSubInt,
+	OpMulInt,
+	OpGreaterThanInt,
+	OpEqualInt,
+	OpNotEqualInt,
+	OpAddPoly,
+	OpEqualPoly,
+	OpNotEqualPoly,
+	OpIndexArray,
+	OpIndexIntArray,
+	OpIndexHash,
+	OpIndexPoly,
+
+	// OpHalt is never emitted by the compiler, the vm appends it to the main
+	// program so the dispatch loop doesn't need a bounds check per instruction.
+	OpHalt,
 };
 
 struct Definition {
@@ -76,17 +123,52 @@ static const std::unordered_map<Opcode, Definition *> definitions{
 		{Opcodes::OpSetLocal, new Definition{"OpSetLocal", {1}}},
 		{Opcodes::OpGetBuiltin, new Definition{"OpGetBuiltin", {1}}},
 		{Opcodes::OpClosure, new Definition{"OpClosure", {2, 1}}},
-		{Opcodes::OpGetFree, new Definition{"OpGetFree", {1}}}};
+		{Opcodes::OpGetFree, new Definition{"OpGetFree", {1}}},
+		{Opcodes::OpTeeGlobal, new Definition{"OpTeeGlobal", {2}}},
+		{Opcodes::OpTeeLocal, new Definition{"OpTeeLocal", {1}}},
+		{Opcodes::OpSubLocalConst, new Definition{"OpSubLocalConst", {1, 2}}},
+		{Opcodes::OpJumpNotEqualLocalConst,
+		 new Definition{"OpJumpNotEqualLocalConst", {1, 2, 2}}},
+		{Opcodes::OpCallGlobal, new Definition{"OpCallGlobal", {2, 1}}},
+		{Opcodes::OpIndexConst, new Definition{"OpIndexConst", {2}}},
+		{Opcodes::OpAddInt, new Definition{"OpAddInt", {}}},
+		{Opcodes::OpAddString, new Definition{"OpAddString", {}}},
+		{Opcodes::OpSubInt, new Definition{"OpSubInt", {}}},
+		{Opcodes::OpMulInt, new Definition{"OpMulInt", {}}},
+		{Opcodes::OpGreaterThanInt, new Definition{"OpGreaterThanInt", {}}},
+		{Opcodes::OpEqualInt, new Definition{"OpEqualInt", {}}},
+		{Opcodes::OpNotEqualInt, new Definition{"OpNotEqualInt", {}}},
+		{Opcodes::OpAddPoly, new Definition{"OpAddPoly", {}}},
+		{Opcodes::OpEqualPoly, new Definition{"OpEqualPoly", {}}},
+		{Opcodes::OpNotEqualPoly, new Definition{"OpNotEqualPoly", {}}},
+		{Opcodes::OpIndexArray, new Definition{"OpIndexArray", {}}},
+		{Opcodes::OpIndexIntArray, new Definition{"OpIndexIntArray", {}}},
+		{Opcodes::OpIndexHash, new Definition{"OpIndexHash", {}}},
+		{Opcodes::OpIndexPoly, new Definition{"OpIndexPoly", {}}},
+		{Opcodes::OpHalt, new Definition{"OpHalt", {}}}};
 
 Definition *look_up(char op_code);
 std::vector<char> make(Opcode op, std::vector<int> operands);
 std::vector<char> encode_uint16(std::uint16_t val);
-std::uint16_t decode_uint16(Instructions inst);
+std::uint16_t decode_uint16(const Instructions &inst);
+
+// read_uint16 and read_uint8 decode an operand in place, ins points at its
+// first byte.
+inline std::uint16_t read_uint16(const char *ins) {
+	return (std::uint16_t)((std::uint8_t)ins[0] << 8 | (std::uint8_t)ins[1]);
+}
+
+inline std::uint8_t read_uint8(const char *ins) { return (std::uint8_t)*ins; }
+
 std::string fmt_instructions(Definition *def, std::vector<int> operands);
 
 std::string instructions_to_string(Instructions &inst);
 std::pair<std::vector<int>, int> read_operands(Definition *def,
-																							 Instructions inst);
+																							 const Instructions &inst);
+// read_operands decodes the operands following an opcode, ins points right
+// after the opcode.
+std::pair<std::vector<int>, int> read_operands(Definition *def,
+																							 const char *ins);
 } // namespace code
 
 #endif
@@ -3,11 +3,13 @@
 #include "code.h"
 #include "object.h"
 #include <algorithm>
+#include <climits>
 #include <memory>
 #include <optional>
 #include <vector>
 
-Compiler::Compiler() {
+Compiler::Compiler(int opt_level) {
+	opt_level_ = opt_level;
 	instructions_ = code::Instructions();
 	constants_ = std::vector<Object *>();
 	last_inst_ = nullptr;
@@ -28,351 +30,335 @@ Compiler::Compiler() {
 	scopes_ = std::vector<CompilationScope>(1, main_scope);
 }
 
+std::string CompileError::message() const {
+	switch (code) {
+	case CompileErrorCode::UndefinedSymbol:
+		return "symbol not found in symbol table: " + std::string(detail);
+	case CompileErrorCode::UnknownInfixOperator:
+		return "unrecognized infix operation: " + std::string(detail);
+	case CompileErrorCode::UnknownPrefixOperator:
+		return "unrecognized prefix operation: " + std::string(detail);
+	case CompileErrorCode::RegisterLimit:
+		return "too many " + std::string(detail) + " for the register vm";
+	}
+	return "unknown compile error";
+}
+
 std::optional<std::string> Compiler::compile(const Node &node) {
+	const auto err = compile_node(node);
+	folds_.clear();
+	if (err.has_value())
+		return err->message();
+
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_node(const Node &node) {
 	AstType type = node.Type();
-	switch (type) {
-	case AstType::Program: {
-		try {
-			const auto &prg = dynamic_cast<const Program &>(node);
-			for (const auto &statement : prg.statements) {
-				auto status = compile(*statement);
-				if (status.has_value())
-					return status;
-			}
-		} catch (std::bad_cast &e) {
-			return "could not cast program type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::ExpressionStatement: {
-		try {
-			const auto &exp_stmt = dynamic_cast<const ExpressionStatement &>(node);
-			auto status = compile(*exp_stmt.expression);
-			if (status.has_value())
-				return "error while compiling expression statement expression.";
-			emit(code::OpPop);
-		} catch (std::bad_cast &e) {
-			return "could not cast expression statement type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::InfixExpression: {
-		try {
-			const auto &infx_exp = dynamic_cast<const InfixExpression &>(node);
-			if (infx_exp.opr == "<") {
-				// this is the same as the code below, but it adds the infix expressions
-				// in a different order such that we only need one type of greater than
-				// opcode.
-				auto status = compile(*infx_exp.right);
-				if (status.has_value())
-					return "error compiling right side of infix expression";
-
-				status = compile(*infx_exp.left);
-				if (status.has_value())
-					return "error compiling the left side of infix expression";
-
-				emit(code::OpGreaterThan);
-				return std::nullopt;
-			}
-			auto status = compile(*infx_exp.left);
-			if (status.has_value())
-				return "error compiling the left side of infix expression";
-
-			status = compile(*infx_exp.right);
-			if (status.has_value())
-				return "error compiling the right side of infix expression";
-
-			const auto &opr = infx_exp.opr;
-			if (opr == "+")
-				emit(code::OpAdd);
-			else if (opr == "-")
-				emit(code::OpSub);
-			else if (opr == "*")
-				emit(code::OpMul);
-			else if (opr == "/")
-				emit(code::OpDiv);
-			else if (opr == ">") {
-				emit(code::OpGreaterThan);
-			} else if (opr == "==") {
-				emit(code::OpEqual);
-			} else if (opr == "!=") {
-				emit(code::OpNotEqual);
-			} else
-				return "error: unrecognized infix operation";
-		} catch (std::bad_cast &e) {
-			return "could not cast infix expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::IntegerLiteral: {
-		try {
-			const auto &intl = dynamic_cast<const IntegerLiteral &>(node);
-			auto integer = new Integer(intl.value);
-			emit(code::OpConstant, {add_constant(integer)});
-		} catch (std::bad_cast &e) {
-			return "could not cast integer literal type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::BooleanExpression: {
-		try {
-			const auto &booll = dynamic_cast<const BooleanExpression &>(node);
-			if (booll.value)
-				emit(code::OpTrue);
-			else
-				emit(code::OpFalse);
-		} catch (std::bad_cast &e) {
-			return "could not cast boolean expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::PrefixExpression: {
-		try {
-			const auto &prex = dynamic_cast<const PrefixExpression &>(node);
-			auto status = compile(*prex.right);
-			if (status.has_value())
-				return "error compiling the right side of prefix expression";
-
-			if (prex.opr == "!")
-				emit(code::OpBang);
-			else if (prex.opr == "-")
-				emit(code::OpMinus);
-			else
-				return "error: unrecognized prefix operation";
-		} catch (std::bad_cast &e) {
-			return "could not cast prefix expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::IfExpression: {
-		try {
-			const auto &ifx = dynamic_cast<const IfExpression &>(node);
-			auto status = compile(*ifx.cond);
-			if (status.has_value())
-				return "error compiling the if expression conditional";
-
-			const auto jump_not_truthy_pos = emit(code::OpJumpNotTruthy, {9999});
-
-			status = compile(*ifx.after);
-			if (status.has_value())
-				return "error compiling if expression true body";
-
-			if (last_instruction_is(code::OpPop))
-				remove_last_pop();
-
-			const auto jump_pos = emit(code::OpJump, {9999});
-			const auto after_conq_pos = current_instructions().size();
-			change_operand(jump_not_truthy_pos, after_conq_pos);
-
-			if (ifx.other == nullptr) {
-				emit(code::OpNull);
-			} else {
-				status = compile(*ifx.other);
-				if (status.has_value())
-					return "error compiling if expression false body";
-
-				if (last_instruction_is(code::OpPop))
-					remove_last_pop();
-			}
-			const auto after_other_pos = current_instructions().size();
-			change_operand(jump_pos, after_other_pos);
-		} catch (std::bad_cast &e) {
-			return "could not cast if expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::BlockStatement: {
-		try {
-			const auto &block = dynamic_cast<const BlockStatement &>(node);
-			for (auto &st : block.statements) {
-				const auto status = compile(*st);
-				if (status.has_value())
-					return "error compiling block statement";
-			}
-		} catch (std::bad_cast &e) {
-			return "could not cast block statement type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::LetStatement: {
-		try {
-			const auto &letexp = dynamic_cast<const LetStatement &>(node);
-			const auto &symbol = symbol_table_->define(letexp.name->value);
-
-			const auto status = compile(*letexp.value);
-			if (status.has_value())
-				return "error compiling let statement";
-
-			if (symbol.scope == scopes::GlobalScope)
-				emit(code::OpSetGlobal, {symbol.index});
-			else
-				emit(code::OpSetLocal, {symbol.index});
-		} catch (std::bad_cast &e) {
-			return "could not cast let statement type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::Identifier: {
-		try {
-			const auto &identifier = dynamic_cast<const Identifier &>(node);
-			auto symbol = symbol_table_->resolve(identifier.value);
-			if (!symbol.has_value())
-				return "Symbol is not found in symbol table.";
-
-			load_symbol(symbol.value());
-		} catch (std::bad_cast &e) {
-			return "could not cast identifier type to node reference. " +
-						 std::string(e.what());
+
+	// expressions whose value is known at compile time are emitted as a single
+	// constant.
+	if (opt_level_ > 0 &&
+			(type == AstType::InfixExpression || type == AstType::PrefixExpression ||
+			 type == AstType::Identifier)) {
+		const auto folded = fold(node);
+		if (folded.has_value()) {
+			emit_constant_value(folded.value());
+			return std::nullopt;
 		}
-		break;
 	}
-	case AstType::StringLiteral: {
-		try {
-			const auto &strl = dynamic_cast<const StringLiteral &>(node);
-			const auto str = new String(strl.TokenLiteral());
-			emit(code::OpConstant, {add_constant(str)});
-		} catch (std::bad_cast &e) {
-			return "could not cast string literal type to node reference. " +
-						 std::string(e.what());
+
+	return visit(node, [this](const auto &n) { return compile_typed(n); });
+}
+
+std::optional<CompileError> Compiler::compile_typed(const Program &prg) {
+	for (const auto &statement : prg.statements) {
+		auto err = compile_node(*statement);
+		if (err.has_value())
+			return err;
+
+		// only lets directly in the program are guaranteed to run before
+		// anything that reads them, ones in if blocks might not run at all.
+		if (opt_level_ > 0 && statement->Type() == AstType::LetStatement) {
+			const auto &letexp = static_cast<const LetStatement &>(*statement);
+			const auto symbol =
+					symbol_table_->resolve(std::string(letexp.name->value));
+			const auto folded = fold(*letexp.value);
+			if (symbol.has_value() && folded.has_value() &&
+					folded->type != ObjType::String)
+				global_constants_[symbol->index] = folded.value();
 		}
-		break;
 	}
-	case AstType::ArrayLiteral: {
-		try {
-			const auto &arrlit = dynamic_cast<const ArrayLiteral &>(node);
-			for (const auto &el : arrlit.elements) {
-				const auto status = compile(*el);
-				if (status.has_value())
-					return "error compiling array element";
-			}
-
-			emit(code::OpArray, {(int)arrlit.elements.size()});
-		} catch (std::bad_cast &e) {
-			return "could not cast array literal type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
+
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+Compiler::compile_typed(const ExpressionStatement &stmt) {
+	auto err = compile_node(*stmt.expression);
+	if (err.has_value())
+		return err;
+
+	emit(code::OpPop);
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+Compiler::compile_typed(const InfixExpression &infx_exp) {
+	if (infx_exp.opr == "<") {
+		// this is the same as the code below, but it adds the infix expressions
+		// in a different order such that we only need one type of greater than
+		// opcode.
+		auto err = compile_node(*infx_exp.right);
+		if (err.has_value())
+			return err;
+
+		err = compile_node(*infx_exp.left);
+		if (err.has_value())
+			return err;
+
+		emit(code::OpGreaterThan);
+		return std::nullopt;
 	}
-	case AstType::HashLiteral: {
-		try {
-			const auto &hash_lit = dynamic_cast<const HashLiteral &>(node);
-
-			// TODO: probably sort the elements or maybe not it works either way
-			for (auto const &pr : hash_lit.pairs) {
-				auto status = compile(*pr.first);
-				if (status.has_value())
-					return "error compiling first part of hash pair";
-
-				status = compile(*pr.second);
-				if (status.has_value())
-					return "error compiling second part of hash pair";
-			}
-
-			emit(code::OpHash, {(int)hash_lit.pairs.size() * 2});
-		} catch (std::bad_cast &e) {
-			return "could not cast hash literal type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
+
+	auto err = compile_node(*infx_exp.left);
+	if (err.has_value())
+		return err;
+
+	err = compile_node(*infx_exp.right);
+	if (err.has_value())
+		return err;
+
+	const auto &opr = infx_exp.opr;
+	if (opr == "+")
+		emit(code::OpAdd);
+	else if (opr == "-")
+		emit(code::OpSub);
+	else if (opr == "*")
+		emit(code::OpMul);
+	else if (opr == "/")
+		emit(code::OpDiv);
+	else if (opr == ">")
+		emit(code::OpGreaterThan);
+	else if (opr == "==")
+		emit(code::OpEqual);
+	else if (opr == "!=")
+		emit(code::OpNotEqual);
+	else
+		return CompileError{CompileErrorCode::UnknownInfixOperator, opr};
+
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const IntegerLiteral &intl) {
+	emit(code::OpConstant, {add_integer_constant(intl.value)});
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+Compiler::compile_typed(const BooleanExpression &booll) {
+	emit(booll.value ? code::OpTrue : code::OpFalse);
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+Compiler::compile_typed(const PrefixExpression &prex) {
+	auto err = compile_node(*prex.right);
+	if (err.has_value())
+		return err;
+
+	if (prex.opr == "!")
+		emit(code::OpBang);
+	else if (prex.opr == "-")
+		emit(code::OpMinus);
+	else
+		return CompileError{CompileErrorCode::UnknownPrefixOperator, prex.opr};
+
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const IfExpression &ifx) {
+	auto err = compile_node(*ifx.cond);
+	if (err.has_value())
+		return err;
+
+	const auto jump_not_truthy_pos = emit(code::OpJumpNotTruthy, {9999});
+
+	err = compile_branch(*ifx.after);
+	if (err.has_value())
+		return err;
+
+	const auto jump_pos = emit(code::OpJump, {9999});
+	const auto after_conq_pos = scoped_inst().size();
+	change_operand(jump_not_truthy_pos, after_conq_pos);
+
+	if (ifx.other == nullptr) {
+		emit(code::OpNull);
+	} else {
+		err = compile_branch(*ifx.other);
+		if (err.has_value())
+			return err;
 	}
-	case AstType::IndexExpression: {
-		try {
-			const auto &index_expression =
-					dynamic_cast<const IndexExpression &>(node);
-			auto status = compile(*index_expression.left);
-			if (status.has_value())
-				return "error compiling index expression left side";
-
-			status = compile(*index_expression.index);
-			if (status.has_value())
-				return "error compiling index expression index";
-			emit(code::OpIndex);
-		} catch (std::bad_cast &e) {
-			return "could not cast index expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
+	const auto after_other_pos = scoped_inst().size();
+	change_operand(jump_pos, after_other_pos);
+
+	return std::nullopt;
+}
+
+// compile_branch compiles a branch of an if expression so that it leaves
+// exactly one value on the stack, like the expression does. A block that
+// doesn't end in an expression, like an empty one or one ending in a let,
+// leaves null.
+std::optional<CompileError> Compiler::compile_branch(const BlockStatement &block) {
+	const auto start = scoped_inst().size();
+	auto err = compile_node(block);
+	if (err.has_value())
+		return err;
+
+	if (scoped_inst().size() > start && last_instruction_is(code::OpPop))
+		remove_last_pop();
+	else if (scoped_inst().size() == start ||
+					 !last_instruction_is(code::OpReturnValue))
+		emit(code::OpNull);
+
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const BlockStatement &block) {
+	for (auto &st : block.statements) {
+		const auto err = compile_node(*st);
+		if (err.has_value())
+			return err;
 	}
-	case AstType::FunctionLiteral: {
-		try {
-			enter_scope();
-			const auto &func = dynamic_cast<const FunctionLiteral &>(node);
-			for (const auto &pr : func.params)
-				symbol_table_->define(pr->value);
 
-			auto status = compile(*func.body);
-			if (status.has_value())
-				return "error compiling function body";
+	return std::nullopt;
+}
 
-			if (last_instruction_is(code::OpPop))
-				replace_last_pop_with_return();
+std::optional<CompileError> Compiler::compile_typed(const LetStatement &letexp) {
+	const auto &symbol =
+			symbol_table_->define(std::string(letexp.name->value));
 
-			if (!last_instruction_is(code::OpReturnValue))
-				emit(code::OpReturn);
+	const auto err = compile_node(*letexp.value);
+	if (err.has_value())
+		return err;
 
-			const auto num_locals = symbol_table_->definition_num_;
-			const auto &free_symbols = symbol_table_->free_symbols_;
-			auto instructions = leave_scope();
+	if (symbol.scope == scopes::GlobalScope)
+		emit(code::OpSetGlobal, {symbol.index});
+	else
+		emit(code::OpSetLocal, {symbol.index});
 
-			for (const auto &sym : free_symbols)
-				load_symbol(sym);
+	return std::nullopt;
+}
 
-			auto compiled_function = new CompiledFunction(instructions, num_locals);
-			compiled_function->m_num_parameters = func.params.size();
+std::optional<CompileError>
+Compiler::compile_typed(const Identifier &identifier) {
+	auto symbol = symbol_table_->resolve(std::string(identifier.value));
+	if (!symbol.has_value())
+		return CompileError{CompileErrorCode::UndefinedSymbol, identifier.value};
 
-			auto fn_index = add_constant(compiled_function);
+	load_symbol(symbol.value());
+	return std::nullopt;
+}
 
-			emit(code::OpClosure, {fn_index, (int)free_symbols.size()});
-		} catch (std::bad_cast &e) {
-			return "could not cast index expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
-	}
-	case AstType::ReturnStatement: {
-		try {
-			const auto &ret = dynamic_cast<const ReturnStatement &>(node);
-			const auto status = compile(*ret.return_value);
-			if (status.has_value())
-				return "error compiling return value";
-			emit(code::OpReturnValue);
-		} catch (std::bad_cast &e) {
-			return "could not cast return statement type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
+std::optional<CompileError> Compiler::compile_typed(const StringLiteral &strl) {
+	emit(code::OpConstant, {add_string_constant(strl.TokenLiteral())});
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const ArrayLiteral &arrlit) {
+	for (const auto &el : arrlit.elements) {
+		const auto err = compile_node(*el);
+		if (err.has_value())
+			return err;
 	}
-	case AstType::CallExpression: {
-		try {
-			const auto &call_exp = dynamic_cast<const CallExpression &>(node);
-			auto status = compile(*call_exp.func);
-			if (status.has_value())
-				return "error compiling call function";
-
-			for (const auto &arg : call_exp.arguments) {
-				status = compile(*arg);
-				if (status.has_value())
-					return "error compiling call argument";
-			}
-
-			emit(code::OpCall, {(int)call_exp.arguments.size()});
-		} catch (std::bad_cast &e) {
-			return "could not cast index expression type to node reference. " +
-						 std::string(e.what());
-		}
-		break;
+
+	emit(code::OpArray, {(int)arrlit.elements.size()});
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const HashLiteral &hash_lit) {
+	// TODO: probably sort the elements or maybe not it works either way
+	for (auto const &pr : hash_lit.pairs) {
+		auto err = compile_node(*pr.first);
+		if (err.has_value())
+			return err;
+
+		err = compile_node(*pr.second);
+		if (err.has_value())
+			return err;
 	}
+
+	emit(code::OpHash, {(int)hash_lit.pairs.size() * 2});
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+Compiler::compile_typed(const IndexExpression &index_exp) {
+	auto err = compile_node(*index_exp.left);
+	if (err.has_value())
+		return err;
+
+	err = compile_node(*index_exp.index);
+	if (err.has_value())
+		return err;
+
+	emit(code::OpIndex);
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const FunctionLiteral &func) {
+	enter_scope();
+	for (const auto &pr : func.params)
+		symbol_table_->define(std::string(pr->value));
+
+	auto err = compile_node(*func.body);
+	if (err.has_value())
+		return err;
+
+	if (last_instruction_is(code::OpPop))
+		replace_last_pop_with_return();
+
+	if (!last_instruction_is(code::OpReturnValue))
+		emit(code::OpReturn);
+
+	const auto num_locals = symbol_table_->definition_num_;
+	const auto &free_symbols = symbol_table_->free_symbols_;
+	auto instructions = leave_scope();
+
+	for (const auto &sym : free_symbols)
+		load_symbol(sym);
+
+	auto compiled_function = new CompiledFunction(instructions, num_locals);
+	compiled_function->m_num_parameters = func.params.size();
+
+	auto fn_index = add_constant(compiled_function);
+
+	emit(code::OpClosure, {fn_index, (int)free_symbols.size()});
+	return std::nullopt;
+}
+
+std::optional<CompileError> Compiler::compile_typed(const ReturnStatement &ret) {
+	const auto err = compile_node(*ret.return_value);
+	if (err.has_value())
+		return err;
+
+	emit(code::OpReturnValue);
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+Compiler::compile_typed(const CallExpression &call_exp) {
+	auto err = compile_node(*call_exp.func);
+	if (err.has_value())
+		return err;
+
+	for (const auto &arg : call_exp.arguments) {
+		err = compile_node(*arg);
+		if (err.has_value())
+			return err;
 	}
 
+	emit(code::OpCall, {(int)call_exp.arguments.size()});
 	return std::nullopt;
 }
 
@@ -381,6 +367,28 @@ int Compiler::add_constant(Object *obj) {
 	return (int)constants_.size() - 1;
 }
 
+// the constant pool is shared by every scope, so nested functions reuse the
+// constants of the enclosing code.
+int Compiler::add_integer_constant(int value) {
+	const auto iter = integer_constants_.find(value);
+	if (iter != integer_constants_.end())
+		return iter->second;
+
+	const auto index = add_constant(new Integer(value));
+	integer_constants_[value] = index;
+	return index;
+}
+
+int Compiler::add_string_constant(const std::string &value) {
+	const auto iter = string_constants_.find(value);
+	if (iter != string_constants_.end())
+		return iter->second;
+
+	const auto index = add_constant(new String(value));
+	string_constants_[value] = index;
+	return index;
+}
+
 int Compiler::emit(code::Opcode op, std::vector<int> operands) {
 	auto inst = code::make(op, operands);
 	auto pos = add_instruction(inst);
@@ -397,12 +405,10 @@ int Compiler::emit(code::Opcode op) {
 	return pos;
 }
 
-int Compiler::add_instruction(std::vector<char> inst) {
-	auto cur_inst = current_instructions();
-	auto pos_new_instruction = cur_inst.size();
-	cur_inst.insert(cur_inst.end(), inst.begin(), inst.end());
-
-	scopes_[scope_index_].instructions = cur_inst;
+int Compiler::add_instruction(const std::vector<char> &inst) {
+	auto &ins = scoped_inst();
+	auto pos_new_instruction = ins.size();
+	ins.insert(ins.end(), inst.begin(), inst.end());
 
 	return pos_new_instruction;
 }
@@ -419,15 +425,12 @@ void Compiler::remove_last_pop() {
 	auto last = scopes_[scope_index_].last_inst;
 	auto prev = scopes_[scope_index_].prev_inst;
 
-	auto old = current_instructions();
-	auto new_inst = code::Instructions(old.begin(), old.begin() + last.pos);
-
-	scopes_[scope_index_].instructions = new_inst;
+	scoped_inst().resize(last.pos);
 	scopes_[scope_index_].last_inst = prev;
 }
 
 void Compiler::change_operand(int op_pos, int operand) {
-	auto op = current_instructions()[op_pos];
+	auto op = scoped_inst()[op_pos];
 	auto new_inst = code::make(op, {operand});
 
 	replace_instructions(op_pos, new_inst);
@@ -502,10 +505,9 @@ void Compiler::enter_scope() {
 }
 
 code::Instructions Compiler::leave_scope() {
-	auto instructions = current_instructions();
+	auto instructions = std::move(scoped_inst());
 
-	scopes_ = std::vector<CompilationScope>(scopes_.begin(),
-																					scopes_.begin() + scopes_.size() - 1);
+	scopes_.pop_back();
 	--scope_index_;
 
 	symbol_table_ = symbol_table_->outer_;
@@ -546,3 +548,130 @@ const Symbol &SymbolTable::define_free(const Symbol &org) {
 
 	return *store_[org.name];
 }
+
+std::optional<ConstantValue> Compiler::fold(const Node &node) {
+	switch (node.Type()) {
+	case AstType::IntegerLiteral:
+		return ConstantValue{ObjType::Integer,
+												 static_cast<const IntegerLiteral &>(node).value};
+	case AstType::BooleanExpression:
+		return ConstantValue{ObjType::Boolean, 0,
+												 static_cast<const BooleanExpression &>(node).value};
+	case AstType::StringLiteral:
+		return ConstantValue{ObjType::String, 0, false, node.TokenLiteral()};
+	case AstType::Identifier: {
+		const auto &identifier = static_cast<const Identifier &>(node);
+		const auto symbol = symbol_table_->resolve(std::string(identifier.value));
+		if (!symbol.has_value() || symbol->scope != scopes::GlobalScope)
+			return std::nullopt;
+
+		const auto iter = global_constants_.find(symbol->index);
+		if (iter == global_constants_.end())
+			return std::nullopt;
+
+		return iter->second;
+	}
+	case AstType::PrefixExpression:
+	case AstType::InfixExpression:
+		break;
+	default:
+		return std::nullopt;
+	}
+
+	const auto known = folds_.find(&node);
+	if (known != folds_.end())
+		return known->second;
+
+	std::optional<ConstantValue> folded;
+	if (node.Type() == AstType::PrefixExpression) {
+		const auto &prex = static_cast<const PrefixExpression &>(node);
+		const auto right = fold(*prex.right);
+		if (right.has_value() && prex.opr == "!") {
+			// only false is falsy out of the values that can be folded.
+			const auto truthy = right->type != ObjType::Boolean || right->boolean;
+			folded = ConstantValue{ObjType::Boolean, 0, !truthy};
+		} else if (right.has_value() && prex.opr == "-" &&
+							 right->type == ObjType::Integer && right->integer != INT_MIN) {
+			folded = ConstantValue{ObjType::Integer, -right->integer};
+		}
+	} else {
+		const auto &infx_exp = static_cast<const InfixExpression &>(node);
+		const auto left = fold(*infx_exp.left);
+		const auto right =
+				left.has_value() ? fold(*infx_exp.right) : std::nullopt;
+		if (right.has_value())
+			folded = fold_infix(std::string(infx_exp.opr), left.value(),
+													right.value());
+	}
+
+	folds_.emplace(&node, folded);
+	return folded;
+}
+
+// fold_infix only folds what the vm would compute without an error, everything
+// else is left to fail at runtime like before.
+std::optional<ConstantValue>
+Compiler::fold_infix(const std::string &opr, const ConstantValue &left,
+										 const ConstantValue &right) {
+	if (left.type == ObjType::Integer && right.type == ObjType::Integer) {
+		const long long l = left.integer;
+		const long long r = right.integer;
+
+		long long res;
+		if (opr == "+")
+			res = l + r;
+		else if (opr == "-")
+			res = l - r;
+		else if (opr == "*")
+			res = l * r;
+		else if (opr == "/" && r != 0)
+			res = l / r;
+		else if (opr == ">")
+			return ConstantValue{ObjType::Boolean, 0, l > r};
+		else if (opr == "<")
+			return ConstantValue{ObjType::Boolean, 0, l < r};
+		else if (opr == "==")
+			return ConstantValue{ObjType::Boolean, 0, l == r};
+		else if (opr == "!=")
+			return ConstantValue{ObjType::Boolean, 0, l != r};
+		else
+			return std::nullopt;
+
+		if (res < INT_MIN || res > INT_MAX)
+			return std::nullopt;
+
+		return ConstantValue{ObjType::Integer, (int)res};
+	}
+
+	if (left.type == ObjType::Boolean && right.type == ObjType::Boolean) {
+		if (opr == "==")
+			return ConstantValue{ObjType::Boolean, 0, left.boolean == right.boolean};
+		else if (opr == "!=")
+			return ConstantValue{ObjType::Boolean, 0, left.boolean != right.boolean};
+	}
+
+	if (left.type == ObjType::String && right.type == ObjType::String) {
+		if (opr == "+")
+			return ConstantValue{ObjType::String, 0, false,
+													 left.string + right.string};
+		else if (opr == "==")
+			return ConstantValue{ObjType::Boolean, 0, left.string == right.string};
+		else if (opr == "!=")
+			return ConstantValue{ObjType::Boolean, 0, left.string != right.string};
+	}
+
+	// values of different types are never equal.
+	if (left.type != right.type && (opr == "==" || opr == "!="))
+		return ConstantValue{ObjType::Boolean, 0, opr == "!="};
+
+	return std::nullopt;
+}
+
+void Compiler::emit_constant_value(const ConstantValue &val) {
+	if (val.type == ObjType::Integer)
+		emit(code::OpConstant, {add_integer_constant(val.integer)});
+	else if (val.type == ObjType::Boolean)
+		emit(val.boolean ? code::OpTrue : code::OpFalse);
+	else if (val.type == ObjType::String)
+		emit(code::OpConstant, {add_string_constant(val.string)});
+}
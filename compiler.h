@@ -1,10 +1,13 @@
 #ifndef LUPS_COMPILER_H
 #define LUPS_COMPILER_H
 
+#include "ast.h"
 #include "builtins.h"
 #include "code.h"
 #include "object.h"
+#include <memory>
 #include <optional>
+#include <string_view>
 #include <unordered_map>
 
 typedef std::string SymbolScope;
@@ -19,6 +22,17 @@ static const SymbolScope FreeScope = "FREE";
 struct Bytecode {
 	code::Instructions instructions;
 	std::vector<Object *> constants;
+
+	// set for bytecode loaded from a .lpsc file. The main program and the
+	// functions run from the file's mapping, which image keeps alive, and
+	// mapped_main is the main program in it, already ended by an OpHalt.
+	std::shared_ptr<void> image;
+	char *mapped_main = nullptr;
+	int mapped_main_size = 0;
+
+	// set by verifier::verify, the vm runs verified code without checking the
+	// stack on every push.
+	int main_max_stack = -1;
 };
 
 struct EmittedInstruction {
@@ -32,6 +46,34 @@ struct CompilationScope {
 	EmittedInstruction prev_inst;
 };
 
+// ConstantValue is the value of an expression that is known at compile time.
+struct ConstantValue {
+	ObjType type;
+	int integer;
+	bool boolean;
+	std::string string;
+};
+
+// CompileErrorCode is why compiling a program failed.
+enum class CompileErrorCode {
+	UndefinedSymbol,
+	UnknownInfixOperator,
+	UnknownPrefixOperator,
+	// the program needs more registers, constants or instructions than the
+	// operands of the register vm can address.
+	RegisterLimit,
+};
+
+// CompileError is what the compiler passes back up the tree when it fails, its
+// message is only rendered once the error reaches compile. detail is a view
+// into the program, like the name of the undefined symbol.
+struct CompileError {
+	CompileErrorCode code;
+	std::string_view detail;
+
+	std::string message() const;
+};
+
 struct Symbol {
 	std::string name;
 	SymbolScope scope;
@@ -67,17 +109,28 @@ public:
 
 class Compiler {
 public:
-	Compiler();
+	// with an optimization level above 0 expressions over literals are folded
+	// and top level let bindings of integers and booleans are propagated.
+	Compiler(int opt_level = 0);
 
 	// The main compiling function. It returns an optional string containing an
 	// error. so if compilation was successful then compile(node).has_value() ==
 	// false
 	std::optional<std::string> compile(const Node &node);
 
+	// compile_node is compile with the error left unrendered, its detail points
+	// into the node so it is only valid while the program is.
+	std::optional<CompileError> compile_node(const Node &node);
+
 	int add_constant(Object *obj);
+
+	// integer and string constants are interned, every occurrence of the same
+	// value shares one index in the constant pool.
+	int add_integer_constant(int value);
+	int add_string_constant(const std::string &value);
 	int emit(code::Opcode op, std::vector<int> operands);
 	int emit(code::Opcode op);
-	int add_instruction(std::vector<char> inst);
+	int add_instruction(const std::vector<char> &inst);
 	void set_last_instruction(code::Opcode, int pos);
 	bool last_instruction_is(const code::Opcode &op);
 	void remove_last_pop();
@@ -96,6 +149,13 @@ public:
 
 	void load_symbol(const Symbol &m);
 
+	// constant folding
+	std::optional<ConstantValue> fold(const Node &node);
+	std::optional<ConstantValue> fold_infix(const std::string &opr,
+																					const ConstantValue &left,
+																					const ConstantValue &right);
+	void emit_constant_value(const ConstantValue &val);
+
 	void enter_scope();
 	code::Instructions leave_scope();
 
@@ -104,11 +164,46 @@ public:
 	SymbolTable *symbol_table_;
 
 private:
+	// one handler per node type, compile_node picks the one to run from the
+	// node's AstType.
+	std::optional<CompileError> compile_typed(const Program &prg);
+	std::optional<CompileError> compile_typed(const ExpressionStatement &stmt);
+	std::optional<CompileError> compile_typed(const InfixExpression &infx_exp);
+	std::optional<CompileError> compile_typed(const IntegerLiteral &intl);
+	std::optional<CompileError> compile_typed(const BooleanExpression &booll);
+	std::optional<CompileError> compile_typed(const PrefixExpression &prex);
+	std::optional<CompileError> compile_typed(const IfExpression &ifx);
+	std::optional<CompileError> compile_typed(const BlockStatement &block);
+	std::optional<CompileError> compile_typed(const LetStatement &letexp);
+	std::optional<CompileError> compile_typed(const Identifier &identifier);
+	std::optional<CompileError> compile_typed(const StringLiteral &strl);
+	std::optional<CompileError> compile_typed(const ArrayLiteral &arrlit);
+	std::optional<CompileError> compile_typed(const HashLiteral &hash_lit);
+	std::optional<CompileError> compile_typed(const IndexExpression &index_exp);
+	std::optional<CompileError> compile_typed(const FunctionLiteral &func);
+	std::optional<CompileError> compile_typed(const ReturnStatement &ret);
+	std::optional<CompileError> compile_typed(const CallExpression &call_exp);
+	std::optional<CompileError> compile_branch(const BlockStatement &block);
+
 	code::Instructions instructions_;
 	std::vector<Object *> constants_;
+	std::unordered_map<int, int> integer_constants_;
+	std::unordered_map<std::string, int> string_constants_;
 
 	EmittedInstruction *last_inst_;
 	EmittedInstruction *prev_inst_;
+
+	int opt_level_;
+
+	// the values of top level let bindings that are known at compile time, keyed
+	// by the global index. Every let gets its own slot, so they are never
+	// rebound.
+	std::unordered_map<int, ConstantValue> global_constants_;
+
+	// the folds of the prefix and infix expressions seen so far. compile_node
+	// folds an expression before it compiles its operands, which then reuse
+	// the folds of their own instead of walking the subtree again.
+	std::unordered_map<const Node *, std::optional<ConstantValue>> folds_;
 };
 
 #endif
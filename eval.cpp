@@ -25,6 +25,9 @@ Object *eval::len(std::vector<Object *> &objs) {
 		return new Error("wrong number of arguments. want 1");
 	}
 
+	// arrays as well, like the vm's len.
+	if (objs[0]->Type() == ObjType::Array)
+		return new Integer(((Array *)objs[0])->elements.size());
 	if (objs[0]->Type() != ObjType::String) {
 		return new Error("len function is not supported for type");
 	}
@@ -53,9 +56,9 @@ Object *eval::array_first(std::vector<Object *> &objs) {
 		return new Error("the argument must be of type array");
 	}
 
-	auto elements = ((Array *)objs[0])->elements;
-	if (elements.size() > 0) {
-		return elements[0];
+	const auto &elements = ((Array *)objs[0])->elements;
+	if (!elements.empty()) {
+		return elements.front();
 	}
 
 	return object_constant::null;
@@ -70,10 +73,9 @@ Object *eval::array_last(std::vector<Object *> &objs) {
 		return new Error("the argument must be of type array");
 	}
 
-	auto elements = ((Array *)objs[0])->elements;
-	auto size = elements.size();
-	if (size > 0) {
-		return elements[size - 1];
+	const auto &elements = ((Array *)objs[0])->elements;
+	if (!elements.empty()) {
+		return elements.back();
 	}
 
 	return object_constant::null;
@@ -89,10 +91,9 @@ Object *eval::array_tail(std::vector<Object *> &objs) {
 	}
 
 	auto elements = ((Array *)objs[0])->elements;
-	auto size = elements.size();
-	if (size > 0) {
-		std::vector<Object *> tailed_elements(elements.begin() + 1, elements.end());
-		return new Array(tailed_elements);
+	if (!elements.empty()) {
+		elements.drop_front();
+		return new Array(std::move(elements));
 	}
 
 	return object_constant::null;
@@ -107,12 +108,10 @@ Object *eval::array_push(std::vector<Object *> &objs) {
 		return new Error("the argument must be of type array");
 	}
 
-	auto array = (Array *)objs[0];
-	auto length = array->elements.size();
-	std::vector<Object *> new_elements = array->elements;
-	new_elements.push_back(objs[1]);
+	auto elements = ((Array *)objs[0])->elements;
+	elements.push_back(objs[1]);
 
-	return new Array(new_elements);
+	return new Array(std::move(elements));
 }
 
 std::unordered_map<std::string, Builtin *> builtin_functions = {
@@ -124,6 +123,18 @@ std::unordered_map<std::string, Builtin *> builtin_functions = {
 		{"push", new Builtin(*eval::array_push)},
 };
 
+Builtin *eval::find_builtin(const std::string &name) {
+	auto builtin = builtin_functions.find(name);
+	return builtin == builtin_functions.end() ? nullptr : builtin->second;
+}
+
+static eval::CallHandler call_handler;
+
+eval::CallHandler eval::set_call_handler(CallHandler handler) {
+	std::swap(call_handler, handler);
+	return handler;
+}
+
 Object *eval::Eval(Node *node, Environment *env) {
 	auto type = node->Type();
 	switch (type) {
@@ -148,14 +159,14 @@ Object *eval::Eval(Node *node, Environment *env) {
 	case AstType::PrefixExpression: {
 		auto pre = (PrefixExpression *)node;
 		auto right = Eval(pre->right.get(), env);
-		return eval::eval_prefix_expression(pre->opr, right);
+		return eval::eval_prefix_expression(std::string(pre->opr), right);
 	}
 	case AstType::InfixExpression: {
 		auto inf = (InfixExpression *)node;
 		auto right = eval::Eval(inf->right.get(), env);
 		auto left = eval::Eval(inf->left.get(), env);
 
-		return eval::eval_infix_exp(inf->opr, right, left);
+		return eval::eval_infix_exp(std::string(inf->opr), right, left);
 	}
 	case AstType::BlockStatement: {
 		return eval::eval_blockstatement(node, env);
@@ -168,7 +179,7 @@ Object *eval::Eval(Node *node, Environment *env) {
 		auto value = eval::Eval(((LetStatement *)node)->value.get(), env);
 		if (eval::is_error(value))
 			return value;
-		env->set(((LetStatement *)node)->name->value, value);
+		env->set(std::string(((LetStatement *)node)->name->value), value);
 		break;
 	}
 	case AstType::ReturnStatement: {
@@ -212,7 +223,7 @@ Object *eval::Eval(Node *node, Environment *env) {
 }
 
 Object *eval::eval_statements(Node *program, Environment *env) {
-	Object *res;
+	Object *res = object_constant::null;
 	auto pg = dynamic_cast<Program *>(program);
 
 	for (auto &st : pg->statements) {
@@ -226,7 +237,9 @@ Object *eval::eval_statements(Node *program, Environment *env) {
 		}
 	}
 
-	return res;
+	// a let has no value, a program that ends with one is null like in the vm,
+	// and so is a block.
+	return res == nullptr ? object_constant::null : res;
 }
 
 Object *eval::eval_prefix_expression(std::string opr, Object *right) {
@@ -265,6 +278,9 @@ Object *eval::eval_infix_exp(std::string opr, Object *right, Object *left) {
 			right->Type() == ObjType::Integer)
 		return eval::eval_integer_infix(opr, right, left);
 	else if (left->Type() != right->Type()) {
+		// values of different types are never equal, like in the vm.
+		if (opr == "==" || opr == "!=")
+			return eval::boolean_to_object(opr == "!=");
 		return new Error("wrong types");
 	} else if (left->Type() == ObjType::String &&
 						 right->Type() == ObjType::String) {
@@ -331,7 +347,7 @@ Object *eval::eval_if_expression(IfExpression *ifexp, Environment *env) {
 }
 
 Object *eval::eval_blockstatement(Node *blockexp, Environment *env) {
-	Object *res;
+	Object *res = object_constant::null;
 	auto bckexp = dynamic_cast<BlockStatement *>(blockexp);
 
 	for (auto &st : bckexp->statements) {
@@ -344,16 +360,17 @@ Object *eval::eval_blockstatement(Node *blockexp, Environment *env) {
 		}
 	}
 
-	return res;
+	return res == nullptr ? object_constant::null : res;
 }
 
 Object *eval::eval_identifier(Node *ident, Environment *env) {
 	auto id = dynamic_cast<Identifier *>(ident);
 
-	auto value = env->get(id->value);
+	auto name = std::string(id->value);
+	auto value = env->get(name);
 	if (value->Type() == ObjType::Error &&
-			builtin_functions.find(id->value) != builtin_functions.end()) {
-		return builtin_functions[id->value];
+			builtin_functions.find(name) != builtin_functions.end()) {
+		return builtin_functions[name];
 	}
 
 	return value;
@@ -419,8 +436,14 @@ Object *eval::apply_function(Object *func, std::vector<Object *> &args) {
 	if (func->Type() != ObjType::Function)
 		return new Error("not a function");
 
-	auto extended = eval::extend_function_env(func, args);
-	auto evaluated = eval::Eval(((Function *)func)->body, extended);
+	if (call_handler)
+		return call_handler((Function *)func, args);
+	return eval::call_function((Function *)func, args);
+}
+
+Object *eval::call_function(Function *fn, std::vector<Object *> &args) {
+	auto extended = eval::extend_function_env(fn, args);
+	auto evaluated = eval::Eval(fn->body, extended);
 
 	return eval::unwrap_return(evaluated);
 }
@@ -431,7 +454,7 @@ Environment *eval::extend_function_env(Object *func,
 	auto env = new Environment(fn->env);
 
 	for (int i = 0; i < fn->params.size(); ++i)
-		env->set(fn->params[i]->value, args[i]);
+		env->set(std::string(fn->params[i]->value), args[i]);
 
 	return env;
 }
@@ -444,12 +467,15 @@ Object *eval::unwrap_return(Object *obj) {
 
 Object *eval::eval_string_infix(const std::string &opr, Object *right,
 																Object *left) {
-	if (opr != "+") {
-		return new Error("unknown operation");
-	}
+	const auto &left_val = ((String *)left)->value;
+	const auto &right_val = ((String *)right)->value;
 
-	auto left_val = ((String *)left)->value;
-	auto right_val = ((String *)right)->value;
+	if (opr == "==")
+		return eval::boolean_to_object(left_val == right_val);
+	else if (opr == "!=")
+		return eval::boolean_to_object(left_val != right_val);
+	else if (opr != "+")
+		return new Error("unknown operation");
 
 	return new String(left_val + right_val);
 }
@@ -510,17 +536,7 @@ Object *eval::eval_hash_literal(Node *node, Environment *env) {
 		if (eval::is_error(value_object))
 			return value_object;
 
-		HashKey res;
-		// we only need to check these types since the previous if expressions
-		// guarantees that the object is one of them.
-		if (key_object->Type() == ObjType::Integer)
-			res = ((Integer *)key_object)->hash_key();
-		else if (key_object->Type() == ObjType::String)
-			res = ((String *)key_object)->hash_key();
-		else if (key_object->Type() == ObjType::Boolean)
-			res = ((Boolean *)key_object)->hash_key();
-
-		result_table->pairs[res.value] = new HashPair{key_object, value_object};
+		result_table->set(key_object, value_object);
 	}
 
 	return result_table;
@@ -539,20 +555,10 @@ Object *eval::eval_hash_index_expression(Object *left, Object *index,
 				index->Type() == ObjType::Boolean))
 		return new Error("unsuable as a hash key");
 
-	HashKey res;
-	// we only need to check these types since the previous if expressions
-	// guarantees that the object is one of them.
-	if (index->Type() == ObjType::Integer)
-		res = ((Integer *)index)->hash_key();
-	else if (index->Type() == ObjType::String)
-		res = ((String *)index)->hash_key();
-	else if (index->Type() == ObjType::Boolean)
-		res = ((Boolean *)index)->hash_key();
-
-	auto pr = hashtable->pairs[res.value];
-	if (pr == nullptr) {
+	auto value = hashtable->get(index);
+	if (value == nullptr) {
 		return object_constant::null;
 	}
 
-	return pr->value;
+	return value;
 }
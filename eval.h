@@ -3,6 +3,8 @@
 
 #include "ast.h"
 #include "object.h"
+#include <functional>
+#include <string>
 
 namespace object_constant {
 extern Null *null;
@@ -29,6 +31,7 @@ std::vector<Object *> eval_expressions(std::vector<Expression *> &exps,
 																			 Environment *env);
 Object *eval_call_expression(Node *node, Environment *env);
 Object *apply_function(Object *func, std::vector<Object *> &args);
+Object *call_function(Function *fn, std::vector<Object *> &args);
 Environment *extend_function_env(Object *func, std::vector<Object *> &args);
 Object *unwrap_return(Object *obj);
 Object *eval_string_infix(const std::string &opr, Object *right, Object *left);
@@ -45,6 +48,18 @@ Object *array_push(std::vector<Object *> &objs);
 Object *eval_hash_literal(Node *node, Environment *env);
 Object *eval_hash_index_expression(Object *left, Object *index,
 																	 Environment *env);
+
+// find_builtin returns the builtin a name refers to when nothing in the
+// environment shadows it, or nullptr.
+Builtin *find_builtin(const std::string &name);
+
+// CallHandler runs the calls of the functions a program defines in place of
+// call_function, the tiered runtime uses it to count them and to move hot
+// functions to the vm, see tier.h. set_call_handler returns the handler it
+// replaces, an empty handler lets call_function run every call.
+typedef std::function<Object *(Function *, std::vector<Object *> &)>
+		CallHandler;
+CallHandler set_call_handler(CallHandler handler);
 } // namespace eval
 
 #endif
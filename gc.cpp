@@ -0,0 +1,221 @@
+#include "gc.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+Heap::Heap(GCConfig config) {
+	config_ = config;
+	objects_ = nullptr;
+	num_objects_ = 0;
+	next_collection_ = config.initial_threshold;
+
+	const auto words = config.nursery_size / sizeof(std::max_align_t);
+	nursery_ = std::make_unique<std::max_align_t[]>(words);
+	nursery_top_ = (char *)nursery_.get();
+	nursery_end_ = nursery_top_ + words * sizeof(std::max_align_t);
+	nursery_full_ = false;
+
+	marking_ = false;
+	epoch_ = 0;
+}
+
+Heap::~Heap() {
+	for (auto obj : young_)
+		obj->~Object();
+
+	auto obj = objects_;
+	while (obj != nullptr) {
+		auto next = obj->gc_next_;
+		delete obj;
+		obj = next;
+	}
+}
+
+void Heap::collect(const std::function<void(Heap &)> &visit_roots) {
+	minor_collect(visit_roots);
+
+	if (num_objects_ >= next_collection_)
+		major_collect(visit_roots);
+}
+
+void Heap::minor_collect(const std::function<void(Heap &)> &visit_roots) {
+	const auto start = std::chrono::steady_clock::now();
+	const auto promoted_before = stats_.promoted;
+
+	visit_roots(*this);
+	for (auto obj : remembered_) {
+		obj->gc_remembered_ = false;
+		trace(obj);
+	}
+	remembered_.clear();
+	drain_gray();
+
+	// everything that survived has been moved out, so the leftovers only need
+	// their destructors to release the memory they own.
+	stats_.objects_freed += young_.size() - (stats_.promoted - promoted_before);
+	for (auto obj : young_)
+		obj->~Object();
+	young_.clear();
+
+	nursery_top_ = (char *)nursery_.get();
+	nursery_full_ = false;
+
+	const std::chrono::duration<double, std::milli> pause =
+			std::chrono::steady_clock::now() - start;
+	++stats_.minor_collections;
+	stats_.live_objects = num_objects_;
+	stats_.last_minor_pause_ms = pause.count();
+	stats_.max_minor_pause_ms = std::max(stats_.max_minor_pause_ms, pause.count());
+	stats_.total_minor_pause_ms += pause.count();
+}
+
+// major_collect runs right after a minor collection, so every live object is
+// in the old generation.
+void Heap::major_collect(const std::function<void(Heap &)> &visit_roots) {
+	const auto start = std::chrono::steady_clock::now();
+
+	++epoch_;
+	marking_ = true;
+	visit_roots(*this);
+	drain_gray();
+	marking_ = false;
+	sweep();
+
+	next_collection_ =
+			std::max(config_.initial_threshold,
+							 (std::size_t)((double)num_objects_ * config_.growth_factor));
+
+	const std::chrono::duration<double, std::milli> pause =
+			std::chrono::steady_clock::now() - start;
+	++stats_.collections;
+	stats_.live_objects = num_objects_;
+	stats_.last_pause_ms = pause.count();
+	stats_.max_pause_ms = std::max(stats_.max_pause_ms, pause.count());
+	stats_.total_pause_ms += pause.count();
+}
+
+// forward returns the old generation copy of a young object, copying it on the
+// first visit. The young object keeps the address of its copy in gc_next_.
+Object *Heap::forward(Object *obj) {
+	if (obj->gc_marked_)
+		return obj->gc_next_;
+
+	auto copy = relocate(obj);
+	copy->gc_state_ = GCState::Owned;
+	copy->gc_next_ = objects_;
+	objects_ = copy;
+	++num_objects_;
+	++stats_.promoted;
+
+	obj->gc_marked_ = true;
+	obj->gc_next_ = copy;
+	gray_.push_back(copy);
+
+	return copy;
+}
+
+// relocate moves the contents of a young object into a new heap allocated one.
+Object *Heap::relocate(Object *obj) {
+	switch (obj->Type()) {
+	case ObjType::Integer:
+		return new Integer(((Integer *)obj)->value);
+	case ObjType::String:
+		return new String(std::move(((String *)obj)->value));
+	case ObjType::Array:
+		return new Array(std::move(((Array *)obj)->elements));
+	case ObjType::IntArray: {
+		auto arr = (IntArray *)obj;
+		return new IntArray(std::move(arr->buffer), arr->start, arr->length);
+	}
+	case ObjType::Hash: {
+		auto hash = new Hash();
+		hash->swap(*(Hash *)obj);
+		return hash;
+	}
+	case ObjType::Closure: {
+		auto closure = new Closure(((Closure *)obj)->func_);
+		closure->free_.swap(((Closure *)obj)->free_);
+		return closure;
+	}
+	default:
+		assert(false && "object type can't be allocated in the nursery");
+		return obj;
+	}
+}
+
+// visit the objects directly referenced by obj.
+void Heap::trace(Object *obj) {
+	switch (obj->Type()) {
+	case ObjType::Array:
+		trace_node(((Array *)obj)->elements.root_);
+		trace_node(((Array *)obj)->elements.tail_);
+		break;
+	case ObjType::Hash:
+		for (auto &pr : ((Hash *)obj)->pairs) {
+			visit(pr.key);
+			visit(pr.value);
+		}
+		break;
+	case ObjType::Closure:
+		for (auto &val : ((Closure *)obj)->free_)
+			visit(val);
+		break;
+	default:
+		break;
+	}
+}
+
+// trace_node visits the objects in the nodes of an array. Arrays share nodes,
+// so a node is only traced once per collection: a minor collection skips the
+// nodes that haven't been written since the last one, they can't reference
+// young objects, and a major one the nodes it has already traced.
+//
+// A leaf is traced up to the slots any array has written, since the arrays
+// sharing a tail leaf may each have appended to it.
+void Heap::trace_node(PersistentVector::Node *node) {
+	if (node == nullptr)
+		return;
+
+	if (marking_) {
+		if (node->gc_epoch == epoch_)
+			return;
+		node->gc_epoch = epoch_;
+	} else {
+		if (!node->gc_young)
+			return;
+		node->gc_young = false;
+	}
+
+	if (node->leaf) {
+		for (int i = 0; i < node->filled; ++i)
+			visit(node->elements[i]);
+	} else {
+		for (auto child : node->children)
+			trace_node(child);
+	}
+}
+
+void Heap::drain_gray() {
+	while (!gray_.empty()) {
+		auto obj = gray_.back();
+		gray_.pop_back();
+		trace(obj);
+	}
+}
+
+void Heap::sweep() {
+	auto link = &objects_;
+	while (*link != nullptr) {
+		auto obj = *link;
+		if (obj->gc_marked_) {
+			obj->gc_marked_ = false;
+			link = &obj->gc_next_;
+			continue;
+		}
+
+		*link = obj->gc_next_;
+		delete obj;
+		--num_objects_;
+		++stats_.objects_freed;
+	}
+}
@@ -0,0 +1,204 @@
+#ifndef LUPS_GC_H
+#define LUPS_GC_H
+
+#include "object.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+struct GCConfig {
+	// the amount of old objects that triggers the first major collection.
+	std::size_t initial_threshold = 1 << 16;
+
+	// after a major collection the next one is triggered once the old
+	// generation has grown to this many times the amount of objects that
+	// survived.
+	double growth_factor = 2.0;
+
+	// the size of the young generation in bytes.
+	std::size_t nursery_size = 1 << 20;
+};
+
+struct GCStats {
+	// major collections of the old generation.
+	std::size_t collections = 0;
+	std::size_t objects_freed = 0;
+	std::size_t live_objects = 0;
+
+	double last_pause_ms = 0;
+	double max_pause_ms = 0;
+	double total_pause_ms = 0;
+
+	// minor collections of the nursery.
+	std::size_t minor_collections = 0;
+	std::size_t young_allocated = 0;
+	std::size_t promoted = 0;
+
+	double last_minor_pause_ms = 0;
+	double max_minor_pause_ms = 0;
+	double total_minor_pause_ms = 0;
+
+	// the fraction of nursery allocations that survived a minor collection.
+	double promotion_rate() const {
+		return young_allocated == 0 ? 0 : (double)promoted / young_allocated;
+	}
+};
+
+// Heap is a generational garbage collector for the objects the vm allocates.
+//
+// New objects are bump allocated in a fixed size nursery. A minor collection
+// copies the nursery objects that are reachable from the roots or from old
+// objects in the remembered set into the old generation and then resets the
+// nursery. The old generation is an intrusive list through Object::gc_next_
+// that is collected with mark and sweep.
+//
+// The owner of the heap supplies the roots when collecting. They are passed by
+// reference, since a minor collection moves objects and updates the slots that
+// pointed at them.
+class Heap {
+public:
+	Heap(GCConfig config = GCConfig());
+	~Heap();
+
+	Heap(const Heap &) = delete;
+	Heap &operator=(const Heap &) = delete;
+
+	// allocate constructs a young object in the nursery. If the nursery is full
+	// the object goes straight to the old generation and a collection is
+	// requested at the next safe point. Only the types handled by relocate can
+	// be allocated here.
+	template <typename T, typename... Args> T *allocate(Args &&...args) {
+		constexpr auto size = (sizeof(T) + alignof(std::max_align_t) - 1) &
+													~(alignof(std::max_align_t) - 1);
+		if (nursery_top_ + size > nursery_end_) {
+			nursery_full_ = true;
+			auto obj = new T(std::forward<Args>(args)...);
+			adopt(obj);
+			return obj;
+		}
+
+		auto obj = new (nursery_top_) T(std::forward<Args>(args)...);
+		nursery_top_ += size;
+		obj->gc_state_ = GCState::Young;
+		young_.push_back(obj);
+		++stats_.young_allocated;
+
+		return obj;
+	}
+
+	// adopt moves an object allocated elsewhere, for example by a builtin, into
+	// the old generation. Objects that are already owned or pinned are left
+	// alone, so it is safe to call on any object.
+	Object *adopt(Object *obj) {
+		if (obj == nullptr || obj->gc_state_ != GCState::Untracked)
+			return obj;
+
+		obj->gc_state_ = GCState::Owned;
+		obj->gc_next_ = objects_;
+		objects_ = obj;
+		++num_objects_;
+
+		// the object was filled before we saw it, so it may reference young
+		// objects.
+		write_barrier(obj);
+
+		return obj;
+	}
+
+	// pin marks an object that is owned elsewhere, such that it is never
+	// adopted or freed by the heap.
+	void pin(Object *obj) {
+		if (obj != nullptr && obj->gc_state_ == GCState::Untracked)
+			obj->gc_state_ = GCState::Pinned;
+	}
+
+	// write_barrier has to be called after storing references into an object,
+	// old objects are remembered so their references to young objects are
+	// treated as roots by the next minor collection.
+	void write_barrier(Object *owner) {
+		if (owner->gc_state_ == GCState::Owned && !owner->gc_remembered_) {
+			owner->gc_remembered_ = true;
+			remembered_.push_back(owner);
+		}
+	}
+
+	bool should_collect() const {
+		return nursery_full_ || num_objects_ >= next_collection_;
+	}
+
+	void visit(Value &val) {
+		if (val.is_object()) {
+			auto obj = val.as_object();
+			visit(obj);
+			val = Value::object(obj);
+		}
+	}
+
+	void visit(Object *&obj) {
+		if (obj == nullptr)
+			return;
+
+		if (obj->gc_state_ == GCState::Young) {
+			obj = forward(obj);
+		} else if (marking_ && obj->gc_state_ == GCState::Owned &&
+							 !obj->gc_marked_) {
+			obj->gc_marked_ = true;
+			gray_.push_back(obj);
+		}
+	}
+
+	template <typename T> void visit(T *&obj) {
+		Object *ptr = obj;
+		visit(ptr);
+		obj = (T *)ptr;
+	}
+
+	// collect does a minor collection and, when the old generation has grown
+	// past its threshold, a major one. visit_roots has to visit every root.
+	void collect(const std::function<void(Heap &)> &visit_roots);
+
+	const GCStats &stats() const { return stats_; }
+	std::size_t size() const { return num_objects_ + young_.size(); }
+
+private:
+	void minor_collect(const std::function<void(Heap &)> &visit_roots);
+	void major_collect(const std::function<void(Heap &)> &visit_roots);
+
+	Object *forward(Object *obj);
+	Object *relocate(Object *obj);
+	void trace(Object *obj);
+	void trace_node(PersistentVector::Node *node);
+	void drain_gray();
+	void sweep();
+
+	GCConfig config_;
+	GCStats stats_;
+
+	// old generation
+	Object *objects_;
+	std::size_t num_objects_;
+	std::size_t next_collection_;
+	std::vector<Object *> remembered_;
+
+	// young generation
+	std::unique_ptr<std::max_align_t[]> nursery_;
+	char *nursery_top_;
+	char *nursery_end_;
+	bool nursery_full_;
+	std::vector<Object *> young_;
+
+	// set during a major collection, old objects are only marked then.
+	bool marking_;
+
+	// counts the major collections, nodes of arrays remember the last one that
+	// traced them.
+	std::uint32_t epoch_;
+
+	// objects whose children haven't been visited yet.
+	std::vector<Object *> gray_;
+};
+
+#endif
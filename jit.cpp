@@ -0,0 +1,723 @@
+#include "jit.h"
+#include "builtins.h"
+#include "code.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LUPS_JIT
+#include <sys/mman.h>
+#endif
+
+bool jit::enabled() {
+#ifdef LUPS_JIT
+	return std::getenv("LUPS_NO_JIT") == nullptr;
+#else
+	return false;
+#endif
+}
+
+#ifdef LUPS_JIT
+namespace {
+enum Reg {
+	RAX = 0,
+	RCX = 1,
+	RDX = 2,
+	RBX = 3,
+	RSP = 4,
+	RBP = 5,
+	RSI = 6,
+	RDI = 7,
+	R8 = 8,
+	R12 = 12,
+	R13 = 13,
+	R14 = 14,
+	R15 = 15,
+};
+
+// the state of the machine code lives in callee saved registers, so it
+// survives the calls into the vm.
+constexpr Reg VMReg = RBX;
+constexpr Reg BaseReg = R12;
+constexpr Reg StackReg = R13;
+constexpr Reg ConstantsReg = R14;
+constexpr Reg GlobalsReg = R15;
+
+// the condition codes of jcc and setcc.
+enum Cond {
+	Equal = 0x4,
+	NotEqual = 0x5,
+	LessEqual = 0xe,
+	Greater = 0xf,
+};
+
+// the condition codes come in pairs that only differ in the lowest bit.
+Cond negate(Cond cond) { return (Cond)(cond ^ 1); }
+
+std::uint64_t bits(Value val) {
+	std::uint64_t out;
+	std::memcpy(&out, &val, sizeof(out));
+	return out;
+}
+
+bool fits_int8(int val) { return val >= -128 && val <= 127; }
+
+// Assembler encodes the few x86-64 instructions the templates are made of.
+// Operands are registers and [base + displacement] memory operands.
+class Assembler {
+public:
+	int size() const { return (int)bytes_.size(); }
+	const std::vector<std::uint8_t> &bytes() const { return bytes_; }
+
+	void load(Reg dst, Reg base, int disp) {
+		rex_w(dst, base);
+		byte(0x8b);
+		mem(dst, base, disp);
+	}
+	void store(Reg base, int disp, Reg src) {
+		rex_w(src, base);
+		byte(0x89);
+		mem(src, base, disp);
+	}
+	void store_imm(Reg base, int disp, std::int32_t imm) {
+		rex_w(RAX, base);
+		byte(0xc7);
+		mem(RAX, base, disp);
+		dword(imm);
+	}
+	void cmp_mem(Reg reg, Reg base, int disp) {
+		rex_w(reg, base);
+		byte(0x3b);
+		mem(reg, base, disp);
+	}
+
+	void mov(Reg dst, Reg src) { alu(0x89, dst, src); }
+	void mov_imm64(Reg dst, std::uint64_t imm) {
+		rex_w(RAX, dst);
+		byte(0xb8 + (dst & 7));
+		qword(imm);
+	}
+	// mov_imm32 sets the low half and clears the high half of the register.
+	void mov_imm32(Reg dst, std::int32_t imm) {
+		rex(RAX, dst);
+		byte(0xb8 + (dst & 7));
+		dword(imm);
+	}
+
+	void add_imm(Reg dst, std::int32_t imm) { alu_imm(0, dst, imm); }
+	void or_imm(Reg dst, std::int32_t imm) { alu_imm(1, dst, imm); }
+	void sub_imm(Reg dst, std::int32_t imm) { alu_imm(5, dst, imm); }
+	void cmp_imm(Reg dst, std::int32_t imm) { alu_imm(7, dst, imm); }
+
+	void add(Reg dst, Reg src) { alu(0x01, dst, src); }
+	void and_(Reg dst, Reg src) { alu(0x21, dst, src); }
+	void cmp(Reg dst, Reg src) { alu(0x39, dst, src); }
+	void test(Reg dst, Reg src) { alu(0x85, dst, src); }
+
+	// the 32 bit arithmetic wraps like the int arithmetic of the vm.
+	void add32(Reg dst, Reg src) { alu(0x01, dst, src, false); }
+	void sub32(Reg dst, Reg src) { alu(0x29, dst, src, false); }
+	void imul32(Reg dst, Reg src) {
+		rex(dst, src);
+		byte(0x0f);
+		byte(0xaf);
+		byte(0xc0 | (dst & 7) << 3 | (src & 7));
+	}
+	void neg32(Reg reg) {
+		rex(RAX, reg);
+		byte(0xf7);
+		byte(0xd8 | (reg & 7));
+	}
+	void movsxd(Reg dst, Reg src) {
+		rex_w(dst, src);
+		byte(0x63);
+		byte(0xc0 | (dst & 7) << 3 | (src & 7));
+	}
+	void sar1(Reg reg) {
+		rex_w(RAX, reg);
+		byte(0xd1);
+		byte(0xf8 | (reg & 7));
+	}
+	void shl(Reg reg, int amount) {
+		rex_w(RAX, reg);
+		byte(0xc1);
+		byte(0xe0 | (reg & 7));
+		byte(amount);
+	}
+
+	// the byte registers are only used for rax to rbx, which don't need a rex
+	// prefix.
+	void test_low_bit(Reg reg) {
+		byte(0xf6);
+		byte(0xc0 | reg);
+		byte(1);
+	}
+	void setcc(Cond cond, Reg reg) {
+		byte(0x0f);
+		byte(0x90 | cond);
+		byte(0xc0 | reg);
+	}
+	void movzx8(Reg dst, Reg src) {
+		byte(0x0f);
+		byte(0xb6);
+		byte(0xc0 | dst << 3 | src);
+	}
+
+	// the jumps take a 32 bit displacement that is patched once the target is
+	// known, they return the offset of the displacement.
+	int jcc(Cond cond) {
+		byte(0x0f);
+		byte(0x80 | cond);
+		dword(0);
+		return size() - 4;
+	}
+	int jmp() {
+		byte(0xe9);
+		dword(0);
+		return size() - 4;
+	}
+	void patch(int at, int target) {
+		const std::int32_t rel = target - (at + 4);
+		std::memcpy(&bytes_[at], &rel, sizeof(rel));
+	}
+
+	void call(Reg reg) {
+		rex(RAX, reg);
+		byte(0xff);
+		byte(0xd0 | (reg & 7));
+	}
+	void push(Reg reg) {
+		rex(RAX, reg);
+		byte(0x50 + (reg & 7));
+	}
+	void pop(Reg reg) {
+		rex(RAX, reg);
+		byte(0x58 + (reg & 7));
+	}
+	void ret() { byte(0xc3); }
+
+private:
+	void byte(int val) { bytes_.push_back((std::uint8_t)val); }
+	void dword(std::int32_t val) {
+		for (int i = 0; i < 4; ++i)
+			byte(val >> (8 * i));
+	}
+	void qword(std::uint64_t val) {
+		for (int i = 0; i < 8; ++i)
+			byte(val >> (8 * i));
+	}
+
+	// reg goes into the reg field of the modrm byte and rm into its rm field.
+	void rex_w(Reg reg, Reg rm) {
+		byte(0x48 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+	}
+	void rex(Reg reg, Reg rm) {
+		if (reg >= 8 || rm >= 8)
+			byte(0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+	}
+	void mem(Reg reg, Reg base, int disp) {
+		// rbp and r13 as a base always need a displacement, rsp and r12 need a
+		// sib byte.
+		const int mod =
+				disp == 0 && (base & 7) != RBP ? 0 : (fits_int8(disp) ? 1 : 2);
+		byte(mod << 6 | (reg & 7) << 3 | (base & 7));
+		if ((base & 7) == RSP)
+			byte(0x24);
+		if (mod == 1)
+			byte(disp);
+		else if (mod == 2)
+			dword(disp);
+	}
+	void alu(int opcode, Reg dst, Reg src, bool wide = true) {
+		if (wide)
+			rex_w(src, dst);
+		else
+			rex(src, dst);
+		byte(opcode);
+		byte(0xc0 | (src & 7) << 3 | (dst & 7));
+	}
+	void alu_imm(int ext, Reg dst, std::int32_t imm) {
+		rex_w(RAX, dst);
+		byte(fits_int8(imm) ? 0x83 : 0x81);
+		byte(0xc0 | ext << 3 | (dst & 7));
+		if (fits_int8(imm))
+			byte(imm);
+		else
+			dword(imm);
+	}
+
+	std::vector<std::uint8_t> bytes_;
+};
+
+// Translator emits the template of every instruction of a function in order.
+// The fast paths are inline, the calls into the vm for the operands they don't
+// handle are stubs after the function's code that jump back when done.
+class Translator {
+public:
+	Translator(CompiledFunction &fn, jit::SlowPath slow_path)
+			: fn_(fn), slow_path_(slow_path), labels_(fn.code_size() + 1, -1) {}
+
+	// translate returns false if the function has an instruction that can't be
+	// in a function.
+	bool translate();
+	const std::vector<std::uint8_t> &code() const { return a_.bytes(); }
+
+private:
+	void push(Reg reg) {
+		a_.store(StackReg, 0, reg);
+		a_.add_imm(StackReg, 8);
+	}
+	void push_imm(Value val) {
+		a_.store_imm(StackReg, 0, (std::int32_t)bits(val));
+		a_.add_imm(StackReg, 8);
+	}
+
+	// call_slow_path runs an instruction in the vm and leaves the function when
+	// it fails.
+	void call_slow_path(int op, int operand0 = 0, int operand1 = 0) {
+		a_.mov(RDI, VMReg);
+		a_.mov(RSI, StackReg);
+		a_.mov_imm32(RDX, op);
+		a_.mov_imm32(RCX, operand0);
+		a_.mov_imm32(R8, operand1);
+		a_.mov_imm64(RAX, (std::uint64_t)slow_path_);
+		a_.call(RAX);
+		a_.test(RAX, RAX);
+		exits_.push_back(a_.jcc(Equal));
+		a_.mov(StackReg, RAX);
+	}
+
+	// guard_integers jumps to a stub unless rax and rcx both hold integers.
+	int guard_integers() {
+		a_.mov(RDX, RAX);
+		a_.and_(RDX, RCX);
+		a_.test_low_bit(RDX);
+		return a_.jcc(Equal);
+	}
+
+	void box_integer() {
+		a_.movsxd(RAX, RAX);
+		a_.add(RAX, RAX);
+		a_.or_imm(RAX, 1);
+	}
+	void box_boolean(Cond cond) {
+		a_.setcc(cond, RAX);
+		a_.movzx8(RAX, RAX);
+		a_.shl(RAX, 3);
+		a_.add_imm(RAX, (std::int32_t)bits(Value::boolean(false)));
+	}
+
+	// null and false only differ in one bit, setting it makes both equal to
+	// false and leaves every truthy value different from false.
+	void compare_falsy(Reg reg) {
+		a_.or_imm(reg, (std::int32_t)(bits(Value::null()) ^
+																	 bits(Value::boolean(false))));
+		a_.cmp_imm(reg, (std::int32_t)bits(Value::boolean(false)));
+	}
+
+	void jump(int at, int target) { jumps_.push_back({at, target}); }
+	void stub(int from, std::function<void()> emit) {
+		stubs_.push_back({from, std::move(emit)});
+	}
+
+	// a comparison followed by a conditional jump that isn't a jump target
+	// jumps on the flags instead of pushing a boolean.
+	bool fuses_with_jump(int next) const {
+		return next < fn_.code_size() &&
+					 fn_.code()[next] == code::OpJumpNotTruthy && !targets_[next];
+	}
+
+	void arithmetic(code::Opcode op);
+	void comparison(code::Opcode op, int &next);
+
+	struct Stub {
+		int from;
+		std::function<void()> emit;
+	};
+
+	Assembler a_;
+	CompiledFunction &fn_;
+	jit::SlowPath slow_path_;
+
+	// the offset of the machine code of every instruction, by bytecode offset.
+	std::vector<int> labels_;
+	std::vector<bool> targets_;
+	// the jumps to patch, by bytecode offset of their target.
+	std::vector<std::pair<int, int>> jumps_;
+	// the jumps to the end of the function.
+	std::vector<int> exits_;
+	std::vector<Stub> stubs_;
+};
+
+code::Opcode generic_opcode(code::Opcode op) {
+	switch (op) {
+	case code::OpAddInt:
+	case code::OpAddString:
+	case code::OpAddPoly:
+		return code::OpAdd;
+	case code::OpSubInt:
+		return code::OpSub;
+	case code::OpMulInt:
+		return code::OpMul;
+	case code::OpGreaterThanInt:
+		return code::OpGreaterThan;
+	case code::OpEqualInt:
+	case code::OpEqualPoly:
+		return code::OpEqual;
+	case code::OpNotEqualInt:
+	case code::OpNotEqualPoly:
+		return code::OpNotEqual;
+	case code::OpIndexArray:
+	case code::OpIndexIntArray:
+	case code::OpIndexHash:
+	case code::OpIndexPoly:
+		return code::OpIndex;
+	default:
+		return op;
+	}
+}
+
+void Translator::arithmetic(code::Opcode op) {
+	a_.load(RAX, StackReg, -16);
+	a_.load(RCX, StackReg, -8);
+	const auto from = guard_integers();
+	a_.sar1(RAX);
+	a_.sar1(RCX);
+	if (op == code::OpAdd)
+		a_.add32(RAX, RCX);
+	else if (op == code::OpSub)
+		a_.sub32(RAX, RCX);
+	else
+		a_.imul32(RAX, RCX);
+	box_integer();
+	a_.sub_imm(StackReg, 8);
+	a_.store(StackReg, -8, RAX);
+
+	const auto resume = a_.size();
+	stub(from, [this, op, resume] {
+		call_slow_path(op);
+		a_.patch(a_.jmp(), resume);
+	});
+}
+
+// comparison inlines the comparison of two integers, other types go to the vm.
+void Translator::comparison(code::Opcode op, int &next) {
+	a_.load(RAX, StackReg, -16);
+	a_.load(RCX, StackReg, -8);
+	const auto from = guard_integers();
+
+	// tagged integers are ordered like the integers, and equal when their words
+	// are, see Value's operator==.
+	auto holds = Greater;
+	if (op == code::OpEqual)
+		holds = Equal;
+	else if (op == code::OpNotEqual)
+		holds = NotEqual;
+
+	if (fuses_with_jump(next)) {
+		const auto target = code::read_uint16(fn_.code() + next + 1);
+		next += 3;
+
+		a_.sub_imm(StackReg, 16);
+		a_.cmp(RAX, RCX);
+		jump(a_.jcc(negate(holds)), target);
+
+		const auto resume = a_.size();
+		stub(from, [this, op, target, resume] {
+			call_slow_path(op);
+			a_.sub_imm(StackReg, 8);
+			a_.load(RAX, StackReg, 0);
+			compare_falsy(RAX);
+			jump(a_.jcc(Equal), target);
+			a_.patch(a_.jmp(), resume);
+		});
+		return;
+	}
+
+	a_.cmp(RAX, RCX);
+	box_boolean(holds);
+	a_.sub_imm(StackReg, 8);
+	a_.store(StackReg, -8, RAX);
+
+	const auto resume = a_.size();
+	stub(from, [this, op, resume] {
+		call_slow_path(op);
+		a_.patch(a_.jmp(), resume);
+	});
+}
+
+bool Translator::translate() {
+	const auto ins = fn_.code();
+	const auto size = fn_.code_size();
+
+	// the jump targets, which can't be fused into the instruction before them.
+	targets_.assign(size + 1, false);
+	for (int ip = 0; ip < size;) {
+		const auto def = code::look_up(ins[ip]);
+		if (def == nullptr)
+			return false;
+
+		const auto [operands, read] = code::read_operands(def, ins + ip + 1);
+		if (ins[ip] == code::OpJump || ins[ip] == code::OpJumpNotTruthy)
+			targets_[operands[0]] = true;
+		else if (ins[ip] == code::OpJumpNotEqualLocalConst)
+			targets_[operands[2]] = true;
+		ip += 1 + read;
+	}
+
+	a_.push(RBX);
+	a_.push(R12);
+	a_.push(R13);
+	a_.push(R14);
+	a_.push(R15);
+	a_.mov(VMReg, RDI);
+	a_.mov(BaseReg, RSI);
+	a_.mov(ConstantsReg, RDX);
+	a_.mov(GlobalsReg, RCX);
+	a_.mov(StackReg, BaseReg);
+	a_.add_imm(StackReg, fn_.m_num_locals * 8);
+
+	for (int ip = 0; ip < size;) {
+		labels_[ip] = a_.size();
+
+		const auto op = generic_opcode(ins[ip]);
+		const auto [operands, read] =
+				code::read_operands(code::look_up(ins[ip]), ins + ip + 1);
+		auto next = ip + 1 + read;
+
+		switch (op) {
+		case code::OpConstant:
+			a_.load(RAX, ConstantsReg, operands[0] * 8);
+			push(RAX);
+			break;
+		case code::OpTrue:
+			push_imm(Value::boolean(true));
+			break;
+		case code::OpFalse:
+			push_imm(Value::boolean(false));
+			break;
+		case code::OpNull:
+			push_imm(Value::null());
+			break;
+		case code::OpPop:
+			a_.sub_imm(StackReg, 8);
+			break;
+		case code::OpGetLocal:
+			a_.load(RAX, BaseReg, operands[0] * 8);
+			push(RAX);
+			break;
+		case code::OpSetLocal:
+			a_.sub_imm(StackReg, 8);
+			a_.load(RAX, StackReg, 0);
+			a_.store(BaseReg, operands[0] * 8, RAX);
+			break;
+		case code::OpTeeLocal:
+			a_.load(RAX, StackReg, -8);
+			a_.store(BaseReg, operands[0] * 8, RAX);
+			break;
+		case code::OpGetGlobal:
+			a_.load(RAX, GlobalsReg, operands[0] * 8);
+			push(RAX);
+			break;
+		case code::OpSetGlobal:
+			a_.sub_imm(StackReg, 8);
+			a_.load(RAX, StackReg, 0);
+			a_.store(GlobalsReg, operands[0] * 8, RAX);
+			break;
+		case code::OpTeeGlobal:
+			a_.load(RAX, StackReg, -8);
+			a_.store(GlobalsReg, operands[0] * 8, RAX);
+			break;
+		case code::OpGetBuiltin:
+			// the builtins are pinned, so their addresses never change.
+			a_.mov_imm64(
+					RAX,
+					bits(Value::object(builtin_functions::functions[operands[0]].second)));
+			push(RAX);
+			break;
+		case code::OpJump:
+			jump(a_.jmp(), operands[0]);
+			break;
+		case code::OpJumpNotTruthy:
+			a_.sub_imm(StackReg, 8);
+			a_.load(RAX, StackReg, 0);
+			compare_falsy(RAX);
+			jump(a_.jcc(Equal), operands[0]);
+			break;
+		case code::OpAdd:
+		case code::OpSub:
+		case code::OpMul:
+			// strings go straight to the vm once the instruction was quickened for
+			// them.
+			if (ins[ip] == code::OpAddString || ins[ip] == code::OpAddPoly)
+				call_slow_path(code::OpAdd);
+			else
+				arithmetic(op);
+			break;
+		case code::OpDiv:
+			call_slow_path(op);
+			break;
+		case code::OpEqual:
+		case code::OpNotEqual:
+		case code::OpGreaterThan:
+			comparison(op, next);
+			break;
+		case code::OpMinus: {
+			a_.load(RAX, StackReg, -8);
+			a_.test_low_bit(RAX);
+			const auto from = a_.jcc(Equal);
+			a_.sar1(RAX);
+			a_.neg32(RAX);
+			box_integer();
+			a_.store(StackReg, -8, RAX);
+
+			const auto resume = a_.size();
+			stub(from, [this, resume] {
+				call_slow_path(code::OpMinus);
+				a_.patch(a_.jmp(), resume);
+			});
+			break;
+		}
+		case code::OpBang:
+			a_.load(RAX, StackReg, -8);
+			compare_falsy(RAX);
+			box_boolean(Equal);
+			a_.store(StackReg, -8, RAX);
+			break;
+		case code::OpSubLocalConst: {
+			a_.load(RAX, BaseReg, operands[0] * 8);
+			a_.load(RCX, ConstantsReg, operands[1] * 8);
+			const auto from = guard_integers();
+			a_.sar1(RAX);
+			a_.sar1(RCX);
+			a_.sub32(RAX, RCX);
+			box_integer();
+			push(RAX);
+
+			const auto resume = a_.size();
+			stub(from, [this, resume] {
+				a_.store(StackReg, 0, RAX);
+				a_.store(StackReg, 8, RCX);
+				a_.add_imm(StackReg, 16);
+				call_slow_path(code::OpSub);
+				a_.patch(a_.jmp(), resume);
+			});
+			break;
+		}
+		case code::OpJumpNotEqualLocalConst: {
+			a_.load(RAX, BaseReg, operands[0] * 8);
+			a_.load(RCX, ConstantsReg, operands[1] * 8);
+			const auto from = guard_integers();
+			a_.cmp(RAX, RCX);
+			jump(a_.jcc(NotEqual), operands[2]);
+
+			const auto target = operands[2];
+			const auto resume = a_.size();
+			stub(from, [this, target, resume] {
+				a_.store(StackReg, 0, RAX);
+				a_.store(StackReg, 8, RCX);
+				a_.add_imm(StackReg, 16);
+				call_slow_path(code::OpEqual);
+				a_.sub_imm(StackReg, 8);
+				a_.load(RAX, StackReg, 0);
+				compare_falsy(RAX);
+				jump(a_.jcc(Equal), target);
+				a_.patch(a_.jmp(), resume);
+			});
+			break;
+		}
+		case code::OpCallGlobal:
+			// the callee goes below the arguments, like OpGetGlobal would have put it.
+			for (int i = 0; i < operands[1]; ++i) {
+				a_.load(RAX, StackReg, -8 * (i + 1));
+				a_.store(StackReg, -8 * i, RAX);
+			}
+			a_.load(RAX, GlobalsReg, operands[0] * 8);
+			a_.store(StackReg, -8 * operands[1], RAX);
+			a_.add_imm(StackReg, 8);
+			call_slow_path(code::OpCall, operands[1]);
+			break;
+		case code::OpIndex:
+		case code::OpIndexConst:
+		case code::OpArray:
+		case code::OpHash:
+		case code::OpClosure:
+		case code::OpGetFree:
+		case code::OpCall:
+			call_slow_path(op, operands.empty() ? 0 : operands[0],
+										 operands.size() < 2 ? 0 : operands[1]);
+			break;
+		case code::OpReturnValue:
+			a_.load(RAX, StackReg, -8);
+			a_.store(BaseReg, -8, RAX);
+			a_.mov(RAX, BaseReg);
+			exits_.push_back(a_.jmp());
+			break;
+		case code::OpReturn:
+			a_.store_imm(BaseReg, -8, (std::int32_t)bits(Value::null()));
+			a_.mov(RAX, BaseReg);
+			exits_.push_back(a_.jmp());
+			break;
+		default:
+			// OpHalt only ends the main program.
+			return false;
+		}
+
+		ip = next;
+	}
+
+	// the stubs can add jumps of their own.
+	for (std::size_t i = 0; i < stubs_.size(); ++i) {
+		a_.patch(stubs_[i].from, a_.size());
+		stubs_[i].emit();
+	}
+
+	for (const auto &[at, target] : jumps_) {
+		if (labels_[target] < 0)
+			return false;
+		a_.patch(at, labels_[target]);
+	}
+
+	// rax holds the stack pointer to return, or nullptr after an error.
+	for (const auto at : exits_)
+		a_.patch(at, a_.size());
+	a_.pop(R15);
+	a_.pop(R14);
+	a_.pop(R13);
+	a_.pop(R12);
+	a_.pop(RBX);
+	a_.ret();
+
+	return true;
+}
+} // namespace
+#endif
+
+std::shared_ptr<void> jit::compile(CompiledFunction &fn, SlowPath slow_path) {
+#ifdef LUPS_JIT
+	Translator translator(fn, slow_path);
+	if (!translator.translate())
+		return nullptr;
+
+	const auto &code = translator.code();
+	const auto size = code.size();
+	auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+									MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return nullptr;
+
+	// the code is never written again, so it doesn't stay writable.
+	std::memcpy(mem, code.data(), size);
+	if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, size);
+		return nullptr;
+	}
+
+	return std::shared_ptr<void>(mem, [size](void *mem) { munmap(mem, size); });
+#else
+	return nullptr;
+#endif
+}
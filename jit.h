@@ -0,0 +1,48 @@
+#ifndef LUPS_JIT_H
+#define LUPS_JIT_H
+
+#include "object.h"
+#include <memory>
+
+class VM;
+
+// The jit translates the bytecode of a hot function into x86-64 machine code,
+// one fixed template per instruction. The machine code works on the vm's
+// stack the way the dispatch loop does, with the stack pointer, the base
+// pointer, the constants and the globals kept in registers. Integer
+// arithmetic, comparisons, locals, globals, constants and jumps run inline,
+// everything else (calls, allocations, indexing and the operands that aren't
+// integers) calls back into the vm.
+//
+// Only verified functions are compiled, the machine code relies on the
+// verifier for its jump targets and on the headroom check of the call for
+// its pushes. It is only available on x86-64 linux, elsewhere compile always
+// fails and the vm keeps interpreting.
+namespace jit {
+// the amount of calls after which a function is compiled.
+static constexpr int CallThreshold = 1000;
+
+// enabled returns false on machines the jit doesn't support and when the
+// LUPS_NO_JIT environment variable is set.
+bool enabled();
+
+// SlowPath runs an instruction the machine code doesn't do inline. sp is the
+// stack pointer of the machine code, the instruction's operands are passed
+// unpacked. It returns the new stack pointer, or nullptr after an error that
+// ends the program.
+typedef Value *(*SlowPath)(VM *vm, Value *sp, int op, int operand0,
+													 int operand1);
+
+// Entry is the machine code of a function. base points at the function's
+// first local, the arguments are in place and the frame has been pushed. It
+// stores the returned value below base and returns base, or nullptr after an
+// error.
+typedef Value *(*Entry)(VM *vm, Value *base, Value *constants, Value *globals);
+
+// compile returns the machine code of fn, or nullptr if it can't be compiled.
+// The code only depends on the bytecode, so it can be shared by every vm
+// that runs the function.
+std::shared_ptr<void> compile(CompiledFunction &fn, SlowPath slow_path);
+} // namespace jit
+
+#endif
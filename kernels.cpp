@@ -0,0 +1,247 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+		(defined(__GNUC__) || defined(__clang__))
+#define LUPS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+// the scalar kernels compute with unsigned integers, which wrap around instead
+// of overflowing. The vectorized kernels use them for the values that don't
+// fill a whole vector.
+int sum_scalar(const int *values, std::size_t n) {
+	std::uint32_t sum = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		sum += (std::uint32_t)values[i];
+	return (int)sum;
+}
+
+int min_scalar(const int *values, std::size_t n) {
+	return *std::min_element(values, values + n);
+}
+
+int max_scalar(const int *values, std::size_t n) {
+	return *std::max_element(values, values + n);
+}
+
+int dot_scalar(const int *a, const int *b, std::size_t n) {
+	std::uint32_t sum = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		sum += (std::uint32_t)a[i] * (std::uint32_t)b[i];
+	return (int)sum;
+}
+
+void scale_scalar(const int *values, int factor, int *out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = (int)((std::uint32_t)values[i] * (std::uint32_t)factor);
+}
+
+void add_scalar(const int *a, const int *b, int *out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = (int)((std::uint32_t)a[i] + (std::uint32_t)b[i]);
+}
+
+#ifdef LUPS_X86_KERNELS
+// the kernels are compiled for their instruction set with the target
+// attribute, so the rest of the program still runs on any x86 cpu.
+#define LUPS_SSE41 __attribute__((target("sse4.1")))
+#define LUPS_AVX2 __attribute__((target("avx2")))
+
+template <int N>
+std::uint32_t lanes_sum(const std::uint32_t (&lanes)[N], std::uint32_t sum) {
+	for (auto lane : lanes)
+		sum += lane;
+	return sum;
+}
+
+LUPS_SSE41 int sum_sse41(const int *values, std::size_t n) {
+	auto acc = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i *)(values + i)));
+
+	std::uint32_t lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	return (int)lanes_sum(lanes, (std::uint32_t)sum_scalar(values + i, n - i));
+}
+
+LUPS_SSE41 int min_sse41(const int *values, std::size_t n) {
+	if (n < 4)
+		return min_scalar(values, n);
+
+	auto acc = _mm_loadu_si128((const __m128i *)values);
+	std::size_t i = 4;
+	for (; i + 4 <= n; i += 4)
+		acc = _mm_min_epi32(acc, _mm_loadu_si128((const __m128i *)(values + i)));
+
+	int lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	auto res = min_scalar(lanes, 4);
+	return i == n ? res : std::min(res, min_scalar(values + i, n - i));
+}
+
+LUPS_SSE41 int max_sse41(const int *values, std::size_t n) {
+	if (n < 4)
+		return max_scalar(values, n);
+
+	auto acc = _mm_loadu_si128((const __m128i *)values);
+	std::size_t i = 4;
+	for (; i + 4 <= n; i += 4)
+		acc = _mm_max_epi32(acc, _mm_loadu_si128((const __m128i *)(values + i)));
+
+	int lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	auto res = max_scalar(lanes, 4);
+	return i == n ? res : std::max(res, max_scalar(values + i, n - i));
+}
+
+LUPS_SSE41 int dot_sse41(const int *a, const int *b, std::size_t n) {
+	auto acc = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		acc = _mm_add_epi32(
+				acc, _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(a + i)),
+														 _mm_loadu_si128((const __m128i *)(b + i))));
+
+	std::uint32_t lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	return (int)lanes_sum(lanes, (std::uint32_t)dot_scalar(a + i, b + i, n - i));
+}
+
+LUPS_SSE41 void scale_sse41(const int *values, int factor, int *out,
+														std::size_t n) {
+	const auto f = _mm_set1_epi32(factor);
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128(
+				(__m128i *)(out + i),
+				_mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(values + i)), f));
+	scale_scalar(values + i, factor, out + i, n - i);
+}
+
+LUPS_SSE41 void add_sse41(const int *a, const int *b, int *out,
+													std::size_t n) {
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(out + i),
+										 _mm_add_epi32(_mm_loadu_si128((const __m128i *)(a + i)),
+																	 _mm_loadu_si128((const __m128i *)(b + i))));
+	add_scalar(a + i, b + i, out + i, n - i);
+}
+
+LUPS_AVX2 int sum_avx2(const int *values, std::size_t n) {
+	auto acc = _mm256_setzero_si256();
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_add_epi32(acc,
+													 _mm256_loadu_si256((const __m256i *)(values + i)));
+
+	std::uint32_t lanes[8];
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	return (int)lanes_sum(lanes, (std::uint32_t)sum_scalar(values + i, n - i));
+}
+
+LUPS_AVX2 int min_avx2(const int *values, std::size_t n) {
+	if (n < 8)
+		return min_scalar(values, n);
+
+	auto acc = _mm256_loadu_si256((const __m256i *)values);
+	std::size_t i = 8;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_min_epi32(acc,
+													 _mm256_loadu_si256((const __m256i *)(values + i)));
+
+	int lanes[8];
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	auto res = min_scalar(lanes, 8);
+	return i == n ? res : std::min(res, min_scalar(values + i, n - i));
+}
+
+LUPS_AVX2 int max_avx2(const int *values, std::size_t n) {
+	if (n < 8)
+		return max_scalar(values, n);
+
+	auto acc = _mm256_loadu_si256((const __m256i *)values);
+	std::size_t i = 8;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_max_epi32(acc,
+													 _mm256_loadu_si256((const __m256i *)(values + i)));
+
+	int lanes[8];
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	auto res = max_scalar(lanes, 8);
+	return i == n ? res : std::max(res, max_scalar(values + i, n - i));
+}
+
+LUPS_AVX2 int dot_avx2(const int *a, const int *b, std::size_t n) {
+	auto acc = _mm256_setzero_si256();
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_add_epi32(
+				acc,
+				_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(a + i)),
+													 _mm256_loadu_si256((const __m256i *)(b + i))));
+
+	std::uint32_t lanes[8];
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	return (int)lanes_sum(lanes, (std::uint32_t)dot_scalar(a + i, b + i, n - i));
+}
+
+LUPS_AVX2 void scale_avx2(const int *values, int factor, int *out,
+													std::size_t n) {
+	const auto f = _mm256_set1_epi32(factor);
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_si256(
+				(__m256i *)(out + i),
+				_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(values + i)),
+													 f));
+	scale_scalar(values + i, factor, out + i, n - i);
+}
+
+LUPS_AVX2 void add_avx2(const int *a, const int *b, int *out, std::size_t n) {
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_si256(
+				(__m256i *)(out + i),
+				_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(a + i)),
+												 _mm256_loadu_si256((const __m256i *)(b + i))));
+	add_scalar(a + i, b + i, out + i, n - i);
+}
+#endif
+} // namespace
+
+const kernels::Kernels &kernels::scalar() {
+	static const Kernels k{"scalar",		 sum_scalar,	 min_scalar, max_scalar,
+												 dot_scalar, scale_scalar, add_scalar};
+	return k;
+}
+
+const kernels::Kernels *kernels::sse41() {
+#ifdef LUPS_X86_KERNELS
+	static const Kernels k{"sse4.1",	sum_sse41,	 min_sse41, max_sse41,
+												 dot_sse41, scale_sse41, add_sse41};
+	if (__builtin_cpu_supports("sse4.1"))
+		return &k;
+#endif
+	return nullptr;
+}
+
+const kernels::Kernels *kernels::avx2() {
+#ifdef LUPS_X86_KERNELS
+	static const Kernels k{"avx2",		 sum_avx2,	 min_avx2, max_avx2,
+												 dot_avx2, scale_avx2, add_avx2};
+	if (__builtin_cpu_supports("avx2"))
+		return &k;
+#endif
+	return nullptr;
+}
+
+const kernels::Kernels &kernels::best() {
+	static const Kernels &k =
+			avx2() != nullptr ? *avx2() : sse41() != nullptr ? *sse41() : scalar();
+	return k;
+}
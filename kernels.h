@@ -0,0 +1,34 @@
+#ifndef LUPS_KERNELS_H
+#define LUPS_KERNELS_H
+
+#include <cstddef>
+
+// kernels are the loops behind the numeric builtins of integer arrays. There
+// is a portable implementation and vectorized ones for the instruction sets
+// the cpu supports, picked when the program runs. Integer arithmetic wraps
+// around on overflow in all of them, so they always agree.
+namespace kernels {
+struct Kernels {
+	const char *name;
+
+	int (*sum)(const int *values, std::size_t n);
+	// min and max need at least one value.
+	int (*min)(const int *values, std::size_t n);
+	int (*max)(const int *values, std::size_t n);
+	int (*dot)(const int *a, const int *b, std::size_t n);
+	void (*scale)(const int *values, int factor, int *out, std::size_t n);
+	void (*add)(const int *a, const int *b, int *out, std::size_t n);
+};
+
+const Kernels &scalar();
+
+// the vectorized implementations are nullptr when the cpu doesn't support
+// them.
+const Kernels *sse41();
+const Kernels *avx2();
+
+// best returns the fastest implementation the cpu supports.
+const Kernels &best();
+} // namespace kernels
+
+#endif
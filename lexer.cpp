@@ -2,8 +2,12 @@
 #include "token.h"
 #include <cctype>
 
-Lexer::Lexer(const std::string &input) {
-	input_ = input;
+Lexer::Lexer(const std::string &input)
+		: Lexer(std::make_shared<const std::string>(input)) {}
+
+Lexer::Lexer(std::shared_ptr<const std::string> source) {
+	source_ = std::move(source);
+	input_ = *source_;
 	read_pos_ = 0;
 	read_char();
 }
@@ -24,99 +28,93 @@ void Lexer::read_char() {
 	read_pos_++;
 }
 
-Token new_token(TokenType type, char ch) {
-	return Token{type, std::string(1, ch)};
-}
-
-TokenType lookup_ident(const std::string &str) {
-	auto keyword = tokentypes::KEYWORDS.find(str);
-	if (keyword == tokentypes::KEYWORDS.end())
-		return tokentypes::IDENT;
-	return keyword->second;
-}
-
 Token Lexer::next_token() {
 	Token tok;
 
+	// a single character token, the character is at pos_.
+	auto new_token = [this](TokenType type) {
+		return Token{type, input_.substr(pos_, 1)};
+	};
+
 	skip_whitespace();
 
 	switch (ch_) {
 	case '=':
 		if (peek_char() == '=') {
-			tok = Token{.type = tokentypes::EQ, .literal = "=="};
+			tok = Token{tokentypes::EQ, input_.substr(pos_, 2)};
 			read_char();
 		} else {
-			tok = new_token(tokentypes::ASSIGN, ch_);
+			tok = new_token(tokentypes::ASSIGN);
 		}
 		read_char();
 		break;
 	case ';':
-		tok = new_token(tokentypes::SEMICOLON, ch_);
+		tok = new_token(tokentypes::SEMICOLON);
 		read_char();
 		break;
 	case ':':
-		tok = new_token(tokentypes::COLON, ch_);
+		tok = new_token(tokentypes::COLON);
 		read_char();
 		break;
 	case '(':
-		tok = new_token(tokentypes::LPAREN, ch_);
+		tok = new_token(tokentypes::LPAREN);
 		read_char();
 		break;
 	case ')':
-		tok = new_token(tokentypes::RPAREN, ch_);
+		tok = new_token(tokentypes::RPAREN);
 		read_char();
 		break;
 	case '[':
-		tok = new_token(tokentypes::LBRACKET, ch_);
+		tok = new_token(tokentypes::LBRACKET);
 		read_char();
 		break;
 	case ']':
-		tok = new_token(tokentypes::RBRACKET, ch_);
+		tok = new_token(tokentypes::RBRACKET);
 		read_char();
 		break;
 	case ',':
-		tok = new_token(tokentypes::COMMA, ch_);
+		tok = new_token(tokentypes::COMMA);
 		read_char();
 		break;
 	case '+':
-		tok = new_token(tokentypes::PLUS, ch_);
+		tok = new_token(tokentypes::PLUS);
 		read_char();
 		break;
 	case '-':
-		tok = new_token(tokentypes::MINUS, ch_);
+		tok = new_token(tokentypes::MINUS);
 		read_char();
 		break;
 	case '!':
 		if (peek_char() == '=') {
-			tok = Token{.type = tokentypes::NEQ, .literal = "!="};
+			tok = Token{tokentypes::NEQ, input_.substr(pos_, 2)};
 			read_char();
 		} else {
-			tok = new_token(tokentypes::BANG, ch_);
+			tok = new_token(tokentypes::BANG);
 		}
 		read_char();
 		break;
 	case '/':
-		tok = new_token(tokentypes::SLASH, ch_);
+		tok = new_token(tokentypes::SLASH);
 		read_char();
 		break;
 	case '*':
-		tok = new_token(tokentypes::ASTERISK, ch_);
+		tok = new_token(tokentypes::ASTERISK);
 		read_char();
 		break;
 	case '<':
-		tok = new_token(tokentypes::LT, ch_);
+		tok = new_token(tokentypes::LT);
 		read_char();
 		break;
 	case '>':
-		tok = new_token(tokentypes::GT, ch_);
+		tok = new_token(tokentypes::GT);
 		read_char();
 		break;
 	case '{':
-		tok = new_token(tokentypes::LBRACE, ch_);
+		tok = new_token(tokentypes::LBRACE);
 		read_char();
 		break;
 	case '}':
-		tok = new_token(tokentypes::RBRACE, ch_);
+		tok = new_token(tokentypes::RBRACE);
 		read_char();
 		break;
 	case '"':
@@ -125,19 +123,19 @@ Token Lexer::next_token() {
 		read_char();
 		break;
 	case 0:
-		tok.literal = "";
+		tok.literal = std::string_view();
 		tok.type = tokentypes::EOFF;
 		read_char();
 		break;
 	default:
 		if (is_letter(ch_)) {
 			tok.literal = read_ident();
-			tok.type = lookup_ident(tok.literal);
+			tok.type = tokentypes::lookup_keyword(tok.literal);
 		} else if (is_digit(ch_)) {
 			tok.type = tokentypes::INT;
 			tok.literal = read_number();
 		} else {
-			tok = new_token(tokentypes::ILLEGAL, ch_);
+			tok = new_token(tokentypes::ILLEGAL);
 			read_char();
 		}
 		break;
@@ -146,7 +144,7 @@ Token Lexer::next_token() {
 	return tok;
 }
 
-std::string Lexer::read_string() {
+std::string_view Lexer::read_string() {
 	int start_pos = pos_ + 1;
 	for (;;) {
 		read_char();
@@ -163,7 +161,7 @@ void Lexer::skip_whitespace() {
 		read_char();
 }
 
-std::string Lexer::read_ident() {
+std::string_view Lexer::read_ident() {
 	int start_pos = pos_;
 	while (is_letter(ch_)) {
 		read_char();
@@ -172,7 +170,7 @@ std::string Lexer::read_ident() {
 	return input_.substr(start_pos, pos_ - start_pos);
 }
 
-std::string Lexer::read_number() {
+std::string_view Lexer::read_number() {
 	int start_pos = pos_;
 	while (is_digit(ch_)) {
 		read_char();
@@ -1,23 +1,31 @@
 #ifndef LUPS_LEXER_H
 #define LUPS_LEXER_H
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include "token.h"
 
 class Lexer {
 public:
 	Lexer(const std::string &input);
+	Lexer(std::shared_ptr<const std::string> source);
 	Token next_token();
 
+	// the source the tokens point into, it is shared with the lexer's copies
+	// and the programs parsed from it.
+	const std::shared_ptr<const std::string> &source() const { return source_; }
+
 private:
-	std::string input_;
+	std::shared_ptr<const std::string> source_;
+	std::string_view input_;
 	int pos_;
 	char ch_;
 	int read_pos_;
 
-	std::string read_ident();
-	std::string read_number();
-	std::string read_string();
+	std::string_view read_ident();
+	std::string_view read_number();
+	std::string_view read_string();
 
 	void read_char();
 	void skip_whitespace();
@@ -1,7 +1,16 @@
+#include "cache.h"
 #include "compiler.h"
+#include "eval.h"
+#include "optimizer.h"
+#include "regcompiler.h"
+#include "regvm.h"
+#include "serializer.h"
+#include "tier.h"
+#include "verifier.h"
 #include "vm.h"
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <streambuf>
 #include "lexer.h"
 #include "parser.h"
@@ -14,32 +23,240 @@ std::unique_ptr<Program> parse_compiler_program_helper(std::string input) {
 	return parser.parse_program();
 }
 
+// print the instructions of the main program and every compiled function.
+void print_disassembly(const std::string &title, Bytecode &bytecode) {
+	std::cout << "== " << title << " ==\n";
+	std::cout << "main:\n" << code::instructions_to_string(bytecode.instructions);
+	for (int i = 0; i < (int)bytecode.constants.size(); ++i) {
+		auto fn = dynamic_cast<CompiledFunction *>(bytecode.constants[i]);
+		if (fn == nullptr)
+			continue;
+
+		std::cout << "constant " << i << ":\n"
+							<< code::instructions_to_string(fn->m_instructions);
+	}
+}
+
+// compile_source compiles and optimizes a program, it returns nullptr if the
+// program doesn't compile.
+Bytecode *compile_source(const std::string &source, int opt_level,
+												 bool disasm) {
+	auto program = parse_compiler_program_helper(source);
+
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	if (status.has_value())
+		return nullptr;
+
+	auto bytecode = comp->bytecode();
+	if (disasm)
+		print_disassembly("before optimization", *bytecode);
+
+	optimizer::optimize(*bytecode, opt_level);
+	if (disasm)
+		print_disassembly("after optimization (level " +
+													std::to_string(opt_level) + ")",
+											*bytecode);
+
+	return bytecode;
+}
+
+// run_registers compiles a source file for the register vm and runs it.
+int run_registers(const std::string &source, bool disasm) {
+	auto program = parse_compiler_program_helper(source);
+
+	RegisterCompiler comp;
+	auto status = comp.compile(*program);
+	if (status.has_value()) {
+		std::cout << status.value() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	auto bytecode = comp.bytecode();
+	if (disasm) {
+		std::cout << "== register code ==\n";
+		std::cout << "main:\n" << reg::instructions_to_string(bytecode->instructions);
+		for (int i = 0; i < (int)bytecode->constants.size(); ++i) {
+			auto fn = dynamic_cast<RegisterFunction *>(bytecode->constants[i]);
+			if (fn != nullptr)
+				std::cout << "constant " << i << ":\n"
+									<< reg::instructions_to_string(fn->m_code);
+		}
+	}
+
+	auto vm = new RegisterVM(bytecode);
+	auto vm_status = vm->run();
+	if (vm_status.has_value())
+		return EXIT_FAILURE;
+
+	std::cout << vm->result()->Inspect() << '\n';
+	return EXIT_SUCCESS;
+}
+
+// run_tiered runs a source file on the tiered runtime, with trace every
+// function that moves to another tier is reported on stderr.
+int run_tiered(const std::string &source, bool trace) {
+	auto program = parse_compiler_program_helper(source);
+
+	TierConfig config;
+	if (trace)
+		config.trace = &std::cerr;
+
+	TieredRuntime runtime(config);
+	auto result = runtime.run(program.get());
+	if (result == nullptr)
+		result = object_constant::null;
+
+	std::cout << result->Inspect() << '\n';
+	return result->Type() == ObjType::Error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// usage: lups [-O<level>] [--disasm] [--engine stack|register|tiered]
+//             [--trace] [--cache <dir>] [--compile [-o <out>]] <file>
+//        lups --cache <dir> --cache-stats
+// A source file is compiled and run, with --compile it is only compiled and
+// the bytecode is written to <out>, by default the file with a .lpsc
+// extension. A .lpsc file is run without compiling it again. With --cache the
+// bytecode of every source file is kept in <dir> and later runs of the same
+// source load it from there, --disasm only shows the code that is compiled.
+// The register engine compiles the source for the register vm instead of the
+// stack vm, it doesn't use the optimizer, the cache or .lpsc files. The stack
+// vm compiles hot functions to machine code unless LUPS_NO_JIT is set. The
+// tiered engine starts out in the tree walker and moves hot functions to the
+// stack vm, --trace shows when they move.
 int main(int argc, char *argv[]) {
-	if (argc <= 1) {
+	std::string fname;
+	std::string out_fname;
+	std::string cache_dir;
+	std::string engine = "stack";
+	int opt_level = optimizer::MaxLevel;
+	bool disasm = false;
+	bool compile_only = false;
+	bool cache_stats = false;
+	bool trace = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg.rfind("-O", 0) == 0 && arg.size() > 2)
+			opt_level = std::stoi(arg.substr(2));
+		else if (arg == "--disasm")
+			disasm = true;
+		else if (arg == "--compile")
+			compile_only = true;
+		else if (arg == "-o" && i + 1 < argc)
+			out_fname = argv[++i];
+		else if (arg == "--cache" && i + 1 < argc)
+			cache_dir = argv[++i];
+		else if (arg == "--cache-stats")
+			cache_stats = true;
+		else if (arg == "--trace")
+			trace = true;
+		else if (arg == "--engine" && i + 1 < argc)
+			engine = argv[++i];
+		else
+			fname = arg;
+	}
+
+	if (cache_stats && !cache_dir.empty()) {
+		const auto stats = CompileCache(cache_dir).stats();
+		std::cout << "hits " << stats.hits << " misses " << stats.misses << '\n';
+		return EXIT_SUCCESS;
+	}
+
+	if (fname.empty()) {
 		std::cout << "you need to provide the wanted filename as an argument."
 							<< '\n';
 		return EXIT_FAILURE;
 	}
-	const std::string fname = std::string(argv[1]);
 
-	std::ifstream t(fname);
-	std::string str;
+	if (engine != "stack" && engine != "register" && engine != "tiered") {
+		std::cout << "unknown engine " << engine
+							<< ", use stack, register or tiered\n";
+		return EXIT_FAILURE;
+	}
 
-	t.seekg(0, std::ios::end);
-	str.reserve(t.tellg());
-	t.seekg(0, std::ios::beg);
+	const std::string extension = serializer::Extension;
+	Bytecode *bytecode;
+	bool verified = false;
+	if (fname.size() > extension.size() &&
+			fname.compare(fname.size() - extension.size(), extension.size(),
+										extension) == 0) {
+		if (engine != "stack") {
+			std::cout << "the " << engine << " engine only runs source files\n";
+			return EXIT_FAILURE;
+		}
 
-	str.assign((std::istreambuf_iterator<char>(t)),
-						 std::istreambuf_iterator<char>());
+		bytecode = new Bytecode();
+		auto err = serializer::load_file(fname, *bytecode);
+		if (err.has_value()) {
+			std::cout << err.value() << '\n';
+			return EXIT_FAILURE;
+		}
+	} else {
+		std::ifstream t(fname, std::ios::binary);
+		std::ostringstream str;
+		str << t.rdbuf();
+		const auto source = str.str();
 
-	auto program = parse_compiler_program_helper(str);
+		if (engine != "stack" && (compile_only || !cache_dir.empty())) {
+			std::cout << "the " << engine << " engine only runs source files\n";
+			return EXIT_FAILURE;
+		}
+		if (engine == "register")
+			return run_registers(source, disasm);
+		if (engine == "tiered")
+			return run_tiered(source, trace);
 
-	auto comp = new Compiler();
-	auto status = comp->compile(*program);
-	if (status.has_value())
+		if (cache_dir.empty()) {
+			bytecode = compile_source(source, opt_level, disasm);
+			if (bytecode == nullptr)
+				return EXIT_FAILURE;
+		} else {
+			CompileCache cache(cache_dir);
+			const auto key = cache.key(source, opt_level);
+			bytecode = new Bytecode();
+			// the cache has verified the entries it hits.
+			verified = cache.load(key, *bytecode);
+			if (!verified) {
+				bytecode = compile_source(source, opt_level, disasm);
+				if (bytecode == nullptr)
+					return EXIT_FAILURE;
+
+				// the program still runs when its bytecode can't be cached.
+				auto err = cache.store(key, *bytecode);
+				if (err.has_value())
+					std::cerr << "cache: " << err.value() << '\n';
+			}
+		}
+	}
+
+	auto verify_status =
+			verified ? std::nullopt : verifier::verify(*bytecode);
+	if (verify_status.has_value()) {
+		std::cout << "invalid bytecode: " << verify_status.value() << '\n';
 		return EXIT_FAILURE;
+	}
+
+	if (compile_only) {
+		if (out_fname.empty()) {
+			auto dot = fname.rfind('.');
+			auto slash = fname.rfind('/');
+			if (dot == std::string::npos ||
+					(slash != std::string::npos && dot < slash))
+				dot = fname.size();
+			out_fname = fname.substr(0, dot) + extension;
+		}
+
+		auto err = serializer::write_file(*bytecode, out_fname);
+		if (err.has_value()) {
+			std::cout << err.value() << '\n';
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
 
-	auto vm = new VM(comp->bytecode());
+	auto vm = new VM(bytecode);
 	auto vm_status = vm->run();
 	if (vm_status.has_value())
 		return EXIT_FAILURE;
@@ -0,0 +1,104 @@
+#include "ast.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "vm.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <streambuf>
+
+// ngrams runs a program and reports the sequences of opcodes that were
+// executed the most, which is what superinstructions should be picked from.
+// The vm has to be built with LUPS_OPCODE_PROFILE, see the Makefile.
+
+#ifndef LUPS_OPCODE_PROFILE
+#error "ngrams needs the vm to be built with LUPS_OPCODE_PROFILE"
+#endif
+
+std::unique_ptr<Program> parse_compiler_program_helper(std::string input) {
+	auto lexer = Lexer(input);
+	auto parser = Parser(std::make_unique<Lexer>(lexer));
+
+	return parser.parse_program();
+}
+
+static std::string ngram_to_string(std::uint32_t key, int n) {
+	std::string res;
+	for (int i = n - 1; i >= 0; --i) {
+		auto def = code::look_up((code::Opcode)((key >> (8 * i)) & 0xff));
+		res += def == nullptr ? "?" : def->name;
+		if (i != 0)
+			res += "; ";
+	}
+
+	return res;
+}
+
+// usage: ngrams [-O<level>] [-t<top>] <file>
+int main(int argc, char *argv[]) {
+	std::string fname;
+	int opt_level = optimizer::MaxLevel;
+	int top = 10;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg.rfind("-O", 0) == 0 && arg.size() > 2)
+			opt_level = std::stoi(arg.substr(2));
+		else if (arg.rfind("-t", 0) == 0 && arg.size() > 2)
+			top = std::stoi(arg.substr(2));
+		else
+			fname = arg;
+	}
+
+	if (fname.empty()) {
+		std::cout << "usage: ngrams [-O<level>] [-t<top>] <file>\n";
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream t(fname);
+	std::string str((std::istreambuf_iterator<char>(t)),
+									std::istreambuf_iterator<char>());
+
+	auto program = parse_compiler_program_helper(str);
+	auto comp = new Compiler(opt_level);
+	auto status = comp->compile(*program);
+	if (status.has_value()) {
+		std::cout << "compilation unsuccessful: " << status.value() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, opt_level);
+
+	auto vm = new VM(bytecode);
+	auto vm_status = vm->run();
+	if (vm_status.has_value()) {
+		std::cout << "running unsuccessful: " << vm_status.value() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	const auto &profile = vm->opcode_profile();
+	std::uint64_t executed = 0;
+	for (const auto &entry : profile.counts(1))
+		executed += entry.second;
+	std::cout << "executed " << executed << " instructions at level "
+						<< opt_level << '\n';
+
+	for (int n = 1; n <= OpcodeProfile::MaxLength; ++n) {
+		std::vector<std::pair<std::uint32_t, std::uint64_t>> sorted(
+				profile.counts(n).begin(), profile.counts(n).end());
+		std::sort(sorted.begin(), sorted.end(),
+							[](const auto &a, const auto &b) { return a.second > b.second; });
+
+		std::cout << "\ntop " << n << "-grams:\n";
+		for (int i = 0; i < top && i < (int)sorted.size(); ++i) {
+			const auto percent = 100.0 * sorted[i].second / executed;
+			std::cout << "  " << sorted[i].second << " (" << percent << "%) "
+								<< ngram_to_string(sorted[i].first, n) << '\n';
+		}
+	}
+
+	return 0;
+}
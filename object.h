@@ -3,6 +3,8 @@
 
 #include "ast.h"
 #include "code.h"
+#include "persistent_vector.h"
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
@@ -23,7 +25,8 @@ enum class ObjType {
 	Array,
 	Hash,
 	CompiledFunction,
-	Closure
+	Closure,
+	IntArray
 };
 
 typedef long long HashValue;
@@ -32,11 +35,82 @@ struct HashKey {
 	HashValue value;
 };
 
+// GCState tells whether a garbage collected heap knows about an object. Pinned
+// objects are owned by someone else (the constant pool, the builtins and the
+// shared true/false/null objects), the heap never frees or traces them. Young
+// objects live in the heap's nursery and Owned ones in its old generation.
+enum class GCState : std::uint8_t { Untracked, Pinned, Young, Owned };
+
 class Object {
 public:
 	virtual ~Object() {}
 	virtual ObjType Type() = 0;
 	virtual std::string Inspect() = 0;
+
+	// garbage collection bookkeeping, see gc.h.
+	GCState gc_state_ = GCState::Untracked;
+	bool gc_marked_ = false;
+	bool gc_remembered_ = false;
+	Object *gc_next_ = nullptr;
+};
+
+// Value is how the vm represents a runtime value on its stack, in globals, in
+// the constant pool and in closures. Integers, booleans and null are stored
+// inline in a single tagged word so that arithmetic never allocates, every other
+// type is a pointer to a heap object.
+//
+// Objects are always at least 8 byte aligned, so a pointer has its low bits
+// cleared. Integers set the lowest bit and keep the value in the upper bits,
+// the other immediates use the 0b10 tag.
+class Value {
+public:
+	Value() : bits_(NullBits) {}
+
+	static Value integer(int v) {
+		return Value(((std::uint64_t)(std::int64_t)v << 1) | IntTag);
+	}
+	static Value boolean(bool b) { return Value(b ? TrueBits : FalseBits); }
+	static Value null() { return Value(NullBits); }
+	static Value object(Object *obj) { return Value((std::uint64_t)obj); }
+
+	bool is_integer() const { return (bits_ & IntTag) != 0; }
+	bool is_boolean() const { return bits_ == TrueBits || bits_ == FalseBits; }
+	bool is_null() const { return bits_ == NullBits; }
+	bool is_object() const { return (bits_ & TagMask) == 0; }
+
+	int as_integer() const { return (int)((std::int64_t)bits_ >> 1); }
+	bool as_boolean() const { return bits_ == TrueBits; }
+	Object *as_object() const { return (Object *)bits_; }
+
+	// type returns the same type the boxed object would have, only heap objects
+	// need a virtual call.
+	ObjType type() const {
+		if (is_integer())
+			return ObjType::Integer;
+		if (is_object())
+			return as_object()->Type();
+		if (is_null())
+			return ObjType::Null;
+		return ObjType::Boolean;
+	}
+
+	// identity comparison, immediates compare by value and objects by address.
+	// This is what == means in lups for any two values but strings, which
+	// values_equal in vm.h compares by contents. The engines compare the words
+	// directly wherever they know that one side isn't a string.
+	bool operator==(const Value &other) const { return bits_ == other.bits_; }
+	bool operator!=(const Value &other) const { return bits_ != other.bits_; }
+
+private:
+	explicit Value(std::uint64_t bits) : bits_(bits) {}
+
+	static constexpr std::uint64_t IntTag = 0x1;
+	static constexpr std::uint64_t TagMask = 0x7;
+	static constexpr std::uint64_t NullBits = 0x02;
+	static constexpr std::uint64_t FalseBits = 0x0a;
+	static constexpr std::uint64_t TrueBits = 0x12;
+
+	std::uint64_t bits_;
 };
 
 class CompiledFunction : public Object {
@@ -50,9 +124,30 @@ public:
 	ObjType Type() { return ObjType::CompiledFunction; }
 	std::string Inspect() { return "compiled-function"; }
 
+	// code returns the instructions the vm runs. They are m_instructions, unless
+	// the function was loaded from a .lpsc file, then they are m_mapped_size
+	// bytes in the file's mapping.
+	char *code() {
+		return m_mapped != nullptr ? m_mapped : m_instructions.data();
+	}
+	int code_size() const {
+		return m_mapped != nullptr ? m_mapped_size : (int)m_instructions.size();
+	}
+
 	code::Instructions m_instructions;
 	int m_num_locals;
-	int m_num_parameters;
+	int m_num_parameters = 0;
+	char *m_mapped = nullptr;
+	int m_mapped_size = 0;
+
+	// the most values a call of the function has on the stack above its base
+	// pointer, counting the locals. It is -1 until the verifier has checked it.
+	int m_max_stack = -1;
+
+	// m_calls counts the calls of the function until it is hot enough for the
+	// jit, m_native holds the machine code it was compiled to, see jit.h.
+	int m_calls = 0;
+	std::shared_ptr<void> m_native;
 };
 
 typedef Object *(*built_in)(std::vector<Object *> &);
@@ -140,12 +235,8 @@ public:
 
 class Function : public Object {
 public:
-	~Function() {
-		delete env;
-		delete body;
-		for (auto pr : params)
-			delete pr;
-	}
+	// the params and body are nodes in the program's arena, which frees them.
+	~Function() { delete env; }
 	ObjType Type() { return ObjType::Function; }
 	std::string Inspect() { return "function"; }
 
@@ -169,11 +260,13 @@ public:
 
 class Array : public Object {
 public:
-	Array(std::vector<Object *> &elems) : Object(), elements(elems) {}
-	~Array() {
-		for (auto elem : elements)
-			delete elem;
+	// the elements can be shared with other arrays and hashes, so they are freed
+	// by the garbage collector instead of the array.
+	Array(std::vector<Object *> &elems) : Object() {
+		for (auto elem : elems)
+			elements.push_back(elem);
 	}
+	Array(PersistentVector elems) : Object(), elements(std::move(elems)) {}
 
 	ObjType Type() { return ObjType::Array; }
 	std::string Inspect() {
@@ -185,7 +278,58 @@ public:
 		return res;
 	}
 
-	std::vector<Object *> elements;
+	PersistentVector elements;
+};
+
+// IntArray is an array whose elements are all integers, they are stored
+// unboxed in one buffer so the numeric builtins can run over them directly.
+// Array literals and push create one instead of an Array when they only see
+// integers.
+//
+// Arrays derived from each other share the buffer the way Array shares its
+// nodes: a tail starts one element further into it and push appends in place
+// unless another array already appended past this one's end.
+class IntArray : public Object {
+public:
+	IntArray(std::vector<int> values)
+			: Object(), buffer(std::make_shared<std::vector<int>>(std::move(values))),
+				start(0), length(buffer->size()) {}
+	IntArray(std::shared_ptr<std::vector<int>> buf, std::size_t start,
+					 std::size_t length)
+			: Object(), buffer(std::move(buf)), start(start), length(length) {}
+
+	ObjType Type() { return ObjType::IntArray; }
+	std::string Inspect() {
+		std::string res = "[";
+		for (std::size_t i = 0; i < length; ++i)
+			res += std::to_string((*this)[i]) + ", ";
+		res += "]";
+		return res;
+	}
+
+	std::size_t size() const { return length; }
+	const int *data() const { return buffer->data() + start; }
+	int operator[](std::size_t index) const { return (*buffer)[start + index]; }
+
+	IntArray *pushed(int value) const {
+		if (buffer->size() != start + length) {
+			auto buf = std::make_shared<std::vector<int>>(data(), data() + length);
+			buf->push_back(value);
+			return new IntArray(std::move(buf), 0, length + 1);
+		}
+
+		buffer->push_back(value);
+		return new IntArray(buffer, start, length + 1);
+	}
+
+	// tailed returns the array without its first element, it must not be empty.
+	IntArray *tailed() const {
+		return new IntArray(buffer, start + 1, length - 1);
+	}
+
+	std::shared_ptr<std::vector<int>> buffer;
+	std::size_t start;
+	std::size_t length;
 };
 
 class Builtin : public Object {
@@ -197,31 +341,27 @@ public:
 	built_in func;
 };
 
+// HashPair is an entry of a hash together with the hash key of its key. The
+// hash owns its pairs but not the objects in them.
 struct HashPair {
-	~HashPair() {
-		delete key;
-		delete value;
-	}
-
 	Object *key;
 	Object *value;
+	HashKey hash;
 };
 
+// Hash is an open addressing hash table. The pairs are stored inline in
+// insertion order and the table only holds their indexes. Keys are compared by
+// type and value, keys with the same hash don't overwrite each other.
 class Hash : public Object {
 public:
-	Hash() { pairs = std::unordered_map<HashValue, HashPair *>(); }
-
-	~Hash() {
-		for (auto pr : pairs)
-			delete pr.second;
-	}
-
 	ObjType Type() { return ObjType::Hash; }
 	std::string Inspect() {
 		std::string result;
 		result += "{";
-		for (const auto &pr : pairs) {
-			result += pr.second->key->Inspect() + ": " + pr.second->value->Inspect();
+		for (int i = 0; i < (int)pairs.size(); ++i) {
+			if (i != 0)
+				result += ", ";
+			result += pairs[i].key->Inspect() + ": " + pairs[i].value->Inspect();
 		}
 
 		result += "}";
@@ -229,26 +369,139 @@ public:
 		return result;
 	}
 
-	std::unordered_map<HashValue, HashPair *> pairs;
+	// key_of returns the hash key of an integer, string or boolean object.
+	static HashKey key_of(Object *key) {
+		switch (key->Type()) {
+		case ObjType::Integer:
+			return ((Integer *)key)->hash_key();
+		case ObjType::String:
+			return ((String *)key)->hash_key();
+		default:
+			return ((Boolean *)key)->hash_key();
+		}
+	}
+
+	// get returns the value stored under a key or nullptr. str has to be the key
+	// itself when the key is a string, since strings are compared by contents.
+	Object *get(const HashKey &key, const String *str) const {
+		const auto slot = find(key, str);
+		return slot == -1 ? nullptr : pairs[slots_[slot] - 1].value;
+	}
+	Object *get(Object *key) const {
+		return get(key_of(key), key->Type() == ObjType::String ? (String *)key
+																													 : nullptr);
+	}
+
+	// set stores a value under a key, a key that is already in the hash keeps
+	// its position in the insertion order.
+	void set(Object *key, const HashKey &hash, Object *value) {
+		const auto str =
+				hash.type == ObjType::String ? (const String *)key : nullptr;
+		const auto slot = find(hash, str);
+		if (slot != -1) {
+			pairs[slots_[slot] - 1].value = value;
+			return;
+		}
+
+		if ((pairs.size() + 1) * 4 > slots_.size() * 3)
+			grow();
+
+		pairs.push_back(HashPair{key, value, hash});
+		insert((std::uint32_t)pairs.size() - 1);
+	}
+	void set(Object *key, Object *value) { set(key, key_of(key), value); }
+
+	std::size_t size() const { return pairs.size(); }
+
+	void swap(Hash &other) {
+		pairs.swap(other.pairs);
+		slots_.swap(other.slots_);
+	}
+
+	// the pairs in insertion order. The garbage collector updates the objects in
+	// them when it moves them, nothing else may change the keys.
+	std::vector<HashPair> pairs;
+
+private:
+	// the table sizes, the largest primes below the powers of two. Integer keys
+	// are their own hash, so keys that are close to each other land in slots
+	// that are close to each other, and a prime size keeps keys that share a
+	// stride from piling up in the same slots.
+	static constexpr std::uint32_t Sizes[] = {
+			7,				 13,				31,				 61,				127,			 251,
+			509,			 1021,			2039,			 4093,			8191,			 16381,
+			32749,		 65521,			131071,		 262139,		524287,		 1048573,
+			2097143,	 4194301,		8388593,	 16777213,	33554393,	 67108859,
+			134217689, 268435399, 536870909, 1073741789, 2147483647, 4294967291};
+
+	std::size_t slot_of(HashValue hash) const {
+		return (std::uint64_t)hash % slots_.size();
+	}
+	std::size_t next_slot(std::size_t slot) const {
+		return slot + 1 == slots_.size() ? 0 : slot + 1;
+	}
+
+	bool matches(const HashPair &pr, const HashKey &key, const String *str) const {
+		if (pr.hash.type != key.type || pr.hash.value != key.value)
+			return false;
+
+		return str == nullptr || ((String *)pr.key)->value == str->value;
+	}
+
+	// find returns the slot that holds the key or -1.
+	std::ptrdiff_t find(const HashKey &key, const String *str) const {
+		if (slots_.empty())
+			return -1;
+
+		for (auto slot = slot_of(key.value);; slot = next_slot(slot)) {
+			if (slots_[slot] == Empty)
+				return -1;
+			if (matches(pairs[slots_[slot] - 1], key, str))
+				return (std::ptrdiff_t)slot;
+		}
+	}
+
+	// insert adds the pair at index to the table, it must not be in it already.
+	void insert(std::uint32_t index) {
+		auto slot = slot_of(pairs[index].hash.value);
+		while (slots_[slot] != Empty)
+			slot = next_slot(slot);
+
+		slots_[slot] = index + 1;
+	}
+
+	// grow moves to the next size and inserts the pairs again, the table is kept
+	// at most three quarters full.
+	void grow() {
+		std::size_t size = Sizes[0];
+		for (auto candidate : Sizes)
+			if (candidate > slots_.size()) {
+				size = candidate;
+				break;
+			}
+
+		slots_.assign(size, Empty);
+		for (std::uint32_t i = 0; i < pairs.size(); ++i)
+			insert(i);
+	}
+
+	// a slot holds the index of its pair plus one.
+	static constexpr std::uint32_t Empty = 0;
+	std::vector<std::uint32_t> slots_;
 };
 
 class Closure : public Object {
 public:
 	Closure(CompiledFunction *func) {
-		free_ = std::vector<Object*>();
+		free_ = std::vector<Value>();
 		func_ = func;
 	}
 
-	~Closure() {
-		for (auto obj : free_)
-			delete obj;
-	}
-
 	ObjType Type() { return ObjType::Closure; }
 	std::string Inspect() { return "closure"; }
 
 	CompiledFunction* func_;
-	std::vector<Object*> free_;
+	std::vector<Value> free_;
 };
 
 #endif
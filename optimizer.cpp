@@ -0,0 +1,359 @@
+#include "optimizer.h"
+#include "object.h"
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+namespace {
+// Inst is a decoded instruction. Jump operands hold the index of the target
+// instruction instead of a byte offset while the instructions are rewritten.
+struct Inst {
+	code::Opcode op;
+	std::vector<int> operands;
+	bool removed;
+};
+
+// the index of the operand that holds the jump target, or -1.
+int jump_operand(code::Opcode op) {
+	switch (op) {
+	case code::OpJump:
+	case code::OpJumpNotTruthy:
+		return 0;
+	case code::OpJumpNotEqualLocalConst:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+bool is_jump(code::Opcode op) { return jump_operand(op) != -1; }
+
+// jump_target returns a reference to the target operand of a jump.
+int &jump_target(Inst &inst) { return inst.operands[jump_operand(inst.op)]; }
+
+// control never falls through these instructions.
+bool ends_block(code::Opcode op) {
+	return op == code::OpJump || op == code::OpReturn ||
+				 op == code::OpReturnValue;
+}
+
+// decode returns false if the instructions can't be decoded safely, for example
+// when a jump doesn't land on an instruction boundary.
+bool decode(const code::Instructions &ins, std::vector<Inst> &out) {
+	std::vector<int> index_of(ins.size() + 1, -1);
+
+	int i = 0;
+	while (i < (int)ins.size()) {
+		auto def = code::look_up(ins[i]);
+		if (def == nullptr)
+			return false;
+
+		index_of[i] = (int)out.size();
+		auto read = code::read_operands(def, ins.data() + i + 1);
+		out.push_back(Inst{ins[i], read.first, false});
+		i += 1 + read.second;
+	}
+	index_of[ins.size()] = (int)out.size();
+
+	for (auto &inst : out) {
+		if (!is_jump(inst.op))
+			continue;
+
+		auto &target = jump_target(inst);
+		if (target < 0 || target > (int)ins.size() || index_of[target] == -1)
+			return false;
+		target = index_of[target];
+	}
+
+	return true;
+}
+
+code::Instructions encode(const std::vector<Inst> &insts) {
+	const int n = (int)insts.size();
+
+	// removed instructions get the offset of the next live one, so jumps to them
+	// land on whatever follows.
+	std::vector<int> new_pos(n + 1, 0);
+	int pos = 0;
+	for (int i = 0; i < n; ++i) {
+		new_pos[i] = pos;
+		if (insts[i].removed)
+			continue;
+
+		pos += 1;
+		for (auto width : code::look_up(insts[i].op)->operand_widths)
+			pos += width;
+	}
+	new_pos[n] = pos;
+
+	code::Instructions out;
+	out.reserve(pos);
+	for (const auto &inst : insts) {
+		if (inst.removed)
+			continue;
+
+		auto copy = inst;
+		const auto jump = jump_operand(copy.op);
+		if (jump != -1)
+			copy.operands[jump] = new_pos[copy.operands[jump]];
+
+		auto encoded = code::make(copy.op, copy.operands);
+		out.insert(out.end(), encoded.begin(), encoded.end());
+	}
+
+	return out;
+}
+
+// Effect is the amount of values an instruction pops and then pushes.
+struct Effect {
+	int pops;
+	int pushes;
+};
+
+// stack_effect returns nothing for instructions that leave the straight line
+// code, the sequences fused into OpCallGlobal can't contain them.
+std::optional<Effect> stack_effect(const Inst &inst) {
+	switch (inst.op) {
+	case code::OpConstant:
+	case code::OpTrue:
+	case code::OpFalse:
+	case code::OpNull:
+	case code::OpGetGlobal:
+	case code::OpGetLocal:
+	case code::OpGetBuiltin:
+	case code::OpGetFree:
+	case code::OpSubLocalConst:
+		return Effect{0, 1};
+	case code::OpAdd:
+	case code::OpSub:
+	case code::OpMul:
+	case code::OpDiv:
+	case code::OpEqual:
+	case code::OpNotEqual:
+	case code::OpGreaterThan:
+	case code::OpIndex:
+		return Effect{2, 1};
+	case code::OpMinus:
+	case code::OpBang:
+	case code::OpTeeGlobal:
+	case code::OpTeeLocal:
+	case code::OpIndexConst:
+		return Effect{1, 1};
+	case code::OpPop:
+	case code::OpSetGlobal:
+	case code::OpSetLocal:
+		return Effect{1, 0};
+	case code::OpArray:
+	case code::OpHash:
+		return Effect{inst.operands[0], 1};
+	case code::OpClosure:
+		return Effect{inst.operands[1], 1};
+	case code::OpCall:
+		return Effect{inst.operands[0] + 1, 1};
+	case code::OpCallGlobal:
+		return Effect{inst.operands[1], 1};
+	default:
+		return std::nullopt;
+	}
+}
+
+// find_call returns the index of the OpCall that consumes the value pushed by
+// the instruction at start, or -1 if the arguments aren't straight line code.
+int find_call(const std::vector<Inst> &insts, const std::vector<bool> &targeted,
+							int start) {
+	int depth = 0;
+	for (int i = start + 1; i < (int)insts.size(); ++i) {
+		const auto &inst = insts[i];
+		if (inst.removed)
+			continue;
+		if (targeted[i])
+			return -1;
+
+		if (inst.op == code::OpCall && inst.operands[0] == depth)
+			return i;
+
+		const auto effect = stack_effect(inst);
+		if (!effect.has_value() || effect->pops > depth)
+			return -1;
+		depth += effect->pushes - effect->pops;
+	}
+
+	return -1;
+}
+} // namespace
+
+code::Instructions optimizer::peephole(const code::Instructions &ins) {
+	std::vector<Inst> insts;
+	if (!decode(ins, insts))
+		return ins;
+
+	const int n = (int)insts.size();
+	std::vector<bool> targeted(n + 1, false);
+
+	auto next_live = [&](int i) {
+		++i;
+		while (i < n && insts[i].removed)
+			++i;
+		return i;
+	};
+
+	// the first live instruction at or after i.
+	auto resolve = [&](int i) {
+		while (i < n && insts[i].removed)
+			++i;
+		return i;
+	};
+
+	// jumps to a removed instruction now land on the next live one.
+	auto remove = [&](int i) {
+		insts[i].removed = true;
+		if (targeted[i])
+			targeted[resolve(i)] = true;
+	};
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+
+		std::fill(targeted.begin(), targeted.end(), false);
+		for (auto &inst : insts)
+			if (!inst.removed && is_jump(inst.op))
+				targeted[resolve(jump_target(inst))] = true;
+
+		for (int i = resolve(0); i < n; i = next_live(i)) {
+			auto &inst = insts[i];
+			const auto next = next_live(i);
+
+			// conditional jumps on a constant condition.
+			if ((inst.op == code::OpTrue || inst.op == code::OpFalse) && next < n &&
+					insts[next].op == code::OpJumpNotTruthy && !targeted[next]) {
+				if (inst.op == code::OpTrue) {
+					remove(i);
+					remove(next);
+				} else {
+					remove(i);
+					insts[next].op = code::OpJump;
+				}
+				changed = true;
+				continue;
+			}
+
+			if (is_jump(inst.op)) {
+				const auto target = resolve(jump_target(inst));
+				if (target < n && insts[target].op == code::OpJump &&
+						resolve(jump_target(insts[target])) != target) {
+					jump_target(inst) = jump_target(insts[target]);
+					targeted[resolve(jump_target(inst))] = true;
+					changed = true;
+				} else if (inst.op == code::OpJump && target == next) {
+					remove(i);
+					changed = true;
+					continue;
+				}
+			}
+
+			if (ends_block(inst.op)) {
+				for (auto k = next; k < n && !targeted[k]; k = next_live(k)) {
+					remove(k);
+					changed = true;
+				}
+			}
+
+			if ((inst.op == code::OpSetGlobal || inst.op == code::OpSetLocal) &&
+					next < n && !targeted[next] &&
+					insts[next].operands == inst.operands &&
+					insts[next].op == (inst.op == code::OpSetGlobal
+																 ? code::OpGetGlobal
+																 : code::OpGetLocal)) {
+				inst.op = inst.op == code::OpSetGlobal ? code::OpTeeGlobal
+																							 : code::OpTeeLocal;
+				remove(next);
+				changed = true;
+			}
+		}
+	}
+
+	return encode(insts);
+}
+
+code::Instructions optimizer::fuse(const code::Instructions &ins) {
+	std::vector<Inst> insts;
+	if (!decode(ins, insts))
+		return ins;
+
+	const int n = (int)insts.size();
+	std::vector<bool> targeted(n + 1, false);
+	for (auto &inst : insts)
+		if (is_jump(inst.op))
+			targeted[jump_target(inst)] = true;
+
+	// the instructions after the first one of a fused sequence can't be jump
+	// targets, the first one keeps its place.
+	auto matches = [&](int i, std::initializer_list<code::Opcode> ops) {
+		int k = i;
+		for (auto op : ops) {
+			if (k >= n || insts[k].op != op || (k != i && targeted[k]))
+				return false;
+			++k;
+		}
+		return true;
+	};
+
+	for (int i = 0; i < n; ++i) {
+		auto &inst = insts[i];
+		if (matches(i, {code::OpGetLocal, code::OpConstant, code::OpEqual,
+										code::OpJumpNotTruthy})) {
+			inst.op = code::OpJumpNotEqualLocalConst;
+			inst.operands = {inst.operands[0], insts[i + 1].operands[0],
+											 insts[i + 3].operands[0]};
+			insts[i + 1].removed = insts[i + 2].removed = insts[i + 3].removed = true;
+			i += 3;
+		} else if (matches(i, {code::OpGetLocal, code::OpConstant, code::OpSub})) {
+			inst.op = code::OpSubLocalConst;
+			inst.operands = {inst.operands[0], insts[i + 1].operands[0]};
+			insts[i + 1].removed = insts[i + 2].removed = true;
+			i += 2;
+		} else if (matches(i, {code::OpConstant, code::OpIndex})) {
+			inst.op = code::OpIndexConst;
+			insts[i + 1].removed = true;
+			i += 1;
+		}
+	}
+
+	// a removed OpGetGlobal hands its jumps to the first instruction of the
+	// arguments, which is fine since the global is only read by the call.
+	for (int i = 0; i < n; ++i) {
+		if (insts[i].removed || insts[i].op != code::OpGetGlobal)
+			continue;
+
+		const auto call = find_call(insts, targeted, i);
+		if (call == -1)
+			continue;
+
+		insts[call].op = code::OpCallGlobal;
+		insts[call].operands = {insts[i].operands[0], insts[call].operands[0]};
+		insts[i].removed = true;
+	}
+
+	return encode(insts);
+}
+
+void optimizer::optimize(Bytecode &bytecode, int level) {
+	if (level <= 0)
+		return;
+
+	auto rewrite = [level](code::Instructions &ins) {
+		ins = peephole(ins);
+		if (level >= 2)
+			ins = fuse(ins);
+	};
+
+	rewrite(bytecode.instructions);
+	for (auto constant : bytecode.constants) {
+		if (constant->Type() != ObjType::CompiledFunction)
+			continue;
+
+		auto fn = (CompiledFunction *)constant;
+		rewrite(fn->m_instructions);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef LUPS_OPTIMIZER_H
+#define LUPS_OPTIMIZER_H
+
+#include "code.h"
+#include "compiler.h"
+
+// The optimizer rewrites the bytecode produced by the compiler before it is
+// handed to the vm. Level 0 leaves the bytecode untouched, level 1 runs the
+// peephole pass and level 2 also fuses common sequences into superinstructions.
+namespace optimizer {
+static constexpr int MaxLevel = 2;
+
+// peephole rewrites naive instruction sequences in a single function:
+//   - OpTrue; OpJumpNotTruthy is removed and OpFalse; OpJumpNotTruthy becomes
+//     an OpJump.
+//   - jumps to the next instruction are removed and jumps to jumps are
+//     threaded to the final target.
+//   - unreachable code after OpJump, OpReturn and OpReturnValue is removed.
+//   - OpSetGlobal n; OpGetGlobal n becomes OpTeeGlobal n, the same for locals.
+// Jump targets are fixed up to the new instruction offsets.
+code::Instructions peephole(const code::Instructions &ins);
+
+// fuse replaces the sequences described next to the superinstructions in
+// code::Opcodes with a single instruction. Only sequences that aren't jumped
+// into are fused.
+code::Instructions fuse(const code::Instructions &ins);
+
+// optimize rewrites the main program and every compiled function in the
+// constant pool in place.
+void optimize(Bytecode &bytecode, int level);
+} // namespace optimizer
+
+#endif
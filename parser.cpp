@@ -2,6 +2,7 @@
 #include "ast.h"
 #include "token.h"
 #include <algorithm>
+#include <charconv>
 #include <cstdlib>
 #include <memory>
 #include <sstream>
@@ -15,11 +16,11 @@ template <typename T> T FromString(const std::string &str) {
 	return ret;
 }
 
-using std::unique_ptr;
 
-unique_ptr<Program> Parser::parse_program() {
+std::unique_ptr<Program> Parser::parse_program() {
 	auto program = std::make_unique<Program>();
-	program->statements = std::vector<unique_ptr<Statement>>();
+	program->source = lx_->source();
+	arena_ = &program->arena;
 
 	while (current_.type != tokentypes::EOFF) {
 		auto stmt = parse_statement();
@@ -32,11 +33,10 @@ unique_ptr<Program> Parser::parse_program() {
 	return program;
 }
 
-Parser::Parser(unique_ptr<Lexer> lx) {
+Parser::Parser(std::unique_ptr<Lexer> lx) {
+	arena_ = nullptr;
 	lx_ = std::move(lx);
 
-	m_prefix_parse_fns = std::unordered_map<TokenType, PrefixParseFn>();
-
 	// TODO: place straight into map
 	add_prefix_parse(tokentypes::IDENT, &Parser::parse_identifier);
 	add_prefix_parse(tokentypes::INT, &Parser::parse_integer_literal);
@@ -51,7 +51,6 @@ Parser::Parser(unique_ptr<Lexer> lx) {
 	add_prefix_parse(tokentypes::LBRACKET, &Parser::parse_array_literal);
 	add_prefix_parse(tokentypes::LBRACE, &Parser::parse_hash_literal);
 
-	m_infix_parse_fns = std::unordered_map<TokenType, InfixParseFn>();
 	add_infix_parse(tokentypes::PLUS, &Parser::parse_infix_expression);
 	add_infix_parse(tokentypes::MINUS, &Parser::parse_infix_expression);
 	add_infix_parse(tokentypes::SLASH, &Parser::parse_infix_expression);
@@ -72,7 +71,7 @@ void Parser::next_token() {
 	peek_ = lx_->next_token();
 }
 
-unique_ptr<Statement> Parser::parse_statement() {
+NodePtr<Statement> Parser::parse_statement() {
 	if (current_.type == tokentypes::LET) {
 		return parse_let_statement();
 	} else if (current_.type == tokentypes::RETURN) {
@@ -96,17 +95,17 @@ bool Parser::expect_peek(TokenType tt) {
 	return false;
 }
 
-unique_ptr<Statement> Parser::parse_let_statement() {
-	auto letstmt = std::make_unique<LetStatement>();
+NodePtr<Statement> Parser::parse_let_statement() {
+	auto letstmt = make<LetStatement>();
 	letstmt->token = current_;
 
 	if (!expect_peek(tokentypes::IDENT)) {
 		return nullptr;
 	}
 
-	auto ident = std::make_unique<Identifier>();
+	auto ident = make<Identifier>();
 	ident->token = current_;
-	ident->value = current_.literal;
+	ident->value = arena_->intern(current_.literal);
 	letstmt->name = std::move(ident);
 
 	if (!expect_peek(tokentypes::ASSIGN)) {
@@ -123,8 +122,8 @@ unique_ptr<Statement> Parser::parse_let_statement() {
 	return letstmt;
 }
 
-unique_ptr<Statement> Parser::parse_return_statement() {
-	auto returnstmt = std::make_unique<ReturnStatement>();
+NodePtr<Statement> Parser::parse_return_statement() {
+	auto returnstmt = make<ReturnStatement>();
 	returnstmt->token = current_;
 
 	next_token();
@@ -136,8 +135,8 @@ unique_ptr<Statement> Parser::parse_return_statement() {
 	return returnstmt;
 }
 
-unique_ptr<Statement> Parser::parse_expression_statement() {
-	auto stmt = std::make_unique<ExpressionStatement>();
+NodePtr<Statement> Parser::parse_expression_statement() {
+	auto stmt = make<ExpressionStatement>();
 	stmt->token = current_;
 
 	stmt->expression = parse_expression(LOWEST);
@@ -148,12 +147,12 @@ unique_ptr<Statement> Parser::parse_expression_statement() {
 	return stmt;
 }
 
-unique_ptr<Expression> Parser::parse_expression(Precedence prec) {
-	if (m_prefix_parse_fns.find(current_.type) == m_prefix_parse_fns.end()) {
+NodePtr<Expression> Parser::parse_expression(Precedence prec) {
+	auto fn = m_prefix_parse_fns[current_.type];
+	if (fn == nullptr) {
 		return nullptr;
 	}
 
-	auto fn = m_prefix_parse_fns[current_.type];
 	auto left = (this->*fn)();
 
 	while (!peek_token_is(tokentypes::SEMICOLON) && prec < peek_precedence()) {
@@ -167,22 +166,22 @@ unique_ptr<Expression> Parser::parse_expression(Precedence prec) {
 	return left;
 }
 
-unique_ptr<Expression> Parser::parse_identifier() {
-	auto identifier = std::make_unique<Identifier>();
+NodePtr<Expression> Parser::parse_identifier() {
+	auto identifier = make<Identifier>();
 	identifier->token = current_;
-	identifier->value = current_.literal;
+	identifier->value = arena_->intern(current_.literal);
 
 	return identifier;
 }
 
-unique_ptr<Expression> Parser::parse_integer_literal() {
-	auto lit = std::make_unique<IntegerLiteral>();
+NodePtr<Expression> Parser::parse_integer_literal() {
+	auto lit = make<IntegerLiteral>();
 	lit->token = current_;
 
-	try {
-		int res = std::stoi(current_.literal);
-		lit->value = res;
-	} catch (std::invalid_argument e) {
+	const auto &text = current_.literal;
+	const auto res = std::from_chars(text.data(), text.data() + text.size(),
+																	 lit->value);
+	if (res.ec != std::errc() || res.ptr != text.data() + text.size()) {
 		errors_.push_back("could not parse integer");
 		return nullptr;
 	}
@@ -190,8 +189,8 @@ unique_ptr<Expression> Parser::parse_integer_literal() {
 	return lit;
 }
 
-unique_ptr<Expression> Parser::parse_prefix_expression() {
-	auto exp = std::make_unique<PrefixExpression>();
+NodePtr<Expression> Parser::parse_prefix_expression() {
+	auto exp = make<PrefixExpression>();
 	exp->token = current_;
 	exp->opr = current_.literal;
 
@@ -201,21 +200,15 @@ unique_ptr<Expression> Parser::parse_prefix_expression() {
 	return exp;
 }
 
-Precedence Parser::peek_precedence() {
-	if (precedences.find(peek_.type) != precedences.end())
-		return precedences.at(peek_.type);
-	return LOWEST;
-}
+Precedence Parser::peek_precedence() { return precedence_of(peek_.type); }
 
 Precedence Parser::current_precedence() {
-	if (precedences.find(current_.type) != precedences.end())
-		return precedences.at(current_.type);
-	return LOWEST;
+	return precedence_of(current_.type);
 }
 
-unique_ptr<Expression>
-Parser::parse_infix_expression(unique_ptr<Expression> left) {
-	auto exp = std::make_unique<InfixExpression>();
+NodePtr<Expression>
+Parser::parse_infix_expression(NodePtr<Expression> left) {
+	auto exp = make<InfixExpression>();
 	exp->token = current_;
 	exp->opr = current_.literal;
 	exp->left = std::move(left);
@@ -227,7 +220,7 @@ Parser::parse_infix_expression(unique_ptr<Expression> left) {
 	return exp;
 }
 
-unique_ptr<Expression> Parser::parse_grouped_expression() {
+NodePtr<Expression> Parser::parse_grouped_expression() {
 	next_token();
 	auto exp = parse_expression(LOWEST);
 	if (!expect_peek(tokentypes::RPAREN))
@@ -236,16 +229,16 @@ unique_ptr<Expression> Parser::parse_grouped_expression() {
 	return exp;
 }
 
-unique_ptr<Expression> Parser::parse_boolean() {
-	auto exp = std::make_unique<BooleanExpression>();
+NodePtr<Expression> Parser::parse_boolean() {
+	auto exp = make<BooleanExpression>();
 	exp->token = current_;
 	exp->value = current_token_is(tokentypes::TRUE);
 
 	return exp;
 }
 
-unique_ptr<Expression> Parser::parse_if_expression() {
-	auto exp = std::make_unique<IfExpression>();
+NodePtr<Expression> Parser::parse_if_expression() {
+	auto exp = make<IfExpression>();
 	exp->token = current_;
 
 	if (!expect_peek(tokentypes::LPAREN))
@@ -275,10 +268,10 @@ unique_ptr<Expression> Parser::parse_if_expression() {
 	return exp;
 }
 
-unique_ptr<BlockStatement> Parser::parse_block_statement() {
-	auto block = std::make_unique<BlockStatement>();
+NodePtr<BlockStatement> Parser::parse_block_statement() {
+	auto block = make<BlockStatement>();
 	block->token = current_;
-	block->statements = std::vector<unique_ptr<Statement>>();
+	std::vector<NodePtr<Statement>> statements;
 
 	next_token();
 
@@ -286,16 +279,17 @@ unique_ptr<BlockStatement> Parser::parse_block_statement() {
 				 !current_token_is(tokentypes::EOFF)) {
 		auto stmt = parse_statement();
 		if (stmt != nullptr) {
-			block->statements.push_back(std::move(stmt));
+			statements.push_back(stmt);
 		}
 		next_token();
 	}
 
+	block->statements = arena_->list(statements);
 	return block;
 }
 
-unique_ptr<Expression> Parser::parse_function_literal() {
-	auto lit = std::make_unique<FunctionLiteral>();
+NodePtr<Expression> Parser::parse_function_literal() {
+	auto lit = make<FunctionLiteral>();
 	lit->token = current_;
 
 	if (!expect_peek(tokentypes::LPAREN))
@@ -311,39 +305,39 @@ unique_ptr<Expression> Parser::parse_function_literal() {
 	return lit;
 }
 
-std::vector<unique_ptr<Identifier>> Parser::parse_function_params() {
-	std::vector<unique_ptr<Identifier>> params;
+ArenaList<NodePtr<Identifier>> Parser::parse_function_params() {
+	std::vector<NodePtr<Identifier>> params;
 	if (peek_token_is(tokentypes::LPAREN)) {
 		next_token();
-		return params;
+		return ArenaList<NodePtr<Identifier>>();
 	}
 
 	next_token();
 
-	auto ident = std::make_unique<Identifier>();
+	auto ident = make<Identifier>();
 	ident->token = current_;
-	ident->value = current_.literal;
+	ident->value = arena_->intern(current_.literal);
 	params.push_back(std::move(ident));
 
 	while (peek_token_is(tokentypes::COMMA)) {
 		next_token();
 		next_token();
 
-		auto ident = std::make_unique<Identifier>();
+		auto ident = make<Identifier>();
 		ident->token = current_;
-		ident->value = current_.literal;
+		ident->value = arena_->intern(current_.literal);
 		params.push_back(std::move(ident));
 	}
 
 	if (!expect_peek(tokentypes::RPAREN))
-		return std::vector<unique_ptr<Identifier>>();
+		return ArenaList<NodePtr<Identifier>>();
 
-	return params;
+	return arena_->list(params);
 }
 
-unique_ptr<Expression>
-Parser::parse_call_expression(unique_ptr<Expression> func) {
-	auto exp = std::make_unique<CallExpression>();
+NodePtr<Expression>
+Parser::parse_call_expression(NodePtr<Expression> func) {
+	auto exp = make<CallExpression>();
 	exp->token = current_;
 	exp->func = std::move(func);
 	exp->arguments = std::move(parse_expression_list(tokentypes::RPAREN));
@@ -351,28 +345,28 @@ Parser::parse_call_expression(unique_ptr<Expression> func) {
 	return exp;
 }
 
-unique_ptr<Expression> Parser::parse_string_literal() {
-	auto strlit = std::make_unique<StringLiteral>();
+NodePtr<Expression> Parser::parse_string_literal() {
+	auto strlit = make<StringLiteral>();
 	strlit->token = current_;
 	strlit->value = current_.literal;
 
 	return strlit;
 }
 
-unique_ptr<Expression> Parser::parse_array_literal() {
-	auto arr = std::make_unique<ArrayLiteral>();
+NodePtr<Expression> Parser::parse_array_literal() {
+	auto arr = make<ArrayLiteral>();
 	arr->token = current_;
 	arr->elements = std::move(parse_expression_list(tokentypes::RBRACKET));
 
 	return arr;
 }
 
-std::vector<unique_ptr<Expression>>
+ArenaList<NodePtr<Expression>>
 Parser::parse_expression_list(TokenType end) {
-	std::vector<unique_ptr<Expression>> expressions;
+	std::vector<NodePtr<Expression>> expressions;
 	if (peek_token_is(end)) {
 		next_token();
-		return expressions;
+		return ArenaList<NodePtr<Expression>>();
 	}
 
 	next_token();
@@ -385,17 +379,17 @@ Parser::parse_expression_list(TokenType end) {
 	}
 
 	if (!expect_peek(end))
-		return std::vector<unique_ptr<Expression>>();
+		return ArenaList<NodePtr<Expression>>();
 
-	return expressions;
+	return arena_->list(expressions);
 }
 
-std::vector<unique_ptr<Expression>> Parser::parse_call_arguments() {
-	std::vector<unique_ptr<Expression>> args;
+ArenaList<NodePtr<Expression>> Parser::parse_call_arguments() {
+	std::vector<NodePtr<Expression>> args;
 
 	if (peek_token_is(tokentypes::RPAREN)) {
 		next_token();
-		return args;
+		return ArenaList<NodePtr<Expression>>();
 	}
 
 	next_token();
@@ -409,14 +403,14 @@ std::vector<unique_ptr<Expression>> Parser::parse_call_arguments() {
 	}
 
 	if (!expect_peek(tokentypes::RPAREN))
-		return std::vector<unique_ptr<Expression>>();
+		return ArenaList<NodePtr<Expression>>();
 
-	return args;
+	return arena_->list(args);
 }
 
-std::unique_ptr<Expression>
-Parser::parse_index_expression(std::unique_ptr<Expression> left) {
-	auto exp = std::make_unique<IndexExpression>();
+NodePtr<Expression>
+Parser::parse_index_expression(NodePtr<Expression> left) {
+	auto exp = make<IndexExpression>();
 	exp->token = current_;
 	exp->left = std::move(left);
 
@@ -428,9 +422,9 @@ Parser::parse_index_expression(std::unique_ptr<Expression> left) {
 	return exp;
 }
 
-unique_ptr<Expression> Parser::parse_hash_literal() {
-	auto hash = std::make_unique<HashLiteral>();
-	std::vector<std::pair<unique_ptr<Expression>, unique_ptr<Expression>>> pairs;
+NodePtr<Expression> Parser::parse_hash_literal() {
+	auto hash = make<HashLiteral>();
+	std::vector<std::pair<NodePtr<Expression>, NodePtr<Expression>>> pairs;
 
 	while (!peek_token_is(tokentypes::RBRACE)) {
 		next_token();
@@ -450,7 +444,7 @@ unique_ptr<Expression> Parser::parse_hash_literal() {
 	if (!expect_peek(tokentypes::RBRACE))
 		return nullptr;
 
-	hash->pairs = std::move(pairs);
+	hash->pairs = arena_->list(pairs);
 
 	return hash;
 }
@@ -458,8 +452,9 @@ unique_ptr<Expression> Parser::parse_hash_literal() {
 std::vector<std::string> Parser::errors() const { return errors_; }
 
 void Parser::peek_error(TokenType tt) {
-	std::string err =
-			"expected next token to be " + tt + " got " + peek_.type + " instead";
+	std::string err = std::string("expected next token to be ") +
+										tokentypes::name(tt) + " got " +
+										tokentypes::name(peek_.type) + " instead";
 	errors_.push_back(err);
 }
 
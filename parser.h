@@ -5,12 +5,11 @@
 #include "lexer.h"
 #include "token.h"
 #include <memory>
-#include <unordered_map>
 
 class Parser;
-typedef std::unique_ptr<Expression> (Parser::*PrefixParseFn)();
-typedef std::unique_ptr<Expression> (Parser::*InfixParseFn)(
-		std::unique_ptr<Expression>);
+typedef NodePtr<Expression> (Parser::*PrefixParseFn)();
+typedef NodePtr<Expression> (Parser::*InfixParseFn)(
+		NodePtr<Expression>);
 
 
 // TODO: make scoped enum
@@ -25,18 +24,29 @@ enum Precedence {
 	INDEX,
 };
 
-const std::unordered_map<TokenType, Precedence> precedences = {
-		{tokentypes::EQ, EQUALS},
-		{tokentypes::NEQ, EQUALS},
-		{tokentypes::LT, LESSGREATER},
-		{tokentypes::GT, LESSGREATER},
-		{tokentypes::PLUS, SUM},
-		{tokentypes::MINUS, SUM},
-		{tokentypes::SLASH, PRODUCT},
-		{tokentypes::ASTERISK, PRODUCT},
-		{tokentypes::LPAREN, CALL},
-		{tokentypes::LBRACKET, INDEX},
-};
+// precedence_of returns the precedence of a token as an infix operator.
+inline Precedence precedence_of(TokenType tt) {
+	switch (tt) {
+	case tokentypes::EQ:
+	case tokentypes::NEQ:
+		return EQUALS;
+	case tokentypes::LT:
+	case tokentypes::GT:
+		return LESSGREATER;
+	case tokentypes::PLUS:
+	case tokentypes::MINUS:
+		return SUM;
+	case tokentypes::SLASH:
+	case tokentypes::ASTERISK:
+		return PRODUCT;
+	case tokentypes::LPAREN:
+		return CALL;
+	case tokentypes::LBRACKET:
+		return INDEX;
+	default:
+		return LOWEST;
+	}
+}
 
 class Parser {
 public:
@@ -48,36 +58,41 @@ private:
 	Token current_;
 	Token peek_;
 
-	std::unordered_map<TokenType, PrefixParseFn> m_prefix_parse_fns;
-	std::unordered_map<TokenType, InfixParseFn> m_infix_parse_fns;
+	// the arena of the program being parsed, every node is allocated in it.
+	Arena *arena_;
+	template <typename T> T *make() { return arena_->make<T>(); }
+
+	// indexed by the token type, nullptr when a token has no parse function.
+	PrefixParseFn m_prefix_parse_fns[tokentypes::Count] = {};
+	InfixParseFn m_infix_parse_fns[tokentypes::Count] = {};
 	void add_prefix_parse(TokenType tt, PrefixParseFn fn);
 	void add_infix_parse(TokenType tt, InfixParseFn fn);
 
 	void next_token();
 
-	std::unique_ptr<Statement> parse_statement();
-	std::unique_ptr<Statement> parse_let_statement();
-	std::unique_ptr<Statement> parse_return_statement();
-	std::unique_ptr<Statement> parse_expression_statement();
-	std::unique_ptr<Expression> parse_expression(Precedence prec);
-	std::unique_ptr<Expression> parse_identifier();
-	std::unique_ptr<Expression> parse_integer_literal();
-	std::unique_ptr<Expression> parse_prefix_expression();
-	std::unique_ptr<Expression> parse_infix_expression(std::unique_ptr<Expression> left);
-	std::unique_ptr<Expression> parse_boolean();
-	std::unique_ptr<Expression> parse_grouped_expression();
-	std::unique_ptr<Expression> parse_if_expression();
-	std::unique_ptr<BlockStatement> parse_block_statement();
-	std::unique_ptr<Expression> parse_function_literal();
-	std::unique_ptr<Expression> parse_string_literal();
-	std::unique_ptr<Expression> parse_call_expression(std::unique_ptr<Expression> func);
-	std::unique_ptr<Expression> parse_array_literal();
-	std::unique_ptr<Expression> parse_hash_literal();
-	std::unique_ptr<Expression> parse_index_expression(std::unique_ptr<Expression> left);
-	std::vector<std::unique_ptr<Expression>> parse_expression_list(TokenType end);
+	NodePtr<Statement> parse_statement();
+	NodePtr<Statement> parse_let_statement();
+	NodePtr<Statement> parse_return_statement();
+	NodePtr<Statement> parse_expression_statement();
+	NodePtr<Expression> parse_expression(Precedence prec);
+	NodePtr<Expression> parse_identifier();
+	NodePtr<Expression> parse_integer_literal();
+	NodePtr<Expression> parse_prefix_expression();
+	NodePtr<Expression> parse_infix_expression(NodePtr<Expression> left);
+	NodePtr<Expression> parse_boolean();
+	NodePtr<Expression> parse_grouped_expression();
+	NodePtr<Expression> parse_if_expression();
+	NodePtr<BlockStatement> parse_block_statement();
+	NodePtr<Expression> parse_function_literal();
+	NodePtr<Expression> parse_string_literal();
+	NodePtr<Expression> parse_call_expression(NodePtr<Expression> func);
+	NodePtr<Expression> parse_array_literal();
+	NodePtr<Expression> parse_hash_literal();
+	NodePtr<Expression> parse_index_expression(NodePtr<Expression> left);
+	ArenaList<NodePtr<Expression>> parse_expression_list(TokenType end);
 
-	std::vector<std::unique_ptr<Identifier>> parse_function_params();
-	std::vector<std::unique_ptr<Expression>> parse_call_arguments();
+	ArenaList<NodePtr<Identifier>> parse_function_params();
+	ArenaList<NodePtr<Expression>> parse_call_arguments();
 
 	Precedence peek_precedence();
 	Precedence current_precedence();
@@ -0,0 +1,236 @@
+#ifndef LUPS_PERSISTENT_VECTOR_H
+#define LUPS_PERSISTENT_VECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+class Object;
+class Heap;
+
+// PersistentVector holds the elements of an array. It is a trie of 32 wide
+// nodes with the last leaf kept outside of it as the tail, like the vectors of
+// Clojure. Copies share their nodes and an update never changes what another
+// copy sees, so arrays can be derived from each other without copying:
+//   - push_back is amortized O(1). It appends to the tail and moves the tail
+//     into the trie once it is full, which copies at most one path of nodes.
+//   - drop_front is O(1). The vector only skips its first element, which stays
+//     alive for as long as the nodes holding it do.
+//   - indexing walks at most log32(n) nodes.
+// The nodes are reference counted, the objects in them are owned by the
+// garbage collector.
+class PersistentVector {
+public:
+	static constexpr int Bits = 5;
+	static constexpr int Width = 1 << Bits;
+	static constexpr std::size_t Mask = Width - 1;
+
+	// Node is a leaf of objects or an interior node of nodes.
+	struct Node {
+		explicit Node(bool is_leaf) : leaf(is_leaf) {
+			std::memset(children, 0, sizeof(children));
+		}
+
+		std::uint32_t refs = 1;
+		bool leaf;
+
+		// the leaf slots that have been written by any vector. A vector whose tail
+		// ends at filled may append to the leaf in place, the others copy it first.
+		std::uint8_t filled = 0;
+
+		// garbage collection bookkeeping, see Heap::trace_node.
+		bool gc_young = true;
+		std::uint32_t gc_epoch = 0;
+
+		union {
+			Object *elements[Width];
+			Node *children[Width];
+		};
+	};
+
+	class const_iterator {
+	public:
+		const_iterator(const PersistentVector *vec, std::size_t index)
+				: vec_(vec), index_(index), leaf_(nullptr) {}
+
+		Object *operator*() {
+			if (leaf_ == nullptr)
+				leaf_ = vec_->leaf_for(index_);
+			return leaf_->elements[index_ & Mask];
+		}
+
+		const_iterator &operator++() {
+			++index_;
+			if ((index_ & Mask) == 0)
+				leaf_ = nullptr;
+			return *this;
+		}
+
+		bool operator==(const const_iterator &other) const {
+			return index_ == other.index_;
+		}
+		bool operator!=(const const_iterator &other) const {
+			return index_ != other.index_;
+		}
+
+	private:
+		const PersistentVector *vec_;
+		std::size_t index_;
+		Node *leaf_;
+	};
+
+	PersistentVector()
+			: root_(nullptr), tail_(nullptr), start_(0), count_(0), shift_(Bits) {}
+
+	PersistentVector(const PersistentVector &other)
+			: root_(other.root_), tail_(other.tail_), start_(other.start_),
+				count_(other.count_), shift_(other.shift_) {
+		retain(root_);
+		retain(tail_);
+	}
+
+	PersistentVector(PersistentVector &&other) noexcept : PersistentVector() {
+		swap(other);
+	}
+
+	PersistentVector &operator=(PersistentVector other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	~PersistentVector() {
+		release(root_);
+		release(tail_);
+	}
+
+	void swap(PersistentVector &other) noexcept {
+		std::swap(root_, other.root_);
+		std::swap(tail_, other.tail_);
+		std::swap(start_, other.start_);
+		std::swap(count_, other.count_);
+		std::swap(shift_, other.shift_);
+	}
+
+	std::size_t size() const { return count_ - start_; }
+	bool empty() const { return count_ == start_; }
+
+	Object *operator[](std::size_t index) const {
+		const auto i = start_ + index;
+		return leaf_for(i)->elements[i & Mask];
+	}
+	Object *front() const { return (*this)[0]; }
+	Object *back() const { return (*this)[size() - 1]; }
+
+	const_iterator begin() const { return const_iterator(this, start_); }
+	const_iterator end() const { return const_iterator(this, count_); }
+
+	void push_back(Object *obj) {
+		auto used = count_ - tail_offset();
+		if (tail_ == nullptr) {
+			tail_ = new Node(true);
+		} else if (used == Width) {
+			push_tail();
+			tail_ = new Node(true);
+			used = 0;
+		} else if (tail_->filled != used) {
+			// another copy has appended to the leaf already.
+			auto leaf = new Node(true);
+			std::memcpy(leaf->elements, tail_->elements, used * sizeof(Object *));
+			leaf->filled = used;
+			release(tail_);
+			tail_ = leaf;
+		}
+
+		tail_->elements[used] = obj;
+		tail_->filled = used + 1;
+		tail_->gc_young = true;
+		++count_;
+	}
+
+	// drop_front removes the first element, the vector must not be empty.
+	void drop_front() { ++start_; }
+
+private:
+	friend class Heap;
+
+	// the index of the first element in the tail, indexes count every element
+	// the nodes hold including the dropped ones.
+	std::size_t tail_offset() const {
+		return count_ < Width ? 0 : ((count_ - 1) >> Bits) << Bits;
+	}
+
+	Node *leaf_for(std::size_t index) const {
+		if (index >= tail_offset())
+			return tail_;
+
+		auto node = root_;
+		for (auto level = shift_; level > 0; level -= Bits)
+			node = node->children[(index >> level) & Mask];
+		return node;
+	}
+
+	// push_tail moves the full tail into the trie, adding a level on top when
+	// the trie is full.
+	void push_tail() {
+		if (root_ != nullptr && (count_ >> Bits) > ((std::size_t)1 << shift_)) {
+			auto root = new Node(false);
+			root->children[0] = root_;
+			root_ = root;
+			shift_ += Bits;
+		}
+
+		root_ = push_tail(shift_, root_);
+		tail_ = nullptr;
+	}
+
+	Node *push_tail(int level, Node *parent) {
+		auto node = parent == nullptr ? new Node(false) : writable(parent);
+		const auto index = ((count_ - 1) >> level) & Mask;
+		if (level == Bits)
+			node->children[index] = tail_;
+		else
+			node->children[index] = push_tail(level - Bits, node->children[index]);
+		node->gc_young = true;
+
+		return node;
+	}
+
+	// writable takes over a reference to an interior node and returns a node the
+	// caller may change, which is a copy unless nobody else holds the node.
+	static Node *writable(Node *node) {
+		if (node->refs == 1)
+			return node;
+
+		auto copy = new Node(false);
+		std::memcpy(copy->children, node->children, sizeof(node->children));
+		for (auto child : copy->children)
+			retain(child);
+		--node->refs;
+
+		return copy;
+	}
+
+	static void retain(Node *node) {
+		if (node != nullptr)
+			++node->refs;
+	}
+
+	static void release(Node *node) {
+		if (node == nullptr || --node->refs != 0)
+			return;
+
+		if (!node->leaf)
+			for (auto child : node->children)
+				release(child);
+		delete node;
+	}
+
+	Node *root_;
+	Node *tail_;
+	std::size_t start_;
+	std::size_t count_;
+	int shift_;
+};
+
+#endif
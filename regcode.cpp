@@ -0,0 +1,82 @@
+#include "regcode.h"
+#include <cstdio>
+
+namespace {
+// Format is how an instruction is printed, every character of operands is the
+// kind of the next operand: 'r' for a register, 'k' for a register or a
+// constant and 'n' for a plain number.
+struct Format {
+	const char *name;
+	const char *operands;
+};
+
+// the order has to match reg::Opcode.
+const Format formats[] = {
+		{"OpMove", "rk"},
+		{"OpLoadBool", "rn"},
+		{"OpLoadNull", "r"},
+		{"OpGetGlobal", "rn"},
+		{"OpSetGlobal", "nk"},
+		{"OpGetBuiltin", "rn"},
+		{"OpGetFree", "rn"},
+		{"OpAdd", "rkk"},
+		{"OpSub", "rkk"},
+		{"OpMul", "rkk"},
+		{"OpDiv", "rkk"},
+		{"OpEqual", "rkk"},
+		{"OpNotEqual", "rkk"},
+		{"OpGreaterThan", "rkk"},
+		{"OpMinus", "rk"},
+		{"OpBang", "rk"},
+		{"OpJump", "n"},
+		{"OpJumpNotTruthy", "nr"},
+		{"OpTestGreaterThan", "nkk"},
+		{"OpTestEqual", "nkk"},
+		{"OpTestNotEqual", "nkk"},
+		{"OpArray", "rrn"},
+		{"OpHash", "rrn"},
+		{"OpIndex", "rkk"},
+		{"OpClosure", "rnn"},
+		{"OpCall", "rn"},
+		{"OpReturn", "k"},
+		{"OpReturnNull", ""},
+		{"OpHalt", ""},
+};
+static_assert(sizeof(formats) / sizeof(formats[0]) == reg::OpHalt + 1,
+							"every register opcode needs a format");
+
+std::string format_operand(char kind, std::uint16_t operand) {
+	if (kind == 'n')
+		return std::to_string(operand);
+	if (kind == 'k' && reg::is_constant(operand))
+		return "k" + std::to_string(operand & ~reg::ConstantBit);
+	return "r" + std::to_string(operand);
+}
+} // namespace
+
+std::string reg::opcode_name(Opcode op) {
+	if (op > OpHalt)
+		return "unknown opcode " + std::to_string(op);
+	return formats[op].name;
+}
+
+std::string reg::instructions_to_string(const Instructions &ins) {
+	std::string res;
+	for (int i = 0; i < (int)ins.size(); ++i) {
+		char pos[16];
+		std::snprintf(pos, sizeof(pos), "%04d ", i);
+		res += pos + opcode_name(ins[i].op);
+		if (ins[i].op > OpHalt) {
+			res += '\n';
+			continue;
+		}
+
+		const std::uint16_t operands[] = {ins[i].a, ins[i].b, ins[i].c};
+		const auto kinds = formats[ins[i].op].operands;
+		for (int j = 0; kinds[j] != '\0'; ++j)
+			res += " " + format_operand(kinds[j], operands[j]);
+		res += '\n';
+	}
+
+	return res;
+}
@@ -0,0 +1,106 @@
+#ifndef LUPS_REGCODE_H
+#define LUPS_REGCODE_H
+
+#include "object.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The instruction set of the register vm. Every instruction is a fixed size
+// record of an opcode and three 16 bit operands, a is usually the register the
+// result is written to. The registers are numbered from the start of the
+// frame: a function's parameters come first, then its other locals and then
+// the temporaries of its expressions.
+//
+// Operands named rk are either a register or, when ConstantBit is set, an
+// index into the constant pool. This lets instructions like OpAdd take a
+// literal directly instead of loading it into a register first.
+namespace reg {
+static constexpr std::uint16_t ConstantBit = 0x8000;
+
+// the highest register and constant index an operand can address.
+static constexpr int MaxRegisters = ConstantBit;
+static constexpr int MaxConstants = ConstantBit;
+
+enum Opcode : std::uint8_t {
+	OpMove,        // a = rk(b)
+	OpLoadBool,    // a = b != 0
+	OpLoadNull,    // a = null
+	OpGetGlobal,   // a = globals[b]
+	OpSetGlobal,   // globals[a] = rk(b)
+	OpGetBuiltin,  // a = builtins[b]
+	OpGetFree,     // a = the closure's free variable b
+
+	OpAdd,         // a = rk(b) + rk(c)
+	OpSub,         // a = rk(b) - rk(c)
+	OpMul,         // a = rk(b) * rk(c)
+	OpDiv,         // a = rk(b) / rk(c)
+	OpEqual,       // a = rk(b) == rk(c)
+	OpNotEqual,    // a = rk(b) != rk(c)
+	OpGreaterThan, // a = rk(b) > rk(c), less than swaps the operands
+	OpMinus,       // a = -rk(b)
+	OpBang,        // a = !rk(b)
+
+	// jumps go to the instruction with index a in the function. The test
+	// instructions fuse a comparison with the jump of an if, they jump unless
+	// the comparison of rk(b) and rk(c) holds.
+	OpJump,               // goto a
+	OpJumpNotTruthy,      // if !b goto a
+	OpTestGreaterThan,    // if !(rk(b) > rk(c)) goto a
+	OpTestEqual,          // if !(rk(b) == rk(c)) goto a
+	OpTestNotEqual,       // if !(rk(b) != rk(c)) goto a
+
+	OpArray,       // a = [b, ..., b + c - 1]
+	OpHash,        // a = {b: b + 1, ..., b + c - 2: b + c - 1}
+	OpIndex,       // a = rk(b)[rk(c)]
+
+	// OpClosure makes a closure of the function in constant b that captures the
+	// c registers starting at a, the closure replaces the first of them.
+	OpClosure,
+
+	// OpCall calls the function in a with the b arguments in the registers after
+	// it. The callee's frame starts at a + 1, so the arguments already are its
+	// first registers, and the result is written back to a.
+	OpCall,
+	OpReturn,      // return rk(a)
+	OpReturnNull,  // return null
+
+	// OpHalt ends the main program like in the stack vm.
+	OpHalt,
+};
+
+struct Instruction {
+	Opcode op;
+	std::uint16_t a;
+	std::uint16_t b;
+	std::uint16_t c;
+};
+
+typedef std::vector<Instruction> Instructions;
+
+inline bool is_constant(std::uint16_t rk) { return (rk & ConstantBit) != 0; }
+inline std::uint16_t constant(int index) {
+	return (std::uint16_t)(index | ConstantBit);
+}
+
+std::string opcode_name(Opcode op);
+std::string instructions_to_string(const Instructions &ins);
+} // namespace reg
+
+// RegisterFunction is a function compiled for the register vm. It is a
+// CompiledFunction, so the closures, the garbage collector and the builtins
+// treat it like any other function, but it carries register code instead of
+// stack code.
+class RegisterFunction : public CompiledFunction {
+public:
+	RegisterFunction(reg::Instructions code, int num_locals, int num_registers)
+			: CompiledFunction(code::Instructions(), num_locals),
+				m_code(std::move(code)), m_num_registers(num_registers) {}
+
+	reg::Instructions m_code;
+
+	// the size of the function's frame, its locals and temporaries.
+	int m_num_registers;
+};
+
+#endif
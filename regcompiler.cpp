@@ -0,0 +1,566 @@
+#include "regcompiler.h"
+#include "builtins.h"
+#include <algorithm>
+
+namespace {
+// the largest function whose instructions the jumps can address.
+constexpr int MaxInstructions = 0xffff;
+
+// count_lets returns the amount of let statements that define a local in the
+// function the node is part of, the ones in nested functions belong to those.
+int count_lets(const Node &node) {
+	switch (node.Type()) {
+	case AstType::LetStatement:
+		return 1 + count_lets(*static_cast<const LetStatement &>(node).value);
+	case AstType::ReturnStatement:
+		return count_lets(
+				*static_cast<const ReturnStatement &>(node).return_value);
+	case AstType::ExpressionStatement:
+		return count_lets(
+				*static_cast<const ExpressionStatement &>(node).expression);
+	case AstType::BlockStatement: {
+		int lets = 0;
+		for (const auto &st : static_cast<const BlockStatement &>(node).statements)
+			lets += count_lets(*st);
+		return lets;
+	}
+	case AstType::IfExpression: {
+		const auto &ifx = static_cast<const IfExpression &>(node);
+		return count_lets(*ifx.cond) + count_lets(*ifx.after) +
+					 (ifx.other != nullptr ? count_lets(*ifx.other) : 0);
+	}
+	case AstType::InfixExpression: {
+		const auto &infx_exp = static_cast<const InfixExpression &>(node);
+		return count_lets(*infx_exp.left) + count_lets(*infx_exp.right);
+	}
+	case AstType::PrefixExpression:
+		return count_lets(*static_cast<const PrefixExpression &>(node).right);
+	case AstType::CallExpression: {
+		const auto &call_exp = static_cast<const CallExpression &>(node);
+		int lets = count_lets(*call_exp.func);
+		for (const auto &arg : call_exp.arguments)
+			lets += count_lets(*arg);
+		return lets;
+	}
+	case AstType::ArrayLiteral: {
+		int lets = 0;
+		for (const auto &el : static_cast<const ArrayLiteral &>(node).elements)
+			lets += count_lets(*el);
+		return lets;
+	}
+	case AstType::HashLiteral: {
+		int lets = 0;
+		for (const auto &pr : static_cast<const HashLiteral &>(node).pairs)
+			lets += count_lets(*pr.first) + count_lets(*pr.second);
+		return lets;
+	}
+	case AstType::IndexExpression: {
+		const auto &index_exp = static_cast<const IndexExpression &>(node);
+		return count_lets(*index_exp.left) + count_lets(*index_exp.index);
+	}
+	default:
+		return 0;
+	}
+}
+
+// test_opcode returns the test instruction for a comparison operator
+// and whether its operands have to be swapped, or OpHalt for other operators.
+std::pair<reg::Opcode, bool> test_opcode(std::string_view opr) {
+	if (opr == ">")
+		return {reg::OpTestGreaterThan, false};
+	if (opr == "<")
+		return {reg::OpTestGreaterThan, true};
+	if (opr == "==")
+		return {reg::OpTestEqual, false};
+	if (opr == "!=")
+		return {reg::OpTestNotEqual, false};
+	return {reg::OpHalt, false};
+}
+} // namespace
+
+RegisterCompiler::RegisterCompiler() {
+	symbol_table_ = new SymbolTable();
+	for (int i = 0; i < (int)builtin_functions::functions.size(); ++i)
+		symbol_table_->define_builtin(i, builtin_functions::functions[i].first);
+
+	// the main program only keeps its result in a register of its own, its lets
+	// are globals.
+	scopes_.push_back(FunctionScope{reg::Instructions(), ResultRegister + 1,
+																	ResultRegister + 1, ResultRegister + 1});
+}
+
+std::optional<std::string> RegisterCompiler::compile(const Program &program) {
+	for (const auto &statement : program.statements) {
+		const auto err = compile_statement(*statement);
+		if (err.has_value())
+			return err->message();
+	}
+	emit(reg::OpHalt);
+
+	if (scope().num_registers > reg::MaxRegisters)
+		return CompileError{CompileErrorCode::RegisterLimit, "registers"}
+				.message();
+	if ((int)scope().code.size() > MaxInstructions)
+		return CompileError{CompileErrorCode::RegisterLimit, "instructions"}
+				.message();
+	if ((int)constants_.size() > reg::MaxConstants)
+		return CompileError{CompileErrorCode::RegisterLimit, "constants"}
+				.message();
+
+	return std::nullopt;
+}
+
+RegisterBytecode *RegisterCompiler::bytecode() {
+	return new RegisterBytecode{scopes_[0].code, scopes_[0].num_registers,
+															constants_};
+}
+
+std::optional<CompileError>
+RegisterCompiler::compile_statement(const Statement &stmt) {
+	const auto saved = scope().next_temp;
+	std::optional<CompileError> err;
+
+	switch (stmt.Type()) {
+	case AstType::LetStatement: {
+		const auto &letexp = static_cast<const LetStatement &>(stmt);
+		const auto symbol =
+				symbol_table_->define(std::string(letexp.name->value));
+		if (symbol.scope == scopes::LocalScope) {
+			err = compile_into(*letexp.value, symbol.index);
+			break;
+		}
+
+		std::uint16_t value;
+		err = compile_operand(*letexp.value, value);
+		if (!err.has_value())
+			emit(reg::OpSetGlobal, symbol.index, value);
+		break;
+	}
+	case AstType::ReturnStatement: {
+		std::uint16_t value;
+		err = compile_operand(
+				*static_cast<const ReturnStatement &>(stmt).return_value, value);
+		if (!err.has_value())
+			emit(reg::OpReturn, value);
+		break;
+	}
+	case AstType::ExpressionStatement: {
+		const auto &exp = *static_cast<const ExpressionStatement &>(stmt).expression;
+		err = compile_into(exp, scopes_.size() == 1 ? ResultRegister : temp());
+		break;
+	}
+	case AstType::BlockStatement:
+		for (const auto &st : static_cast<const BlockStatement &>(stmt).statements) {
+			err = compile_statement(*st);
+			if (err.has_value())
+				break;
+		}
+		break;
+	default:
+		break;
+	}
+
+	scope().next_temp = saved;
+	return err;
+}
+
+// compile_block compiles a branch of an if expression, the value of its last
+// expression statement goes to dest. Like in the stack compiler a branch that
+// doesn't end in one leaves null, unless it returns.
+std::optional<CompileError>
+RegisterCompiler::compile_block(const BlockStatement &block, int dest) {
+	const auto &statements = block.statements;
+	const int size = (int)statements.size();
+	for (int i = 0; i < size - 1; ++i) {
+		const auto err = compile_statement(*statements[i]);
+		if (err.has_value())
+			return err;
+	}
+
+	if (size > 0 && statements[size - 1]->Type() == AstType::ExpressionStatement)
+		return compile_into(
+				*static_cast<const ExpressionStatement &>(*statements[size - 1])
+						 .expression,
+				dest);
+
+	if (size > 0) {
+		const auto err = compile_statement(*statements[size - 1]);
+		if (err.has_value())
+			return err;
+	}
+	if (size == 0 || statements[size - 1]->Type() != AstType::ReturnStatement)
+		emit(reg::OpLoadNull, dest);
+
+	return std::nullopt;
+}
+
+// compile_body compiles the body of a function, which returns the value of its
+// last expression statement.
+std::optional<CompileError>
+RegisterCompiler::compile_body(const BlockStatement &body) {
+	const auto &statements = body.statements;
+	const int size = (int)statements.size();
+	for (int i = 0; i < size - 1; ++i) {
+		const auto err = compile_statement(*statements[i]);
+		if (err.has_value())
+			return err;
+	}
+
+	if (size > 0 && statements[size - 1]->Type() == AstType::ExpressionStatement) {
+		std::uint16_t value;
+		const auto err = compile_operand(
+				*static_cast<const ExpressionStatement &>(*statements[size - 1])
+						 .expression,
+				value);
+		if (err.has_value())
+			return err;
+
+		emit(reg::OpReturn, value);
+		return std::nullopt;
+	}
+
+	if (size > 0) {
+		const auto err = compile_statement(*statements[size - 1]);
+		if (err.has_value())
+			return err;
+	}
+	if (size == 0 || statements[size - 1]->Type() != AstType::ReturnStatement)
+		emit(reg::OpReturnNull);
+
+	return std::nullopt;
+}
+
+std::optional<CompileError> RegisterCompiler::compile_into(const Expression &exp,
+																													 int dest) {
+	const auto saved = scope().next_temp;
+	std::optional<CompileError> err;
+
+	switch (exp.Type()) {
+	case AstType::IntegerLiteral:
+		emit(reg::OpMove, dest,
+				 reg::constant(add_integer_constant(
+						 static_cast<const IntegerLiteral &>(exp).value)));
+		break;
+	case AstType::StringLiteral:
+		emit(reg::OpMove, dest,
+				 reg::constant(add_string_constant(exp.TokenLiteral())));
+		break;
+	case AstType::BooleanExpression:
+		emit(reg::OpLoadBool, dest,
+				 static_cast<const BooleanExpression &>(exp).value ? 1 : 0);
+		break;
+	case AstType::Identifier: {
+		const auto &identifier = static_cast<const Identifier &>(exp);
+		const auto symbol = symbol_table_->resolve(std::string(identifier.value));
+		if (!symbol.has_value())
+			return CompileError{CompileErrorCode::UndefinedSymbol, identifier.value};
+
+		load_symbol(symbol.value(), dest);
+		break;
+	}
+	case AstType::PrefixExpression: {
+		const auto &prex = static_cast<const PrefixExpression &>(exp);
+		if (prex.opr != "!" && prex.opr != "-")
+			return CompileError{CompileErrorCode::UnknownPrefixOperator, prex.opr};
+
+		std::uint16_t right;
+		err = compile_operand(*prex.right, right);
+		if (!err.has_value())
+			emit(prex.opr == "!" ? reg::OpBang : reg::OpMinus, dest, right);
+		break;
+	}
+	case AstType::InfixExpression:
+		err = compile_infix(static_cast<const InfixExpression &>(exp), dest);
+		break;
+	case AstType::IfExpression:
+		err = compile_if(static_cast<const IfExpression &>(exp), dest);
+		break;
+	case AstType::FunctionLiteral:
+		err = compile_function(static_cast<const FunctionLiteral &>(exp), dest);
+		break;
+	case AstType::CallExpression:
+		err = compile_call(static_cast<const CallExpression &>(exp), dest);
+		break;
+	case AstType::ArrayLiteral: {
+		const auto &elements = static_cast<const ArrayLiteral &>(exp).elements;
+		const auto first = scope().next_temp;
+		for (const auto &el : elements) {
+			err = compile_into(*el, temp());
+			if (err.has_value())
+				break;
+		}
+		if (!err.has_value())
+			emit(reg::OpArray, dest, first, (int)elements.size());
+		break;
+	}
+	case AstType::HashLiteral: {
+		const auto &pairs = static_cast<const HashLiteral &>(exp).pairs;
+		const auto first = scope().next_temp;
+		for (const auto &pr : pairs) {
+			err = compile_into(*pr.first, temp());
+			if (!err.has_value())
+				err = compile_into(*pr.second, temp());
+			if (err.has_value())
+				break;
+		}
+		if (!err.has_value())
+			emit(reg::OpHash, dest, first, (int)pairs.size() * 2);
+		break;
+	}
+	case AstType::IndexExpression: {
+		const auto &index_exp = static_cast<const IndexExpression &>(exp);
+		std::uint16_t left, index;
+		err = compile_operand(*index_exp.left, left);
+		if (!err.has_value())
+			err = compile_operand(*index_exp.index, index);
+		if (!err.has_value())
+			emit(reg::OpIndex, dest, left, index);
+		break;
+	}
+	default:
+		break;
+	}
+
+	scope().next_temp = saved;
+	return err;
+}
+
+std::optional<CompileError>
+RegisterCompiler::compile_operand(const Expression &exp, std::uint16_t &rk) {
+	switch (exp.Type()) {
+	case AstType::IntegerLiteral:
+		rk = reg::constant(
+				add_integer_constant(static_cast<const IntegerLiteral &>(exp).value));
+		return std::nullopt;
+	case AstType::StringLiteral:
+		rk = reg::constant(add_string_constant(exp.TokenLiteral()));
+		return std::nullopt;
+	case AstType::Identifier: {
+		// a local is only written by its let, so it can be read in place.
+		const auto &identifier = static_cast<const Identifier &>(exp);
+		const auto symbol = symbol_table_->resolve(std::string(identifier.value));
+		if (symbol.has_value() && symbol->scope == scopes::LocalScope) {
+			rk = (std::uint16_t)symbol->index;
+			return std::nullopt;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	const auto reg = temp();
+	rk = (std::uint16_t)reg;
+	return compile_into(exp, reg);
+}
+
+std::optional<CompileError>
+RegisterCompiler::compile_infix(const InfixExpression &infx_exp, int dest) {
+	const auto &opr = infx_exp.opr;
+	reg::Opcode op;
+	if (opr == "+")
+		op = reg::OpAdd;
+	else if (opr == "-")
+		op = reg::OpSub;
+	else if (opr == "*")
+		op = reg::OpMul;
+	else if (opr == "/")
+		op = reg::OpDiv;
+	else if (opr == ">" || opr == "<")
+		op = reg::OpGreaterThan;
+	else if (opr == "==")
+		op = reg::OpEqual;
+	else if (opr == "!=")
+		op = reg::OpNotEqual;
+	else
+		return CompileError{CompileErrorCode::UnknownInfixOperator, opr};
+
+	std::uint16_t left, right;
+	auto err = compile_operand(*infx_exp.left, left);
+	if (err.has_value())
+		return err;
+
+	err = compile_operand(*infx_exp.right, right);
+	if (err.has_value())
+		return err;
+
+	// there is only a greater than instruction, less than swaps the operands.
+	if (opr == "<")
+		std::swap(left, right);
+
+	emit(op, dest, left, right);
+	return std::nullopt;
+}
+
+std::optional<CompileError> RegisterCompiler::compile_if(const IfExpression &ifx,
+																												 int dest) {
+	// a comparison in the condition is fused with the jump, there is no need for
+	// the boolean.
+	const auto saved = scope().next_temp;
+	int jump_pos;
+	const auto test = ifx.cond->Type() == AstType::InfixExpression
+												? test_opcode(
+															static_cast<const InfixExpression &>(*ifx.cond).opr)
+												: std::make_pair(reg::OpHalt, false);
+	if (test.first != reg::OpHalt) {
+		const auto &cond = static_cast<const InfixExpression &>(*ifx.cond);
+		std::uint16_t left, right;
+		auto err = compile_operand(*cond.left, left);
+		if (!err.has_value())
+			err = compile_operand(*cond.right, right);
+		if (err.has_value())
+			return err;
+
+		if (test.second)
+			std::swap(left, right);
+		jump_pos = emit(test.first, 0, left, right);
+	} else {
+		const auto cond = temp();
+		auto err = compile_into(*ifx.cond, cond);
+		if (err.has_value())
+			return err;
+
+		jump_pos = emit(reg::OpJumpNotTruthy, 0, cond);
+	}
+	scope().next_temp = saved;
+
+	auto err = compile_block(*ifx.after, dest);
+	if (err.has_value())
+		return err;
+
+	const auto jump_over_pos = emit(reg::OpJump);
+	patch_jump(jump_pos);
+
+	if (ifx.other == nullptr) {
+		emit(reg::OpLoadNull, dest);
+	} else {
+		err = compile_block(*ifx.other, dest);
+		if (err.has_value())
+			return err;
+	}
+	patch_jump(jump_over_pos);
+
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+RegisterCompiler::compile_function(const FunctionLiteral &func, int dest) {
+	// the locals are counted up front, so the temporaries can start right above
+	// them before all of the lets have been seen.
+	const int num_locals = (int)func.params.size() + count_lets(*func.body);
+	scopes_.push_back(
+			FunctionScope{reg::Instructions(), num_locals, num_locals, num_locals});
+	symbol_table_ = new SymbolTable(symbol_table_);
+	for (const auto &pr : func.params)
+		symbol_table_->define(std::string(pr->value));
+
+	auto err = compile_body(*func.body);
+	if (err.has_value())
+		return err;
+
+	auto fn_scope = std::move(scope());
+	scopes_.pop_back();
+	const auto free_symbols = symbol_table_->free_symbols_;
+	symbol_table_ = symbol_table_->outer_;
+
+	if (fn_scope.num_registers > reg::MaxRegisters)
+		return CompileError{CompileErrorCode::RegisterLimit, "registers"};
+	if ((int)fn_scope.code.size() > MaxInstructions)
+		return CompileError{CompileErrorCode::RegisterLimit, "instructions"};
+
+	auto fn = new RegisterFunction(std::move(fn_scope.code), num_locals,
+																 fn_scope.num_registers);
+	fn->m_num_parameters = func.params.size();
+	constants_.push_back(fn);
+	const int fn_index = (int)constants_.size() - 1;
+
+	if (free_symbols.empty()) {
+		emit(reg::OpClosure, dest, fn_index, 0);
+		return std::nullopt;
+	}
+
+	// the captured values are gathered in consecutive registers.
+	const auto first = scope().next_temp;
+	for (const auto &sym : free_symbols)
+		load_symbol(sym, temp());
+	emit(reg::OpClosure, first, fn_index, (int)free_symbols.size());
+	emit(reg::OpMove, dest, first);
+
+	return std::nullopt;
+}
+
+std::optional<CompileError>
+RegisterCompiler::compile_call(const CallExpression &call_exp, int dest) {
+	// the callee and the arguments have to be the topmost registers, since the
+	// callee's frame starts right after the callee. When dest is the topmost
+	// temporary the call is made in place.
+	const auto in_place =
+			dest >= scope().num_locals && dest + 1 == scope().next_temp;
+	const auto callee = in_place ? dest : temp();
+	auto err = compile_into(*call_exp.func, callee);
+	if (err.has_value())
+		return err;
+
+	for (const auto &arg : call_exp.arguments) {
+		err = compile_into(*arg, temp());
+		if (err.has_value())
+			return err;
+	}
+
+	emit(reg::OpCall, callee, (int)call_exp.arguments.size());
+	if (callee != dest)
+		emit(reg::OpMove, dest, callee);
+
+	return std::nullopt;
+}
+
+void RegisterCompiler::load_symbol(const Symbol &symbol, int dest) {
+	if (symbol.scope == scopes::GlobalScope)
+		emit(reg::OpGetGlobal, dest, symbol.index);
+	else if (symbol.scope == scopes::LocalScope && symbol.index != dest)
+		emit(reg::OpMove, dest, symbol.index);
+	else if (symbol.scope == scopes::BuiltinScope)
+		emit(reg::OpGetBuiltin, dest, symbol.index);
+	else if (symbol.scope == scopes::FreeScope)
+		emit(reg::OpGetFree, dest, symbol.index);
+}
+
+int RegisterCompiler::emit(reg::Opcode op, int a, int b, int c) {
+	auto &code = scope().code;
+	code.push_back(reg::Instruction{op, (std::uint16_t)a, (std::uint16_t)b,
+																	(std::uint16_t)c});
+	return (int)code.size() - 1;
+}
+
+// patch_jump points the jump at pos to the next instruction that is emitted.
+void RegisterCompiler::patch_jump(int pos) {
+	auto &code = scope().code;
+	code[pos].a = (std::uint16_t)code.size();
+}
+
+int RegisterCompiler::temp() {
+	auto &current = scope();
+	const auto reg = current.next_temp++;
+	current.num_registers = std::max(current.num_registers, current.next_temp);
+	return reg;
+}
+
+int RegisterCompiler::add_integer_constant(int value) {
+	const auto iter = integer_constants_.find(value);
+	if (iter != integer_constants_.end())
+		return iter->second;
+
+	constants_.push_back(new Integer(value));
+	integer_constants_[value] = (int)constants_.size() - 1;
+	return (int)constants_.size() - 1;
+}
+
+int RegisterCompiler::add_string_constant(const std::string &value) {
+	const auto iter = string_constants_.find(value);
+	if (iter != string_constants_.end())
+		return iter->second;
+
+	constants_.push_back(new String(value));
+	string_constants_[value] = (int)constants_.size() - 1;
+	return (int)constants_.size() - 1;
+}
@@ -0,0 +1,92 @@
+#ifndef LUPS_REGCOMPILER_H
+#define LUPS_REGCOMPILER_H
+
+#include "ast.h"
+#include "compiler.h"
+#include "regcode.h"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// RegisterBytecode is a program compiled for the register vm. Its functions
+// are RegisterFunctions in the constant pool.
+struct RegisterBytecode {
+	// the main program, ended by an OpHalt.
+	reg::Instructions instructions;
+	int num_registers;
+	std::vector<Object *> constants;
+};
+
+// RegisterCompiler compiles a program to three address code for the register
+// vm. It resolves names with the same symbol tables as the stack compiler, so
+// locals, globals, builtins and free variables get the same indexes, and a
+// local's index is the register it lives in.
+//
+// Every expression is compiled into a destination register. The temporaries
+// needed on the way are allocated above the locals like a stack and released
+// once the expression is done, so the operands of a call always end up in
+// consecutive registers.
+class RegisterCompiler {
+public:
+	// the expression statements of the main program leave their value in this
+	// register, the vm reports it as the result of the program.
+	static constexpr int ResultRegister = 0;
+
+	RegisterCompiler();
+
+	std::optional<std::string> compile(const Program &program);
+	RegisterBytecode *bytecode();
+
+private:
+	// FunctionScope is the function that is being compiled.
+	struct FunctionScope {
+		reg::Instructions code;
+		int num_locals;
+		int next_temp;
+		int num_registers;
+	};
+
+	std::optional<CompileError> compile_statement(const Statement &stmt);
+	std::optional<CompileError> compile_block(const BlockStatement &block,
+																						int dest);
+	std::optional<CompileError> compile_body(const BlockStatement &body);
+
+	// compile_into compiles an expression such that its value ends up in dest.
+	// dest is only written once everything else in the expression has run.
+	std::optional<CompileError> compile_into(const Expression &exp, int dest);
+
+	// compile_operand compiles an expression for an rk operand. Literals become
+	// constants and locals are used in place, everything else is computed into a
+	// new temporary.
+	std::optional<CompileError> compile_operand(const Expression &exp,
+																							std::uint16_t &rk);
+
+	std::optional<CompileError> compile_infix(const InfixExpression &infx_exp,
+																						int dest);
+	std::optional<CompileError> compile_if(const IfExpression &ifx, int dest);
+	std::optional<CompileError> compile_function(const FunctionLiteral &func,
+																							 int dest);
+	std::optional<CompileError> compile_call(const CallExpression &call_exp,
+																					 int dest);
+
+	void load_symbol(const Symbol &symbol, int dest);
+
+	int emit(reg::Opcode op, int a = 0, int b = 0, int c = 0);
+	void patch_jump(int pos);
+	int temp();
+
+	int add_integer_constant(int value);
+	int add_string_constant(const std::string &value);
+
+	FunctionScope &scope() { return scopes_.back(); }
+
+	std::vector<FunctionScope> scopes_;
+	SymbolTable *symbol_table_;
+
+	std::vector<Object *> constants_;
+	std::unordered_map<int, int> integer_constants_;
+	std::unordered_map<std::string, int> string_constants_;
+};
+
+#endif
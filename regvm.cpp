@@ -0,0 +1,459 @@
+#include "regvm.h"
+#include "builtins.h"
+#include "eval.h"
+#include <algorithm>
+
+RegisterVM::RegisterVM(RegisterBytecode *bytecode, GCConfig gc_config)
+		: heap_(gc_config) {
+	constants_.reserve(bytecode->constants.size());
+	for (auto constant : bytecode->constants) {
+		heap_.pin(constant);
+		constants_.push_back(object_to_value(constant));
+	}
+
+	heap_.pin(object_constant::null);
+	heap_.pin(object_constant::TRUE_OBJ);
+	heap_.pin(object_constant::FALSE_OBJ);
+	for (const auto &builtin : builtin_functions::functions)
+		heap_.pin(builtin.second);
+
+	registers_ = std::vector<Value>(RegisterFileSize);
+	globals_ = std::vector<Value>(GlobalsSize);
+
+	main_fn_ = std::make_unique<RegisterFunction>(
+			bytecode->instructions, 0, bytecode->num_registers);
+	main_closure_ = std::make_unique<Closure>(main_fn_.get());
+
+	frames_index_ = 1;
+	frames_[0] = RegisterFrame{main_closure_.get(), main_fn_->m_code.data(),
+														 main_fn_->m_code.data(), registers_.data(),
+														 main_fn_->m_num_registers};
+}
+
+// The dispatch loop is built like the one of the stack vm, with computed goto
+// when the compiler supports it and a switch otherwise. Every handler starts
+// with the instruction already decoded into inst and ip at the next one.
+#if defined(__GNUC__) && !defined(LUPS_SWITCH_DISPATCH)
+#define LUPS_COMPUTED_GOTO
+#endif
+
+#ifdef LUPS_COMPUTED_GOTO
+#define VM_TARGET(op) target_##op
+#define VM_DISPATCH()                                                          \
+	do {                                                                         \
+		inst = *ip++;                                                              \
+		goto *dispatch_table[inst.op];                                             \
+	} while (0)
+#else
+#define VM_TARGET(op) case reg::op
+#define VM_DISPATCH() goto dispatch
+#endif
+
+// VM_RK reads an rk operand, a register of the frame or a constant.
+#define VM_RK(operand)                                                         \
+	(reg::is_constant(operand) ? constants[(operand) & ~reg::ConstantBit]        \
+														 : base[operand])
+
+#define VM_LOAD_FRAME()                                                        \
+	do {                                                                         \
+		frame = &frames_[frames_index_ - 1];                                       \
+		code = frame->code;                                                        \
+		ip = frame->ip;                                                            \
+		base = frame->base;                                                        \
+	} while (0)
+
+// the integer cases are done in the handler, anything else takes the slow
+// path that the stack vm's generic instructions take as well.
+#define VM_ARITHMETIC(op, operator)                                            \
+	VM_TARGET(op) : {                                                            \
+		const auto left = VM_RK(inst.b);                                           \
+		const auto right = VM_RK(inst.c);                                          \
+		if (left.is_integer() && right.is_integer()) {                             \
+			base[inst.a] =                                                           \
+					Value::integer(left.as_integer() operator right.as_integer());       \
+			VM_DISPATCH();                                                           \
+		}                                                                          \
+                                                                               \
+		auto status = binary_operation(reg::op, left, right, base[inst.a]);        \
+		if (status.has_value())                                                    \
+			return status;                                                           \
+		VM_DISPATCH();                                                             \
+	}
+
+#define VM_TEST_GREATER_THAN(left, right, pass)                                \
+	do {                                                                         \
+		if (!(left).is_integer() || !(right).is_integer())                         \
+			return "comparison operator is not recognized";                         \
+		pass = (left).as_integer() > (right).as_integer();                         \
+	} while (0)
+
+std::optional<std::string> RegisterVM::run() {
+#ifdef LUPS_COMPUTED_GOTO
+	// the order has to match reg::Opcode.
+	static const void *dispatch_table[] = {
+			&&target_OpMove,
+			&&target_OpLoadBool,
+			&&target_OpLoadNull,
+			&&target_OpGetGlobal,
+			&&target_OpSetGlobal,
+			&&target_OpGetBuiltin,
+			&&target_OpGetFree,
+			&&target_OpAdd,
+			&&target_OpSub,
+			&&target_OpMul,
+			&&target_OpDiv,
+			&&target_OpEqual,
+			&&target_OpNotEqual,
+			&&target_OpGreaterThan,
+			&&target_OpMinus,
+			&&target_OpBang,
+			&&target_OpJump,
+			&&target_OpJumpNotTruthy,
+			&&target_OpTestGreaterThan,
+			&&target_OpTestEqual,
+			&&target_OpTestNotEqual,
+			&&target_OpArray,
+			&&target_OpHash,
+			&&target_OpIndex,
+			&&target_OpClosure,
+			&&target_OpCall,
+			&&target_OpReturn,
+			&&target_OpReturnNull,
+			&&target_OpHalt,
+	};
+	static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+										reg::OpHalt + 1,
+								"dispatch table doesn't cover every opcode");
+#endif
+
+	const Value *constants = constants_.data();
+	RegisterFrame *frame;
+	const reg::Instruction *code;
+	const reg::Instruction *ip;
+	Value *base;
+	reg::Instruction inst;
+	VM_LOAD_FRAME();
+
+#ifdef LUPS_COMPUTED_GOTO
+	VM_DISPATCH();
+#else
+dispatch:
+	inst = *ip++;
+	switch (inst.op) {
+#endif
+	VM_TARGET(OpMove) : {
+		base[inst.a] = VM_RK(inst.b);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpLoadBool) : {
+		base[inst.a] = Value::boolean(inst.b != 0);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpLoadNull) : {
+		base[inst.a] = Value::null();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetGlobal) : {
+		base[inst.a] = globals_[inst.b];
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpSetGlobal) : {
+		globals_[inst.a] = VM_RK(inst.b);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetBuiltin) : {
+		base[inst.a] = Value::object(builtin_functions::functions[inst.b].second);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetFree) : {
+		base[inst.a] = frame->cl->free_[inst.b];
+		VM_DISPATCH();
+	}
+	VM_ARITHMETIC(OpAdd, +)
+	VM_ARITHMETIC(OpSub, -)
+	VM_ARITHMETIC(OpMul, *)
+	VM_TARGET(OpDiv) : {
+		auto status =
+				binary_operation(reg::OpDiv, VM_RK(inst.b), VM_RK(inst.c), base[inst.a]);
+		if (status.has_value())
+			return status;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpEqual) : {
+		base[inst.a] = Value::boolean(values_equal(VM_RK(inst.b), VM_RK(inst.c)));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpNotEqual) : {
+		base[inst.a] = Value::boolean(!values_equal(VM_RK(inst.b), VM_RK(inst.c)));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGreaterThan) : {
+		const auto left = VM_RK(inst.b);
+		const auto right = VM_RK(inst.c);
+		bool greater;
+		VM_TEST_GREATER_THAN(left, right, greater);
+		base[inst.a] = Value::boolean(greater);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpMinus) : {
+		const auto right = VM_RK(inst.b);
+		if (!right.is_integer())
+			return "type cannot be used in conjunction with minus expression";
+
+		base[inst.a] = Value::integer(-right.as_integer());
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpBang) : {
+		base[inst.a] = Value::boolean(!is_truthy(VM_RK(inst.b)));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpJump) : {
+		ip = code + inst.a;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpJumpNotTruthy) : {
+		if (!is_truthy(base[inst.b]))
+			ip = code + inst.a;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpTestGreaterThan) : {
+		const auto left = VM_RK(inst.b);
+		const auto right = VM_RK(inst.c);
+		bool greater;
+		VM_TEST_GREATER_THAN(left, right, greater);
+		if (!greater)
+			ip = code + inst.a;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpTestEqual) : {
+		if (!values_equal(VM_RK(inst.b), VM_RK(inst.c)))
+			ip = code + inst.a;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpTestNotEqual) : {
+		if (values_equal(VM_RK(inst.b), VM_RK(inst.c)))
+			ip = code + inst.a;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpArray) : {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		base[inst.a] = Value::object(
+				make_array(heap_, base + inst.b, base + inst.b + inst.c));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpHash) : {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto hash = make_hash(heap_, base + inst.b, base + inst.b + inst.c);
+		if (hash == nullptr)
+			return "type of key is invalid, needs to be 'int' 'bool' or 'string'";
+
+		base[inst.a] = Value::object(hash);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpIndex) : {
+		auto status = index(VM_RK(inst.b), VM_RK(inst.c), base[inst.a]);
+		if (status.has_value())
+			return status;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpClosure) : {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto fn = (RegisterFunction *)constants[inst.b].as_object();
+		auto closure = heap_.allocate<Closure>(fn);
+		closure->free_.assign(base + inst.a, base + inst.a + inst.c);
+		heap_.write_barrier(closure);
+
+		base[inst.a] = Value::object(closure);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpCall) : {
+		frame->ip = ip;
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto status = call(base + inst.a, inst.b);
+		if (status.has_value())
+			return status;
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpReturn) : {
+		const auto value = VM_RK(inst.a);
+		if (frames_index_ == 1) {
+			result_ = value;
+			return std::nullopt;
+		}
+
+		// the result replaces the closure in the caller's frame.
+		--frames_index_;
+		base[-1] = value;
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpReturnNull) : {
+		if (frames_index_ == 1) {
+			result_ = Value::null();
+			return std::nullopt;
+		}
+
+		--frames_index_;
+		base[-1] = Value::null();
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpHalt) : {
+		result_ = base[RegisterCompiler::ResultRegister];
+		return std::nullopt;
+	}
+#ifndef LUPS_COMPUTED_GOTO
+	default:
+		return "unknown opcode";
+	}
+#endif
+}
+
+#undef VM_TARGET
+#undef VM_DISPATCH
+#undef VM_RK
+#undef VM_LOAD_FRAME
+#undef VM_ARITHMETIC
+#undef VM_TEST_GREATER_THAN
+
+std::optional<std::string> RegisterVM::call(Value *callee, int num_args) {
+	if (!callee->is_object())
+		return "calling a type that is not a function.";
+
+	const auto obj = callee->as_object();
+	if (obj->Type() == ObjType::Builtin) {
+		auto args = std::vector<Object *>(num_args, nullptr);
+		for (int i = 0; i < num_args; ++i)
+			args[i] = box_value(heap_, callee[1 + i]);
+
+		auto res = heap_.adopt(((Builtin *)obj)->func(args));
+		*callee = object_to_value(res);
+		return std::nullopt;
+	}
+
+	if (obj->Type() != ObjType::Closure)
+		return "calling a type that is not a function.";
+
+	const auto closure = (Closure *)obj;
+	const auto fn = (RegisterFunction *)closure->func_;
+	if (num_args != fn->m_num_parameters)
+		return "the amount of arguments supplied differs from the amount of "
+					 "parameters the function needs.";
+
+	if (frames_index_ >= MaxFrames)
+		return "frame stack overflow";
+
+	const auto base = callee + 1;
+	const auto end = (int)(base - registers_.data()) + fn->m_num_registers;
+	if (end > RegisterFileSize)
+		return "stack overflow";
+
+	// the registers past the arguments may still hold values of frames that
+	// have returned, the garbage collector must not see those.
+	std::fill(base + num_args, base + fn->m_num_registers, Value::null());
+
+	const auto &caller = frames_[frames_index_ - 1];
+	frames_[frames_index_++] = RegisterFrame{
+			closure, fn->m_code.data(), fn->m_code.data(), base,
+			std::max(caller.top, end)};
+	return std::nullopt;
+}
+
+void RegisterVM::collect_garbage() {
+	heap_.collect([this](Heap &heap) {
+		const auto top = frames_[frames_index_ - 1].top;
+		for (int i = 0; i < top; ++i)
+			heap.visit(registers_[i]);
+		for (auto &global : globals_)
+			heap.visit(global);
+		for (auto &constant : constants_)
+			heap.visit(constant);
+		for (int i = 0; i < frames_index_; ++i)
+			heap.visit(frames_[i].cl);
+		heap.visit(result_);
+	});
+}
+
+std::optional<std::string> RegisterVM::binary_operation(reg::Opcode op,
+																												Value left, Value right,
+																												Value &dest) {
+	if (left.is_integer() && right.is_integer()) {
+		const auto left_val = left.as_integer();
+		const auto right_val = right.as_integer();
+		switch (op) {
+		case reg::OpAdd:
+			dest = Value::integer(left_val + right_val);
+			break;
+		case reg::OpSub:
+			dest = Value::integer(left_val - right_val);
+			break;
+		case reg::OpMul:
+			dest = Value::integer(left_val * right_val);
+			break;
+		case reg::OpDiv:
+			if (right_val == 0)
+				return "division by zero";
+			dest = Value::integer(left_val / right_val);
+			break;
+		default:
+			return "binary integer operation is not recognized.";
+		}
+		return std::nullopt;
+	}
+
+	if (left.type() == ObjType::String && right.type() == ObjType::String) {
+		if (op != reg::OpAdd)
+			return "binary string operation not recognized has to be '+'";
+
+		const auto &left_value = ((String *)left.as_object())->value;
+		const auto &right_value = ((String *)right.as_object())->value;
+		dest = Value::object(heap_.allocate<String>(left_value + right_value));
+		return std::nullopt;
+	}
+
+	return "binary operation is not recognized for given types.";
+}
+
+std::optional<std::string> RegisterVM::index(Value left, Value index,
+																						 Value &dest) {
+	const auto type = left.type();
+	if (type == ObjType::Array && index.is_integer()) {
+		const auto array = (Array *)left.as_object();
+		const auto idx = index.as_integer();
+		dest = idx < 0 || idx >= (int)array->elements.size()
+							 ? Value::null()
+							 : object_to_value(array->elements[idx]);
+		return std::nullopt;
+	}
+
+	if (type == ObjType::IntArray && index.is_integer()) {
+		const auto array = (IntArray *)left.as_object();
+		const auto idx = index.as_integer();
+		dest = idx < 0 || idx >= (int)array->size() ? Value::null()
+																								: Value::integer((*array)[idx]);
+		return std::nullopt;
+	}
+
+	if (type == ObjType::Hash) {
+		const auto key = hash_key_of(index);
+		if (!key.has_value())
+			return "type of index is invalid, needs to be 'int' 'bool' or 'string'";
+
+		const auto str =
+				key->type == ObjType::String ? (String *)index.as_object() : nullptr;
+		const auto value = ((Hash *)left.as_object())->get(key.value(), str);
+		dest = value == nullptr ? Value::null() : object_to_value(value);
+		return std::nullopt;
+	}
+
+	return "index expression is not supported for the type in question.";
+}
@@ -0,0 +1,75 @@
+#ifndef LUPS_REGVM_H
+#define LUPS_REGVM_H
+
+#include "gc.h"
+#include "regcompiler.h"
+#include "vm.h"
+#include <array>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// the registers of every frame that is running, frames are laid out after each
+// other like on the stack of the stack vm.
+static constexpr int RegisterFileSize = 1 << 16;
+
+// RegisterFrame is a record in the register vm's preallocated frame stack.
+// The registers of a frame start at base, a callee's frame starts right after
+// the register its closure was called from.
+struct RegisterFrame {
+	Closure *cl;
+	const reg::Instruction *code;
+	// the next instruction to run, only written back when the frame calls.
+	const reg::Instruction *ip;
+	Value *base;
+
+	// one past the highest register that this frame or any frame below it uses,
+	// the garbage collector scans the registers up to here.
+	int top;
+};
+
+// RegisterVM runs the code of the register compiler. It shares the values,
+// objects, garbage collector and builtins with the stack vm, only the
+// instructions and the frames differ. An instruction names the registers it
+// reads and writes, so there is no pushing and popping, and an expression like
+// a + 1 is a single instruction instead of three.
+class RegisterVM {
+public:
+	RegisterVM(RegisterBytecode *bytecode, GCConfig gc_config = GCConfig());
+
+	std::optional<std::string> run();
+
+	// result returns the value of the last expression statement of the main
+	// program boxed into an object, like the last popped element of the stack
+	// vm. A return in the main program ends it with the returned value.
+	Object *result() { return box_value(heap_, result_); }
+
+	void collect_garbage();
+	const GCStats &gc_stats() const { return heap_.stats(); }
+
+private:
+	// the slow paths of the instructions, for operands that aren't integers.
+	std::optional<std::string> binary_operation(reg::Opcode op, Value left,
+																							Value right, Value &dest);
+	std::optional<std::string> index(Value left, Value index, Value &dest);
+
+	// call enters the closure in callee or calls the builtin in it, its
+	// arguments are the registers after it.
+	std::optional<std::string> call(Value *callee, int num_args);
+
+	std::vector<Value> constants_;
+	std::vector<Value> registers_;
+	std::vector<Value> globals_;
+
+	std::array<RegisterFrame, MaxFrames> frames_;
+	int frames_index_;
+
+	std::unique_ptr<RegisterFunction> main_fn_;
+	std::unique_ptr<Closure> main_closure_;
+	Value result_;
+
+	Heap heap_;
+};
+
+#endif
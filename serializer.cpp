@@ -0,0 +1,251 @@
+#include "serializer.h"
+#include "object.h"
+#include "vm.h"
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+static const char Magic[4] = {'L', 'P', 'S', 'C'};
+
+enum Tag : std::uint8_t {
+	IntegerTag,
+	StringTag,
+	FunctionTag,
+};
+
+void write_uint32(std::vector<char> &out, std::uint32_t val) {
+	for (int i = 0; i < 4; ++i)
+		out.push_back((char)(val >> (8 * i)));
+}
+
+void write_bytes(std::vector<char> &out, const char *data, std::size_t size) {
+	write_uint32(out, (std::uint32_t)size);
+	out.insert(out.end(), data, data + size);
+}
+
+// Reader reads a serialized file in place, every read checks that it stays in
+// the file.
+class Reader {
+public:
+	Reader(char *data, std::size_t size) : pos_(data), end_(data + size) {}
+
+	bool uint8(std::uint8_t &val) {
+		if (end_ - pos_ < 1)
+			return false;
+
+		val = (std::uint8_t)*pos_++;
+		return true;
+	}
+
+	bool uint32(std::uint32_t &val) {
+		if (end_ - pos_ < 4)
+			return false;
+
+		val = 0;
+		for (int i = 0; i < 4; ++i)
+			val |= (std::uint32_t)(std::uint8_t)pos_[i] << (8 * i);
+		pos_ += 4;
+		return true;
+	}
+
+	// bytes returns a length prefixed run of bytes without copying it.
+	char *bytes(std::uint32_t &size) {
+		if (!uint32(size) || (std::size_t)(end_ - pos_) < size)
+			return nullptr;
+
+		auto start = pos_;
+		pos_ += size;
+		return start;
+	}
+
+	bool at_end() const { return pos_ == end_; }
+
+private:
+	char *pos_;
+	char *end_;
+};
+
+std::optional<std::string> read_constant(Reader &reader, Object *&constant) {
+	std::uint8_t tag;
+	if (!reader.uint8(tag))
+		return "truncated constant";
+
+	switch (tag) {
+	case IntegerTag: {
+		std::uint32_t value;
+		if (!reader.uint32(value))
+			return "truncated integer constant";
+
+		constant = new Integer((int)value);
+		return std::nullopt;
+	}
+	case StringTag: {
+		std::uint32_t size;
+		auto data = reader.bytes(size);
+		if (data == nullptr)
+			return "truncated string constant";
+
+		constant = new String(std::string(data, size));
+		return std::nullopt;
+	}
+	case FunctionTag: {
+		std::uint32_t num_locals, num_parameters, size;
+		if (!reader.uint32(num_locals) || !reader.uint32(num_parameters))
+			return "truncated function constant";
+
+		auto code = reader.bytes(size);
+		if (code == nullptr)
+			return "truncated function constant";
+
+		// the counts have to fit a frame before they can be stored as ints.
+		if (num_locals > StackSize || num_parameters > num_locals)
+			return "malformed function constant";
+
+		auto fn = new CompiledFunction(code::Instructions(), (int)num_locals);
+		fn->m_num_parameters = (int)num_parameters;
+		fn->m_mapped = code;
+		fn->m_mapped_size = (int)size;
+		constant = fn;
+		return std::nullopt;
+	}
+	default:
+		return "unknown constant tag " + std::to_string(tag);
+	}
+}
+} // namespace
+
+std::optional<std::string> serializer::serialize(const Bytecode &bytecode,
+																								 std::vector<char> &out) {
+	if (bytecode.mapped_main != nullptr)
+		return "bytecode loaded from a lpsc file is already serialized";
+
+	out.insert(out.end(), Magic, Magic + sizeof(Magic));
+	write_uint32(out, Version);
+	write_uint32(out, code::OpHalt + 1);
+	write_uint32(out, (std::uint32_t)bytecode.constants.size());
+
+	for (auto constant : bytecode.constants) {
+		switch (constant->Type()) {
+		case ObjType::Integer:
+			out.push_back(IntegerTag);
+			write_uint32(out, (std::uint32_t)((Integer *)constant)->value);
+			break;
+		case ObjType::String: {
+			const auto &value = ((String *)constant)->value;
+			out.push_back(StringTag);
+			write_bytes(out, value.data(), value.size());
+			break;
+		}
+		case ObjType::CompiledFunction: {
+			auto fn = (CompiledFunction *)constant;
+			out.push_back(FunctionTag);
+			write_uint32(out, (std::uint32_t)fn->m_num_locals);
+			write_uint32(out, (std::uint32_t)fn->m_num_parameters);
+			write_bytes(out, fn->code(), fn->code_size());
+			break;
+		}
+		default:
+			return "can't serialize constant " + constant->Inspect();
+		}
+	}
+
+	write_uint32(out, (std::uint32_t)bytecode.instructions.size() + 1);
+	out.insert(out.end(), bytecode.instructions.begin(),
+						 bytecode.instructions.end());
+	out.push_back(code::OpHalt);
+
+	return std::nullopt;
+}
+
+std::optional<std::string> serializer::deserialize(char *data,
+																									 std::size_t size,
+																									 Bytecode &bytecode) {
+	if (size < sizeof(Magic) || std::memcmp(data, Magic, sizeof(Magic)) != 0)
+		return "not a lpsc file";
+
+	Reader reader(data + sizeof(Magic), size - sizeof(Magic));
+	std::uint32_t version, num_opcodes, num_constants;
+	if (!reader.uint32(version) || !reader.uint32(num_opcodes) ||
+			!reader.uint32(num_constants))
+		return "truncated header";
+
+	if (version != Version)
+		return "unsupported lpsc version " + std::to_string(version);
+
+	if (num_opcodes != code::OpHalt + 1)
+		return "lpsc file was written with a different instruction set";
+
+	std::vector<Object *> constants;
+	for (std::uint32_t i = 0; i < num_constants; ++i) {
+		Object *constant;
+		auto err = read_constant(reader, constant);
+		if (err.has_value()) {
+			for (auto read : constants)
+				delete read;
+			return err;
+		}
+
+		constants.push_back(constant);
+	}
+
+	std::uint32_t main_size;
+	auto main = reader.bytes(main_size);
+	if (main == nullptr || main_size == 0 || main[main_size - 1] != code::OpHalt ||
+			!reader.at_end()) {
+		for (auto read : constants)
+			delete read;
+		return "malformed main program";
+	}
+
+	bytecode.constants = std::move(constants);
+	bytecode.mapped_main = main;
+	bytecode.mapped_main_size = (int)main_size;
+	return std::nullopt;
+}
+
+std::optional<std::string> serializer::write_file(const Bytecode &bytecode,
+																									const std::string &path) {
+	std::vector<char> out;
+	auto err = serialize(bytecode, out);
+	if (err.has_value())
+		return err;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(out.data(), out.size());
+	if (!file)
+		return "could not write " + path;
+
+	return std::nullopt;
+}
+
+std::optional<std::string> serializer::load_file(const std::string &path,
+																								 Bytecode &bytecode) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return "could not open " + path;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return "could not read " + path;
+	}
+
+	const std::size_t size = st.st_size;
+	auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return "could not map " + path;
+
+	std::shared_ptr<void> image(data,
+															[size](void *data) { munmap(data, size); });
+	auto err = deserialize((char *)data, size, bytecode);
+	if (err.has_value())
+		return path + ": " + err.value();
+
+	bytecode.image = std::move(image);
+	return std::nullopt;
+}
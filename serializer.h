@@ -0,0 +1,49 @@
+#ifndef LUPS_SERIALIZER_H
+#define LUPS_SERIALIZER_H
+
+#include "compiler.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// The serializer stores compiled and optimized bytecode in .lpsc files, so a
+// program can be run again without lexing, parsing and compiling it. Every
+// number is a little endian uint32 and a file is laid out as:
+//
+//   "LPSC" version opcode-count constant-count
+//   constants, each a tag followed by
+//     integer:  value
+//     string:   length bytes
+//     function: locals parameters length instructions
+//   main-length main-instructions
+//
+// The main program is stored ending with an OpHalt. The opcode count makes a
+// file from a build with different opcodes fail to load instead of running
+// the wrong instructions.
+namespace serializer {
+static constexpr std::uint32_t Version = 1;
+static constexpr const char *Extension = ".lpsc";
+
+// serialize encodes bytecode, it fails for constants that can't be stored.
+std::optional<std::string> serialize(const Bytecode &bytecode,
+																		 std::vector<char> &out);
+
+// deserialize decodes the size bytes at data into bytecode. Instructions are
+// not copied, the main program and every function run straight from data, so
+// it has to outlive them and stay writable for the vm to quicken them.
+std::optional<std::string> deserialize(char *data, std::size_t size,
+																			 Bytecode &bytecode);
+
+std::optional<std::string> write_file(const Bytecode &bytecode,
+																			const std::string &path);
+
+// load_file maps the file at path and deserializes it. The mapping is private,
+// quickening copies the pages it writes to instead of changing the file, and
+// bytecode.image keeps it mapped.
+std::optional<std::string> load_file(const std::string &path,
+																		 Bytecode &bytecode);
+} // namespace serializer
+
+#endif
@@ -1,15 +1,26 @@
 #include "ast.h"
+#include "cache.h"
 #include "code.h"
 #include "compiler.h"
 #include "eval.h"
+#include "jit.h"
+#include "kernels.h"
 #include "lexer.h"
 #include "object.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "regcompiler.h"
+#include "regvm.h"
+#include "serializer.h"
+#include "tier.h"
 #include "token.h"
+#include "verifier.h"
 #include "vm.h"
+#include <filesystem>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <tuple>
 #include <type_traits>
@@ -187,6 +198,75 @@ TEST(LexerTest, HashTest) {
 	EXPECT_EQ(err, "") << err;
 }
 
+TEST(LexerTest, KeywordsAndIdentifiers) {
+	// identifiers that share the first letter and length, or a prefix, with a
+	// keyword.
+	std::string input = "func funcs fun let lets true tree false fakes if in "
+											"else elsa return retain x - =";
+	std::vector<std::pair<TokenType, std::string>> expected{
+			{tokentypes::FUNCTION, "func"}, {tokentypes::IDENT, "funcs"},
+			{tokentypes::IDENT, "fun"},			{tokentypes::LET, "let"},
+			{tokentypes::IDENT, "lets"},		{tokentypes::TRUE, "true"},
+			{tokentypes::IDENT, "tree"},		{tokentypes::FALSE, "false"},
+			{tokentypes::IDENT, "fakes"},		{tokentypes::IF, "if"},
+			{tokentypes::IDENT, "in"},			{tokentypes::ELSE, "else"},
+			{tokentypes::IDENT, "elsa"},		{tokentypes::RETURN, "return"},
+			{tokentypes::IDENT, "retain"},	{tokentypes::IDENT, "x"},
+			{tokentypes::MINUS, "-"},				{tokentypes::ASSIGN, "="},
+			{tokentypes::EOFF, ""},
+	};
+
+	auto err = run_lexer_tests(input, expected);
+	EXPECT_EQ(err, "") << err;
+}
+
+TEST(ParserTest, SourceOutlivesInput) {
+	std::unique_ptr<Program> program;
+	{
+		std::string input = "let answer = \"forty\" + \"two\";";
+		auto parser = Parser(std::make_unique<Lexer>(input));
+		program = parser.parse_program();
+	}
+
+	// the tokens point into the source the program keeps alive.
+	ASSERT_EQ(program->statements.size(), 1);
+	EXPECT_EQ(program->statements[0]->TokenLiteral(), "let");
+	auto let = dynamic_cast<LetStatement *>(program->statements[0].get());
+	ASSERT_NE(let, nullptr);
+	EXPECT_EQ(let->name->TokenLiteral(), "answer");
+	EXPECT_EQ(let->value->String(), "(forty + two)");
+}
+
+TEST(ParserTest, IntegerOutOfRange) {
+	auto parser = Parser(std::make_unique<Lexer>("99999999999;"));
+	parser.parse_program();
+	ASSERT_EQ(parser.errors().size(), 1);
+	EXPECT_EQ(parser.errors()[0], "could not parse integer");
+}
+
+TEST(ParserTest, IdentifiersAreInterned) {
+	auto parser = Parser(std::make_unique<Lexer>("let x = 1; x + x;"));
+	auto program = parser.parse_program();
+	ASSERT_EQ(program->statements.size(), 2);
+
+	auto let = dynamic_cast<LetStatement *>(program->statements[0].get());
+	auto stmt =
+			dynamic_cast<ExpressionStatement *>(program->statements[1].get());
+	ASSERT_NE(let, nullptr);
+	ASSERT_NE(stmt, nullptr);
+	auto infix = dynamic_cast<InfixExpression *>(stmt->expression.get());
+	ASSERT_NE(infix, nullptr);
+
+	// every use of a name shares the arena's one copy of it.
+	auto left = dynamic_cast<Identifier *>(infix->left.get());
+	auto right = dynamic_cast<Identifier *>(infix->right.get());
+	ASSERT_NE(left, nullptr);
+	ASSERT_NE(right, nullptr);
+	EXPECT_EQ(left->value, "x");
+	EXPECT_EQ(left->value.data(), right->value.data());
+	EXPECT_EQ(let->name->value.data(), left->value.data());
+}
+
 TEST(ParserTest, LetStatements) {
 	std::string input = "let x = 5;"
 											"let y = 10;"
@@ -218,8 +298,8 @@ TEST(ParserTest, LetStatements) {
 
 TEST(ParserTest, ReturnStatements) {
 	std::string input = "return 5;"
-											"return = 10;"
-											"return = 123456;";
+											"return 10;"
+											"return 123456;";
 
 	auto lexer = Lexer(input);
 	auto parser = Parser(std::make_unique<Lexer>(lexer));
@@ -349,7 +429,7 @@ TEST(ParsetTest, BooleanPrefixExpressionTest) {
 	}
 }
 
-bool test_integer_literal(int expected, std::unique_ptr<Expression> exp) {
+bool test_integer_literal(int expected, NodePtr<Expression> exp) {
 	auto lit = dynamic_cast<IntegerLiteral *>(exp.get());
 	if (lit == nullptr)
 		return false;
@@ -360,7 +440,7 @@ bool test_integer_literal(int expected, std::unique_ptr<Expression> exp) {
 	return true;
 }
 
-bool test_bool_literal(bool expected, std::unique_ptr<Expression> exp) {
+bool test_bool_literal(bool expected, NodePtr<Expression> exp) {
 	auto lit = dynamic_cast<BooleanExpression *>(exp.get());
 	if (lit == nullptr)
 		return false;
@@ -1216,26 +1296,23 @@ TEST(EvalTest, HashEvaluationTest) {
 	EXPECT_NE(hash, nullptr);
 
 	struct Testcase {
-		HashKey hk;
+		Object *key;
 		int expected;
 	};
 
 	std::vector<Testcase> expected{
-			{(new String("one"))->hash_key(), 1},
-			{(new String("two"))->hash_key(), 2},
-			{(new String("three"))->hash_key(), 3},
-			{(new Integer(4))->hash_key(), 4},
-			{(new Boolean(true))->hash_key(), 5},
-			{(new Boolean(false))->hash_key(), 6},
+			{new String("one"), 1},  {new String("two"), 2},
+			{new String("three"), 3}, {new Integer(4), 4},
+			{new Boolean(true), 5},  {new Boolean(false), 6},
 	};
 
-	EXPECT_EQ(expected.size(), hash->pairs.size())
+	EXPECT_EQ(expected.size(), hash->size())
 			<< "The is a wrong amount of pairs in the hashtable";
 	for (const auto &tc : expected) {
-		auto pair = hash->pairs[tc.hk.value];
-		EXPECT_NE(pair, nullptr) << "the pair shouldn't be a null pointer";
+		auto value = hash->get(tc.key);
+		EXPECT_NE(value, nullptr) << "the value shouldn't be a null pointer";
 
-		EXPECT_TRUE(test_integer_object(pair->value, tc.expected));
+		EXPECT_TRUE(test_integer_object(value, tc.expected));
 	}
 }
 
@@ -1425,7 +1502,13 @@ const std::string run_vm_tests(const std::vector<VMTestcase<T>> &tests) {
 		if (status.has_value())
 			return status.value();
 
-		auto vm = new VM(comp->bytecode());
+		// the tests run the unchecked dispatch loop the verified code takes.
+		auto bytecode = comp->bytecode();
+		auto verify_status = verifier::verify(*bytecode);
+		if (verify_status.has_value())
+			return tt.input + " doesn't verify: " + verify_status.value();
+
+		auto vm = new VM(bytecode);
 		auto vm_status = vm->run();
 		if (vm_status.has_value())
 			return "Running the vm was unsuccessful, got err: " + vm_status.value();
@@ -1434,6 +1517,39 @@ const std::string run_vm_tests(const std::vector<VMTestcase<T>> &tests) {
 		if (stack_elem == nullptr)
 			return "The stack element is a null pointer.";
 
+		// and with every function compiled by the jit on its first call.
+		auto jit_comp = new Compiler();
+		jit_comp->compile(*program);
+		auto jit_bytecode = jit_comp->bytecode();
+		verifier::verify(*jit_bytecode);
+		auto jit_vm = new VM(jit_bytecode);
+		jit_vm->set_jit_threshold(1);
+		auto jit_status = jit_vm->run();
+		if (jit_status.has_value())
+			return tt.input + " fails with the jit: " + jit_status.value();
+		if (jit_vm->last_popped_stack_elem()->Inspect() != stack_elem->Inspect())
+			return tt.input + " gives " +
+						 jit_vm->last_popped_stack_elem()->Inspect() +
+						 " with the jit instead of " + stack_elem->Inspect();
+
+		// every program runs on the register vm as well, which has to get the same
+		// result.
+		auto reg_comp = new RegisterCompiler();
+		auto reg_status = reg_comp->compile(*program);
+		if (reg_status.has_value())
+			return tt.input + " doesn't compile for the register vm: " +
+						 reg_status.value();
+
+		auto reg_vm = new RegisterVM(reg_comp->bytecode());
+		auto reg_vm_status = reg_vm->run();
+		if (reg_vm_status.has_value())
+			return tt.input + " fails on the register vm: " + reg_vm_status.value();
+
+		const auto reg_result = reg_vm->result()->Inspect();
+		if (reg_result != stack_elem->Inspect())
+			return tt.input + " gives " + reg_result +
+						 " on the register vm instead of " + stack_elem->Inspect();
+
 		if constexpr (std::is_same<int, T>::value) {
 			// In some test cases -1 is used to indicate that it should return null.
 			if (tt.expected == -1) {
@@ -1453,6 +1569,13 @@ const std::string run_vm_tests(const std::vector<VMTestcase<T>> &tests) {
 			if (!test_boolean_object(stack_elem, tt.expected))
 				return "The boolean object is invalid";
 		} else if constexpr (std::is_same<std::vector<int>, T>::value) {
+			if (auto packed = dynamic_cast<IntArray *>(stack_elem)) {
+				std::vector<int> values(packed->data(), packed->data() + packed->size());
+				if (values != tt.expected)
+					return "The packed array has the wrong elements.";
+				continue;
+			}
+
 			auto arr = dynamic_cast<Array *>(stack_elem);
 			if (arr->elements.size() != tt.expected.size())
 				return "The amount of elements differs in the array.";
@@ -1465,15 +1588,15 @@ const std::string run_vm_tests(const std::vector<VMTestcase<T>> &tests) {
 			if (hash == nullptr)
 				return "The class is not a Hash object";
 
-			if (hash->pairs.size() != tt.expected.size())
+			if (hash->size() != tt.expected.size())
 				return "The amount of elements differ in the hash class";
 
 			for (const auto &e : tt.expected) {
-				auto pr = hash->pairs[e.first];
-				if (pr == nullptr)
+				auto value = hash->get(HashKey{ObjType::Integer, e.first}, nullptr);
+				if (value == nullptr)
 					return "A pair was not found in the map";
 
-				if (!test_integer_object(pr->value, e.second))
+				if (!test_integer_object(value, e.second))
 					return "The integer object is invalid";
 			}
 		}
@@ -1670,8 +1793,11 @@ TEST(CodeTest, ReadOperands) {
 	};
 
 	std::vector<Testcase> test_cases{{code::OpConstant, {65535}, 2},
+																	 {code::OpConstant, {128}, 2},
+																	 {code::OpConstant, {383}, 2},
 																	 {code::OpGetLocal, {255}, 1},
-																	 {code::OpClosure, {65535, 255}, 3}};
+																	 {code::OpClosure, {65535, 255}, 3},
+																	 {code::OpClosure, {200, 128}, 3}};
 
 	for (const auto &tc : test_cases) {
 		auto instructions = code::make(tc.op, tc.operands);
@@ -1688,9 +1814,96 @@ TEST(CodeTest, ReadOperands) {
 					<< "operands wrong got " << res.first[i] << " want "
 					<< tc.operands[i];
 		}
+
+		// the same operands read in place.
+		auto in_place = code::read_operands(def, instructions.data() + 1);
+		EXPECT_EQ(in_place.first, res.first);
+		EXPECT_EQ(in_place.second, res.second);
 	}
 }
 
+TEST(VMTest, Quickening) {
+	auto program = parse_compiler_program_helper(
+			"let add = func(a, b) { a + b }; let lt = func(a, b) { a < b };"
+			"let eq = func(a, b) { a == b };"
+			"[add(1, 2), lt(1, 2), eq(1, 1), add(\"a\", \"b\"), eq(true, true), "
+			"lt(2, 1), add(3, 4), eq(2, 3)]");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+
+	auto bytecode = comp->bytecode();
+	auto vm = new VM(bytecode);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("[3, true, true, ab, true, false, 7, false, ]",
+						vm->last_popped_stack_elem()->Inspect());
+
+	// add and eq saw other types after being quickened, lt only saw integers.
+	auto opcode_of = [&](int const_index) {
+		auto fn = dynamic_cast<CompiledFunction *>(bytecode->constants[const_index]);
+		return fn->m_instructions[4];
+	};
+	EXPECT_EQ(code::OpAddPoly, opcode_of(0));
+	EXPECT_EQ(code::OpGreaterThanInt, opcode_of(1));
+	EXPECT_EQ(code::OpEqualPoly, opcode_of(2));
+}
+
+TEST(VMTest, HashKeysWithEqualHashes) {
+	std::vector<VMTestcase<int>> test_cases{
+			{"{1: 10, true: 20}[1]", 10},
+			{"{1: 10, true: 20}[true]", 20},
+			{"{0: 10, false: 20}[false]", 20},
+	};
+
+	auto err = run_vm_tests(test_cases);
+	EXPECT_EQ(err, "") << err;
+}
+
+TEST(VMTest, IndexInlineCaches) {
+	auto program = parse_compiler_program_helper(
+			"let config = {\"width\": 10, \"height\": 20};"
+			"let width = func() { config[\"width\"] };"
+			"let at = func(x, i) { x[i] };"
+			"let get = func(x, k) { x[k] };"
+			"[width(), at([true], 0), get(config, \"height\"), get([7], 0), width()]");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, 2);
+
+	auto vm = new VM(bytecode);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("[10, true, 20, 7, 10, ]",
+						vm->last_popped_stack_elem()->Inspect());
+
+	auto function = [&](int const_index) {
+		return dynamic_cast<CompiledFunction *>(bytecode->constants[const_index]);
+	};
+
+	// the constant key is fused into the instruction, the others are quickened
+	// for the receivers they saw.
+	EXPECT_EQ(code::OpIndexConst, function(4)->m_instructions[3]);
+	EXPECT_EQ(code::OpIndexArray, function(5)->m_instructions[4]);
+	EXPECT_EQ(code::OpIndexPoly, function(6)->m_instructions[4]);
+}
+
+TEST(VMTest, OperandsWithHighBytes) {
+	// the jumps in the function and the index of the last constant are past
+	// 127, which used to be sign extended when decoded.
+	std::string body;
+	for (int i = 0; i < 200; ++i)
+		body += "if (a) { " + std::to_string(i) + " };";
+
+	auto program = parse_compiler_program_helper(
+			"let f = func(a) { " + body + " 1000 }; f(true);");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+
+	auto vm = new VM(comp->bytecode());
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_TRUE(test_integer_object(vm->last_popped_stack_elem(), 1000));
+}
+
 TEST(VMTest, VMIntegerArithmetic) {
 	std::vector<VMTestcase<int>> test_cases{
 			{"1", 1},
@@ -2078,26 +2291,26 @@ TEST(CompilerTest, HashLiterals) {
 TEST(CompilerTest, CIndexExpression) {
 	std::vector<CompilerTestcase<int>> test_cases{
 			{"[1, 2, 3][1 + 1]",
-			 {1, 2, 3, 1, 1},
+			 {1, 2, 3},
 			 {{
 					 code::make(code::OpConstant, {0}),
 					 code::make(code::OpConstant, {1}),
 					 code::make(code::OpConstant, {2}),
 					 code::make(code::OpArray, {3}),
-					 code::make(code::OpConstant, {3}),
-					 code::make(code::OpConstant, {4}),
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpConstant, {0}),
 					 code::make(code::OpAdd, {}),
 					 code::make(code::OpIndex, {}),
 					 code::make(code::OpPop, {}),
 			 }}},
 			{"{1: 2}[2 - 1]",
-			 {1, 2, 2, 1},
+			 {1, 2},
 			 {{
 					 code::make(code::OpConstant, {0}),
 					 code::make(code::OpConstant, {1}),
 					 code::make(code::OpHash, {2}),
-					 code::make(code::OpConstant, {2}),
-					 code::make(code::OpConstant, {3}),
+					 code::make(code::OpConstant, {1}),
+					 code::make(code::OpConstant, {0}),
 					 code::make(code::OpSub, {}),
 					 code::make(code::OpIndex, {}),
 					 code::make(code::OpPop, {}),
@@ -2147,6 +2360,32 @@ TEST(VMTest, IndexExpressions) {
 	EXPECT_EQ(err, "") << err;
 }
 
+TEST(CompilerTest, InternedConstants) {
+	auto program = parse_compiler_program_helper(
+			"let f = func() { let g = func() { 1 + 1 }; \"x\" }; 1; \"x\"; 1;");
+	auto compiler = new Compiler();
+	ASSERT_FALSE(compiler->compile(*program).has_value());
+
+	// 1, g, "x" and f.
+	auto bytecode = compiler->bytecode();
+	ASSERT_EQ(4, (int)bytecode->constants.size());
+	EXPECT_EQ("1", bytecode->constants[0]->Inspect());
+	EXPECT_EQ("x", bytecode->constants[2]->Inspect());
+
+	std::vector<code::Instructions> expected{
+			code::make(code::OpClosure, {3, 0}),
+			code::make(code::OpSetGlobal, {0}),
+			code::make(code::OpConstant, {0}),
+			code::make(code::OpPop, {}),
+			code::make(code::OpConstant, {2}),
+			code::make(code::OpPop, {}),
+			code::make(code::OpConstant, {0}),
+			code::make(code::OpPop, {}),
+	};
+	EXPECT_TRUE(test_instructions(expected, bytecode->instructions))
+			<< code::instructions_to_string(bytecode->instructions);
+}
+
 TEST(CompilerTest, CompilerScopes) {
 	auto compiler = new Compiler();
 	EXPECT_EQ(compiler->scope_index_, 0);
@@ -2719,6 +2958,22 @@ TEST(CompilerTest, Closures) {
 	EXPECT_EQ(err, "");
 }
 
+TEST(CompilerTest, Errors) {
+	auto program =
+			parse_compiler_program_helper("let f = func(x) { x + missing }; f(1);");
+	auto comp = new Compiler();
+
+	// the error is the one the failing node reported, not a wrapper of it.
+	auto err = comp->compile_node(*program);
+	ASSERT_TRUE(err.has_value());
+	EXPECT_EQ(err->code, CompileErrorCode::UndefinedSymbol);
+	EXPECT_EQ(err->detail, "missing");
+
+	auto status = Compiler().compile(*program);
+	ASSERT_TRUE(status.has_value());
+	EXPECT_EQ(status.value(), "symbol not found in symbol table: missing");
+}
+
 TEST(VMTest, Closures) {
 	std::vector<VMTestcase<int>> test_cases {
 		{
@@ -2733,3 +2988,1111 @@ TEST(VMTest, Closures) {
 	auto err = run_vm_tests(test_cases);
 	EXPECT_EQ(err, "") << err;
 }
+
+TEST(VMTest, FrameStackOverflowReturnsError) {
+	auto program = parse_compiler_program_helper("let f = func() { f() }; f();");
+	auto comp = new Compiler();
+	auto status = comp->compile(*program);
+	EXPECT_FALSE(status.has_value());
+
+	auto vm = new VM(comp->bytecode());
+	auto vm_status = vm->run();
+	EXPECT_TRUE(vm_status.has_value());
+}
+
+TEST(ObjectTest, HashTable) {
+	auto hash = new Hash();
+
+	// 1 and true have the same hash value, but they are different keys.
+	hash->set(new Integer(1), new String("one"));
+	hash->set(new Boolean(true), new String("true"));
+	hash->set(new String("a"), new Integer(2));
+	hash->set(new Integer(1), new String("uno"));
+
+	EXPECT_EQ(3, (int)hash->size());
+	EXPECT_EQ("uno", hash->get(new Integer(1))->Inspect());
+	EXPECT_EQ("true", hash->get(new Boolean(true))->Inspect());
+	EXPECT_EQ("2", hash->get(new String("a"))->Inspect());
+	EXPECT_EQ(nullptr, hash->get(new Boolean(false)));
+	EXPECT_EQ(nullptr, hash->get(new String("b")));
+
+	// overwriting a key keeps its place in the insertion order.
+	EXPECT_EQ("{1: uno, true: true, a: 2}", hash->Inspect());
+
+	for (int i = 0; i < 10000; ++i)
+		hash->set(new Integer(i * 7), new Integer(i));
+	for (int i = 0; i < 10000; ++i)
+		ASSERT_TRUE(test_integer_object(hash->get(new Integer(i * 7)), i));
+	EXPECT_EQ(10003, (int)hash->size());
+}
+
+TEST(ObjectTest, PersistentVector) {
+	std::vector<Object *> ints;
+	for (int i = 0; i < 40000; ++i)
+		ints.push_back(new Integer(i));
+
+	// enough elements for a trie of three levels.
+	PersistentVector vec;
+	for (auto obj : ints)
+		vec.push_back(obj);
+	ASSERT_EQ(40000, (int)vec.size());
+	for (int i = 0; i < 40000; ++i)
+		ASSERT_EQ(ints[i], vec[i]);
+
+	// copies that are changed afterwards don't see each others changes, even
+	// when both append to the tail they share.
+	auto left = vec;
+	auto right = vec;
+	left.push_back(ints[1]);
+	right.push_back(ints[2]);
+	right.push_back(ints[3]);
+	EXPECT_EQ(40000, (int)vec.size());
+	EXPECT_EQ(ints[1], left.back());
+	EXPECT_EQ(ints[2], right[40000]);
+	EXPECT_EQ(ints[3], right.back());
+
+	auto tail = vec;
+	for (int i = 0; i < 1000; ++i)
+		tail.drop_front();
+	EXPECT_EQ(39000, (int)tail.size());
+	EXPECT_EQ(ints[1000], tail.front());
+	EXPECT_EQ(ints[0], vec.front());
+
+	int expected = 1000;
+	for (auto obj : tail)
+		ASSERT_EQ(ints[expected++], obj);
+	EXPECT_EQ(40000, expected);
+}
+
+TEST(ObjectTest, IntegerKernels) {
+	std::vector<const kernels::Kernels *> implementations{
+			&kernels::scalar(), kernels::sse41(), kernels::avx2()};
+
+	std::vector<int> a, b;
+	for (int i = 0; i < 1000; ++i) {
+		a.push_back((i * 7919) % 2001 - 1000);
+		b.push_back(i % 3 == 0 ? 2147483647 - i : -i);
+	}
+
+	const auto &scalar = kernels::scalar();
+	for (auto impl : implementations) {
+		if (impl == nullptr)
+			continue;
+
+		// every length up to a few vectors checks the leftover handling.
+		for (std::size_t n : {1, 3, 4, 7, 8, 9, 17, 31, 1000}) {
+			EXPECT_EQ(scalar.sum(b.data(), n), impl->sum(b.data(), n)) << impl->name;
+			EXPECT_EQ(scalar.min(a.data(), n), impl->min(a.data(), n)) << impl->name;
+			EXPECT_EQ(scalar.max(a.data(), n), impl->max(a.data(), n)) << impl->name;
+			EXPECT_EQ(scalar.dot(a.data(), b.data(), n),
+								impl->dot(a.data(), b.data(), n))
+					<< impl->name;
+
+			std::vector<int> expected(n), got(n);
+			scalar.scale(b.data(), -3, expected.data(), n);
+			impl->scale(b.data(), -3, got.data(), n);
+			EXPECT_EQ(expected, got) << impl->name;
+
+			scalar.add(a.data(), b.data(), expected.data(), n);
+			impl->add(a.data(), b.data(), got.data(), n);
+			EXPECT_EQ(expected, got) << impl->name;
+		}
+	}
+}
+
+TEST(ObjectTest, ValueImmediates) {
+	for (int v : {0, 1, -1, 42, -1234567, 2147483647, -2147483647 - 1}) {
+		auto val = Value::integer(v);
+		EXPECT_TRUE(val.is_integer());
+		EXPECT_FALSE(val.is_object());
+		EXPECT_EQ(val.as_integer(), v);
+		EXPECT_EQ(val.type(), ObjType::Integer);
+	}
+
+	EXPECT_TRUE(Value::boolean(true).as_boolean());
+	EXPECT_FALSE(Value::boolean(false).as_boolean());
+	EXPECT_EQ(Value::boolean(true).type(), ObjType::Boolean);
+	EXPECT_NE(Value::boolean(true), Value::boolean(false));
+	EXPECT_TRUE(Value().is_null());
+	EXPECT_EQ(Value::null().type(), ObjType::Null);
+
+	auto str = new String("hello");
+	auto val = Value::object(str);
+	EXPECT_TRUE(val.is_object());
+	EXPECT_EQ(val.as_object(), str);
+	EXPECT_EQ(val.type(), ObjType::String);
+}
+
+TEST(VMTest, GarbageCollection) {
+	auto program = parse_compiler_program_helper(
+			"let make = func(n) { if (n == 0) { [] } else { push(make(n - 1), n * 2) "
+			"} };"
+			"let keep = {\"list\": make(50)};"
+			"let churn = func(n) {"
+			"    if (n == 0) { 0 } else { {\"a\": make(10)}; \"s\" + \"t\"; churn(n - 1) "
+			"}"
+			"};"
+			"churn(50);"
+			"keep[\"list\"][49]");
+	auto comp = new Compiler();
+	auto status = comp->compile(*program);
+	EXPECT_FALSE(status.has_value());
+
+	auto vm = new VM(comp->bytecode(), GCConfig{16, 1.5});
+	auto vm_status = vm->run();
+	ASSERT_FALSE(vm_status.has_value()) << vm_status.value();
+
+	EXPECT_TRUE(test_integer_object(vm->last_popped_stack_elem(), 100));
+	EXPECT_GT(vm->gc_stats().collections, 0);
+	EXPECT_GT(vm->gc_stats().objects_freed, 0);
+	delete vm;
+}
+
+TEST(VMTest, GenerationalGarbageCollection) {
+	auto program = parse_compiler_program_helper(
+			"let make = func(n) { if (n == 0) { [] } else { push(make(n - 1), n * 2) "
+			"} };"
+			"let adder = func(a) { func(b) { a + b } };"
+			"let keep = {\"list\": make(50), \"add\": adder(\"x\" + \"y\")};"
+			"let churn = func(n) {"
+			"    if (n == 0) { 0 } else { [make(5), \"s\" + \"t\"]; churn(n - 1) }"
+			"};"
+			"churn(200);"
+			"[keep[\"add\"](\"z\"), keep[\"list\"][49]]");
+	auto comp = new Compiler();
+	auto status = comp->compile(*program);
+	EXPECT_FALSE(status.has_value());
+
+	// a nursery this small fills up between most safe points, which also
+	// exercises allocating straight into the old generation.
+	auto vm = new VM(comp->bytecode(), GCConfig{64, 2.0, 512});
+	auto vm_status = vm->run();
+	ASSERT_FALSE(vm_status.has_value()) << vm_status.value();
+
+	auto arr = dynamic_cast<Array *>(vm->last_popped_stack_elem());
+	ASSERT_NE(arr, nullptr);
+	ASSERT_EQ(arr->elements.size(), 2);
+	EXPECT_TRUE(test_string_constant("xyz", arr->elements[0]));
+	EXPECT_TRUE(test_integer_object(arr->elements[1], 100));
+	EXPECT_GT(vm->gc_stats().minor_collections, 0);
+	EXPECT_GT(vm->gc_stats().promoted, 0);
+	EXPECT_LT(vm->gc_stats().promotion_rate(), 1.0);
+	delete vm;
+}
+
+TEST(VMTest, PersistentArrays) {
+	auto program = parse_compiler_program_helper(
+			"let build = func(arr, n) { if (n == 0) { arr } else { build(push(arr, "
+			"n), n - 1) } };"
+			"let sum = func(arr, acc) { if (len(arr) == 0) { acc } else { "
+			"sum(tail(arr), acc + first(arr)) } };"
+			"let list = tail(build([true], 300));"
+			"let other = push(list, 5);"
+			"[sum(list, 0), len(list), last(other), list[299], tail([])]");
+	auto comp = new Compiler();
+	auto status = comp->compile(*program);
+	EXPECT_FALSE(status.has_value());
+
+	// arrays share their nodes, so this checks that the collector still finds
+	// and moves every element while the lists are built.
+	auto vm = new VM(comp->bytecode(), GCConfig{64, 2.0, 512});
+	auto vm_status = vm->run();
+	ASSERT_FALSE(vm_status.has_value()) << vm_status.value();
+
+	auto arr = dynamic_cast<Array *>(vm->last_popped_stack_elem());
+	ASSERT_NE(arr, nullptr);
+	ASSERT_EQ(arr->elements.size(), 5);
+	EXPECT_TRUE(test_integer_object(arr->elements[0], 45150));
+	EXPECT_TRUE(test_integer_object(arr->elements[1], 300));
+	EXPECT_TRUE(test_integer_object(arr->elements[2], 5));
+	EXPECT_TRUE(test_integer_object(arr->elements[3], 1));
+	EXPECT_EQ(arr->elements[4]->Type(), ObjType::Null);
+	EXPECT_GT(vm->gc_stats().minor_collections, 0);
+	delete vm;
+}
+
+TEST(VMTest, IntegerArrays) {
+	std::vector<VMTestcase<int>> test_cases{
+			{"sum([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11])", 66},
+			{"sum([])", 0},
+			{"min([5, 3, 9, -4, 8, 1, 2, 7, 6])", -4},
+			{"max([5, 3, 9, -4, 8, 1, 2, 7, 6])", 9},
+			{"min([])", -1},
+			{"dot([1, 2, 3], [4, 5, 6])", 32},
+			{"dot([1, 2], [1])", -2},
+			{"sum(scale([1, 2, 3], 3))", 18},
+			{"add([1, 2, 3], [10, 20, 30])[2]", 33},
+			{"sum(push(tail([1, 2, 3]), 10))", 15},
+			{"len(tail([1, 2, 3]))", 2},
+			{"last(push([1, 2], 3))", 3},
+			{"[1, 2, 3][3]", -1},
+			{"sum(push([1, 2], true))", -2},
+			{"len(push([1, 2], true))", 3},
+			{"sum([1, true])", -2},
+	};
+
+	auto err = run_vm_tests(test_cases);
+	EXPECT_EQ(err, "") << err;
+}
+
+TEST(VMTest, IntegerArraysArePacked) {
+	auto program = parse_compiler_program_helper(
+			"let at = func(x, i) { x[i] };"
+			"let a = [1, 2, 3];"
+			"let b = push(a, 4);"
+			"let c = push(a, 5);"
+			"[at(b, 3), at(c, 3), len(a), push(b, \"x\")]");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+
+	auto bytecode = comp->bytecode();
+	auto vm = new VM(bytecode);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("[4, 5, 3, [1, 2, 3, 4, x, ], ]",
+						vm->last_popped_stack_elem()->Inspect());
+
+	auto at = dynamic_cast<CompiledFunction *>(bytecode->constants[0]);
+	EXPECT_EQ(code::OpIndexIntArray, at->m_instructions[4]);
+}
+
+TEST(OptimizerTest, Peephole) {
+	struct Testcase {
+		std::string input;
+		std::vector<code::Instructions> expected_instructions;
+	};
+
+	std::vector<Testcase> test_cases{
+			{"if (true) { 10 } else { 20 }; 3333;",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpPop, {}),
+					 code::make(code::OpConstant, {2}),
+					 code::make(code::OpPop, {}),
+			 }},
+			{"if (false) { 10 }; 3333;",
+			 {
+					 code::make(code::OpNull, {}),
+					 code::make(code::OpPop, {}),
+					 code::make(code::OpConstant, {1}),
+					 code::make(code::OpPop, {}),
+			 }},
+			{"if (1 > 2) { 10 } else { if (true) { 20 } else { 30 } }; 3333;",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpConstant, {1}),
+					 code::make(code::OpGreaterThan, {}),
+					 code::make(code::OpJumpNotTruthy, {16}),
+					 code::make(code::OpConstant, {2}),
+					 code::make(code::OpJump, {19}),
+					 code::make(code::OpConstant, {3}),
+					 code::make(code::OpPop, {}),
+					 code::make(code::OpConstant, {5}),
+					 code::make(code::OpPop, {}),
+			 }},
+			{"let one = 1; one;",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpTeeGlobal, {0}),
+					 code::make(code::OpPop, {}),
+			 }},
+	};
+
+	for (const auto &tt : test_cases) {
+		auto program = parse_compiler_program_helper(tt.input);
+		auto compiler = new Compiler();
+		auto status = compiler->compile(*program);
+		ASSERT_FALSE(status.has_value());
+
+		auto bytecode = compiler->bytecode();
+		optimizer::optimize(*bytecode, 1);
+		EXPECT_TRUE(
+				test_instructions(tt.expected_instructions, bytecode->instructions))
+				<< tt.input << '\n'
+				<< code::instructions_to_string(bytecode->instructions);
+	}
+}
+
+TEST(OptimizerTest, PeepholeFunctions) {
+	auto program = parse_compiler_program_helper(
+			"func(a) { let b = a; if (a > 1) { return a; } else { return b; } }");
+	auto compiler = new Compiler();
+	auto status = compiler->compile(*program);
+	ASSERT_FALSE(status.has_value());
+
+	auto bytecode = compiler->bytecode();
+	optimizer::optimize(*bytecode, 1);
+
+	auto fn = dynamic_cast<CompiledFunction *>(bytecode->constants[1]);
+	ASSERT_NE(fn, nullptr);
+
+	std::vector<code::Instructions> expected{
+			code::make(code::OpGetLocal, {0}),
+			code::make(code::OpSetLocal, {1}),
+			code::make(code::OpGetLocal, {0}),
+			code::make(code::OpConstant, {0}),
+			code::make(code::OpGreaterThan, {}),
+			code::make(code::OpJumpNotTruthy, {16}),
+			code::make(code::OpGetLocal, {0}),
+			code::make(code::OpReturnValue, {}),
+			code::make(code::OpGetLocal, {1}),
+			code::make(code::OpReturnValue, {}),
+	};
+	EXPECT_TRUE(test_instructions(expected, fn->m_instructions))
+			<< code::instructions_to_string(fn->m_instructions);
+}
+
+TEST(OptimizerTest, ConstantFolding) {
+	struct Testcase {
+		std::string input;
+		std::vector<code::Instructions> expected_instructions;
+		std::vector<std::string> expected_constants;
+	};
+
+	std::vector<Testcase> test_cases{
+			{"1 + 2 * 3;",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {"7"}},
+			{"!(1 < 2) == false;",
+			 {
+					 code::make(code::OpTrue, {}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {}},
+			{"\"lu\" + \"ps\";",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {"lups"}},
+			// strings compare by contents and values of different types are unequal.
+			{"\"lu\" == \"lu\" != (1 == true);",
+			 {
+					 code::make(code::OpTrue, {}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {}},
+			// division by zero and mixed types are left to fail at runtime.
+			{"1 / 0;",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpConstant, {1}),
+					 code::make(code::OpDiv, {}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {"1", "0"}},
+			{"let a = 2 * 3; let b = a + 1; b;",
+			 {
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpSetGlobal, {0}),
+					 code::make(code::OpConstant, {1}),
+					 code::make(code::OpSetGlobal, {1}),
+					 code::make(code::OpConstant, {1}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {"6", "7"}},
+			// a let inside of an if might not run, so it isn't propagated.
+			// the branch ending in a let leaves null like the missing else does.
+			{"if (true) { let c = 1; }; c;",
+			 {
+					 code::make(code::OpTrue, {}),
+					 code::make(code::OpJumpNotTruthy, {14}),
+					 code::make(code::OpConstant, {0}),
+					 code::make(code::OpSetGlobal, {0}),
+					 code::make(code::OpNull, {}),
+					 code::make(code::OpJump, {15}),
+					 code::make(code::OpNull, {}),
+					 code::make(code::OpPop, {}),
+					 code::make(code::OpGetGlobal, {0}),
+					 code::make(code::OpPop, {}),
+			 },
+			 {"1"}},
+	};
+
+	for (const auto &tt : test_cases) {
+		auto program = parse_compiler_program_helper(tt.input);
+		auto compiler = new Compiler(1);
+		ASSERT_FALSE(compiler->compile(*program).has_value()) << tt.input;
+
+		auto bytecode = compiler->bytecode();
+		EXPECT_TRUE(
+				test_instructions(tt.expected_instructions, bytecode->instructions))
+				<< tt.input << "\n"
+				<< code::instructions_to_string(bytecode->instructions);
+
+		ASSERT_EQ(tt.expected_constants.size(), bytecode->constants.size())
+				<< tt.input;
+		for (int i = 0; i < (int)tt.expected_constants.size(); ++i)
+			EXPECT_EQ(tt.expected_constants[i], bytecode->constants[i]->Inspect());
+	}
+}
+
+TEST(OptimizerTest, PropagatesGlobalsIntoFunctions) {
+	auto program = parse_compiler_program_helper(
+			"let limit = 10 * 1000; func(n) { n > limit / 2 }");
+	auto compiler = new Compiler(1);
+	ASSERT_FALSE(compiler->compile(*program).has_value());
+
+	auto bytecode = compiler->bytecode();
+	auto fn = dynamic_cast<CompiledFunction *>(bytecode->constants[2]);
+	ASSERT_NE(fn, nullptr);
+
+	std::vector<code::Instructions> expected{
+			code::make(code::OpGetLocal, {0}),
+			code::make(code::OpConstant, {1}),
+			code::make(code::OpGreaterThan, {}),
+			code::make(code::OpReturnValue, {}),
+	};
+	EXPECT_TRUE(test_instructions(expected, fn->m_instructions))
+			<< code::instructions_to_string(fn->m_instructions);
+	EXPECT_EQ("5000", bytecode->constants[1]->Inspect());
+}
+
+TEST(OptimizerTest, Superinstructions) {
+	auto program = parse_compiler_program_helper(
+			"let fib = func(n) { if (n == 0) { return 0; } else { return fib(n - 1) "
+			"+ fib(n - 2); } };");
+	auto compiler = new Compiler();
+	ASSERT_FALSE(compiler->compile(*program).has_value());
+
+	auto bytecode = compiler->bytecode();
+	optimizer::optimize(*bytecode, 2);
+
+	auto fn = dynamic_cast<CompiledFunction *>(bytecode->constants[3]);
+	ASSERT_NE(fn, nullptr);
+
+	std::vector<code::Instructions> expected{
+			code::make(code::OpJumpNotEqualLocalConst, {0, 0, 10}),
+			code::make(code::OpConstant, {0}),
+			code::make(code::OpReturnValue, {}),
+			code::make(code::OpSubLocalConst, {0, 1}),
+			code::make(code::OpCallGlobal, {0, 1}),
+			code::make(code::OpSubLocalConst, {0, 2}),
+			code::make(code::OpCallGlobal, {0, 1}),
+			code::make(code::OpAdd, {}),
+			code::make(code::OpReturnValue, {}),
+	};
+	EXPECT_TRUE(test_instructions(expected, fn->m_instructions))
+			<< code::instructions_to_string(fn->m_instructions);
+}
+
+TEST(OptimizerTest, SameResultsAsUnoptimized) {
+	std::vector<std::string> inputs{
+			"let fib = func(n) { if (n == 0) { return 0; } else { if (n == 1) { "
+			"return 1; } else { return fib(n - 1) + fib(n - 2); } } }; fib(15);",
+			"let x = 10; let y = x * 2; if (y > x) { y } else { x }",
+			"let f = func(a) { let b = a + 1; b; if (true) { b } }; f(41)",
+			"let g = func() { if (false) { 1 } }; g()",
+			"let h = func(a) { if (a) { if (!a) { 1 } else { 2 } } else { 3 } }; "
+			"[h(true), h(false)]",
+			"let newAdder = func(a) { func(b) { a + b } }; newAdder(1)(2)",
+			"let limit = 60 * 60 * 24; let f = func(n) { n > limit / 2 }; "
+			"[f(100), f(50000), -limit, !limit, \"a\" + \"b\"]",
+			"let flag = !(1 > 2); if (flag == true) { 1 } else { 2 }",
+			"let x = 1; let f = func() { x * 10 }; let x = 2; f() + x",
+			"let sub = func(a, b) { a - b }; let s = func(n) { sub(n - 1, n) + "
+			"sub(n, 1) }; s(10)",
+			"let eq = func(a) { if (a == \"x\") { 1 } else { 2 } }; [eq(\"x\"), "
+			"eq(1), eq(true)]",
+			"let add = func(a, b) { a + b }; let id = func(x) { x }; "
+			"add(id(1), add(id(2), 3))",
+			"let h = {\"a\": 1, 2: 3, true: 4}; let arr = [5, 6]; "
+			"let get = func(x, k) { x[k] }; "
+			"[h[\"a\"], h[2], h[true], h[\"b\"], arr[1], arr[5], get(h, \"a\"), "
+			"get(arr, 0), get(h, 2)]",
+	};
+
+	for (const auto &input : inputs) {
+		std::string results[optimizer::MaxLevel + 1];
+		for (int level = 0; level <= optimizer::MaxLevel; ++level) {
+			auto program = parse_compiler_program_helper(input);
+			auto compiler = new Compiler(level);
+			ASSERT_FALSE(compiler->compile(*program).has_value());
+
+			auto bytecode = compiler->bytecode();
+			optimizer::optimize(*bytecode, level);
+
+			auto vm = new VM(bytecode);
+			auto vm_status = vm->run();
+			ASSERT_FALSE(vm_status.has_value()) << input;
+			results[level] = vm->last_popped_stack_elem()->Inspect();
+		}
+
+		for (int level = 1; level <= optimizer::MaxLevel; ++level)
+			EXPECT_EQ(results[0], results[level]) << input << " at level " << level;
+	}
+}
+
+TEST(SerializerTest, RoundTrip) {
+	auto program = parse_compiler_program_helper(
+			"let greet = func(name) { \"hi \" + name };"
+			"let adder = func(a) { func(b) { a + b } };"
+			"let fib = func(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };"
+			"[greet(\"lups\"), adder(2)(3), fib(15), {\"k\": -7}[\"k\"]]");
+	auto comp = new Compiler(optimizer::MaxLevel);
+	ASSERT_FALSE(comp->compile(*program).has_value());
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, optimizer::MaxLevel);
+
+	std::vector<char> data;
+	ASSERT_FALSE(serializer::serialize(*bytecode, data).has_value());
+
+	Bytecode loaded;
+	auto err = serializer::deserialize(data.data(), data.size(), loaded);
+	ASSERT_FALSE(err.has_value()) << err.value();
+	ASSERT_EQ(loaded.constants.size(), bytecode->constants.size());
+
+	// the instructions are used where they are in the data, not copied.
+	for (auto constant : loaded.constants) {
+		auto fn = dynamic_cast<CompiledFunction *>(constant);
+		if (fn == nullptr)
+			continue;
+
+		EXPECT_TRUE(fn->m_instructions.empty());
+		EXPECT_GE(fn->code(), data.data());
+		EXPECT_LT(fn->code(), data.data() + data.size());
+	}
+
+	auto vm = new VM(&loaded);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("[hi lups, 5, 610, -7, ]",
+						vm->last_popped_stack_elem()->Inspect());
+}
+
+TEST(SerializerTest, LoadFile) {
+	auto program = parse_compiler_program_helper("let x = 20; x * 2 + 2");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+
+	const auto path = testing::TempDir() + "serializer_test.lpsc";
+	ASSERT_FALSE(serializer::write_file(*comp->bytecode(), path).has_value());
+
+	auto loaded = new Bytecode();
+	auto err = serializer::load_file(path, *loaded);
+	ASSERT_FALSE(err.has_value()) << err.value();
+
+	auto vm = new VM(loaded);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("42", vm->last_popped_stack_elem()->Inspect());
+
+	// the loaded bytecode can't be serialized again, its main program is only
+	// in the mapping.
+	std::vector<char> data;
+	EXPECT_TRUE(serializer::serialize(*loaded, data).has_value());
+}
+
+TEST(SerializerTest, RejectsMalformedFiles) {
+	auto program = parse_compiler_program_helper("func(x) { x }(\"s\")");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+
+	std::vector<char> data;
+	ASSERT_FALSE(serializer::serialize(*comp->bytecode(), data).has_value());
+
+	auto load = [](std::vector<char> data) {
+		Bytecode bytecode;
+		return serializer::deserialize(data.data(), data.size(), bytecode);
+	};
+	EXPECT_FALSE(load(data).has_value());
+
+	auto bad_magic = data;
+	bad_magic[0] = 'X';
+	EXPECT_EQ(load(bad_magic), "not a lpsc file");
+
+	auto bad_version = data;
+	bad_version[4] = serializer::Version + 1;
+	EXPECT_EQ(load(bad_version),
+						"unsupported lpsc version " +
+								std::to_string(serializer::Version + 1));
+
+	auto bad_opcodes = data;
+	bad_opcodes[8] = 1;
+	EXPECT_EQ(load(bad_opcodes),
+						"lpsc file was written with a different instruction set");
+
+	// the function is the first constant, its local and parameter counts follow
+	// its tag.
+	ASSERT_EQ(data[16], 2);
+	auto bad_locals = data;
+	std::fill(bad_locals.begin() + 17, bad_locals.begin() + 21, (char)0xff);
+	EXPECT_EQ(load(bad_locals), "malformed function constant");
+
+	auto bad_parameters = data;
+	bad_parameters[21] = 2;
+	EXPECT_EQ(load(bad_parameters), "malformed function constant");
+
+	// every truncation is caught instead of reading past the end.
+	for (std::size_t size = 0; size < data.size(); ++size)
+		EXPECT_TRUE(load(std::vector<char>(data.begin(), data.begin() + size))
+										.has_value())
+				<< size;
+}
+
+TEST(CacheTest, HitsAndMisses) {
+	const auto dir = testing::TempDir() + "lups_cache_test";
+	std::filesystem::remove_all(dir);
+	CompileCache cache(dir);
+
+	const std::string source = "let double = func(x) { x * 2 }; double(21)";
+	const auto key = cache.key(source, optimizer::MaxLevel);
+	EXPECT_NE(key, cache.key(source, 0));
+	EXPECT_NE(key, cache.key(source + " ", optimizer::MaxLevel));
+
+	Bytecode missed;
+	EXPECT_FALSE(cache.load(key, missed));
+
+	auto program = parse_compiler_program_helper(source);
+	auto comp = new Compiler(optimizer::MaxLevel);
+	ASSERT_FALSE(comp->compile(*program).has_value());
+	auto bytecode = comp->bytecode();
+	optimizer::optimize(*bytecode, optimizer::MaxLevel);
+	auto err = cache.store(key, *bytecode);
+	ASSERT_FALSE(err.has_value()) << err.value();
+
+	// another cache on the same directory, like the next process, finds it.
+	CompileCache other(dir);
+	auto loaded = new Bytecode();
+	ASSERT_TRUE(other.load(key, *loaded));
+	auto vm = new VM(loaded);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("42", vm->last_popped_stack_elem()->Inspect());
+
+	auto stats = other.stats();
+	EXPECT_EQ(stats.hits, 1);
+	EXPECT_EQ(stats.misses, 1);
+
+	// a damaged entry is a miss and storing the program again replaces it.
+	const auto path = dir + "/" + key + serializer::Extension;
+	std::filesystem::resize_file(path, 10);
+	Bytecode damaged;
+	EXPECT_FALSE(cache.load(key, damaged));
+	ASSERT_FALSE(cache.store(key, *bytecode).has_value());
+	Bytecode stored;
+	EXPECT_TRUE(cache.load(key, stored));
+
+	// so is an entry that reads fine but pops from an empty stack.
+	Bytecode invalid;
+	invalid.instructions = code::make(code::OpPop, {});
+	ASSERT_FALSE(cache.store(key, invalid).has_value());
+	Bytecode unverified;
+	EXPECT_FALSE(cache.load(key, unverified));
+	ASSERT_FALSE(cache.store(key, *bytecode).has_value());
+	Bytecode restored;
+	EXPECT_TRUE(cache.load(key, restored));
+
+	stats = cache.stats();
+	EXPECT_EQ(stats.hits, 3);
+	EXPECT_EQ(stats.misses, 3);
+
+	// only the entry and the stats are left, no temporary files.
+	int files = 0;
+	for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+		(void)entry;
+		++files;
+	}
+	EXPECT_EQ(files, 2);
+	std::filesystem::remove_all(dir);
+}
+
+TEST(VerifierTest, MaxStackDepth) {
+	auto program = parse_compiler_program_helper(
+			"let add = func(a, b) { let c = a + b; [a, b, c] }; add(1, 2)");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+	auto bytecode = comp->bytecode();
+
+	auto err = verifier::verify(*bytecode);
+	ASSERT_FALSE(err.has_value()) << err.value();
+
+	// the three locals and the three elements of the array.
+	auto add = dynamic_cast<CompiledFunction *>(bytecode->constants[0]);
+	ASSERT_NE(add, nullptr);
+	EXPECT_EQ(add->m_max_stack, 6);
+	// the closure and the two arguments of the call.
+	EXPECT_EQ(bytecode->main_max_stack, 3);
+
+	auto vm = new VM(bytecode);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("[1, 2, 3, ]", vm->last_popped_stack_elem()->Inspect());
+}
+
+TEST(VerifierTest, StackOverflowInVerifiedCode) {
+	auto program =
+			parse_compiler_program_helper("let f = func(n) { 1 + f(n + 1) }; f(0)");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+	auto bytecode = comp->bytecode();
+	ASSERT_FALSE(verifier::verify(*bytecode).has_value());
+
+	auto vm = new VM(bytecode);
+	auto err = vm->run();
+	ASSERT_TRUE(err.has_value());
+	EXPECT_NE(err.value().find("overflow"), std::string::npos) << err.value();
+}
+
+TEST(VerifierTest, RejectsInvalidCode) {
+	struct Testcase {
+		std::vector<code::Instructions> main;
+		std::vector<code::Instructions> function;
+		int num_locals;
+		std::string expected;
+		int num_parameters = 0;
+	};
+
+	std::vector<Testcase> test_cases{
+			{{code::make(code::OpConstant, {1}), code::make(code::OpPop, {})},
+			 {},
+			 0,
+			 "main: constant index out of range at 0"},
+			{{code::make(code::OpPop, {})}, {}, 0, "main: stack underflow at 0"},
+			{{{(char)200}}, {}, 0, "main: unknown opcode 200 at 0"},
+			{{}, {{code::OpConstant, 0}}, 0, "constant 1: truncated OpConstant at 0"},
+			{{code::make(code::OpJump, {1}), code::make(code::OpConstant, {0})},
+			 {},
+			 0,
+			 "main: jump to 1 isn't an instruction boundary at 0"},
+			{{code::make(code::OpTrue, {}),
+				code::make(code::OpJumpNotTruthy, {7}),
+				code::make(code::OpTrue, {}), code::make(code::OpTrue, {}),
+				code::make(code::OpPop, {})},
+			 {},
+			 0,
+			 "main: stack height 1 differs from 0 at 7"},
+			{{code::make(code::OpTrue, {}), code::make(code::OpReturnValue, {})},
+			 {},
+			 0,
+			 "main: return outside of a function at 1"},
+			{{code::make(code::OpGetFree, {0}), code::make(code::OpPop, {})},
+			 {},
+			 0,
+			 "main: free variable outside of a function at 0"},
+			{{code::make(code::OpTrue, {}), code::make(code::OpHash, {1}),
+				code::make(code::OpPop, {})},
+			 {},
+			 0,
+			 "main: hash of an odd number of values at 1"},
+			{{code::make(code::OpClosure, {0, 0}), code::make(code::OpPop, {})},
+			 {},
+			 0,
+			 "main: closure of a constant that isn't a function at 0"},
+			{{code::make(code::OpClosure, {1, 0}), code::make(code::OpPop, {})},
+			 {code::make(code::OpGetFree, {0}), code::make(code::OpReturnValue, {})},
+			 0,
+			 "closure of constant 1 captures too few free variables"},
+			{{},
+			 {code::make(code::OpGetLocal, {1}), code::make(code::OpReturnValue, {})},
+			 1,
+			 "constant 1: local index out of range at 0"},
+			{{},
+			 {code::make(code::OpSetLocal, {0}), code::make(code::OpReturn, {})},
+			 1,
+			 "constant 1: stack underflow at 0"},
+			{{}, {code::make(code::OpTrue, {})}, 0,
+			 "constant 1: control runs off the end at 0"},
+			{{}, {code::make(code::OpHalt, {})}, 0,
+			 "constant 1: halt inside a function at 0"},
+			{{}, {code::make(code::OpReturn, {})}, -100,
+			 "constant 1: -100 locals and 0 parameters don't make a frame"},
+			{{}, {code::make(code::OpReturn, {})}, StackSize + 1,
+			 "constant 1: 2049 locals and 0 parameters don't make a frame"},
+			{{}, {code::make(code::OpReturn, {})}, 1,
+			 "constant 1: 1 locals and 2 parameters don't make a frame", 2},
+	};
+
+	for (auto &tt : test_cases) {
+		Bytecode bytecode;
+		bytecode.instructions = concat_instructions(tt.main);
+		bytecode.constants.push_back(new Integer(1));
+		if (!tt.function.empty()) {
+			auto fn = new CompiledFunction(concat_instructions(tt.function),
+																		 tt.num_locals);
+			fn->m_num_parameters = tt.num_parameters;
+			bytecode.constants.push_back(fn);
+		}
+
+		auto err = verifier::verify(bytecode);
+		ASSERT_TRUE(err.has_value()) << tt.expected;
+		EXPECT_EQ(err.value(), tt.expected);
+		EXPECT_EQ(bytecode.main_max_stack, -1);
+	}
+}
+
+TEST(RegisterVMTest, ThreeAddressCode) {
+	auto program = parse_compiler_program_helper(
+			"let add = func(a, b) { let c = a + b; c * 2 }; add(1, 2)");
+	auto comp = new RegisterCompiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+	auto bytecode = comp->bytecode();
+
+	// the locals live in fixed registers and constants are operands.
+	auto add = dynamic_cast<RegisterFunction *>(bytecode->constants[1]);
+	ASSERT_NE(add, nullptr);
+	EXPECT_EQ(reg::instructions_to_string(add->m_code), "0000 OpAdd r2 r0 r1\n"
+																											 "0001 OpMul r3 r2 k0\n"
+																											 "0002 OpReturn r3\n");
+
+	auto vm = new RegisterVM(bytecode);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("6", vm->result()->Inspect());
+}
+
+TEST(RegisterVMTest, Errors) {
+	struct Testcase {
+		std::string input;
+		std::string expected;
+	};
+
+	std::vector<Testcase> test_cases{
+			{"func(a) { a }(1, 2)", "the amount of arguments supplied differs"},
+			{"let f = func(n) { 1 + f(n + 1) }; f(0)", "overflow"},
+			{"5 / 0", "division by zero"},
+			{"1(2)", "calling a type that is not a function."},
+	};
+
+	for (auto &tt : test_cases) {
+		auto program = parse_compiler_program_helper(tt.input);
+		auto comp = new RegisterCompiler();
+		ASSERT_FALSE(comp->compile(*program).has_value()) << tt.input;
+
+		auto vm = new RegisterVM(comp->bytecode());
+		auto err = vm->run();
+		ASSERT_TRUE(err.has_value()) << tt.input;
+		EXPECT_NE(err.value().find(tt.expected), std::string::npos) << err.value();
+	}
+}
+
+// run_jit compiles and verifies input and runs it with the given jit threshold.
+static std::pair<VM *, std::optional<std::string>>
+run_jit(const std::string &input, int threshold) {
+	auto program = parse_compiler_program_helper(input);
+	auto comp = new Compiler();
+	comp->compile(*program);
+	auto bytecode = comp->bytecode();
+	verifier::verify(*bytecode);
+
+	auto vm = new VM(bytecode);
+	vm->set_jit_threshold(threshold);
+	auto status = vm->run();
+	return {vm, status};
+}
+
+TEST(JitTest, CompilesHotFunctions) {
+	if (!jit::enabled())
+		GTEST_SKIP() << "the jit isn't available";
+
+	auto program = parse_compiler_program_helper(
+			"let fib = func(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };"
+			"let once = func() { fib(20) }; once()");
+	auto comp = new Compiler();
+	ASSERT_FALSE(comp->compile(*program).has_value());
+	auto bytecode = comp->bytecode();
+	ASSERT_FALSE(verifier::verify(*bytecode).has_value());
+
+	auto vm = new VM(bytecode);
+	vm->set_jit_threshold(10);
+	ASSERT_FALSE(vm->run().has_value());
+	EXPECT_EQ("6765", vm->last_popped_stack_elem()->Inspect());
+
+	// only fib was called often enough.
+	for (auto constant : bytecode->constants) {
+		auto fn = dynamic_cast<CompiledFunction *>(constant);
+		if (fn == nullptr)
+			continue;
+		EXPECT_EQ(fn->m_native != nullptr, fn->m_calls == 10);
+	}
+}
+
+TEST(JitTest, MixesWithInterpretedFrames) {
+	// f is compiled on its third call while the first two still run in the
+	// dispatch loop, g is first called from the machine code of f.
+	auto [vm, err] = run_jit("let g = func(x) { x * 2 };"
+													 "let f = func(n) {"
+													 "    if (n == 0) { 0 } else { f(n - 1) + g(n) }"
+													 "};"
+													 "[f(5), g(1), f(2)]",
+													 3);
+	ASSERT_FALSE(err.has_value()) << err.value();
+	EXPECT_EQ("[30, 2, 6, ]", vm->last_popped_stack_elem()->Inspect());
+}
+
+TEST(JitTest, Errors) {
+	struct Testcase {
+		std::string input;
+		std::string expected;
+	};
+
+	std::vector<Testcase> test_cases{
+			{"let f = func(a) { a + true }; f(1)",
+			 "binary operation is not recognized for given types."},
+			{"let f = func(a) { -a }; f(true)",
+			 "type cannot be used in conjunction with minus expression"},
+			{"let f = func(a) { a > \"b\" }; f(1)",
+			 "comparison operator is not recognized"},
+			{"let f = func(n) { 1 + f(n + 1) }; f(0)", "overflow"},
+			{"let g = func(a) { a }; let f = func() { g(1, 2) }; f()",
+			 "the amount of arguments supplied differs"},
+	};
+
+	for (auto &tt : test_cases) {
+		auto [vm, err] = run_jit(tt.input, 1);
+		ASSERT_TRUE(err.has_value()) << tt.input;
+		EXPECT_NE(err.value().find(tt.expected), std::string::npos) << err.value();
+	}
+}
+
+TEST(JitTest, DisabledByEnvironment) {
+	setenv("LUPS_NO_JIT", "1", 1);
+	EXPECT_FALSE(jit::enabled());
+	unsetenv("LUPS_NO_JIT");
+}
+
+// run_tiered runs a program on the tiered runtime, it returns what the program
+// evaluates to and the trace.
+std::pair<std::string, std::string> run_tiered(const std::string &input,
+																							 TierConfig config) {
+	auto program = parse_compiler_program_helper(input);
+	std::ostringstream trace;
+	config.trace = &trace;
+
+	TieredRuntime runtime(config);
+	auto result = runtime.run(program.get());
+	return {result->Inspect(), trace.str()};
+}
+
+TEST(TierTest, MatchesEval) {
+	std::vector<std::string> test_cases{
+			"let fib = func(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };"
+			"fib(15)",
+			"let newAdder = func(a) { func(b) { a + b } };"
+			"let apply = func(f, n) { if (n == 0) { 0 } else { f(apply(f, n - 1)) } };"
+			"let inc = func(x) { x + 1 }; [apply(inc, 20), newAdder(2)(3)]",
+			"let make = func(n) { if (n == 0) { [] } else { push(make(n - 1), n) } };"
+			"let words = [\"a\", \"b\"];"
+			"let entry = func(i) { {\"n\": make(i), \"w\": words[i - (i / 2) * 2] + \"!\"} };"
+			"let run = func(n) { if (n == 0) { [] } else { push(run(n - 1), entry(n)) } };"
+			"let all = run(12); [all[11], first(all)[\"w\"], tail(make(3))]",
+			"let limit = 10; let count = func(n) { if (n > limit) { n } else { count(n + 1) } };"
+			"let limit = 20; count(0)",
+			"let even = func(n) { if (n == 0) { true } else { odd(n - 1) } };"
+			"let odd = func(n) { if (n == 0) { false } else { even(n - 1) } };"
+			"[even(30), odd(7), even(5)]",
+			// strings compare by contents and values of different types are unequal
+			// in every tier.
+			"let eq = func(a, b) { a == b }; let ne = func(a, b) { a != b };"
+			"let is = func(s) { if (s == \"x\") { 1 } else { 2 } };"
+			"let pair = func(n) { let a = [n]; [a, a] };"
+			"let warm = func(n) { if (n == 0) { 0 } else {"
+			"  eq(n, n); ne(n, n); is(n); pair(n); warm(n - 1) } };"
+			"warm(150); let p = pair(1);"
+			"[eq(\"x\", \"x\"), eq(1, true), eq(\"a\" + \"b\", \"ab\"), ne(\"x\", \"y\"),"
+			" ne(true, 1), is(\"x\"), is(\"y\"), is(true), p[0] == p[1]]",
+			"let f = func(n) { if (n == 0) { 0 } else { n + f(n - 1) } };"
+			"let g = func(n) { f(n) + true }; [f(10), g(3), f(5)]",
+	};
+
+	for (const auto &input : test_cases) {
+		const auto expected = eval_test(input)->Inspect();
+		for (auto threshold : {1, 3, 100}) {
+			TierConfig config;
+			config.call_threshold = threshold;
+			config.back_edge_threshold = threshold;
+			config.jit_threshold = 5;
+			config.gc = GCConfig{16, 1.5, 512};
+			EXPECT_EQ(expected, run_tiered(input, config).first) << input;
+		}
+	}
+}
+
+TEST(TierTest, TracesTierUps) {
+	const std::string input =
+			"let fib = func(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };"
+			"let twice = func(x) { x * 2 };"
+			"[fib(1), fib(1), fib(10), twice(fib(1))]";
+
+	TierConfig config;
+	config.call_threshold = 3;
+	config.back_edge_threshold = 100;
+	config.jit_threshold = 10;
+	auto [result, trace] = run_tiered(input, config);
+	EXPECT_EQ("[1, 1, 55, 2, ]", result);
+	EXPECT_NE(trace.find("tier-up fib eval -> vm after 3 calls\n"),
+						std::string::npos)
+			<< trace;
+	// twice was only called once.
+	EXPECT_EQ(trace.find("twice"), std::string::npos) << trace;
+	if (jit::enabled()) {
+		EXPECT_NE(trace.find("tier-up fib vm -> jit after 10 calls in the vm\n"),
+							std::string::npos)
+				<< trace;
+	}
+
+	config.call_threshold = 100;
+	config.back_edge_threshold = 4;
+	trace = run_tiered(input, config).second;
+	EXPECT_NE(trace.find("tier-up fib eval -> vm after 4 back edges\n"),
+						std::string::npos)
+			<< trace;
+}
+
+TEST(TierTest, StaysInEval) {
+	struct Testcase {
+		std::string input;
+		std::string expected;
+		std::string trace;
+	};
+
+	std::vector<Testcase> test_cases{
+			{"let newAdder = func(a) { func(b) { a + b } }; newAdder(1)(2)", "3",
+			 "stays newAdder in eval: defines functions"},
+			{"let f = func() { missing }; f()", "err: identifier not found: missing",
+			 "stays f in eval: uses missing, which isn't a global"},
+			{"let make = func() { func(b) { b * 2 } }; let double = make(); double(4)",
+			 "8", "stays double in eval: not defined at the top level"},
+			{"let f = func(a) { print(); a }; f(1)", "1",
+			 "stays f in eval: uses print, which only the tree walker has"},
+	};
+
+	for (const auto &tt : test_cases) {
+		TierConfig config;
+		config.call_threshold = 1;
+		auto [result, trace] = run_tiered(tt.input, config);
+		EXPECT_EQ(tt.expected, result) << tt.input;
+		EXPECT_NE(trace.find(tt.trace), std::string::npos) << trace;
+	}
+}
+
+TEST(TierTest, EmptyValuesAreNull) {
+	std::vector<std::string> test_cases{
+			"",
+			"let f = func() { }; [f(), f()]",
+			"let x = if (true) { let y = 1; }; x",
+			"let f = func() { let y = 1; }; [f(), f()]",
+	};
+
+	for (const auto &input : test_cases) {
+		for (auto threshold : {1, 100}) {
+			TierConfig config;
+			config.call_threshold = threshold;
+			const auto expected =
+					input.find('[') == std::string::npos ? "NULL" : "[NULL, NULL, ]";
+			EXPECT_EQ(expected, run_tiered(input, config).first) << input;
+		}
+	}
+}
+
+TEST(TierTest, Errors) {
+	TierConfig config;
+	config.call_threshold = 1;
+	auto [result, trace] =
+			run_tiered("let f = func(a) { a + true }; f(1)", config);
+
+	// the call runs again in the tree walker, which reports the error.
+	EXPECT_EQ("err: wrong types", result);
+	EXPECT_NE(trace.find("tier-up f eval -> vm"), std::string::npos) << trace;
+	EXPECT_NE(trace.find("tier-down f vm -> eval after binary operation is not "
+											 "recognized for given types.\n"),
+						std::string::npos)
+			<< trace;
+}
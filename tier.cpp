@@ -0,0 +1,456 @@
+#include "tier.h"
+#include "builtins.h"
+#include "compiler.h"
+#include "eval.h"
+#include "optimizer.h"
+#include "verifier.h"
+#include <unordered_set>
+
+namespace {
+// FreeNames collects the names a function literal uses without defining them,
+// in the order they are first used. A name that is used before the function
+// binds it with a let refers to the outer one at that point, like it does in
+// the tree walker. nested is set when the body defines functions of its own.
+struct FreeNames {
+	std::unordered_set<std::string> bound;
+	std::unordered_set<std::string> seen;
+	std::vector<std::string> names;
+	bool nested = false;
+
+	void walk(Node *node) {
+		if (node == nullptr)
+			return;
+
+		switch (node->Type()) {
+		case AstType::Identifier: {
+			const auto name = std::string(((Identifier *)node)->value);
+			if (bound.count(name) == 0 && seen.insert(name).second)
+				names.push_back(name);
+			break;
+		}
+		case AstType::LetStatement: {
+			auto let = (LetStatement *)node;
+			walk(let->value.get());
+			bound.insert(std::string(let->name->value));
+			break;
+		}
+		case AstType::ReturnStatement:
+			walk(((ReturnStatement *)node)->return_value.get());
+			break;
+		case AstType::ExpressionStatement:
+			walk(((ExpressionStatement *)node)->expression.get());
+			break;
+		case AstType::BlockStatement:
+			for (const auto &st : ((BlockStatement *)node)->statements)
+				walk(st.get());
+			break;
+		case AstType::PrefixExpression:
+			walk(((PrefixExpression *)node)->right.get());
+			break;
+		case AstType::InfixExpression:
+			walk(((InfixExpression *)node)->left.get());
+			walk(((InfixExpression *)node)->right.get());
+			break;
+		case AstType::IfExpression:
+			walk(((IfExpression *)node)->cond.get());
+			walk(((IfExpression *)node)->after.get());
+			walk(((IfExpression *)node)->other.get());
+			break;
+		case AstType::CallExpression:
+			walk(((CallExpression *)node)->func.get());
+			for (const auto &arg : ((CallExpression *)node)->arguments)
+				walk(arg.get());
+			break;
+		case AstType::IndexExpression:
+			walk(((IndexExpression *)node)->left.get());
+			walk(((IndexExpression *)node)->index.get());
+			break;
+		case AstType::ArrayLiteral:
+			for (const auto &elem : ((ArrayLiteral *)node)->elements)
+				walk(elem.get());
+			break;
+		case AstType::HashLiteral:
+			for (const auto &pr : ((HashLiteral *)node)->pairs) {
+				walk(pr.first.get());
+				walk(pr.second.get());
+			}
+			break;
+		case AstType::FunctionLiteral:
+			nested = true;
+			break;
+		default:
+			break;
+		}
+	}
+};
+} // namespace
+
+static bool vm_builtin(const std::string &name) {
+	for (const auto &builtin : builtin_functions::functions)
+		if (builtin.first == name)
+			return true;
+
+	return false;
+}
+
+TieredRuntime::TieredRuntime(TierConfig config) : config_(config) {
+	// the vm only ever runs functions, its main program stays empty.
+	Bytecode bytecode;
+	verifier::verify(bytecode);
+	vm_ = std::make_unique<VM>(&bytecode, config_.gc);
+	if (config_.jit_threshold.has_value())
+		vm_->set_jit_threshold(config_.jit_threshold.value());
+
+	vm_->set_jit_listener([this](CompiledFunction &fn) {
+		auto function = functions_.find(&fn);
+		if (function != functions_.end())
+			trace("tier-up " + name_of(function->second) + " vm -> jit after " +
+						std::to_string(fn.m_calls) + " calls in the vm");
+	});
+}
+
+Object *TieredRuntime::run(Node *program) {
+	auto previous = eval::set_call_handler(
+			[this](Function *fn, std::vector<Object *> &args) {
+				return call(fn, args);
+			});
+	auto result = eval::Eval(program, &globals_);
+	eval::set_call_handler(previous);
+
+	return result;
+}
+
+Object *TieredRuntime::call(Function *fn, std::vector<Object *> &args) {
+	auto &profile = profiles_[fn->body];
+	if (profile.closure == nullptr && !profile.stays) {
+		++profile.calls;
+		if (profile.active > 0)
+			++profile.back_edges;
+
+		if (profile.calls >= config_.call_threshold)
+			promote(fn, profile, std::to_string(profile.calls) + " calls");
+		else if (profile.back_edges >= config_.back_edge_threshold)
+			promote(fn, profile,
+							std::to_string(profile.back_edges) + " back edges");
+	}
+
+	if (profile.closure != nullptr && !profile.stays && fn->env == &globals_) {
+		auto result = call_vm(fn, profile, args);
+		if (result != nullptr)
+			return result;
+	}
+
+	++profile.active;
+	auto result = eval::call_function(fn, args);
+	--profile.active;
+
+	return result;
+}
+
+bool TieredRuntime::promote(Function *fn, Profile &profile,
+														const std::string &reason) {
+	const auto name = name_of(fn);
+	auto stay = [&](const std::string &why) {
+		profile.stays = true;
+		trace("stays " + name + " in eval: " + why);
+		return false;
+	};
+
+	if (fn->env != &globals_)
+		return stay("not defined at the top level");
+
+	FreeNames free;
+	for (auto param : fn->params)
+		free.bound.insert(std::string(param->value));
+	free.walk(fn->body);
+	if (free.nested)
+		return stay("defines functions");
+
+	// builtins the vm has as well are left to the compiler, the vm's versions
+	// also take its packed arrays.
+	std::vector<std::string> names;
+	std::vector<std::string> new_globals;
+	for (const auto &free_name : free.names) {
+		if (lookup(free_name) == nullptr)
+			return stay("uses " + free_name + ", which isn't a global");
+		if (globals_.m_store.count(free_name) == 0) {
+			if (vm_builtin(free_name))
+				continue;
+			return stay("uses " + free_name + ", which only the tree walker has");
+		}
+
+		names.push_back(free_name);
+		if (global_indexes_.count(free_name) == 0)
+			new_globals.push_back(free_name);
+	}
+
+	// a fresh compiler for every function keeps a failed compile from leaving
+	// scopes behind, it starts out with the vm's constants and globals.
+	Compiler comp(optimizer::MaxLevel);
+	for (auto constant : constants_)
+		comp.add_constant(constant);
+	for (const auto &global : vm_globals_)
+		comp.symbol_table_->define(global.name);
+	for (const auto &global : new_globals)
+		comp.symbol_table_->define(global);
+
+	// the function only keeps the parts of its literal the tree walker needs.
+	std::vector<NodePtr<Identifier>> params(fn->params.begin(), fn->params.end());
+	FunctionLiteral literal;
+	literal.params = ArenaList<NodePtr<Identifier>>(params.data(), params.size());
+	literal.body = fn->body;
+
+	auto err = comp.compile(literal);
+	if (err.has_value())
+		return stay(err.value());
+
+	std::unique_ptr<Bytecode> bytecode(comp.bytecode());
+	auto compiled = (CompiledFunction *)bytecode->constants.back();
+	compiled->m_instructions =
+			optimizer::fuse(optimizer::peephole(compiled->m_instructions));
+
+	bytecode->instructions.clear();
+	auto invalid = verifier::verify(*bytecode);
+	if (invalid.has_value())
+		return stay("invalid bytecode: " + invalid.value());
+
+	for (auto i = constants_.size(); i < bytecode->constants.size(); ++i) {
+		constants_.push_back(bytecode->constants[i]);
+		vm_->add_constant(bytecode->constants[i]);
+	}
+	for (const auto &global : new_globals) {
+		global_indexes_[global] = (int)vm_globals_.size();
+		vm_globals_.push_back(Global{global});
+	}
+	for (const auto &global : names)
+		profile.globals.push_back(global_indexes_[global]);
+
+	profile.closure = std::make_unique<Closure>(compiled);
+	vm_->pin(profile.closure.get());
+	functions_[compiled] = fn;
+	trace("tier-up " + name + " eval -> vm after " + reason);
+
+	return true;
+}
+
+// call_vm returns nullptr when the call has to run in the tree walker. The vm
+// stops at errors the tree walker may handle differently, or not have at all
+// like a stack overflow, so a call that fails there is run again in the tree
+// walker and so are all later calls of the function. Functions that can move
+// have no side effects, running them twice is safe.
+Object *TieredRuntime::call_vm(Function *fn, Profile &profile,
+															 std::vector<Object *> &args) {
+	++sync_epoch_;
+	if (!sync(profile))
+		return nullptr;
+
+	std::vector<Value> values;
+	values.reserve(args.size());
+	for (auto arg : args) {
+		auto val = import(arg);
+		if (!val.has_value())
+			return nullptr;
+		values.push_back(val.value());
+	}
+
+	Value result;
+	auto status =
+			vm_->call(Value::object(profile.closure.get()), values, result);
+	if (status.has_value()) {
+		profile.stays = true;
+		trace("tier-down " + name_of(fn) + " vm -> eval after " + status.value());
+		return nullptr;
+	}
+
+	exported_.clear();
+	return export_value(result);
+}
+
+// sync copies the globals a function uses, and those of the functions it can
+// call in turn, that have changed since the last call. It returns false if one
+// of them can't be copied.
+bool TieredRuntime::sync(Profile &profile) {
+	if (profile.synced == sync_epoch_)
+		return true;
+	profile.synced = sync_epoch_;
+
+	for (auto index : profile.globals) {
+		auto obj = lookup(vm_globals_[index].name);
+		if (obj != vm_globals_[index].synced) {
+			// importing a function can promote it, which adds globals.
+			auto val = import(obj);
+			vm_globals_[index].synced = obj;
+			vm_globals_[index].valid = val.has_value();
+			if (val.has_value())
+				vm_->set_global(index, val.value());
+		}
+
+		if (!vm_globals_[index].valid)
+			return false;
+		if (obj != nullptr && obj->Type() == ObjType::Function &&
+				!sync(profiles_[((Function *)obj)->body]))
+			return false;
+	}
+
+	return true;
+}
+
+std::optional<Value> TieredRuntime::import(Object *obj) {
+	if (obj == nullptr)
+		return Value::null();
+
+	switch (obj->Type()) {
+	case ObjType::Integer:
+	case ObjType::Boolean:
+	case ObjType::Null:
+		return object_to_value(obj);
+	case ObjType::Function: {
+		auto fn = (Function *)obj;
+		auto &profile = profiles_[fn->body];
+		if (profile.closure == nullptr &&
+				(profile.stays || !promote(fn, profile, "a call from the vm")))
+			return std::nullopt;
+		if (fn->env != &globals_)
+			return std::nullopt;
+		return Value::object(profile.closure.get());
+	}
+	default:
+		if (!shareable(obj))
+			return std::nullopt;
+		pin(obj);
+		return Value::object(obj);
+	}
+}
+
+// shareable tells whether the vm can use an object of the tree walker as it
+// is. Pinned objects have been checked before. Builtins of the tree walker
+// aren't, print would make running a call again show its output twice.
+bool TieredRuntime::shareable(Object *obj) {
+	if (obj->gc_state_ == GCState::Pinned)
+		return true;
+
+	switch (obj->Type()) {
+	case ObjType::Integer:
+	case ObjType::Boolean:
+	case ObjType::Null:
+	case ObjType::String:
+		return true;
+	case ObjType::Array:
+		for (auto elem : ((Array *)obj)->elements)
+			if (!shareable(elem))
+				return false;
+		return true;
+	case ObjType::Hash:
+		for (const auto &pr : ((Hash *)obj)->pairs)
+			if (!shareable(pr.key) || !shareable(pr.value))
+				return false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// pin keeps the vm's heap from adopting an object of the tree walker or any
+// object in it, arrays and hashes of the vm can share them.
+void TieredRuntime::pin(Object *obj) {
+	if (obj->gc_state_ == GCState::Pinned)
+		return;
+
+	vm_->pin(obj);
+	if (obj->Type() == ObjType::Array) {
+		for (auto elem : ((Array *)obj)->elements)
+			pin(elem);
+	} else if (obj->Type() == ObjType::Hash) {
+		for (const auto &pr : ((Hash *)obj)->pairs) {
+			pin(pr.key);
+			pin(pr.value);
+		}
+	}
+}
+
+Object *TieredRuntime::export_value(Value val) {
+	if (!val.is_object())
+		return value_to_object(val);
+	return export_object(val.as_object());
+}
+
+// export_object copies an object of the vm's heap into one the tree walker can
+// keep, the heap may move or free the original. Pinned objects aren't the
+// heap's and are shared. An array or hash that is in the result more than once
+// is copied once, the tree walker compares them by identity.
+Object *TieredRuntime::export_object(Object *obj) {
+	auto copy = exported_.find(obj);
+	if (copy != exported_.end())
+		return copy->second;
+
+	auto res = copy_object(obj);
+	if (obj->Type() == ObjType::Array || obj->Type() == ObjType::IntArray ||
+			obj->Type() == ObjType::Hash)
+		exported_[obj] = res;
+	return res;
+}
+
+Object *TieredRuntime::copy_object(Object *obj) {
+	switch (obj->Type()) {
+	case ObjType::Integer:
+		return new Integer(((Integer *)obj)->value);
+	case ObjType::String:
+		if (obj->gc_state_ == GCState::Pinned)
+			return obj;
+		return new String(((String *)obj)->value);
+	case ObjType::Array: {
+		if (obj->gc_state_ == GCState::Pinned)
+			return obj;
+		PersistentVector elements;
+		for (auto elem : ((Array *)obj)->elements)
+			elements.push_back(export_object(elem));
+		return new Array(std::move(elements));
+	}
+	// the tree walker has no packed arrays.
+	case ObjType::IntArray: {
+		auto arr = (IntArray *)obj;
+		PersistentVector elements;
+		for (std::size_t i = 0; i < arr->size(); ++i)
+			elements.push_back(new Integer((*arr)[i]));
+		return new Array(std::move(elements));
+	}
+	case ObjType::Hash: {
+		if (obj->gc_state_ == GCState::Pinned)
+			return obj;
+		auto hash = new Hash();
+		for (const auto &pr : ((Hash *)obj)->pairs)
+			hash->set(export_object(pr.key), pr.hash, export_object(pr.value));
+		return hash;
+	}
+	case ObjType::Closure: {
+		auto fn = functions_.find(((Closure *)obj)->func_);
+		if (fn == functions_.end())
+			return new Error("the vm returned a closure the tree walker can't call");
+		return fn->second;
+	}
+	default:
+		return obj;
+	}
+}
+
+Object *TieredRuntime::lookup(const std::string &name) {
+	auto global = globals_.m_store.find(name);
+	if (global != globals_.m_store.end())
+		return global->second;
+
+	return eval::find_builtin(name);
+}
+
+// name_of returns the name of the global a function is bound to.
+std::string TieredRuntime::name_of(Function *fn) {
+	for (const auto &global : globals_.m_store)
+		if (global.second == fn)
+			return global.first;
+
+	return "<anonymous>";
+}
+
+void TieredRuntime::trace(const std::string &line) {
+	if (config_.trace != nullptr)
+		*config_.trace << line << '\n';
+}
@@ -0,0 +1,121 @@
+#ifndef LUPS_TIER_H
+#define LUPS_TIER_H
+
+#include "ast.h"
+#include "object.h"
+#include "vm.h"
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// TierConfig sets when the tiered runtime moves a function to the next tier.
+struct TierConfig {
+	// a function moves from the tree walker to the vm once it has been called
+	// call_threshold times, or back_edge_threshold times while it was already
+	// running. lups has no loops, so a call of a function that is still running
+	// is what counts as a back edge.
+	int call_threshold = 100;
+	int back_edge_threshold = 50;
+
+	// the calls after which the vm compiles a function to machine code, 0 turns
+	// the jit off. Unset keeps the vm's default.
+	std::optional<int> jit_threshold;
+
+	// the garbage collector of the vm's heap.
+	GCConfig gc;
+
+	// every function that moves to another tier, or can't, is reported as a line
+	// on trace when it is set.
+	std::ostream *trace = nullptr;
+};
+
+// TieredRuntime runs a program on the tree walker and moves the functions
+// that get hot to the stack vm, whose jit takes them to machine code in turn.
+// Scripts that only run briefly never pay for compiling.
+//
+// The tiers meet at calls: a function that has moved runs in the vm from its
+// next call on, calls that are already running finish in the tree walker. A
+// function can only move when it is defined at the top level and the names it
+// doesn't define itself are globals or builtins the vm has as well, the vm
+// then gets a copy of those globals on every call from the tree walker. Values
+// are shared where both engines represent them the same way, the tree walker's
+// objects are pinned in the vm's heap and the vm's are copied out of it. A call
+// whose arguments or globals the vm can't represent, like functions that stay
+// in the tree walker, runs in the tree walker. So does a call that fails in the
+// vm, the function stays in the tree walker after it.
+class TieredRuntime {
+public:
+	TieredRuntime(TierConfig config = TierConfig());
+
+	// run evaluates a program, it returns the value of the last statement, which
+	// is an Error when the program failed. The program has to outlive the
+	// runtime, the functions it defines point into it.
+	Object *run(Node *program);
+
+private:
+	// Profile is what the runtime knows about one function literal.
+	struct Profile {
+		int calls = 0;
+		int back_edges = 0;
+		// the calls of the function that are running in the tree walker.
+		int active = 0;
+		// set once the function runs in the vm.
+		std::unique_ptr<Closure> closure;
+		// set when the function can't move to the vm.
+		bool stays = false;
+		// the vm's copies of the globals the function uses, and the call from the
+		// tree walker they were last synced for.
+		std::vector<int> globals;
+		unsigned synced = 0;
+	};
+
+	// Global is a global of the tree walker the vm has a copy of.
+	struct Global {
+		std::string name;
+		// the object the copy was made of, and whether the vm can represent it.
+		Object *synced = nullptr;
+		bool valid = false;
+	};
+
+	Object *call(Function *fn, std::vector<Object *> &args);
+
+	// promote compiles a function for the vm, it returns false when it has to
+	// stay in the tree walker.
+	bool promote(Function *fn, Profile &profile, const std::string &reason);
+	Object *call_vm(Function *fn, Profile &profile, std::vector<Object *> &args);
+
+	// conversions between the engines. import returns nothing for objects the
+	// vm can't represent.
+	std::optional<Value> import(Object *obj);
+	bool shareable(Object *obj);
+	void pin(Object *obj);
+	Object *export_value(Value val);
+	Object *export_object(Object *obj);
+	Object *copy_object(Object *obj);
+	bool sync(Profile &profile);
+
+	// lookup returns the object a name is bound to at the top level, or nullptr.
+	Object *lookup(const std::string &name);
+	std::string name_of(Function *fn);
+	void trace(const std::string &line);
+
+	TierConfig config_;
+	Environment globals_;
+	std::unique_ptr<VM> vm_;
+
+	// keyed by the body of the literal, every function made from the same
+	// literal shares it.
+	std::unordered_map<BlockStatement *, Profile> profiles_;
+	std::unordered_map<CompiledFunction *, Function *> functions_;
+	std::vector<Object *> constants_;
+	std::vector<Global> vm_globals_;
+	unsigned sync_epoch_ = 0;
+	std::unordered_map<std::string, int> global_indexes_;
+	// the copies made while exporting the result of a call.
+	std::unordered_map<Object *, Object *> exported_;
+};
+
+#endif
@@ -1,56 +1,104 @@
 #ifndef LUPS_TOKEN_H
 #define LUPS_TOKEN_H
 
-#include <string>
-#include <unordered_map>
-
-typedef std::string TokenType;
-struct Token {
-	TokenType type;
-	std::string literal;
-};
+#include <cstdint>
+#include <string_view>
 
 namespace tokentypes {
-const TokenType ILLEGAL = "ILLEGAL";
-const TokenType EOFF = "EOF";
-const TokenType IDENT = "IDENT";
-const TokenType INT = "INT";
-
-const TokenType ASSIGN = "=";
-const TokenType PLUS = "+";
-const TokenType MINUS = "=";
-const TokenType BANG = "!";
-const TokenType ASTERISK = "*";
-const TokenType SLASH = "/";
-const TokenType COMMA = ",";
-const TokenType SEMICOLON = ";";
-const TokenType EQ = "==";
-const TokenType NEQ = "!=";
-const TokenType COLON = ":";
-
-const TokenType LPAREN = "(";
-const TokenType RPAREN = ")";
-const TokenType LBRACE = "{";
-const TokenType RBRACE = "}";
-const TokenType LBRACKET = "[";
-const TokenType RBRACKET = "]";
-
-const TokenType LT = "<";
-const TokenType GT = ">";
-
-const TokenType FUNCTION = "FUNCTION";
-const TokenType LET = "LET";
-const TokenType TRUE = "TRUE";
-const TokenType FALSE = "FALSE";
-const TokenType IF = "IF";
-const TokenType ELSE = "ELSE";
-const TokenType RETURN = "RETURN";
-const TokenType STRING = "STRING";
-
-const std::unordered_map<std::string, TokenType> KEYWORDS = {
-		{"func", FUNCTION}, {"let", LET},   {"true", TRUE},     {"false", FALSE},
-		{"if", IF},         {"else", ELSE}, {"return", RETURN},
+enum TokenType : std::uint8_t {
+	ILLEGAL,
+	EOFF,
+	IDENT,
+	INT,
+
+	ASSIGN,
+	PLUS,
+	MINUS,
+	BANG,
+	ASTERISK,
+	SLASH,
+	COMMA,
+	SEMICOLON,
+	EQ,
+	NEQ,
+	COLON,
+
+	LPAREN,
+	RPAREN,
+	LBRACE,
+	RBRACE,
+	LBRACKET,
+	RBRACKET,
+
+	LT,
+	GT,
+
+	FUNCTION,
+	LET,
+	TRUE,
+	FALSE,
+	IF,
+	ELSE,
+	RETURN,
+	STRING,
+
+	// the amount of token types, tables indexed by the type have this size.
+	Count,
 };
+
+// name returns how a token type is shown in error messages.
+inline const char *name(TokenType type) {
+	static const char *const names[Count] = {
+			"ILLEGAL", "EOF", "IDENT",		"INT",	 "=",		 "+",			"-",
+			"!",			 "*",		"/",				",",		 ";",		 "==",		"!=",
+			":",			 "(",		")",				"{",		 "}",		 "[",			"]",
+			"<",			 ">",		"FUNCTION", "LET",	 "TRUE", "FALSE", "IF",
+			"ELSE",		 "RETURN", "STRING",
+	};
+	return names[type];
+}
+
+// lookup_keyword returns the type of an identifier, which is one of the
+// keywords or IDENT. The keywords are found with a perfect hash of their first
+// letter and length, so an identifier costs one table lookup and at most one
+// comparison.
+inline TokenType lookup_keyword(std::string_view ident) {
+	struct Keyword {
+		std::string_view word;
+		TokenType type;
+	};
+	static const Keyword table[16] = {
+			{"func", FUNCTION},
+			{"false", FALSE},
+			{},
+			{},
+			{"if", IF},
+			{},
+			{},
+			{},
+			{},
+			{},
+			{"return", RETURN},
+			{"let", LET},
+			{"true", TRUE},
+			{},
+			{"else", ELSE},
+			{},
+	};
+
+	const auto &keyword = table[((unsigned char)ident[0] * 2 + ident.size()) & 15];
+	return keyword.word == ident ? keyword.type : IDENT;
+}
 } // namespace tokentypes
 
+typedef tokentypes::TokenType TokenType;
+
+// Token is a token type together with its text. The text is a view into the
+// source the lexer reads, which the lexer and the program parsed from it keep
+// alive.
+struct Token {
+	TokenType type;
+	std::string_view literal;
+};
+
 #endif
@@ -0,0 +1,343 @@
+#include "verifier.h"
+#include "builtins.h"
+#include "object.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// the global indexes are 16 bits wide, so they can't be out of range.
+static_assert(GlobalsSize >= 1 << 16, "the vm needs a slot for every global");
+
+namespace {
+// Effect is the amount of values an instruction pops and then pushes, and how
+// far above the height it starts with it grows the stack on the way.
+struct Effect {
+	int pops;
+	int pushes;
+	int peak;
+};
+
+Effect stack_effect(code::Opcode op, const std::vector<int> &operands) {
+	switch (op) {
+	case code::OpConstant:
+	case code::OpTrue:
+	case code::OpFalse:
+	case code::OpNull:
+	case code::OpGetGlobal:
+	case code::OpGetLocal:
+	case code::OpGetBuiltin:
+	case code::OpGetFree:
+		return Effect{0, 1, 1};
+	// when the operands aren't integers both are pushed for the generic path.
+	case code::OpSubLocalConst:
+		return Effect{0, 1, 2};
+	case code::OpMinus:
+	case code::OpBang:
+	case code::OpTeeGlobal:
+	case code::OpTeeLocal:
+	case code::OpIndexConst:
+		return Effect{1, 1, 0};
+	case code::OpPop:
+	case code::OpSetGlobal:
+	case code::OpSetLocal:
+	case code::OpJumpNotTruthy:
+	case code::OpReturnValue:
+		return Effect{1, 0, 0};
+	case code::OpJump:
+	case code::OpJumpNotEqualLocalConst:
+	case code::OpReturn:
+	case code::OpHalt:
+		return Effect{0, 0, 0};
+	case code::OpArray:
+	case code::OpHash:
+		return Effect{operands[0], 1, 0};
+	case code::OpClosure:
+		return Effect{operands[1], 1, 0};
+	case code::OpCall:
+		return Effect{operands[0] + 1, 1, 0};
+	// the callee is moved in below the arguments before the call.
+	case code::OpCallGlobal:
+		return Effect{operands[1], 1, 1};
+	default:
+		// the binary operations, their fused and their quickened variants.
+		return Effect{2, 1, 0};
+	}
+}
+
+// control never falls through these instructions.
+bool ends_block(code::Opcode op) {
+	return op == code::OpJump || op == code::OpReturn ||
+				 op == code::OpReturnValue || op == code::OpHalt;
+}
+
+// the offset of the operand that holds the jump target, or -1.
+int jump_operand(code::Opcode op) {
+	switch (op) {
+	case code::OpJump:
+	case code::OpJumpNotTruthy:
+		return 0;
+	case code::OpJumpNotEqualLocalConst:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+struct Inst {
+	int pos;
+	code::Opcode op;
+	std::vector<int> operands;
+};
+
+// Code is what is known about the main program or a function while it is
+// verified.
+struct Code {
+	const char *code;
+	int size;
+	int num_locals;
+	bool is_main;
+
+	// the free variables the function reads, every closure of it needs them.
+	int needed_free;
+	int max_stack;
+};
+
+class Verifier {
+public:
+	Verifier(const std::vector<Object *> &constants) : constants_(constants) {}
+
+	std::optional<std::string> verify(Code &fn) {
+		std::vector<Inst> insts;
+		std::vector<int> index_of(fn.size + 1, -1);
+		auto err = decode(fn, insts, index_of);
+		if (!err.has_value())
+			err = check_operands(fn, insts, index_of);
+		if (!err.has_value())
+			err = check_stack(fn, insts, index_of);
+		return err;
+	}
+
+	// closures are the OpClosure instructions seen so far, as the constant
+	// index and the amount of free variables they capture.
+	std::vector<std::pair<int, int>> closures;
+
+private:
+	std::optional<std::string> decode(const Code &fn,
+																		std::vector<Inst> &insts,
+																		std::vector<int> &index_of) {
+		int pos = 0;
+		while (pos < fn.size) {
+			const auto op = fn.code[pos];
+			auto def = (std::uint8_t)op <= code::OpHalt ? code::look_up(op) : nullptr;
+			if (def == nullptr)
+				return "unknown opcode " + std::to_string((std::uint8_t)op) + " at " +
+							 std::to_string(pos);
+
+			int width = 0;
+			for (auto w : def->operand_widths)
+				width += w;
+			if (pos + 1 + width > fn.size)
+				return "truncated " + def->name + " at " + std::to_string(pos);
+
+			index_of[pos] = (int)insts.size();
+			insts.push_back(
+					Inst{pos, op, code::read_operands(def, fn.code + pos + 1).first});
+			pos += 1 + width;
+		}
+
+		return std::nullopt;
+	}
+
+	std::optional<std::string> check_operands(Code &fn,
+																						const std::vector<Inst> &insts,
+																						const std::vector<int> &index_of) {
+		for (const auto &inst : insts) {
+			const auto at = " at " + std::to_string(inst.pos);
+			switch (inst.op) {
+			case code::OpConstant:
+			case code::OpIndexConst:
+				if (inst.operands[0] >= (int)constants_.size())
+					return "constant index out of range" + at;
+				break;
+			case code::OpSubLocalConst:
+			case code::OpJumpNotEqualLocalConst:
+				if (inst.operands[1] >= (int)constants_.size())
+					return "constant index out of range" + at;
+				[[fallthrough]];
+			case code::OpGetLocal:
+			case code::OpSetLocal:
+			case code::OpTeeLocal:
+				if (inst.operands[0] >= fn.num_locals)
+					return "local index out of range" + at;
+				break;
+			case code::OpGetBuiltin:
+				if (inst.operands[0] >= (int)builtin_functions::functions.size())
+					return "builtin index out of range" + at;
+				break;
+			case code::OpGetFree:
+				// the main program runs as a closure without free variables.
+				if (fn.is_main)
+					return "free variable outside of a function" + at;
+				fn.needed_free = std::max(fn.needed_free, inst.operands[0] + 1);
+				break;
+			case code::OpHash:
+				// the values alternate between keys and values.
+				if (inst.operands[0] % 2 != 0)
+					return "hash of an odd number of values" + at;
+				break;
+			case code::OpClosure:
+				if (inst.operands[0] >= (int)constants_.size() ||
+						constants_[inst.operands[0]]->Type() != ObjType::CompiledFunction)
+					return "closure of a constant that isn't a function" + at;
+				closures.push_back({inst.operands[0], inst.operands[1]});
+				break;
+			case code::OpReturn:
+			case code::OpReturnValue:
+				if (fn.is_main)
+					return "return outside of a function" + at;
+				break;
+			case code::OpHalt:
+				if (!fn.is_main)
+					return "halt inside a function" + at;
+				break;
+			}
+
+			const auto jump = jump_operand(inst.op);
+			if (jump != -1) {
+				const auto target = inst.operands[jump];
+				if (target >= fn.size || index_of[target] == -1)
+					return "jump to " + std::to_string(target) +
+								 " isn't an instruction boundary" + at;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	std::optional<std::string> check_stack(Code &fn,
+																				 const std::vector<Inst> &insts,
+																				 const std::vector<int> &index_of) {
+		// the height of the stack before each instruction, -1 until a path to the
+		// instruction is seen. A function starts with its locals on the stack.
+		std::vector<int> heights(insts.size(), -1);
+		std::vector<int> work;
+		if (!insts.empty()) {
+			heights[0] = fn.num_locals;
+			work.push_back(0);
+		}
+		fn.max_stack = fn.num_locals;
+
+		while (!work.empty()) {
+			const auto i = work.back();
+			work.pop_back();
+
+			const auto &inst = insts[i];
+			const auto at = " at " + std::to_string(inst.pos);
+			const auto height = heights[i];
+			const auto effect = stack_effect(inst.op, inst.operands);
+			if (height - effect.pops < fn.num_locals)
+				return "stack underflow" + at;
+
+			// the heights stay within the stack, so only the sums can grow past it.
+			const auto next = (std::int64_t)height - effect.pops + effect.pushes;
+			const auto peak = std::max((std::int64_t)height + effect.peak, next);
+			if (peak > StackSize)
+				return "stack overflow" + at;
+			fn.max_stack = std::max(fn.max_stack, (int)peak);
+
+			auto flow_to = [&](int target) -> std::optional<std::string> {
+				if (heights[target] == -1) {
+					heights[target] = next;
+					work.push_back(target);
+				} else if (heights[target] != next) {
+					return "stack height " + std::to_string(next) + " differs from " +
+								 std::to_string(heights[target]) + " at " +
+								 std::to_string(insts[target].pos);
+				}
+				return std::nullopt;
+			};
+
+			if (!ends_block(inst.op)) {
+				if (i + 1 >= (int)insts.size())
+					return "control runs off the end" + at;
+
+				auto err = flow_to(i + 1);
+				if (err.has_value())
+					return err;
+			}
+
+			const auto jump = jump_operand(inst.op);
+			if (jump != -1) {
+				auto err = flow_to(index_of[inst.operands[jump]]);
+				if (err.has_value())
+					return err;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	const std::vector<Object *> &constants_;
+};
+} // namespace
+
+std::optional<std::string> verifier::verify(Bytecode &bytecode) {
+	Verifier verifier(bytecode.constants);
+
+	// the vm appends the OpHalt to the main program unless it was loaded with
+	// one.
+	code::Instructions main;
+	Code main_fn{bytecode.mapped_main, 0, 0, true, 0, 0};
+	if (bytecode.mapped_main == nullptr) {
+		main = bytecode.instructions;
+		main.push_back(code::OpHalt);
+		main_fn.code = main.data();
+		main_fn.size = (int)main.size();
+	} else {
+		main_fn.size = bytecode.mapped_main_size;
+	}
+
+	auto err = verifier.verify(main_fn);
+	if (err.has_value())
+		return "main: " + err.value();
+
+	std::vector<Code> functions(bytecode.constants.size());
+	for (int i = 0; i < (int)bytecode.constants.size(); ++i) {
+		auto fn = dynamic_cast<CompiledFunction *>(bytecode.constants[i]);
+		if (fn == nullptr)
+			continue;
+
+		// a call puts the locals on the stack before any instruction runs, the vm
+		// trusts these counts as they are.
+		if (fn->m_num_parameters < 0 || fn->m_num_locals < fn->m_num_parameters ||
+				fn->m_num_locals > StackSize)
+			return "constant " + std::to_string(i) + ": " +
+						 std::to_string(fn->m_num_locals) + " locals and " +
+						 std::to_string(fn->m_num_parameters) +
+						 " parameters don't make a frame";
+
+		functions[i] =
+				Code{fn->code(), fn->code_size(), fn->m_num_locals, false, 0, 0};
+		auto err = verifier.verify(functions[i]);
+		if (err.has_value())
+			return "constant " + std::to_string(i) + ": " + err.value();
+	}
+
+	for (const auto &closure : verifier.closures) {
+		if (closure.second < functions[closure.first].needed_free)
+			return "closure of constant " + std::to_string(closure.first) +
+						 " captures too few free variables";
+	}
+
+	// only record the depths once everything is known to be safe, the vm runs
+	// code with depths without checks.
+	for (int i = 0; i < (int)bytecode.constants.size(); ++i) {
+		auto fn = dynamic_cast<CompiledFunction *>(bytecode.constants[i]);
+		if (fn != nullptr)
+			fn->m_max_stack = functions[i].max_stack;
+	}
+	bytecode.main_max_stack = main_fn.max_stack;
+
+	return std::nullopt;
+}
@@ -0,0 +1,26 @@
+#ifndef LUPS_VERIFIER_H
+#define LUPS_VERIFIER_H
+
+#include "compiler.h"
+#include <optional>
+#include <string>
+
+// The verifier proves that bytecode can't make the vm read or write outside of
+// its stack, globals, constants, locals or free variables, so the vm can run
+// it without checking the stack on every push. For the main program and every
+// function in the constant pool it checks that:
+//   - every instruction is a known opcode with all of its operands.
+//   - jumps land on instruction boundaries and control never runs off the end.
+//   - constant, local, free and builtin indexes are in range, and OpClosure
+//     only makes closures of compiled functions with enough free variables.
+//   - the stack never drops into the locals and has the same height wherever
+//     paths join, which gives every function a maximum stack depth.
+// The type checks of the values stay in the vm, they depend on what runs.
+namespace verifier {
+// verify records the maximum stack depth of every function in m_max_stack and
+// of the main program in bytecode.main_max_stack. The depths count from the
+// frame's base pointer and include the locals.
+std::optional<std::string> verify(Bytecode &bytecode);
+} // namespace verifier
+
+#endif
@@ -4,6 +4,7 @@
 #include "compiler.h"
 #include "eval.h"
 #include "object.h"
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <map>
@@ -22,300 +23,787 @@
 // handling. Since then I don't have to hardcode multiple different errors
 // values into enums or something similar.
 
-Object *native_bool_to_obj(bool val) {
-	return (val ? object_constant::TRUE_OBJ : object_constant::FALSE_OBJ);
+bool is_truthy(Value val) {
+	if (val.is_boolean())
+		return val.as_boolean();
+	else if (val.is_null())
+		return false;
+
+	return true;
 }
 
-bool is_truthy(Object *obj) {
-	if (obj == nullptr)
-		return false;
+bool values_equal(Value left, Value right) {
+	if (left == right)
+		return true;
 
-	if (obj->Type() == ObjType::Boolean)
-		return ((Boolean *)obj)->value;
-	else if (obj->Type() == ObjType::Null)
-		return false;
+	return left.type() == ObjType::String && right.type() == ObjType::String &&
+				 ((String *)left.as_object())->value ==
+						 ((String *)right.as_object())->value;
+}
 
-	return true;
+Value object_to_value(Object *obj) {
+	if (obj == nullptr)
+		return Value::null();
+
+	switch (obj->Type()) {
+	case ObjType::Integer:
+		return Value::integer(((Integer *)obj)->value);
+	case ObjType::Boolean:
+		return Value::boolean(((Boolean *)obj)->value);
+	case ObjType::Null:
+		return Value::null();
+	default:
+		return Value::object(obj);
+	}
 }
 
-// create vm instance from bytecode generated by compiler.
-VM::VM(Bytecode *bytecode) {
-	sp_ = 0;
-	constants_ = bytecode->constants;
-	stack_ = std::vector<Object *>(StackSize, nullptr);
-	globals_ = std::vector<Object *>(GlobalsSize);
+Object *value_to_object(Value val) {
+	if (val.is_integer())
+		return new Integer(val.as_integer());
+	else if (val.is_boolean())
+		return val.as_boolean() ? object_constant::TRUE_OBJ
+														: object_constant::FALSE_OBJ;
+	else if (val.is_null())
+		return object_constant::null;
 
-	std::unique_ptr<Frame> main_frame(new Frame(bytecode->instructions, 0));
+	return val.as_object();
+}
 
-	frames_ = std::array<std::unique_ptr<Frame>, MaxFrames>();
-	frames_[0] = std::move(main_frame);
+// hash_key_of matches the hash_key functions of the objects.
+std::optional<HashKey> hash_key_of(Value val) {
+	switch (val.type()) {
+	case ObjType::Integer:
+		return HashKey{ObjType::Integer, (HashValue)val.as_integer()};
+	case ObjType::String:
+		return ((String *)val.as_object())->hash_key();
+	case ObjType::Boolean:
+		return HashKey{ObjType::Boolean, (HashValue)(val.as_boolean() ? 1 : 0)};
+	default:
+		return std::nullopt;
+	}
+}
+
+VM::VM(Bytecode *bytecode, GCConfig gc_config) : heap_(gc_config) {
+	sp_ = 0;
+	constants_ = std::vector<Value>();
+	constants_.reserve(bytecode->constants.size());
+	for (auto constant : bytecode->constants)
+		add_constant(constant);
+
+	heap_.pin(object_constant::null);
+	heap_.pin(object_constant::TRUE_OBJ);
+	heap_.pin(object_constant::FALSE_OBJ);
+	for (const auto &builtin : builtin_functions::functions)
+		heap_.pin(builtin.second);
+
+	stack_ = std::vector<Value>(StackSize);
+	globals_ = std::vector<Value>(GlobalsSize);
+
+	image_ = bytecode->image;
+	if (bytecode->mapped_main != nullptr) {
+		main_fn_ = std::make_unique<CompiledFunction>(code::Instructions());
+		main_fn_->m_mapped = bytecode->mapped_main;
+		main_fn_->m_mapped_size = bytecode->mapped_main_size;
+	} else {
+		main_fn_ = std::make_unique<CompiledFunction>(bytecode->instructions);
+		main_fn_->m_instructions.push_back(code::OpHalt);
+	}
+	main_fn_->m_max_stack = bytecode->main_max_stack;
+	main_closure_ = std::make_unique<Closure>(main_fn_.get());
+
+	halt_fn_ = std::make_unique<CompiledFunction>(
+			code::Instructions(1, code::OpHalt));
+	halt_closure_ = std::make_unique<Closure>(halt_fn_.get());
+#ifdef LUPS_OPCODE_PROFILE
+	// machine code doesn't record the opcodes it runs.
+	jit_threshold_ = 0;
+#else
+	jit_threshold_ = jit::enabled() ? jit::CallThreshold : 0;
+#endif
+
+	frames_index_ = 0;
+	push_frame(main_closure_.get(), 0);
+}
 
-	frames_index_ = 1;
+int VM::add_constant(Object *constant) {
+	heap_.pin(constant);
+	constants_.push_back(object_to_value(constant));
+	constant_keys_.push_back(hash_key_of(constants_.back()));
+	return (int)constants_.size() - 1;
 }
 
 // return the topmost element in stack.
-Object *VM::stack_top() {
+Value VM::stack_top() {
 	if (sp_ == 0)
-		return nullptr;
+		return Value::null();
 
 	return stack_[sp_ - 1];
 }
 
-std::optional<std::string> VM::run() {
-	for (current_frame().ip_ = 0;
-			 current_frame().ip_ < (int)current_frame().instructions().size();
-			 ++current_frame().ip_) {
-		auto &ip = current_frame().ip_;
-		const auto &inst = current_frame().instructions();
-		const auto op = inst[ip];
-
+// quickened_binary returns the specialized opcode for a generic arithmetic or
+// comparison opcode with the given operands, or the opcode itself if there is
+// none.
+static code::Opcode quickened_binary(code::Opcode op, Value left, Value right) {
+	if (left.is_integer() && right.is_integer()) {
 		switch (op) {
-		case code::OpConstant: {
-			auto const_index = code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ += 2;
-
-			auto status = push(constants_[const_index]);
-			if (status.has_value())
-				return status.value();
-
-			break;
-		}
-		case code::OpPop: {
-			pop();
-			break;
-		}
-		case code::OpMul:
-		case code::OpDiv:
+		case code::OpAdd:
+			return code::OpAddInt;
 		case code::OpSub:
-		case code::OpAdd: {
-			auto status = execute_binary_operation(op);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpTrue: {
-			auto status = push(object_constant::TRUE_OBJ);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpFalse: {
-			auto status = push(object_constant::FALSE_OBJ);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
+			return code::OpSubInt;
+		case code::OpMul:
+			return code::OpMulInt;
+		case code::OpGreaterThan:
+			return code::OpGreaterThanInt;
 		case code::OpEqual:
+			return code::OpEqualInt;
 		case code::OpNotEqual:
-		case code::OpGreaterThan: {
-			auto status = execute_comparison(op);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpBang: {
-			auto status = execute_bang_operator();
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpMinus: {
-			auto status = execute_minus_operator();
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpJump: {
-			auto pos = (int)code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ = pos - 1;
-			break;
-		}
-		case code::OpJumpNotTruthy: {
-			auto pos = (int)code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ += 2;
-
-			auto condition = pop();
-			if (!is_truthy(condition))
-				current_frame().ip_ = pos - 1;
-			break;
-		}
-		case code::OpNull: {
-			auto status = push(object_constant::null);
-			if (status.has_value())
-				return status.value();
-			break;
+			return code::OpNotEqualInt;
 		}
-		case code::OpSetGlobal: {
-			auto global_index = code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ += 2;
+	} else if (op == code::OpAdd && left.type() == ObjType::String &&
+						 right.type() == ObjType::String) {
+		return code::OpAddString;
+	}
 
-			globals_[global_index] = pop();
-			break;
-		}
-		case code::OpGetGlobal: {
-			auto global_index = code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ += 2;
+	return op;
+}
 
-			auto status = push(globals_[global_index]);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpArray: {
-			auto num_elements = code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ += 2;
-			auto array = build_array(sp_ - num_elements, sp_);
-			sp_ -= num_elements;
-
-			auto status = push(array);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpHash: {
-			auto num_elements = code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			current_frame().ip_ += 2;
-
-			auto hash = build_hash(sp_ - num_elements, sp_);
-			sp_ -= num_elements;
-			auto status = push(hash);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpIndex: {
-			auto index = pop();
-			auto left = pop();
+// generic_opcode is the opcode the compiler emitted for a quickened one.
+static code::Opcode generic_opcode(code::Opcode op) {
+	switch (op) {
+	case code::OpAddInt:
+	case code::OpAddString:
+	case code::OpAddPoly:
+		return code::OpAdd;
+	case code::OpSubInt:
+		return code::OpSub;
+	case code::OpMulInt:
+		return code::OpMul;
+	case code::OpGreaterThanInt:
+		return code::OpGreaterThan;
+	case code::OpEqualInt:
+	case code::OpEqualPoly:
+		return code::OpEqual;
+	case code::OpNotEqualInt:
+	case code::OpNotEqualPoly:
+		return code::OpNotEqual;
+	default:
+		return op;
+	}
+}
 
-			auto status = execute_index_expression(left, index);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpCall: {
-			auto num_args = (int)((std::uint8_t)inst[ip + 1]);
-			current_frame().ip_ += 1;
+// The dispatch loop can be built in two ways. With GCC and Clang every handler
+// jumps straight to the next one through a table of label addresses (computed
+// goto), which gives the branch predictor one indirect jump per opcode instead
+// of the single shared jump of a switch. Defining LUPS_SWITCH_DISPATCH at build
+// time selects the portable switch based loop instead.
+#if defined(__GNUC__) && !defined(LUPS_SWITCH_DISPATCH)
+#define LUPS_COMPUTED_GOTO
+#endif
+
+// builds with LUPS_OPCODE_PROFILE record every executed opcode.
+#ifdef LUPS_OPCODE_PROFILE
+#define VM_PROFILE() opcode_profile_.record(*ip)
+#else
+#define VM_PROFILE()
+#endif
+
+#ifdef LUPS_COMPUTED_GOTO
+#define VM_TARGET(op) target_##op
+#define VM_DISPATCH()                                                          \
+	do {                                                                         \
+		VM_PROFILE();                                                              \
+		goto *dispatch_table[(std::uint8_t)*ip++];                                 \
+	} while (0)
+#else
+#define VM_TARGET(op) case code::op
+#define VM_DISPATCH() goto dispatch
+#endif
+
+// VM_PUSH pushes a value and returns the error when the stack is full. Code
+// that passed the verifier doesn't check, its frame was checked to have room
+// for all of its values when it was entered.
+#define VM_PUSH(val)                                                           \
+	do {                                                                         \
+		if constexpr (Verified) {                                                  \
+			stack_[sp_++] = (val);                                                   \
+		} else {                                                                   \
+			auto push_status = push(val);                                            \
+			if (push_status.has_value())                                             \
+				return push_status.value();                                            \
+		}                                                                          \
+	} while (0)
+
+// VM_QUICKEN rewrites the instruction that is being executed to another
+// opcode, it takes effect the next time the instruction runs.
+#define VM_QUICKEN(op) ins[ip - 1 - ins] = (op)
+
+// the frame state is cached in locals while the frame is running, these move it
+// between the locals and the frame when a call or return switches frames.
+#define VM_SAVE_FRAME() frame->ip_ = (int)(ip - ins)
+#define VM_LOAD_FRAME()                                                        \
+	do {                                                                         \
+		frame = &current_frame();                                                  \
+		ins = frame->code();                                                       \
+		ip = ins + frame->ip_;                                                     \
+	} while (0)
 
-			const auto status = execute_call(num_args);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpReturnValue: {
-			auto return_value = pop();
-			const auto &frame = pop_frame();
-			sp_ = frame.base_pointer_ - 1;
+std::optional<std::string> VM::run() {
+	if (main_fn_->m_max_stack < 0)
+		return execute<false>();
 
-			const auto status = push(return_value);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpReturn: {
-			const auto &frame = pop_frame();
-			sp_ = frame.base_pointer_ - 1;
+	if (sp_ + main_fn_->m_max_stack > StackSize)
+		return "stack overflow";
+	return execute<true>();
+}
 
-			const auto status = push(object_constant::null);
-			if (status.has_value())
-				return status.value();
-			break;
-		}
-		case code::OpSetLocal: {
-			auto local_index = (int)((std::uint8_t)inst[ip + 1]);
-			current_frame().ip_ += 1;
+template <bool Verified> std::optional<std::string> VM::execute() {
+#ifdef LUPS_COMPUTED_GOTO
+	// the order has to match code::Opcodes.
+	static const void *dispatch_table[] = {
+			&&target_OpConstant,
+			&&target_OpAdd,
+			&&target_OpPop,
+			&&target_OpSub,
+			&&target_OpMul,
+			&&target_OpDiv,
+			&&target_OpTrue,
+			&&target_OpFalse,
+			&&target_OpEqual,
+			&&target_OpNotEqual,
+			&&target_OpGreaterThan,
+			&&target_OpMinus,
+			&&target_OpBang,
+			&&target_OpJumpNotTruthy,
+			&&target_OpJump,
+			&&target_OpNull,
+			&&target_OpGetGlobal,
+			&&target_OpSetGlobal,
+			&&target_OpArray,
+			&&target_OpHash,
+			&&target_OpIndex,
+			&&target_OpCall,
+			&&target_OpReturnValue,
+			&&target_OpReturn,
+			&&target_OpGetLocal,
+			&&target_OpSetLocal,
+			&&target_OpGetBuiltin,
+			&&target_OpClosure,
+			&&target_OpGetFree,
+			&&target_OpTeeGlobal,
+			&&target_OpTeeLocal,
+			&&target_OpSubLocalConst,
+			&&target_OpJumpNotEqualLocalConst,
+			&&target_OpCallGlobal,
+			&&target_OpIndexConst,
+			&&target_OpAddInt,
+			&&target_OpAddString,
+			&&target_OpSubInt,
+			&&target_OpMulInt,
+			&&target_OpGreaterThanInt,
+			&&target_OpEqualInt,
+			&&target_OpNotEqualInt,
+			&&target_OpAddPoly,
+			&&target_OpEqualPoly,
+			&&target_OpNotEqualPoly,
+			&&target_OpIndexArray,
+			&&target_OpIndexIntArray,
+			&&target_OpIndexHash,
+			&&target_OpIndexPoly,
+			&&target_OpHalt,
+	};
+	static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+										code::OpHalt + 1,
+								"dispatch table doesn't cover every opcode");
+#endif
+
+	Frame *frame;
+	char *ins;
+	const char *ip;
+	VM_LOAD_FRAME();
+
+#ifdef LUPS_COMPUTED_GOTO
+	VM_DISPATCH();
+#else
+dispatch:
+	VM_PROFILE();
+	switch ((std::uint8_t)*ip++) {
+#endif
+	VM_TARGET(OpConstant) : {
+		auto const_index = code::read_uint16(ip);
+		ip += 2;
+
+		VM_PUSH(constants_[const_index]);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpPop) : {
+		pop();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpAdd) : VM_TARGET(OpSub) : VM_TARGET(OpMul) : VM_TARGET(OpDiv) : {
+		const auto op = ip[-1];
+		VM_QUICKEN(quickened_binary(op, stack_[sp_ - 2], stack_[sp_ - 1]));
+
+		auto status = execute_binary_operation(op);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpTrue) : {
+		VM_PUSH(Value::boolean(true));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpFalse) : {
+		VM_PUSH(Value::boolean(false));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpEqual) : VM_TARGET(OpNotEqual) : VM_TARGET(OpGreaterThan) : {
+		const auto op = ip[-1];
+		VM_QUICKEN(quickened_binary(op, stack_[sp_ - 2], stack_[sp_ - 1]));
+
+		auto status = execute_comparison(op);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpBang) : {
+		auto status = execute_bang_operator();
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpMinus) : {
+		auto status = execute_minus_operator();
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpJump) : {
+		auto pos = (int)code::read_uint16(ip);
+		ip = ins + pos;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpJumpNotTruthy) : {
+		auto pos = (int)code::read_uint16(ip);
+		ip += 2;
+
+		auto condition = pop();
+		if (!is_truthy(condition))
+			ip = ins + pos;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpNull) : {
+		VM_PUSH(Value::null());
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpSetGlobal) : {
+		auto global_index = code::read_uint16(ip);
+		ip += 2;
 
-			auto &frame = current_frame();
-			stack_[frame.base_pointer_ + local_index] = pop();
-			break;
-		}
-		case code::OpGetLocal: {
-			auto local_index = (int)((std::uint8_t)inst[ip + 1]);
-			current_frame().ip_ += 1;
+		globals_[global_index] = pop();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetGlobal) : {
+		auto global_index = code::read_uint16(ip);
+		ip += 2;
 
-			const auto &frame = current_frame();
-			const auto status = push(stack_[frame.base_pointer_ + local_index]);
-			if (status.has_value()) {
-				return status.value();
-			}
-			break;
+		VM_PUSH(globals_[global_index]);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpArray) : {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto num_elements = code::read_uint16(ip);
+		ip += 2;
+
+		auto array = build_array(sp_ - num_elements, sp_);
+		sp_ -= num_elements;
+
+		VM_PUSH(Value::object(array));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpHash) : {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto num_elements = code::read_uint16(ip);
+		ip += 2;
+
+		auto hash = build_hash(sp_ - num_elements, sp_);
+		sp_ -= num_elements;
+		VM_PUSH(Value::object(hash));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpIndex) : {
+		auto index = pop();
+		auto left = pop();
+
+		if (left.is_object()) {
+			const auto left_type = left.as_object()->Type();
+			if (left_type == ObjType::Array && index.is_integer())
+				VM_QUICKEN(code::OpIndexArray);
+			else if (left_type == ObjType::IntArray && index.is_integer())
+				VM_QUICKEN(code::OpIndexIntArray);
+			else if (left_type == ObjType::Hash)
+				VM_QUICKEN(code::OpIndexHash);
 		}
-		case code::OpGetBuiltin: {
-			auto builtin_index = (int)((std::uint8_t)inst[ip + 1]);
-			current_frame().ip_ += 1;
 
-			// the compiler ensures that this index exists
-			auto def = builtin_functions::functions[builtin_index];
+		auto status = execute_index_expression(left, index);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpCall) : {
+		auto num_args = (int)code::read_uint8(ip);
+		ip += 1;
+
+		VM_SAVE_FRAME();
+		if (heap_.should_collect())
+			collect_garbage();
+
+		const auto status = execute_call(num_args);
+		if (status.has_value())
+			return status.value();
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpReturnValue) : {
+		auto return_value = pop();
+		const auto &returned = pop_frame();
+		sp_ = returned.base_pointer_ - 1;
+
+		VM_PUSH(return_value);
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpReturn) : {
+		const auto &returned = pop_frame();
+		sp_ = returned.base_pointer_ - 1;
 
-			auto status = push(def.second);
-			if (status.has_value())
-				return status.value();
+		VM_PUSH(Value::null());
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpSetLocal) : {
+		auto local_index = (int)code::read_uint8(ip);
+		ip += 1;
+
+		stack_[frame->base_pointer_ + local_index] = pop();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetLocal) : {
+		auto local_index = (int)code::read_uint8(ip);
+		ip += 1;
+
+		VM_PUSH(stack_[frame->base_pointer_ + local_index]);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetBuiltin) : {
+		auto builtin_index = (int)code::read_uint8(ip);
+		ip += 1;
+
+		// the compiler ensures that this index exists
+		auto def = builtin_functions::functions[builtin_index];
+
+		VM_PUSH(Value::object(def.second));
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpClosure) : {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto const_index = code::read_uint16(ip);
+		auto num_free = (int)code::read_uint8(ip + 2);
+		ip += 3;
+
+		auto status = push_closure(const_index, num_free);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGetFree) : {
+		auto free_idx = (int)code::read_uint8(ip);
+		ip += 1;
+
+		const auto &curr_closure = frame->closure();
+		VM_PUSH(curr_closure.free_[free_idx]);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpTeeGlobal) : {
+		auto global_index = code::read_uint16(ip);
+		ip += 2;
+
+		globals_[global_index] = stack_[sp_ - 1];
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpTeeLocal) : {
+		auto local_index = (int)code::read_uint8(ip);
+		ip += 1;
+
+		stack_[frame->base_pointer_ + local_index] = stack_[sp_ - 1];
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpSubLocalConst) : {
+		auto local = stack_[frame->base_pointer_ + code::read_uint8(ip)];
+		auto constant = constants_[code::read_uint16(ip + 1)];
+		ip += 3;
+
+		if (local.is_integer() && constant.is_integer()) {
+			VM_PUSH(Value::integer(local.as_integer() - constant.as_integer()));
+			VM_DISPATCH();
 		}
-		case code::OpClosure: {
-			auto const_index = code::decode_uint16(
-					code::Instructions(inst.begin() + ip + 1, inst.begin() + ip + 3));
-			auto num_free = (int)((uint8_t)inst[ip + 3]);
-			current_frame().ip_ += 3;
 
-			auto status = push_closure(const_index, num_free);
+		VM_PUSH(local);
+		VM_PUSH(constant);
+		auto status = execute_binary_operation(code::OpSub);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpJumpNotEqualLocalConst) : {
+		auto local = stack_[frame->base_pointer_ + code::read_uint8(ip)];
+		auto constant = constants_[code::read_uint16(ip + 1)];
+		auto pos = (int)code::read_uint16(ip + 3);
+		ip += 5;
+
+		if (!values_equal(local, constant))
+			ip = ins + pos;
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpCallGlobal) : {
+		auto global_index = code::read_uint16(ip);
+		auto num_args = (int)code::read_uint8(ip + 2);
+		ip += 3;
+
+		if (!Verified && sp_ >= StackSize)
+			return "stack overflow";
+
+		// the callee goes below the arguments, like OpGetGlobal would have put it.
+		for (int i = sp_; i > sp_ - num_args; --i)
+			stack_[i] = stack_[i - 1];
+		stack_[sp_ - num_args] = globals_[global_index];
+		++sp_;
+
+		VM_SAVE_FRAME();
+		if (heap_.should_collect())
+			collect_garbage();
+
+		const auto status = execute_call(num_args);
+		if (status.has_value())
+			return status.value();
+		VM_LOAD_FRAME();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpAddInt) : VM_TARGET(OpSubInt) : VM_TARGET(OpMulInt) : {
+		const auto op = ip[-1];
+		const auto left = stack_[sp_ - 2];
+		const auto right = stack_[sp_ - 1];
+		if (!left.is_integer() || !right.is_integer()) {
+			VM_QUICKEN(op == code::OpAddInt   ? code::OpAddPoly
+								 : op == code::OpSubInt ? code::OpSub
+																				: code::OpMul);
+			auto status = execute_binary_operation(generic_opcode(op));
 			if (status.has_value())
 				return status.value();
-			break;
+			VM_DISPATCH();
 		}
-		case code::OpGetFree: {
-			auto free_idx = (int)((uint8_t)inst[ip + 1]);
-			current_frame().ip_ += 1;
 
-			const auto &curr_closure = current_frame().closure();
-			auto status = push(curr_closure.free_[free_idx]);
+		int res;
+		if (op == code::OpAddInt)
+			res = left.as_integer() + right.as_integer();
+		else if (op == code::OpSubInt)
+			res = left.as_integer() - right.as_integer();
+		else
+			res = left.as_integer() * right.as_integer();
+
+		--sp_;
+		stack_[sp_ - 1] = Value::integer(res);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpGreaterThanInt) : VM_TARGET(OpEqualInt) :
+			VM_TARGET(OpNotEqualInt) : {
+		const auto op = ip[-1];
+		const auto left = stack_[sp_ - 2];
+		const auto right = stack_[sp_ - 1];
+		if (!left.is_integer() || !right.is_integer()) {
+			VM_QUICKEN(op == code::OpEqualInt      ? code::OpEqualPoly
+								 : op == code::OpNotEqualInt ? code::OpNotEqualPoly
+																						 : code::OpGreaterThan);
+			auto status = execute_comparison(generic_opcode(op));
 			if (status.has_value())
 				return status.value();
+			VM_DISPATCH();
+		}
 
-			break;
+		bool res;
+		if (op == code::OpGreaterThanInt)
+			res = left.as_integer() > right.as_integer();
+		else if (op == code::OpEqualInt)
+			res = left.as_integer() == right.as_integer();
+		else
+			res = left.as_integer() != right.as_integer();
+
+		--sp_;
+		stack_[sp_ - 1] = Value::boolean(res);
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpAddString) : {
+		const auto left = stack_[sp_ - 2];
+		const auto right = stack_[sp_ - 1];
+		if (left.type() != ObjType::String || right.type() != ObjType::String)
+			VM_QUICKEN(code::OpAddPoly);
+
+		auto status = execute_binary_operation(code::OpAdd);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpAddPoly) : {
+		auto status = execute_binary_operation(code::OpAdd);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpEqualPoly) : VM_TARGET(OpNotEqualPoly) : {
+		auto status = execute_comparison(generic_opcode(ip[-1]));
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpIndexArray) : {
+		auto index = pop();
+		auto left = pop();
+
+		std::optional<std::string> status;
+		if (index.is_integer() && left.type() == ObjType::Array) {
+			status = execute_array_index(left.as_object(), index);
+		} else {
+			VM_QUICKEN(code::OpIndexPoly);
+			status = execute_index_expression(left, index);
 		}
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpIndexIntArray) : {
+		auto index = pop();
+		auto left = pop();
+
+		std::optional<std::string> status;
+		if (index.is_integer() && left.type() == ObjType::IntArray) {
+			status = execute_int_array_index(left.as_object(), index);
+		} else {
+			VM_QUICKEN(code::OpIndexPoly);
+			status = execute_index_expression(left, index);
 		}
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
 	}
-
-	return std::nullopt;
+	VM_TARGET(OpIndexHash) : {
+		auto index = pop();
+		auto left = pop();
+
+		std::optional<std::string> status;
+		if (left.type() == ObjType::Hash) {
+			status = execute_hash_index(left.as_object(), index);
+		} else {
+			VM_QUICKEN(code::OpIndexPoly);
+			status = execute_index_expression(left, index);
+		}
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpIndexPoly) : {
+		auto index = pop();
+		auto left = pop();
+
+		auto status = execute_index_expression(left, index);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpIndexConst) : {
+		auto const_index = code::read_uint16(ip);
+		ip += 2;
+
+		auto left = pop();
+
+		std::optional<std::string> status;
+		const auto &key = constant_keys_[const_index];
+		if (key.has_value() && left.type() == ObjType::Hash)
+			status = execute_hash_lookup((Hash *)left.as_object(),
+																	 constants_[const_index], key.value());
+		else
+			status = execute_index_expression(left, constants_[const_index]);
+		if (status.has_value())
+			return status.value();
+		VM_DISPATCH();
+	}
+	VM_TARGET(OpHalt) : {
+		VM_SAVE_FRAME();
+		return std::nullopt;
+	}
+#ifndef LUPS_COMPUTED_GOTO
+	default:
+		return "unknown opcode";
+	}
+#endif
 }
 
+#undef VM_TARGET
+#undef VM_DISPATCH
+#undef VM_SAVE_FRAME
+#undef VM_LOAD_FRAME
+#undef VM_PROFILE
+#undef VM_QUICKEN
+#undef VM_PUSH
+
 // push item to the stack and check for stack overflow.
-std::optional<std::string> VM::push(Object *obj) {
+std::optional<std::string> VM::push(Value val) {
 	if (sp_ >= StackSize)
 		// stack overflow
 		return "stack overflow";
 
-	stack_[sp_] = obj;
+	stack_[sp_] = val;
 	++sp_;
 
 	return std::nullopt;
 }
 
 // pop the top element from the stack and return it.
-Object *VM::pop() {
-	auto obj = stack_[sp_ - 1];
+Value VM::pop() {
+	auto val = stack_[sp_ - 1];
 	sp_--;
 
-	return obj;
+	return val;
 }
 
-Object *VM::last_popped_stack_elem() { return stack_[sp_]; }
+Object *VM::last_popped_stack_elem() { return box(stack_[sp_]); }
+
+void VM::collect_garbage() {
+	heap_.collect([this](Heap &heap) {
+		for (int i = 0; i < sp_; ++i)
+			heap.visit(stack_[i]);
+		for (auto &global : globals_)
+			heap.visit(global);
+		for (auto &constant : constants_)
+			heap.visit(constant);
+		for (int i = 0; i < frames_index_; ++i)
+			heap.visit(frames_[i].cl_);
+	});
+}
 
 std::optional<std::string> VM::execute_binary_operation(code::Opcode op) {
 	auto right = pop();
 	auto left = pop();
 
 	// check that types support a certain operation.
-	if (left->Type() == ObjType::Integer && right->Type() == ObjType::Integer) {
+	if (left.is_integer() && right.is_integer()) {
 		return execute_binary_integer_operation(op, left, right);
-	} else if (left->Type() == ObjType::String &&
-						 right->Type() == ObjType::String) {
+	} else if (left.type() == ObjType::String &&
+						 right.type() == ObjType::String) {
 		return execute_binary_string_operation(op, left, right);
 	} else {
 		// the types don't have a supported binary expression
@@ -324,10 +812,10 @@ std::optional<std::string> VM::execute_binary_operation(code::Opcode op) {
 }
 
 std::optional<std::string> VM::execute_binary_integer_operation(code::Opcode op,
-																																Object *left,
-																																Object *right) {
-	auto left_val = ((Integer *)left)->value;
-	auto right_val = ((Integer *)right)->value;
+																																Value left,
+																																Value right) {
+	auto left_val = left.as_integer();
+	auto right_val = right.as_integer();
 
 	int res;
 	switch (op) {
@@ -348,7 +836,7 @@ std::optional<std::string> VM::execute_binary_integer_operation(code::Opcode op,
 		return "binary integer operation is not recognized.";
 	}
 
-	return push(new Integer(res));
+	return push(Value::integer(res));
 }
 
 std::optional<std::string> VM::execute_comparison(code::Opcode op) {
@@ -356,15 +844,15 @@ std::optional<std::string> VM::execute_comparison(code::Opcode op) {
 	auto left = pop();
 
 	// check that types support a certain operation.
-	if (left->Type() == ObjType::Integer && right->Type() == ObjType::Integer) {
+	if (left.is_integer() && right.is_integer()) {
 		return execute_integer_comparison(op, left, right);
 	}
 
 	switch (op) {
 	case code::OpEqual:
-		return push(native_bool_to_obj(right == left));
+		return push(Value::boolean(values_equal(left, right)));
 	case code::OpNotEqual:
-		return push(native_bool_to_obj(right != left));
+		return push(Value::boolean(!values_equal(left, right)));
 	}
 
 	// the operation is not recognized.
@@ -372,17 +860,17 @@ std::optional<std::string> VM::execute_comparison(code::Opcode op) {
 }
 
 std::optional<std::string>
-VM::execute_integer_comparison(code::Opcode op, Object *left, Object *right) {
-	auto left_value = ((Integer *)left)->value;
-	auto right_value = ((Integer *)right)->value;
+VM::execute_integer_comparison(code::Opcode op, Value left, Value right) {
+	auto left_value = left.as_integer();
+	auto right_value = right.as_integer();
 
 	switch (op) {
 	case code::OpEqual:
-		return push(native_bool_to_obj(right_value == left_value));
+		return push(Value::boolean(right_value == left_value));
 	case code::OpNotEqual:
-		return push(native_bool_to_obj(right_value != left_value));
+		return push(Value::boolean(right_value != left_value));
 	case code::OpGreaterThan:
-		return push(native_bool_to_obj(left_value > right_value));
+		return push(Value::boolean(left_value > right_value));
 	}
 
 	return "integer comparison operator not supported";
@@ -390,122 +878,137 @@ VM::execute_integer_comparison(code::Opcode op, Object *left, Object *right) {
 
 std::optional<std::string> VM::execute_bang_operator() {
 	auto oper = pop();
-	if (oper == object_constant::TRUE_OBJ)
-		return push(object_constant::FALSE_OBJ);
-	else if (oper == object_constant::FALSE_OBJ)
-		return push(object_constant::TRUE_OBJ);
-	else if (oper == object_constant::null)
-		return push(object_constant::TRUE_OBJ);
-
-	return push(object_constant::FALSE_OBJ);
+	return push(Value::boolean(!is_truthy(oper)));
 }
 
 std::optional<std::string> VM::execute_minus_operator() {
 	auto oper = pop();
-	if (oper->Type() != ObjType::Integer)
+	if (!oper.is_integer())
 		// type cannot be used in conjunction with integer type
 		return "type cannot be used in conjunction with minus expression";
 
-	auto value = ((Integer *)oper)->value;
-	return push(new Integer(-value));
+	return push(Value::integer(-oper.as_integer()));
 }
 
 std::optional<std::string> VM::execute_binary_string_operation(code::Opcode op,
-																															 Object *left,
-																															 Object *right) {
+																															 Value left,
+																															 Value right) {
 	if (op != code::OpAdd)
 		return "binary string operation not recognized has to be '+'";
 
-	auto left_value = ((String *)left)->value;
-	auto right_value = ((String *)right)->value;
+	const auto &left_value = ((String *)left.as_object())->value;
+	const auto &right_value = ((String *)right.as_object())->value;
 
-	return push(new String(left_value + right_value));
+	return push(
+			Value::object(heap_.allocate<String>(left_value + right_value)));
 }
 
-Object *VM::build_array(int start_index, int end_index) {
-	auto elements = std::vector<Object *>(end_index - start_index, nullptr);
+Object *box_value(Heap &heap, Value val) {
+	if (val.is_integer())
+		return heap.allocate<Integer>(val.as_integer());
+	return value_to_object(val);
+}
 
-	for (int i = start_index; i < end_index; ++i)
-		elements[i - start_index] = stack_[i];
+Object *make_array(Heap &heap, const Value *begin, const Value *end) {
+	// literals of only integers are packed.
+	if (std::all_of(begin, end, [](Value val) { return val.is_integer(); })) {
+		std::vector<int> values(end - begin);
+		for (auto val = begin; val != end; ++val)
+			values[val - begin] = val->as_integer();
+		return heap.allocate<IntArray>(std::move(values));
+	}
 
-	return new Array(elements);
+	PersistentVector elements;
+	for (auto val = begin; val != end; ++val)
+		elements.push_back(box_value(heap, *val));
+
+	return heap.allocate<Array>(std::move(elements));
 }
 
-Object *VM::build_hash(int start_index, int end_index) {
-	auto hashtable = new Hash();
-	for (int i = start_index; i < end_index; i += 2) {
-		auto key = stack_[i];
-		auto value = stack_[i + 1];
-		auto pair = new HashPair{key, value};
-
-		if (!(key->Type() == ObjType::Integer || key->Type() == ObjType::String ||
-					key->Type() == ObjType::Boolean))
+Object *make_hash(Heap &heap, const Value *begin, const Value *end) {
+	auto hashtable = heap.allocate<Hash>();
+	for (auto key = begin; key != end; key += 2) {
+		const auto hash_key = hash_key_of(*key);
+		if (!hash_key.has_value())
 			return nullptr;
 
-		HashKey res;
-		// we only need to check these types since the previous if expressions
-		// guarantees that the object is one of them.
-		if (key->Type() == ObjType::Integer)
-			res = ((Integer *)key)->hash_key();
-		else if (key->Type() == ObjType::String)
-			res = ((String *)key)->hash_key();
-		else if (key->Type() == ObjType::Boolean)
-			res = ((Boolean *)key)->hash_key();
-		hashtable->pairs[res.value] = pair;
+		hashtable->set(box_value(heap, *key), hash_key.value(),
+									 box_value(heap, key[1]));
 	}
+	heap.write_barrier(hashtable);
 
 	return hashtable;
 }
 
-std::optional<std::string> VM::execute_index_expression(Object *left,
-																												Object *index) {
-	if (left->Type() == ObjType::Array && index->Type() == ObjType::Integer)
-		return execute_array_index(left, index);
-	else if (left->Type() == ObjType::Hash)
-		return execute_hash_index(left, index);
+Object *VM::build_array(int start_index, int end_index) {
+	return make_array(heap_, stack_.data() + start_index,
+										stack_.data() + end_index);
+}
+
+Object *VM::build_hash(int start_index, int end_index) {
+	return make_hash(heap_, stack_.data() + start_index,
+									 stack_.data() + end_index);
+}
+
+std::optional<std::string> VM::execute_index_expression(Value left,
+																												Value index) {
+	if (!left.is_object())
+		return "index expression is not supported for the type in question.";
+
+	auto left_type = left.as_object()->Type();
+	if (left_type == ObjType::Array && index.is_integer())
+		return execute_array_index(left.as_object(), index);
+	else if (left_type == ObjType::IntArray && index.is_integer())
+		return execute_int_array_index(left.as_object(), index);
+	else if (left_type == ObjType::Hash)
+		return execute_hash_index(left.as_object(), index);
 
 	// the index operator is not supported for this type
 	return "index expression is not supported for the type in question.";
 }
 
-std::optional<std::string> VM::execute_array_index(Object *arr, Object *index) {
-	auto array = dynamic_cast<Array *>(arr);
-	if (array == nullptr)
-		return "object is not of type array.";
+// the callers have already checked the type of the receiver.
+std::optional<std::string> VM::execute_array_index(Object *arr, Value index) {
+	auto array = (Array *)arr;
 
-	auto idx = ((Integer *)index)->value;
+	auto idx = index.as_integer();
 	auto max = (int)array->elements.size() - 1;
 
 	if (idx < 0 || idx > max) {
-		return push(object_constant::null);
+		return push(Value::null());
 	}
 
-	return push(array->elements[idx]);
+	return push(object_to_value(array->elements[idx]));
 }
 
-std::optional<std::string> VM::execute_hash_index(Object *hash, Object *index) {
-	auto hashobj = dynamic_cast<Hash *>(hash);
-	if (hashobj == nullptr)
-		return "object is not of type hash.";
+std::optional<std::string> VM::execute_int_array_index(Object *arr,
+																										Value index) {
+	auto array = (IntArray *)arr;
 
-	if (!(index->Type() == ObjType::Integer || index->Type() == ObjType::String ||
-				index->Type() == ObjType::Boolean))
-		return "type of index is invalid, needs to be 'int' 'bool' or 'string'";
+	auto idx = index.as_integer();
+	if (idx < 0 || idx >= (int)array->size())
+		return push(Value::null());
 
-	HashKey res;
-	// we only need to check these types since the previous if expressions
-	// guarantees that the object is one of them.
-	if (index->Type() == ObjType::Integer)
-		res = ((Integer *)index)->hash_key();
-	else if (index->Type() == ObjType::String)
-		res = ((String *)index)->hash_key();
-	else if (index->Type() == ObjType::Boolean)
-		res = ((Boolean *)index)->hash_key();
+	return push(Value::integer((*array)[idx]));
+}
 
-	if (hashobj->pairs.count(res.value) == 0)
-		return push(object_constant::null);
+std::optional<std::string> VM::execute_hash_index(Object *hash, Value index) {
+	const auto key = hash_key_of(index);
+	if (!key.has_value())
+		return "type of index is invalid, needs to be 'int' 'bool' or 'string'";
 
-	return push(hashobj->pairs[res.value]->value);
+	return execute_hash_lookup((Hash *)hash, index, key.value());
+}
+
+std::optional<std::string>
+VM::execute_hash_lookup(Hash *hash, Value index, const HashKey &key) {
+	const auto str =
+			key.type == ObjType::String ? (String *)index.as_object() : nullptr;
+	const auto value = hash->get(key, str);
+	if (value == nullptr)
+		return push(Value::null());
+
+	return push(object_to_value(value));
 }
 
 std::optional<std::string> VM::call_closure(Object *cl, int num_args) {
@@ -517,22 +1020,188 @@ std::optional<std::string> VM::call_closure(Object *cl, int num_args) {
 		return "the amount of arguments supplied differs from the amount of "
 					 "parameters the function needs.";
 
-	auto frame =
-			std::make_unique<Frame>(closure->func_->m_instructions, sp_ - num_args);
-	auto new_stack_ptr = frame->base_pointer_ + closure->func_->m_num_locals;
-	push_frame(std::move(frame));
-	sp_ = new_stack_ptr;
+	if (frames_index_ >= MaxFrames)
+		return "frame stack overflow";
+
+	// the stack headroom of verified functions is checked once here instead of
+	// on every push.
+	const auto base_pointer = sp_ - num_args;
+	if (base_pointer + closure->func_->m_max_stack > StackSize)
+		return "stack overflow";
+
+	push_frame(closure, base_pointer);
+	sp_ = base_pointer + closure->func_->m_num_locals;
+
+	if (jit_threshold_ == 0)
+		return std::nullopt;
+
+	const auto fn = closure->func_;
+	if (fn->m_calls < jit_threshold_ && ++fn->m_calls == jit_threshold_ &&
+			fn->m_max_stack >= 0) {
+		fn->m_native = jit::compile(*fn, &VM::jit_slow_path);
+		if (fn->m_native != nullptr && jit_listener_)
+			jit_listener_(*fn);
+	}
+	if (fn->m_native != nullptr)
+		return run_native(fn, base_pointer);
 
 	return std::nullopt;
 }
 
+std::optional<std::string> VM::run_native(CompiledFunction *fn,
+																					int base_pointer) {
+	const auto entry = (jit::Entry)fn->m_native.get();
+	const auto sp = entry(this, stack_.data() + base_pointer, constants_.data(),
+												globals_.data());
+	if (sp == nullptr)
+		return jit_error_;
+
+	sp_ = (int)(sp - stack_.data());
+	pop_frame();
+	return std::nullopt;
+}
+
+Value *VM::jit_slow_path(VM *vm, Value *sp, int op, int operand0,
+												 int operand1) {
+	// calls of closures that have been compiled go straight to their machine
+	// code, with the checks of call_closure.
+	if (op == code::OpCall) {
+		const auto callee = sp[-1 - operand0];
+		if (callee.is_object() && callee.as_object()->Type() == ObjType::Closure) {
+			const auto closure = (Closure *)callee.as_object();
+			const auto fn = closure->func_;
+			const auto base = sp - operand0;
+			if (fn->m_native != nullptr && operand0 == fn->m_num_parameters &&
+					vm->frames_index_ < MaxFrames &&
+					base + fn->m_max_stack <= vm->stack_.data() + StackSize &&
+					!vm->heap_.should_collect()) {
+				vm->push_frame(closure, (int)(base - vm->stack_.data()));
+				const auto entry = (jit::Entry)fn->m_native.get();
+				const auto ret = entry(vm, base, vm->constants_.data(),
+															 vm->globals_.data());
+				if (ret != nullptr)
+					vm->pop_frame();
+				return ret;
+			}
+		}
+	}
+
+	vm->sp_ = (int)(sp - vm->stack_.data());
+	auto status = vm->execute_slow_path(op, operand0, operand1);
+	if (status.has_value()) {
+		vm->jit_error_ = status;
+		return nullptr;
+	}
+
+	return vm->stack_.data() + vm->sp_;
+}
+
+// execute_slow_path does what the dispatch loop does for the instruction.
+std::optional<std::string>
+VM::execute_slow_path(code::Opcode op, int operand0, int operand1) {
+	switch (op) {
+	case code::OpAdd:
+	case code::OpSub:
+	case code::OpMul:
+	case code::OpDiv:
+		return execute_binary_operation(op);
+	case code::OpEqual:
+	case code::OpNotEqual:
+	case code::OpGreaterThan:
+		return execute_comparison(op);
+	case code::OpMinus:
+		return execute_minus_operator();
+	case code::OpIndex: {
+		auto index = pop();
+		auto left = pop();
+		return execute_index_expression(left, index);
+	}
+	case code::OpIndexConst: {
+		auto left = pop();
+		const auto &key = constant_keys_[operand0];
+		if (key.has_value() && left.type() == ObjType::Hash)
+			return execute_hash_lookup((Hash *)left.as_object(), constants_[operand0],
+																 key.value());
+		return execute_index_expression(left, constants_[operand0]);
+	}
+	case code::OpArray:
+	case code::OpHash: {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		auto literal = op == code::OpArray ? build_array(sp_ - operand0, sp_)
+																			 : build_hash(sp_ - operand0, sp_);
+		sp_ -= operand0;
+		return push(Value::object(literal));
+	}
+	case code::OpClosure:
+		if (heap_.should_collect())
+			collect_garbage();
+		return push_closure(operand0, operand1);
+	case code::OpGetFree:
+		return push(current_frame().closure().free_[operand0]);
+	case code::OpCall: {
+		if (heap_.should_collect())
+			collect_garbage();
+
+		// closures that run as machine code and builtins are done when the call
+		// returns, the frame of a closure that is interpreted is still to run.
+		const auto frames = frames_index_;
+		auto status = execute_call(operand0);
+		if (status.has_value() || frames_index_ == frames)
+			return status;
+
+		if (frames_index_ >= MaxFrames)
+			return "frame stack overflow";
+
+		frames_[frames_index_] = frames_[frames_index_ - 1];
+		frames_[frames_index_ - 1] = Frame(halt_closure_.get(), 0);
+		++frames_index_;
+
+		status = main_fn_->m_max_stack < 0 ? execute<false>() : execute<true>();
+		if (!status.has_value())
+			pop_frame();
+		return status;
+	}
+	default:
+		return "unknown opcode";
+	}
+}
+
+std::optional<std::string> VM::call(Value callee,
+																		const std::vector<Value> &args,
+																		Value &result) {
+	const auto sp = sp_;
+	const auto frames = frames_index_;
+	if (sp_ + 1 + (int)args.size() > StackSize)
+		return "stack overflow";
+
+	stack_[sp_++] = callee;
+	for (auto arg : args)
+		stack_[sp_++] = arg;
+
+	// the call runs like one made by machine code, interpreted callees halt when
+	// they return to it.
+	auto status = execute_slow_path(code::OpCall, (int)args.size(), 0);
+	if (!status.has_value())
+		result = pop();
+
+	// a failed call leaves its values and frames behind.
+	sp_ = sp;
+	frames_index_ = frames;
+	return status;
+}
+
 std::optional<std::string> VM::execute_call(int num_args) {
 	const auto callee = stack_[sp_ - 1 - num_args];
+	if (!callee.is_object())
+		return "calling a type that is not a function.";
 
-	if (callee->Type() == ObjType::Closure)
-		return call_closure(callee, num_args);
-	else if (callee->Type() == ObjType::Builtin)
-		return call_builtin(callee, num_args);
+	const auto callee_type = callee.as_object()->Type();
+	if (callee_type == ObjType::Closure)
+		return call_closure(callee.as_object(), num_args);
+	else if (callee_type == ObjType::Builtin)
+		return call_builtin(callee.as_object(), num_args);
 
 	// calling a non-function.
 	return "calling a type that is not a function.";
@@ -543,33 +1212,34 @@ std::optional<std::string> VM::call_builtin(Object *builtin, int num_args) {
 	if (builtin_func == nullptr)
 		return "the object is not of type builtin";
 
-	auto args = std::vector<Object *>(stack_.begin() + sp_ - num_args,
-																		stack_.begin() + sp_);
-	auto res = (builtin_func->func(args));
+	auto args = std::vector<Object *>(num_args, nullptr);
+	for (int i = 0; i < num_args; ++i)
+		args[i] = box(stack_[sp_ - num_args + i]);
+	auto res = heap_.adopt(builtin_func->func(args));
 
-	if (res != nullptr) {
-		push(res);
-	} else {
-		push(object_constant::null);
-	}
-
-	return std::nullopt;
+	// the result replaces the builtin and its arguments on the stack.
+	sp_ -= num_args + 1;
+	return push(object_to_value(res));
 }
 
 std::optional<std::string> VM::push_closure(int const_index, int num_free) {
 	auto constant = constants_[const_index];
 
-	auto fn = dynamic_cast<CompiledFunction *>(constant);
+	if (!constant.is_object())
+		return "the object is not of type 'CompiledFunction'";
+
+	auto fn = dynamic_cast<CompiledFunction *>(constant.as_object());
 	if (fn == nullptr)
 		return "the object is not of type 'CompiledFunction'";
 
-	std::vector<Object *> free_vec(num_free, nullptr);
+	std::vector<Value> free_vec(num_free);
 	for (int i = 0; i < num_free; ++i)
 		free_vec[i] = stack_[sp_ - num_free + i];
 	sp_ -= num_free;
 
-	auto closure = new Closure(fn);
+	auto closure = heap_.allocate<Closure>(fn);
 	closure->free_ = free_vec;
+	heap_.write_barrier(closure);
 
-	return push(closure);
+	return push(Value::object(closure));
 }
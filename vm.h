@@ -3,42 +3,90 @@
 
 #include "code.h"
 #include "compiler.h"
+#include "gc.h"
+#include "jit.h"
 #include <array>
+#include <functional>
 #include <memory>
+#include <unordered_map>
 static constexpr int StackSize = 2048;
 static constexpr int GlobalsSize = 65536;
 static constexpr int MaxFrames = 1024;
 
+// conversions between the vm's values and the objects used by arrays, hashes
+// and builtins. Boxing an integer allocates a new Integer object.
+Value object_to_value(Object *obj);
+Object *value_to_object(Value val);
+
+// helpers the stack vm and the register vm share. values_equal is what == means
+// in lups. hash_key_of returns the key a value is stored under in a hash, or
+// nothing if it can't be a key.
+// make_array and make_hash build the literal out of a run of values, make_hash
+// returns nullptr when one of the keys can't be used.
+bool is_truthy(Value val);
+bool values_equal(Value left, Value right);
+std::optional<HashKey> hash_key_of(Value val);
+Object *box_value(Heap &heap, Value val);
+Object *make_array(Heap &heap, const Value *begin, const Value *end);
+Object *make_hash(Heap &heap, const Value *begin, const Value *end);
+
+// Frame is a plain record in the vm's preallocated frame stack. It points at
+// the closure being executed instead of owning a copy of it, so entering and
+// leaving a function never allocates.
 class Frame {
 public:
-	Frame(code::Instructions inst) {
-		cl_ = std::make_unique<Closure>(new CompiledFunction(inst));
-		ip_ = -1;
-		base_pointer_ = 0;
-	}
-
-	Frame(code::Instructions inst, int base_pointer) {
-		cl_ = std::make_unique<Closure>(new CompiledFunction(inst));
-		ip_ = -1;
-		base_pointer_ = base_pointer;
-	}
+	Frame() : ip_(0), base_pointer_(0), cl_(nullptr) {}
+	Frame(Closure *cl, int base_pointer)
+			: ip_(0), base_pointer_(base_pointer), cl_(cl) {}
 
-	code::Instructions &instructions() noexcept {
-		return cl_->func_->m_instructions;
-	}
+	char *code() noexcept { return cl_->func_->code(); }
 	const Closure &closure() const noexcept { return *cl_; };
 
+	// ip_ is the offset of the next instruction to execute. The dispatch loop
+	// keeps the instruction pointer in a local and only writes it back here when
+	// the frame is suspended by a call.
 	int ip_;
 	int base_pointer_;
-	std::unique_ptr<Closure> cl_;
+	Closure *cl_;
+};
+
+#ifdef LUPS_OPCODE_PROFILE
+// OpcodeProfile counts how many times every sequence of up to MaxLength
+// consecutively executed opcodes was seen. A sequence is keyed by its opcodes
+// packed into a word, oldest first.
+class OpcodeProfile {
+public:
+	static constexpr int MaxLength = 4;
+
+	void record(code::Opcode op) {
+		window_ = window_ << 8 | (std::uint8_t)op;
+		if (executed_ < MaxLength)
+			++executed_;
+
+		for (int n = 1; n <= executed_; ++n)
+			++counts_[n - 1][window_ & (~0u >> (32 - 8 * n))];
+	}
+
+	const std::unordered_map<std::uint32_t, std::uint64_t> &counts(int n) const {
+		return counts_[n - 1];
+	}
+
+private:
+	std::uint32_t window_ = 0;
+	int executed_ = 0;
+	std::unordered_map<std::uint32_t, std::uint64_t> counts_[MaxLength];
 };
+#endif
 
 class VM {
 public:
-	VM(Bytecode *bytecode);
-	Object *stack_top();
-	std::optional<std::string> push(Object *obj);
-	Object *pop();
+	VM(Bytecode *bytecode, GCConfig gc_config = GCConfig());
+	Value stack_top();
+	std::optional<std::string> push(Value val);
+	Value pop();
+
+	// returns the last popped value boxed into an object, the object is shared
+	// when the value is not an immediate.
 	Object *last_popped_stack_elem();
 
 	// The optional contains a possible error message, meaning that std::optional
@@ -49,25 +97,27 @@ public:
 	// binary operations
 	std::optional<std::string> execute_binary_operation(code::Opcode op);
 	std::optional<std::string> execute_binary_integer_operation(code::Opcode op,
-																															Object *left,
-																															Object *right);
+																															Value left,
+																															Value right);
 	std::optional<std::string>
-	execute_binary_string_operation(code::Opcode op, Object *left, Object *right);
+	execute_binary_string_operation(code::Opcode op, Value left, Value right);
 
 	// comparisons
 	std::optional<std::string> execute_comparison(code::Opcode op);
 	std::optional<std::string>
-	execute_integer_comparison(code::Opcode op, Object *left, Object *right);
+	execute_integer_comparison(code::Opcode op, Value left, Value right);
 
 	// prefix expressions
 	std::optional<std::string> execute_bang_operator();
 	std::optional<std::string> execute_minus_operator();
 
 	// index expressions
-	std::optional<std::string> execute_index_expression(Object *left,
-																											Object *index);
-	std::optional<std::string> execute_array_index(Object *left, Object *index);
-	std::optional<std::string> execute_hash_index(Object *left, Object *index);
+	std::optional<std::string> execute_index_expression(Value left, Value index);
+	std::optional<std::string> execute_array_index(Object *left, Value index);
+	std::optional<std::string> execute_int_array_index(Object *left, Value index);
+	std::optional<std::string> execute_hash_index(Object *left, Value index);
+	std::optional<std::string> execute_hash_lookup(Hash *hash, Value index,
+																								 const HashKey &key);
 
 	// functions
 	std::optional<std::string> call_closure(Object *cl, int num_args);
@@ -78,27 +128,103 @@ public:
 	Object *build_array(int start_index, int end_index);
 	Object *build_hash(int start_index, int end_index);
 
+	// garbage collection. Objects created while running are owned by the vm's
+	// heap, collections only happen at instructions where every live value is
+	// reachable from the stack, globals, constants or the frames.
+	Object *box(Value val) { return box_value(heap_, val); }
+	void collect_garbage();
+	const GCStats &gc_stats() const { return heap_.stats(); }
+
+	// verified functions are compiled to machine code by the jit once they have
+	// been called threshold times, 0 turns the jit off. It is on unless the
+	// LUPS_NO_JIT environment variable is set.
+	void set_jit_threshold(int threshold) { jit_threshold_ = threshold; }
+
+	// set_jit_listener registers a function that is told about every function
+	// the jit compiles.
+	void set_jit_listener(std::function<void(CompiledFunction &)> listener) {
+		jit_listener_ = std::move(listener);
+	}
+
+	// embedding the vm in another engine, see tier.h. add_constant appends a
+	// constant for functions compiled after the vm was created, set_global
+	// stores a global and pin hands an object owned by the caller to the vm.
+	// None of them may be called while the vm runs.
+	int add_constant(Object *constant);
+	void set_global(int index, Value val) { globals_[index] = val; }
+	void pin(Object *obj) { heap_.pin(obj); }
+
+	// call calls a closure or builtin with the arguments and leaves what it
+	// returns in result.
+	std::optional<std::string> call(Value callee, const std::vector<Value> &args,
+																	Value &result);
+
+#ifdef LUPS_OPCODE_PROFILE
+	const OpcodeProfile &opcode_profile() const { return opcode_profile_; }
+#endif
+
 	// frame functions
-	Frame &current_frame() { return *frames_[frames_index_ - 1]; }
+	Frame &current_frame() { return frames_[frames_index_ - 1]; }
 
-	void push_frame(std::unique_ptr<Frame> frame) {
-		frames_[frames_index_] = std::move(frame);
+	void push_frame(Closure *cl, int base_pointer) {
+		frames_[frames_index_] = Frame(cl, base_pointer);
 		++frames_index_;
 	}
 
 	Frame &pop_frame() {
 		--frames_index_;
-		return *frames_[frames_index_];
+		return frames_[frames_index_];
 	}
 
 private:
-	int sp_;
-	std::vector<Object *> constants_;
-	std::vector<Object *> stack_;
-	std::vector<Object *> globals_;
+	// execute is the dispatch loop, it skips the stack checks of every push
+	// when the bytecode has been verified.
+	template <bool Verified> std::optional<std::string> execute();
+
+	// run_native runs the machine code of a function whose frame has just been
+	// pushed, and pops the frame when it returns.
+	std::optional<std::string> run_native(CompiledFunction *fn, int base_pointer);
+
+	// the machine code calls jit_slow_path for the instructions it doesn't run
+	// itself, it runs them with execute_slow_path on the vm's stack.
+	static Value *jit_slow_path(VM *vm, Value *sp, int op, int operand0,
+															int operand1);
+	std::optional<std::string> execute_slow_path(code::Opcode op, int operand0,
+																							 int operand1);
 
-	std::array<std::unique_ptr<Frame>, MaxFrames> frames_;
+	int sp_;
+	std::vector<Value> constants_;
+	// the hash keys of the constants that can be used as one, computed once so
+	// OpIndexConst doesn't hash the key on every lookup.
+	std::vector<std::optional<HashKey>> constant_keys_;
+	std::vector<Value> stack_;
+	std::vector<Value> globals_;
+
+	std::array<Frame, MaxFrames> frames_;
 	int frames_index_;
+
+	// the top level program runs as a closure like any other function, the vm
+	// owns it since it isn't part of the constant pool.
+	std::unique_ptr<CompiledFunction> main_fn_;
+	std::unique_ptr<Closure> main_closure_;
+	// the mapping of the .lpsc file the bytecode was loaded from, if any.
+	std::shared_ptr<void> image_;
+
+	int jit_threshold_;
+	// the error of the machine code that failed last.
+	std::optional<std::string> jit_error_;
+	std::function<void(CompiledFunction &)> jit_listener_;
+	// machine code that calls a function that is still interpreted puts a frame
+	// of this closure below the callee's, the dispatch loop halts when the callee
+	// returns to it.
+	std::unique_ptr<CompiledFunction> halt_fn_;
+	std::unique_ptr<Closure> halt_closure_;
+
+	Heap heap_;
+
+#ifdef LUPS_OPCODE_PROFILE
+	OpcodeProfile opcode_profile_;
+#endif
 };
 
 #endif